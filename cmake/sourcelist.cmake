@@ -5,9 +5,14 @@ set(SOURCE_FILES
 	"${SOURCE_DIR}/ansi_escapes.cpp"
 	"${SOURCE_DIR}/ArrayBuffer.cpp"
 	"${SOURCE_DIR}/BufferOperations.cpp"
+	"${SOURCE_DIR}/Checksum.cpp"
+	"${SOURCE_DIR}/Codecs.cpp"
+	"${SOURCE_DIR}/CompiledGrammar.cpp"
+	"${SOURCE_DIR}/Coroutines.cpp"
 	"${SOURCE_DIR}/Data.cpp"
 	"${SOURCE_DIR}/DerivationTree.cpp"
 	"${SOURCE_DIR}/DeltaDebugging.cpp"
+	"${SOURCE_DIR}/EarleyParser.cpp"
 	"${SOURCE_DIR}/ExecutionHandler.cpp"
 	"${SOURCE_DIR}/ExclusionTree.cpp"
 	"${SOURCE_DIR}/Evaluation.cpp"
@@ -21,13 +26,19 @@ set(SOURCE_FILES
 	"${SOURCE_DIR}/Logging.cpp" 
 	"${SOURCE_DIR}/LuaEngine.cpp" 
 	"${SOURCE_DIR}/LZMAStreambuf.cpp" 
+	"${SOURCE_DIR}/MappedFile.cpp"
+	"${SOURCE_DIR}/Journal.cpp"
 	"${SOURCE_DIR}/MemoryStream.cpp"
 	"${SOURCE_DIR}/Oracle.cpp"
 	"${SOURCE_DIR}/Processes.cpp"
 	"${SOURCE_DIR}/Record.cpp"
+	"${SOURCE_DIR}/RegenerationCache.cpp"
+	"${SOURCE_DIR}/SaveFile.cpp"
+	"${SOURCE_DIR}/SaveQuery.cpp"
 	"${SOURCE_DIR}/Session.cpp"
 	"${SOURCE_DIR}/SessionData.cpp"
 	"${SOURCE_DIR}/SessionFunctions.cpp"
+	"${SOURCE_DIR}/StringTable.cpp"
 	"${SOURCE_DIR}/Settings.cpp"
 	"${SOURCE_DIR}/TaskController.cpp"
 	"${SOURCE_DIR}/ThreadSafe.cpp"
@@ -42,9 +53,14 @@ set(SOURCE_FILES
 	"${SOURCE_DIR}/ansi_escapes.cpp"
 	"${SOURCE_DIR}/ArrayBuffer.cpp"
 	"${SOURCE_DIR}/BufferOperations.cpp"
+	"${SOURCE_DIR}/Checksum.cpp"
+	"${SOURCE_DIR}/Codecs.cpp"
+	"${SOURCE_DIR}/CompiledGrammar.cpp"
+	"${SOURCE_DIR}/Coroutines.cpp"
 	"${SOURCE_DIR}/Data.cpp"
 	"${SOURCE_DIR}/DerivationTree.cpp"
 	"${SOURCE_DIR}/DeltaDebugging.cpp"
+	"${SOURCE_DIR}/EarleyParser.cpp"
 	"${ROOT_DIR}/DeathHandler/death_handler.cc"
 	"${SOURCE_DIR}/ExecutionHandler.cpp"
 	"${SOURCE_DIR}/ExclusionTree.cpp"
@@ -59,13 +75,19 @@ set(SOURCE_FILES
 	"${SOURCE_DIR}/Logging.cpp" 
 	"${SOURCE_DIR}/LuaEngine.cpp" 
 	"${SOURCE_DIR}/LZMAStreambuf.cpp" 
+	"${SOURCE_DIR}/MappedFile.cpp"
+	"${SOURCE_DIR}/Journal.cpp"
 	"${SOURCE_DIR}/MemoryStream.cpp"
 	"${SOURCE_DIR}/Oracle.cpp"
 	"${SOURCE_DIR}/Processes.cpp"
 	"${SOURCE_DIR}/Record.cpp"
+	"${SOURCE_DIR}/RegenerationCache.cpp"
+	"${SOURCE_DIR}/SaveFile.cpp"
+	"${SOURCE_DIR}/SaveQuery.cpp"
 	"${SOURCE_DIR}/Session.cpp"
 	"${SOURCE_DIR}/SessionData.cpp"
 	"${SOURCE_DIR}/SessionFunctions.cpp"
+	"${SOURCE_DIR}/StringTable.cpp"
 	"${SOURCE_DIR}/Settings.cpp"
 	"${SOURCE_DIR}/TaskController.cpp"
 	"${SOURCE_DIR}/ThreadSafe.cpp"
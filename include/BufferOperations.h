@@ -28,6 +28,36 @@ namespace Buffer
 	template <>
 	int64_t _sizeof(size_t& value);
 
+	/// <summary>
+	/// A streambuf whose get area lies in memory, so that records can be parsed in place
+	/// </summary>
+	class ViewStreambuf : public std::streambuf
+	{
+	public:
+		/// <summary>
+		/// Returns a pointer to the next [length] bytes of the get area and advances past them.
+		/// Returns nullptr if the bytes are not available in the current get area.
+		/// </summary>
+		char* View(size_t length)
+		{
+			if ((size_t)(egptr() - gptr()) < length)
+				return nullptr;
+			char* ptr = gptr();
+			setg(eback(), gptr() + length, egptr());
+			return ptr;
+		}
+	};
+
+	/// <summary>
+	/// Returns a view of the next [length] bytes of [stream], if its streambuf supports it
+	/// </summary>
+	inline char* View(std::istream* stream, size_t length)
+	{
+		if (auto view = dynamic_cast<ViewStreambuf*>(stream->rdbuf()))
+			return view->View(length);
+		return nullptr;
+	}
+
 	class ArrayBuffer
 	{
 	private:
@@ -83,6 +113,12 @@ namespace Buffer
 		{
 			_size = length;
 			_offset = 0;
+			// streams backed by memory are read in place
+			if (char* view = View(data, (size_t)length); view != nullptr && length > 0) {
+				_buffer = (unsigned char*)view;
+				__copied = true;
+				return;
+			}
 			_buffer = new unsigned char[length];
 			data->read((char*)_buffer, length);
 			int64_t rd = data->gcount();
@@ -104,7 +140,7 @@ namespace Buffer
 			if (__copied)
 				return;
 			else
-				delete _buffer;
+				delete[] _buffer;
 		}
 
 		int64_t Size()
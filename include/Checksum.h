@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Checksum
+{
+	/// <summary>
+	/// Computes the CRC32C [Castagnoli] of [size] bytes at [data], continuing from [crc].
+	/// Uses the crc32 instructions of SSE4.2 or ARMv8 if the processor supports them
+	/// </summary>
+	uint32_t CRC32C(const void* data, size_t size, uint32_t crc = 0);
+
+	/// <summary>
+	/// returns whether CRC32C is computed with processor instructions
+	/// </summary>
+	bool IsHardwareAccelerated();
+}
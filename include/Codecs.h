@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Codecs
+{
+	enum class CodecType : int32_t
+	{
+		/// <summary>
+		/// data is stored uncompressed
+		/// </summary>
+		None = 0,
+		/// <summary>
+		/// xz streams, best ratio but slow
+		/// </summary>
+		LZMA = 1,
+		/// <summary>
+		/// zstd frames
+		/// </summary>
+		Zstd = 2,
+		/// <summary>
+		/// zstd frames compressed with a dictionary that is stored in the header of the savefile
+		/// </summary>
+		ZstdDictionary = 3,
+	};
+
+	/// <summary>
+	/// Compresses and decompresses independent blocks of data.
+	/// Codecs are used by multiple threads at the same time and must not keep state between calls.
+	/// </summary>
+	class Codec
+	{
+	public:
+		virtual ~Codec() = default;
+
+		virtual CodecType GetType() = 0;
+		virtual const char* GetName() = 0;
+
+		/// <summary>
+		/// Compresses [length] bytes at [in] into [out]
+		/// </summary>
+		virtual bool Compress(const char* in, size_t length, std::string& out) = 0;
+		/// <summary>
+		/// Decompresses [length] bytes at [in] into [out], which must be able to hold [outlength] bytes
+		/// </summary>
+		virtual bool Decompress(const char* in, size_t length, char* out, size_t outlength) = 0;
+	};
+
+	/// <summary>
+	/// Creates a codec of [type]. [level] and [extreme] are only used for compression,
+	/// [dictionary] is required for ZstdDictionary.
+	/// Returns nullptr for CodecType::None or if the codec cannot be created.
+	/// </summary>
+	std::unique_ptr<Codec> CreateCodec(CodecType type, int32_t level = 0, bool extreme = false, const std::string& dictionary = {});
+
+	/// <summary>
+	/// Trains a dictionary of at most [capacity] bytes from [samples], that are stored back to back in [buffer]
+	/// </summary>
+	bool TrainDictionary(const std::string& buffer, const std::vector<size_t>& samples, size_t capacity, std::string& dictionary);
+
+	const char* ToString(CodecType type);
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "DerivationTree.h"
+#include "Grammar.h"
+
+/// <summary>
+/// Immutable, flat representation of a GrammarTree used by the derivation of inputs.
+///
+/// Nodes and expansions are stored in contiguous tables and reference each other by index, terminal symbols are
+/// interned in the symbol table of derivation trees. Everything a derivation step decides that only depends on the grammar is computed once: the
+/// expansion used to grow sequences, and for each phase of the derivation the candidate expansions with their
+/// cumulative weights. For length-aware derivation, nodes and expansions carry the bounds of the number of sequence
+/// nodes they can produce and the depth of their smallest derivation.
+/// </summary>
+class CompiledGrammar
+{
+public:
+	static inline constexpr uint32_t None = UINT32_MAX;
+	/// <summary>
+	/// yield of nodes that can produce any number of sequence nodes
+	/// </summary>
+	static inline constexpr int64_t Unbounded = INT64_MAX / 4;
+
+	/// <summary>
+	/// list of candidate expansions of a node, with the running sum of their weights
+	/// </summary>
+	struct Candidates
+	{
+		/// <summary>
+		/// offset into the candidate and cumulative weight tables
+		/// </summary>
+		uint32_t begin = 0;
+		uint32_t count = 0;
+		float weight = 0.f;
+	};
+
+	struct Node
+	{
+		uint64_t id = 0;
+		GrammarNode::NodeType type = GrammarNode::NodeType::Terminal;
+		EnumType flags = 0;
+		/// <summary>
+		/// index of the first expansion of the node
+		/// </summary>
+		uint32_t expansions = 0;
+		uint32_t expansionCount = 0;
+		/// <summary>
+		/// symbol id of the identifier of terminals
+		/// </summary>
+		uint32_t symbol = 0;
+		/// <summary>
+		/// position and size of the byte table of character class terminals for each way of producing character
+		/// classes, terminals without a table always produce [symbol]
+		/// </summary>
+		uint32_t alphabet[2] = { 0, 0 };
+		uint32_t alphabetSize[2] = { 0, 0 };
+		/// <summary>
+		/// expansion used to grow sequences, when scanning expansions forward [0] and backward [1]
+		/// </summary>
+		uint32_t preferred[2] = { None, None };
+		/// <summary>
+		/// expansions that produce sequences
+		/// </summary>
+		Candidates sequence;
+		/// <summary>
+		/// expansions that do not produce sequences
+		/// </summary>
+		Candidates final;
+		/// <summary>
+		/// all expansions
+		/// </summary>
+		Candidates all;
+		/// <summary>
+		/// minimal and maximal number of sequence nodes below the node
+		/// </summary>
+		int64_t minYield = 0;
+		int64_t maxYield = 0;
+		/// <summary>
+		/// depth of the smallest derivation of the node, which applies [cheapest] to every node
+		/// </summary>
+		uint32_t minDepth = 0;
+		/// <summary>
+		/// expansion with the fewest sequence nodes, and of those the one with the smallest depth
+		/// </summary>
+		uint32_t cheapest = None;
+
+		bool IsSequence() const { return type == GrammarNode::NodeType::Sequence; }
+	};
+
+	struct Expansion
+	{
+		/// <summary>
+		/// index of the first child in the children table
+		/// </summary>
+		uint32_t children = 0;
+		uint32_t childCount = 0;
+		/// <summary>
+		/// node repeated by regular expansions, None for regular expansions
+		/// </summary>
+		uint32_t regex = None;
+		int32_t min = 0;
+		EnumType flags = 0;
+		float weight = 0.f;
+		/// <summary>
+		/// minimal and maximal number of sequence nodes produced by the expansion
+		/// </summary>
+		int64_t minYield = 0;
+		int64_t maxYield = 0;
+		/// <summary>
+		/// depth of the smallest derivation of the expansion
+		/// </summary>
+		uint32_t minDepth = 0;
+	};
+
+	/// <summary>
+	/// Compiles the nodes reachable from the root of [tree]
+	/// </summary>
+	static std::shared_ptr<CompiledGrammar> Compile(GrammarTree& tree);
+
+	uint32_t GetRoot() const { return _root; }
+	const Node& GetNode(uint32_t index) const { return _nodes[index]; }
+	uint32_t GetNodeCount() const { return (uint32_t)_nodes.size(); }
+	/// <summary>
+	/// returns the expansion with local index [index] of [node]
+	/// </summary>
+	const Expansion& GetExpansion(const Node& node, uint32_t index) const { return _expansions[node.expansions + index]; }
+	/// <summary>
+	/// returns the expansion with global index [index]
+	/// </summary>
+	const Expansion& GetExpansion(uint32_t index) const { return _expansions[index]; }
+	uint32_t GetExpansionCount() const { return (uint32_t)_expansions.size(); }
+	const uint32_t* GetChildren(const Expansion& expansion) const { return _children.data() + expansion.children; }
+	/// <summary>
+	/// returns the index of the node with grammar id [id], or None
+	/// </summary>
+	uint32_t Find(uint64_t id) const { return id < _index.size() ? _index[id] : None; }
+
+	/// <summary>
+	/// Chooses one of [candidates] at random and returns the local index of the expansion. Weighted candidates are
+	/// chosen by their share of [scale]
+	/// </summary>
+	uint32_t Choose(const Candidates& candidates, float scale, std::mt19937& randan) const;
+	/// <summary>
+	/// Returns the symbol id of the content produced by the terminal [node], with character classes produced as
+	/// recorded by [classes]
+	/// </summary>
+	uint32_t GetSymbol(const Node& node, DerivationTree::CharacterClasses classes, std::mt19937& randan) const;
+
+	size_t MemorySize() const;
+
+private:
+	std::vector<Node> _nodes;
+	std::vector<Expansion> _expansions;
+	std::vector<uint32_t> _children;
+	/// <summary>
+	/// local expansion indexes of all candidate lists, and the running sum of their weights
+	/// </summary>
+	std::vector<uint32_t> _candidates;
+	std::vector<float> _cumulative;
+	/// <summary>
+	/// byte tables of the character classes, holding the symbol ids of the characters in each class
+	/// </summary>
+	std::vector<uint32_t> _alphabet;
+	/// <summary>
+	/// node index by grammar id
+	/// </summary>
+	std::vector<uint32_t> _index;
+	uint32_t _root = None;
+
+	Candidates AddCandidates(const Node& node, bool (*filter)(const Expansion&));
+	/// <summary>
+	/// computes the yield bounds and smallest derivations of all nodes and expansions
+	/// </summary>
+	void ComputeYields();
+	/// <summary>
+	/// returns the strongly connected components of the grammar, each after the components it derives
+	/// </summary>
+	std::vector<std::vector<uint32_t>> FindComponents() const;
+};
+
+/// <summary>
+/// FIFO queue of derivation nodes and the compiled grammar nodes they are expanded with
+/// </summary>
+class DerivationQueue
+{
+public:
+	void Push(DerivationTree::NodeIndex node, uint32_t gnode) { _items.push_back({ node, gnode }); }
+	std::pair<DerivationTree::NodeIndex, uint32_t> Pop()
+	{
+		auto item = _items[_head++];
+		if (_head == _items.size()) {
+			_items.clear();
+			_head = 0;
+		}
+		return item;
+	}
+	size_t Size() const { return _items.size() - _head; }
+
+private:
+	std::vector<std::pair<DerivationTree::NodeIndex, uint32_t>> _items;
+	size_t _head = 0;
+};
@@ -0,0 +1,481 @@
+#pragma once
+
+#include <coroutine>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <thread>
+#include <queue>
+#include <vector>
+
+#include "Form.h"
+#include "Function.h"
+#include "TaskController.h"
+
+namespace Coroutines
+{
+	class Task;
+}
+
+namespace Functions
+{
+	/// <summary>
+	/// Resumes a suspended coroutine on a worker thread of the TaskController.
+	/// Coroutine frames cannot be saved, callbacks restored from a savefile only keep the owner
+	/// of the coroutine, which restarts its flow after loading.
+	/// </summary>
+	class CoroutineResumeCallback : public BaseFunction
+	{
+	public:
+		std::coroutine_handle<> _handle;
+		FunctionType _type = FunctionType::Medium;
+		/// <summary>
+		/// form that resumes the flow of the coroutine after loading, 0 if there is none
+		/// </summary>
+		FormID _owner = 0;
+
+		void Run() override;
+		static uint64_t GetTypeStatic() { return 'CORE'; }
+		uint64_t GetType() override { return 'CORE'; }
+
+		FunctionType GetFunctionType() override { return _type; }
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
+
+		bool ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool WriteData(std::ostream* buffer, size_t& offset) override;
+
+		static std::shared_ptr<BaseFunction> Create() { return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutineResumeCallback>()); }
+		void Dispose() override;
+		size_t GetLength() override;
+
+		virtual const char* GetName() override
+		{
+			return "CoroutineResumeCallback";
+		}
+	};
+
+	/// <summary>
+	/// Runs a function and afterwards resumes the coroutine that awaits it
+	/// </summary>
+	class CoroutineTaskCallback : public BaseFunction
+	{
+	public:
+		std::shared_ptr<BaseFunction> _function;
+		std::coroutine_handle<> _handle;
+		/// <summary>
+		/// form that resumes the flow of the coroutine after loading, 0 if there is none
+		/// </summary>
+		FormID _owner = 0;
+
+		void Run() override;
+		static uint64_t GetTypeStatic() { return 'COTA'; }
+		uint64_t GetType() override { return 'COTA'; }
+
+		FunctionType GetFunctionType() override { return _function ? _function->GetFunctionType() : FunctionType::Medium; }
+		FunctionPriority GetPriority() override { return _function ? _function->GetPriority() : FunctionPriority::Normal; }
+		std::chrono::nanoseconds GetDeadline() override { return _function ? _function->GetDeadline() : std::chrono::nanoseconds(0); }
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
+
+		bool ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool WriteData(std::ostream* buffer, size_t& offset) override;
+
+		static std::shared_ptr<BaseFunction> Create() { return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutineTaskCallback>()); }
+		void Dispose() override;
+		size_t GetLength() override;
+
+		virtual const char* GetName() override
+		{
+			return "CoroutineTaskCallback";
+		}
+	};
+
+	/// <summary>
+	/// Callback that completes a Coroutines::Completion when it is run. Can be passed to every interface
+	/// that expects a callback, for instance as callback for tests added to the ExecutionHandler
+	/// </summary>
+	class CoroutineCompletionCallback : public BaseFunction
+	{
+	public:
+		/// <summary>
+		/// 0 = pending, 1 = coroutine suspended, 2 = completed, 3 = coroutine suspending
+		/// </summary>
+		std::atomic<int32_t> _status = 0;
+		std::coroutine_handle<> _handle;
+		FunctionType _type = FunctionType::Light;
+		/// <summary>
+		/// form that resumes the flow of the coroutine after loading, 0 if there is none
+		/// </summary>
+		FormID _owner = 0;
+
+		void Run() override;
+		static uint64_t GetTypeStatic() { return 'COCO'; }
+		uint64_t GetType() override { return 'COCO'; }
+
+		FunctionType GetFunctionType() override { return _type; }
+		FunctionPriority GetPriority() override { return FunctionPriority::High; }
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
+
+		bool ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool WriteData(std::ostream* buffer, size_t& offset) override;
+
+		static std::shared_ptr<BaseFunction> Create() { return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutineCompletionCallback>()); }
+		void Dispose() override;
+		size_t GetLength() override;
+
+		virtual const char* GetName() override
+		{
+			return "CoroutineCompletionCallback";
+		}
+	};
+}
+
+namespace Coroutines
+{
+	/// <summary>
+	/// State shared between a running coroutine and its owning Task object
+	/// </summary>
+	struct TaskState
+	{
+		std::atomic_bool finished = false;
+		std::atomic_bool suspended = false;
+		std::atomic<uint64_t> suspensions = 0;
+		std::exception_ptr exception;
+		std::mutex lock;
+		std::condition_variable condition;
+		/// <summary>
+		/// called every time the coroutine reaches a suspension point, before it can be resumed
+		/// </summary>
+		std::function<void(uint64_t)> checkpoint;
+		/// <summary>
+		/// form that restarts the flow of the coroutine after a savefile has been loaded
+		/// </summary>
+		FormID owner = 0;
+	};
+
+	/// <summary>
+	/// Coroutine type that executes on the worker threads of a TaskController.
+	/// The coroutine does not run until Start is called, from there on every resumption is a task
+	/// in the TaskController queues. The coroutine frame destroys itself upon completion.
+	/// </summary>
+	class Task
+	{
+	public:
+		struct promise_type
+		{
+			TaskController* controller = nullptr;
+			Functions::FunctionType type = Functions::FunctionType::Medium;
+			std::shared_ptr<TaskState> state = std::make_shared<TaskState>();
+
+			Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept { return false; }
+				void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+				{
+					// copy state as the frame is destroyed before we notify waiters
+					auto state = handle.promise().state;
+					handle.destroy();
+					{
+						std::unique_lock<std::mutex> guard(state->lock);
+						state->finished = true;
+					}
+					state->condition.notify_all();
+				}
+				void await_resume() noexcept {}
+			};
+			FinalAwaiter final_suspend() noexcept { return {}; }
+
+			void return_void() {}
+			void unhandled_exception();
+
+			/// <summary>
+			/// Records that the coroutine has reached a suspension point and calls the checkpoint hook
+			/// </summary>
+			void Suspend()
+			{
+				uint64_t count = ++state->suspensions;
+				state->suspended = true;
+				if (state->checkpoint)
+					state->checkpoint(count);
+			}
+			/// <summary>
+			/// Records that the coroutine is running again
+			/// </summary>
+			void Resume()
+			{
+				state->suspended = false;
+			}
+			/// <summary>
+			/// Reverts the last call to Suspend, if the coroutine continued without suspending
+			/// </summary>
+			void Abandon()
+			{
+				--state->suspensions;
+				state->suspended = false;
+			}
+		};
+
+		using handle_type = std::coroutine_handle<promise_type>;
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+		Task(Task&& other) noexcept :
+			_handle(std::exchange(other._handle, nullptr)), _state(std::move(other._state))
+		{}
+		Task& operator=(Task&& other) noexcept
+		{
+			if (this != &other) {
+				if (_handle)
+					_handle.destroy();
+				_handle = std::exchange(other._handle, nullptr);
+				_state = std::move(other._state);
+			}
+			return *this;
+		}
+		~Task()
+		{
+			// coroutines that have never been started are owned by this object
+			if (_handle)
+				_handle.destroy();
+		}
+
+		/// <summary>
+		/// Schedules the coroutine on the given controller. Ownership of the coroutine frame passes to the
+		/// controller and it is destroyed once the coroutine finishes.
+		/// </summary>
+		/// <param name="controller"></param>
+		/// <param name="type">queue the coroutine is resumed on</param>
+		void Start(TaskController* controller, Functions::FunctionType type = Functions::FunctionType::Medium);
+
+		/// <summary>
+		/// Sets the function that is called every time the coroutine reaches a suspension point.
+		/// If an awaited Completion is completed while the function runs, the coroutine continues without
+		/// suspending and the same count is passed again at the next suspension point.
+		/// Must be set before the coroutine is started.
+		/// </summary>
+		/// <param name="checkpoint"></param>
+		void SetCheckpoint(std::function<void(uint64_t)> checkpoint)
+		{
+			if (_state)
+				_state->checkpoint = checkpoint;
+		}
+
+		/// <summary>
+		/// Sets the form that restarts the flow of the coroutine after a savefile has been loaded.
+		/// Callbacks of coroutines without an owner that are restored from a savefile report the flow as lost.
+		/// Must be set before the coroutine is started.
+		/// </summary>
+		/// <param name="owner"></param>
+		void SetOwner(FormID owner)
+		{
+			if (_state)
+				_state->owner = owner;
+		}
+
+		/// <summary>
+		/// Blocks until the coroutine has finished. Rethrows exceptions that escaped the coroutine.
+		/// </summary>
+		void Wait();
+
+		/// <summary>
+		/// Returns whether the coroutine has finished
+		/// </summary>
+		/// <returns></returns>
+		bool Finished() { return _state && _state->finished.load(); }
+		/// <summary>
+		/// Returns whether the coroutine is currently suspended
+		/// </summary>
+		/// <returns></returns>
+		bool Suspended() { return _state && _state->suspended.load(); }
+		/// <summary>
+		/// Returns the number of times the coroutine has been suspended
+		/// </summary>
+		/// <returns></returns>
+		uint64_t GetSuspensions() { return _state ? _state->suspensions.load() : 0; }
+
+	private:
+		explicit Task(handle_type handle) :
+			_handle(handle), _state(handle.promise().state) {}
+
+		handle_type _handle;
+		std::shared_ptr<TaskState> _state;
+	};
+
+	/// <summary>
+	/// Awaitable that continues the coroutine on a worker of the given type.
+	/// Can be used to yield or to switch from a light worker to a medium or heavy worker
+	/// </summary>
+	class Schedule
+	{
+	public:
+		Schedule(Functions::FunctionType type) :
+			_type(type), _keepType(false) {}
+		Schedule() {}
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(Task::handle_type handle);
+		void await_resume() noexcept
+		{
+			if (_handle)
+				_handle.promise().Resume();
+		}
+
+	private:
+		Task::handle_type _handle;
+		Functions::FunctionType _type = Functions::FunctionType::Medium;
+		bool _keepType = true;
+	};
+
+	/// <summary>
+	/// Awaitable that schedules a function on the TaskController and resumes the coroutine
+	/// on the same worker thread once the function has been executed
+	/// </summary>
+	class AwaitTask
+	{
+	public:
+		AwaitTask(std::shared_ptr<Functions::BaseFunction> function) :
+			_function(function) {}
+
+		bool await_ready() noexcept { return !_function; }
+		void await_suspend(Task::handle_type handle);
+		void await_resume() noexcept
+		{
+			if (_handle)
+				_handle.promise().Resume();
+		}
+
+	private:
+		Task::handle_type _handle;
+		std::shared_ptr<Functions::BaseFunction> _function;
+	};
+
+	/// <summary>
+	/// Awaitable that resumes the coroutine after the given duration has passed
+	/// </summary>
+	class Sleep
+	{
+	public:
+		Sleep(std::chrono::nanoseconds duration) :
+			_duration(duration) {}
+
+		bool await_ready() noexcept { return _duration.count() <= 0; }
+		void await_suspend(Task::handle_type handle);
+		void await_resume() noexcept
+		{
+			if (_handle)
+				_handle.promise().Resume();
+		}
+
+	private:
+		Task::handle_type _handle;
+		std::chrono::nanoseconds _duration;
+	};
+
+	/// <summary>
+	/// One-shot event that is completed by running its callback. The callback can be handed to any
+	/// interface that expects a Functions::BaseFunction callback, e.g. as the callback of a test
+	/// added to the ExecutionHandler, and the coroutine awaiting the completion is resumed once
+	/// the test has finished.
+	/// </summary>
+	class Completion
+	{
+	public:
+		Completion(Functions::FunctionType type = Functions::FunctionType::Light);
+		/// <summary>
+		/// Awaits an existing callback, e.g. one that has been handed out before the awaiting coroutine was created
+		/// </summary>
+		/// <param name="callback"></param>
+		Completion(std::shared_ptr<Functions::CoroutineCompletionCallback> callback) :
+			_callback(callback) {}
+
+		/// <summary>
+		/// Returns the callback that completes this event
+		/// </summary>
+		/// <returns></returns>
+		std::shared_ptr<Functions::BaseFunction> GetCallback() { return _callback; }
+
+		/// <summary>
+		/// Returns whether the event has been completed
+		/// </summary>
+		/// <returns></returns>
+		bool Completed() { return _callback->_status.load() == 2; }
+
+		/// <summary>
+		/// Returns whether a coroutine is suspended and waiting for the event
+		/// </summary>
+		/// <returns></returns>
+		bool Awaited() { return _callback->_status.load() == 1; }
+
+		bool await_ready() noexcept { return Completed(); }
+		bool await_suspend(Task::handle_type handle);
+		void await_resume() noexcept
+		{
+			if (_handle)
+				_handle.promise().Resume();
+		}
+
+	private:
+		Task::handle_type _handle;
+		std::shared_ptr<Functions::CoroutineCompletionCallback> _callback;
+	};
+
+	/// <summary>
+	/// Timer thread that schedules functions after a given point in time
+	/// </summary>
+	class Timer
+	{
+	public:
+		static Timer* GetSingleton();
+
+		~Timer();
+
+		/// <summary>
+		/// Adds [function] to [controller] once [time] has been reached
+		/// </summary>
+		void Schedule(std::chrono::steady_clock::time_point time, TaskController* controller, std::shared_ptr<Functions::BaseFunction> function);
+
+	private:
+		Timer() {}
+
+		struct Entry
+		{
+			std::chrono::steady_clock::time_point time;
+			uint64_t sequence;
+			TaskController* controller;
+			std::shared_ptr<Functions::BaseFunction> function;
+
+			bool operator>(const Entry& other) const
+			{
+				if (time != other.time)
+					return time > other.time;
+				return sequence > other.sequence;
+			}
+		};
+
+		void InternalLoop();
+
+		std::mutex _lock;
+		std::condition_variable _condition;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> _entries;
+		uint64_t _sequence = 0;
+		bool _terminate = false;
+		std::thread _thread;
+	};
+
+	/// <summary>
+	/// Registers the factories of the coroutine callbacks
+	/// </summary>
+	void RegisterFactories();
+}
@@ -7,6 +7,7 @@
 
 #include <sys/types.h>
 
+#include <array>
 #include <string>
 #include <queue>
 #include <unordered_map>
@@ -14,12 +15,14 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
-#include <boost/bimap.hpp>
-#include <boost/bimap/unordered_set_of.hpp>
 #include <boost/unordered_map.hpp>
 #include <algorithm>
 #include <functional>
+#include <fstream>
+#include <list>
+#include <thread>
 
+#include "Codecs.h"
 #include "TaskController.h"
 #include "Form.h"
 #include "Session.h"
@@ -30,8 +33,10 @@
 #include "ExecutionHandler.h"
 #include "Logging.h"
 #include "Utility.h"
+#include "StringTable.h"
 
 class LoadResolver;
+class MappedFile;
 
 class Data
 {
@@ -39,6 +44,19 @@ public:
 	struct LoadSaveArgs
 	{
 		bool skipExlusionTree = false;
+		/// <summary>
+		/// Input and DerivationTree records are only read from the savefile once they are looked up
+		/// </summary>
+		bool lazyLoad = false;
+		/// <summary>
+		/// Reads the savefile through a memory mapping, falls back to regular file reads if the file cannot be mapped
+		/// </summary>
+		bool mapFile = true;
+		/// <summary>
+		/// Loads the records of all intact blocks of a damaged savefile, instead of failing at the first damaged block.
+		/// Requires a savefile of version 0x7 or newer
+		/// </summary>
+		bool recover = false;
 	};
 
 	struct StaticFormIDs
@@ -80,8 +98,88 @@ public:
 		int64_t _Fail = 0;
 		int64_t _DeltaController = 0;
 		int64_t _Generation = 0;
+
+		SaveStats& operator+=(const SaveStats& rhs)
+		{
+			_Input += rhs._Input;
+			_Grammar += rhs._Grammar;
+			_DevTree += rhs._DevTree;
+			_ExclTree += rhs._ExclTree;
+			_ExclTreeNode += rhs._ExclTreeNode;
+			_Generator += rhs._Generator;
+			_Session += rhs._Session;
+			_Settings += rhs._Settings;
+			_Test += rhs._Test;
+			_TaskController += rhs._TaskController;
+			_ExecutionHandler += rhs._ExecutionHandler;
+			_Oracle += rhs._Oracle;
+			_SessionData += rhs._SessionData;
+			_Fail += rhs._Fail;
+			_DeltaController += rhs._DeltaController;
+			_Generation += rhs._Generation;
+			return *this;
+		}
+	};
+
+	/// <summary>
+	/// block of serialized records in a savefile
+	/// </summary>
+	/// <summary>
+	/// entry of the form index at the end of a savefile
+	/// </summary>
+	struct SaveFormIndexEntry
+	{
+		FormID formid = 0;
+		int32_t type = 0;
+		EnumType flags = 0;
+		/// <summary>
+		/// block the record is stored in
+		/// </summary>
+		uint64_t block = 0;
+		/// <summary>
+		/// offset of the record in the uncompressed block
+		/// </summary>
+		uint64_t offset = 0;
+	};
+
+	struct SaveBlock
+	{
+		/// <summary>
+		/// serialized records, compressed once the block is finished
+		/// </summary>
+		std::string data;
+		uint64_t rawsize = 0;
+		uint64_t records = 0;
+		SaveStats stats;
+		bool failed = false;
+		std::vector<SaveFormIndexEntry> forms;
 	};
 
+	/// <summary>
+	/// entry of the block index at the end of a savefile
+	/// </summary>
+	struct SaveBlockIndexEntry
+	{
+		uint64_t offset = 0;
+		uint64_t rawsize = 0;
+		uint64_t storedsize = 0;
+		uint64_t records = 0;
+		/// <summary>
+		/// CRC32C of the stored data [version 0x7 and newer]
+		/// </summary>
+		uint32_t checksum = 0;
+	};
+
+	/// <summary>
+	/// reads the block and form index at the end of [file] of savefile [version], the index of savefiles with checksums is verified
+	/// </summary>
+	static bool ReadSaveIndex(std::istream& file, int32_t version, std::vector<SaveBlockIndexEntry>& blocks, std::vector<SaveFormIndexEntry>& forms);
+
+	/// <summary>
+	/// version of the savefiles written
+	/// </summary>
+	static constexpr int32_t saveversion = 0x7;
+
 private:
 	struct ObjStorage
 	{
@@ -109,7 +207,6 @@ private:
 
 	const uint64_t guid1 = 0xe30db97c4f1e478f;
 	const uint64_t guid2 = 0x8b03f3d9e946dcf3;
-	const int32_t saveversion = 0x3;
 	/// <summary>
 	/// unique name of the save [i.e. "Testing"]
 	/// </summary>
@@ -186,21 +283,111 @@ private:
 	std::shared_mutex _hashmaplock;
 
 	/// <summary>
-	/// id of the next string in the registry
+	/// forms of a lazily loaded savefile that are read on demand
+	/// </summary>
+	struct LazySave
+	{
+		std::ifstream file;
+		int32_t version = 0;
+		std::unique_ptr<Codecs::Codec> codec;
+		std::vector<SaveBlockIndexEntry> blocks;
+		std::unordered_map<FormID, SaveFormIndexEntry> forms;
+		/// <summary>
+		/// most recently used uncompressed blocks
+		/// </summary>
+		std::list<std::pair<uint64_t, std::string>> cache;
+		std::recursive_mutex lock;
+	};
+	std::unique_ptr<LazySave> _lazy;
+
+	/// <summary>
+	/// number of uncompressed blocks kept in memory for lazy loading
 	/// </summary>
-	FormID _stringNextFormID = 100;
+	const size_t _lazyCacheBlocks = 4;
+
 	/// <summary>
-	/// Type definition of BiMap for ease-of-access
+	/// returns the uncompressed [block] of the lazily loaded savefile
 	/// </summary>
-	typedef boost::bimap<boost::bimaps::unordered_set_of<FormID>, boost::bimaps::unordered_set_of<std::string>> StringHashmap;
+	const std::string* ReadLazyBlock(uint64_t block);
 	/// <summary>
-	/// string registry
+	/// decodes the Input, DerivationTree and Test records in [bulk] blocks of the [mapped] savefile on multiple threads
+	/// and registers them in the order they are stored in. Returns false if a block is damaged
+	/// </summary>
+	bool ReadBlocksParallel(MappedFile& mapped, int32_t version, Codecs::Codec* codec, std::vector<SaveBlockIndexEntry>& blocks, std::vector<size_t>& bulk, SaveStats& stats, int64_t& readbytes);
+	/// <summary>
+	/// reads [count] records from [save] and registers them, Input and DerivationTree records are skipped if [skipbulk] is set
+	/// </summary>
+	bool ReadRecords(std::istream& save, uint64_t count, LoadSaveArgs& loadArgs, SaveStats& stats, bool skipbulk, int64_t& readbytes);
+	/// <summary>
+	/// calls InitializeEarly or InitializeLate [late] on all [forms].
+	/// Forms are initialized in stages, so that forms depending on Grammars and the SessionData come after them.
+	/// Stages whose forms only link their own references run on multiple threads
+	/// </summary>
+	void InitializeForms(std::vector<std::shared_ptr<IForm>>& forms, bool late);
+	/// <summary>
+	/// returns the number of threads used while loading
+	/// </summary>
+	size_t GetLoadThreads();
+
+	/// <summary>
+	/// journal of the forms changed since the last full save
+	/// </summary>
+	struct JournalState
+	{
+		/// <summary>
+		/// full savefile the journal is applied to
+		/// </summary>
+		std::filesystem::path base;
+		std::filesystem::path file;
+		/// <summary>
+		/// number of the base savefile
+		/// </summary>
+		int32_t number = 0;
+		uint64_t epoch = 0;
+		/// <summary>
+		/// number of segments in the journal
+		/// </summary>
+		uint64_t segments = 0;
+		/// <summary>
+		/// strings with smaller ids are part of the base or an earlier segment
+		/// </summary>
+		FormID strings = 0;
+		/// <summary>
+		/// guards the files and the fields above against the compaction thread
+		/// </summary>
+		std::mutex lock;
+		std::thread compactor;
+		std::atomic<bool> compacting = false;
+
+		~JournalState()
+		{
+			if (compactor.joinable())
+				compactor.join();
+		}
+	};
+	std::unique_ptr<JournalState> _journal;
+
+	/// <summary>
+	/// starts a new, empty journal for the full savefile [base] with the [number]
+	/// </summary>
+	void ResetJournal(std::filesystem::path base, int32_t number, FormID strings);
+	/// <summary>
+	/// appends all changed forms as a new segment to the journal
+	/// </summary>
+	void SaveJournal(std::shared_ptr<Functions::BaseFunction> callback, std::shared_ptr<Settings> settings);
+	/// <summary>
+	/// merges the current segments of the journal into a new full savefile on a background thread
 	/// </summary>
-	StringHashmap _stringHashmap;
+	void CompactJournal(int32_t compressionLevel);
 	/// <summary>
-	/// mutex for _stringHashmap access
+	/// applies the segments of the journal at [path] to the forms loaded from the savefile [base]
 	/// </summary>
-	std::mutex _stringHashmapLock;
+	bool ReplayJournal(std::filesystem::path path, std::filesystem::path base, LoadSaveArgs& loadArgs, SaveStats& stats, int64_t& readbytes);
+
+	/// <summary>
+	/// string registry
+	/// </summary>
+	StringTable _strings;
 
 	/// <summary>
 	/// holds references to reusable objects
@@ -223,12 +410,18 @@ private:
 
 	void RegisterForms();
 
-	size_t GetStringHashmapSize();
-
-	bool WriteStringHashmap(std::ostream* buffer, size_t& offset, size_t length);
+	/// <summary>
+	/// writes the string hashmap record with all strings with an id of at least [minid], and returns the id of the next string
+	/// </summary>
+	FormID WriteStringHashmap(std::ostream* buffer, FormID minid = 0);
 
 	bool ReadStringHashmap(std::istream* buffer, size_t& offset, size_t length);
 
+	/// <summary>
+	/// writes [form] as a record to [buffer] and returns whether it was written
+	/// </summary>
+	bool WriteRecord(IForm* form, std::ostream* buffer, SaveStats& stats);
+
 public:
 	bool _globalTasks = false;
 	bool _globalExec = false;
@@ -243,6 +436,30 @@ public:
 	uint64_t _actionloadsave_current = 0;
 	size_t _actionrecord_len = 0;
 	size_t _actionrecord_offset = 0;
+	/// <summary>
+	/// number of forms serialized into a single block of a savefile
+	/// </summary>
+	size_t _saveBlockRecords = 8192;
+	/// <summary>
+	/// number of threads serializing blocks [0 = number of hardware threads]
+	/// </summary>
+	size_t _saveThreads = 0;
+	/// <summary>
+	/// number of threads decoding blocks of a memory mapped savefile and initializing the loaded forms [0 = number of hardware threads]
+	/// </summary>
+	size_t _loadThreads = 0;
+	/// <summary>
+	/// time spent in each phase of the last load
+	/// </summary>
+	std::vector<std::pair<std::string, std::chrono::nanoseconds>> _loadTimes;
+	/// <summary>
+	/// maximum number of Input and DerivationTree records sampled to train the dictionary for zstd dictionary compression
+	/// </summary>
+	size_t _saveDictionarySamples = 4096;
+	/// <summary>
+	/// maximum size of trained dictionaries
+	/// </summary>
+	size_t _saveDictionarySize = 112640;
 
 	/// <summary>
 	/// Returns a singleton for the Data class
@@ -357,6 +574,8 @@ public:
 			if (form->CanDelete(this) == true) {
 				std::unique_lock<std::shared_mutex> guard(_hashmaplock);
 				form->SetFlag(Form::FormFlags::Deleted);
+				// the flag hash doesn't register the deleted flag, so the deletion has to be marked explicitly
+				form->SetChanged();
 				// if form was in an earlier save file we don't delete it from the hashmap
 				// such that we can save to a newer savefile that it was deleted
 				if (form->WasSaved() == false)
@@ -379,6 +598,8 @@ public:
 			if (form->CanDelete(this) == true) {
 				std::unique_lock<std::shared_mutex> guard(_hashmaplock);
 				form->SetFlag(Form::FormFlags::Deleted);
+				// the flag hash doesn't register the deleted flag, so the deletion has to be marked explicitly
+				form->SetChanged();
 				// if form was in an earlier save file we don't delete it from the hashmap
 				// such that we can save to a newer savefile that it was deleted
 				if (form->WasSaved() == false)
@@ -402,14 +623,47 @@ public:
 	template <class T, typename = std::enable_if<std::is_base_of<IForm, T>::value>>
 	std::shared_ptr<T> LookupFormID(FormID formid)
 	{
-		std::shared_lock<std::shared_mutex> guard(_hashmaplock);
-		auto itr = _hashmap.find(formid);
-		if (itr != _hashmap.end() && itr->second->HasFlag(Form::FormFlags::Deleted) == false) {
-			return dynamic_pointer_cast<T>(itr->second);
+		{
+			std::shared_lock<std::shared_mutex> guard(_hashmaplock);
+			auto itr = _hashmap.find(formid);
+			if (itr != _hashmap.end()) {
+				if (itr->second->HasFlag(Form::FormFlags::Deleted) == false)
+					return dynamic_pointer_cast<T>(itr->second);
+				return {};
+			}
 		}
+		// forms skipped by a lazy load are read from the savefile on first access
+		if (_lazy)
+			return dynamic_pointer_cast<T>(LoadLazyForm(formid));
 		return {};
 	}
 
+	/// <summary>
+	/// Reads a form that has been skipped by a lazy load from the savefile and registers it.
+	/// Returns an invalid shared_ptr if the form isn't part of the savefile.
+	/// </summary>
+	std::shared_ptr<IForm> LoadLazyForm(FormID formid);
+	/// <summary>
+	/// Reads all forms of [type] that have been skipped by a lazy load, or all skipped forms if [type] is 0
+	/// </summary>
+	void LoadLazyForms(int32_t type = 0);
+	/// <summary>
+	/// Removes lazily loaded forms from memory that are unchanged and not referenced outside of the database.
+	/// They are read from the savefile again on their next lookup. Inputs are evicted together with their Test
+	/// and stay in memory while another Test refers to them.
+	/// </summary>
+	/// <returns>number of evicted forms</returns>
+	size_t EvictLazyForms();
+	/// <summary>
+	/// Counts the forms of [type] with an id lower than [formid], including the forms of the lazily loaded
+	/// savefile that aren't in memory
+	/// </summary>
+	int64_t CountOlderLazyForms(int32_t type, FormID formid);
+	/// <summary>
+	/// Returns whether forms of the loaded savefile are read on demand
+	/// </summary>
+	bool IsLazyLoaded() { return (bool)_lazy; }
+
 	/// <summary>
 	/// Returns a vector with all database entries that match the given type
 	/// </summary>
@@ -418,6 +672,8 @@ public:
 	template <class T, typename = std::enable_if<std::is_base_of<IForm, T>::value>>
 	std::vector<std::shared_ptr<T>> GetFormArray()
 	{
+		if (_lazy)
+			LoadLazyForms(T::GetTypeStatic());
 		std::vector<std::shared_ptr<T>> results;
 		std::shared_lock<std::shared_mutex> guard(_hashmaplock);
 		for (auto& [_, form] : _hashmap) {
@@ -435,6 +691,9 @@ public:
 	template <class T, typename = std::enable_if<std::is_base_of<IForm, T>::value>>
 	int64_t CountOlderObjects(std::shared_ptr<T> compare)
 	{
+		// the forms of a lazily loaded savefile are counted from its index, instead of reading all of them
+		if (_lazy)
+			return CountOlderLazyForms(T::GetTypeStatic(), compare->GetFormID());
 		std::vector<std::shared_ptr<T>> results;
 		std::shared_lock<std::shared_mutex> guard(_hashmaplock);
 		FormID formid = compare->GetFormID();
@@ -457,6 +716,12 @@ public:
 	/// </summary>
 	/// <param name="visitor">predicate that is applied to all database entries</param>
 	void Visit(std::function<VisitAction(std::shared_ptr<IForm>)> visitor);
+	/// <summary>
+	/// Applies the [visitor] function to all forms in the hashmap, without reading the forms of a lazily loaded
+	/// savefile that aren't in memory
+	/// </summary>
+	/// <param name="visitor">predicate that is applied to all database entries</param>
+	void VisitLoaded(std::function<VisitAction(std::shared_ptr<IForm>)> visitor);
 
 	/// <summary>
 	/// Returns a copy of the hashmap with weak pointers instead of the shared pointers
@@ -469,7 +734,7 @@ public:
 	/// </summary>
 	/// <param name="str">string to find / generate id for</param>
 	/// <returns>id of the string</returns>
-	FormID GetIDFromString(std::string str);
+	FormID GetIDFromString(std::string_view str);
 
 	/// <summary>
 	/// Returns the string associated with the given ID, and a boolean that indicates whether the value exists
@@ -489,6 +754,11 @@ public:
 	/// <param name="callback">callback to execute after save</param>
 	void Save(std::shared_ptr<Functions::BaseFunction> callback);
 
+	/// <summary>
+	/// waits until a running compaction of the save journal has finished
+	/// </summary>
+	void WaitForCompaction();
+
 	/// <summary>
 	/// sets the unique name of the saves
 	/// </summary>
@@ -523,6 +793,8 @@ public:
 	template <class T, typename = std::enable_if<std::is_base_of<IForm, T>::value>>
 	std::shared_ptr<T> FindRandomObject(EnumType matchflags, EnumType excludeflags, std::set<FormID>& excluded, std::function<bool(std::shared_ptr<IForm>)> pred)
 	{
+		if (_lazy)
+			LoadLazyForms(T::GetTypeStatic());
 		std::shared_lock<std::shared_mutex> guard(_hashmaplock);
 		FormID formid = Utility::RandomInt(_baseformid, _nextformid - 1);
 		std::shared_ptr<T> result;
@@ -608,11 +880,17 @@ public:
 	template <class T>
 	std::shared_ptr<T> ResolveFormID(FormID formid)
 	{
-		auto itr = _data->_hashmap.find(formid);
-		if (itr != _data->_hashmap.end()) {
-			if (itr->second)
-				return dynamic_pointer_cast<T>(itr->second);
+		{
+			std::shared_lock<std::shared_mutex> guard(_data->_hashmaplock);
+			auto itr = _data->_hashmap.find(formid);
+			if (itr != _data->_hashmap.end()) {
+				if (itr->second)
+					return dynamic_pointer_cast<T>(itr->second);
+				return {};
+			}
 		}
+		if (_data->IsLazyLoaded())
+			return dynamic_pointer_cast<T>(_data->LoadLazyForm(formid));
 		return {};
 	}
 
@@ -620,12 +898,19 @@ public:
 	/// Executes all tasks waiting in the queue
 	/// </summary>
 	/// <param name="progress">variable incremented and overwritten for each resolved task</param>
-	void Resolve(uint64_t& progress);
+	/// <param name="threads">number of threads executing the tasks</param>
+	void Resolve(uint64_t& progress, size_t threads = 1);
 	/// <summary>
 	/// Executes all tasks waiting in the late queue
 	/// </summary>
 	/// <param name="progress">variable incremented and overwritten for each resolved task</param>
-	void ResolveLate(uint64_t& progress);
+	/// <param name="threads">number of threads executing the tasks</param>
+	void ResolveLate(uint64_t& progress, size_t threads = 1);
+
+	/// <summary>
+	/// returns the lock guarding links to the form [formid] that are set by other forms while initializing in parallel
+	/// </summary>
+	std::mutex& GetLinkLock(FormID formid) { return _linklocks[formid % _linklocks.size()]; }
 
 	void Regenerate(uint64_t& progress, uint64_t& max, std::shared_ptr<SessionData> sessiondata, int32_t numthreads);
 
@@ -658,6 +943,13 @@ private:
 	std::unordered_set<FormID> _regeneration;
 	std::deque<std::shared_ptr<Input>> _regenqueue;
 	std::mutex _regenlock;
+
+	std::array<std::mutex, 64> _linklocks;
+
+	/// <summary>
+	/// executes all tasks in [queue] on [threads] threads
+	/// </summary>
+	void RunTasks(std::queue<TaskDelegate*>& queue, uint64_t& progress, size_t threads);
 	
 	class Task : public TaskDelegate
 	{
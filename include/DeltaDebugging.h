@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Coroutines.h"
 #include "Form.h"
 #include "Function.h"
 #include "Input.h"
@@ -143,6 +144,22 @@ namespace DeltaDebugging
 		bool processedEndEvent = false;
 	};
 
+	struct RunningTest
+	{
+		/// <summary>
+		/// batchident of the batch the test belongs to
+		/// </summary>
+		uint64_t batchident = 0;
+		/// <summary>
+		/// resumes the worker waiting for the test
+		/// </summary>
+		std::shared_ptr<Functions::CoroutineCompletionCallback> completion = std::make_shared<Functions::CoroutineCompletionCallback>();
+		/// <summary>
+		/// input to evaluate once the test has finished, differs from the tested input if it was a duplicate
+		/// </summary>
+		std::shared_ptr<Input> result;
+	};
+
 	struct GenerateComplementsData
 	{
 
@@ -157,6 +174,20 @@ namespace DeltaDebugging
 
 		uint64_t batchident = 0;
 
+		/// <summary>
+		/// [Standard mode] the tests of a level are run by coroutines, [dinfo] holds the splits and complements to test
+		/// and [tasks] counts the active workers
+		/// </summary>
+		bool coroutines = false;
+		/// <summary>
+		/// [coroutines] index of the next entry in [dinfo] to be tested
+		/// </summary>
+		size_t next = 0;
+		/// <summary>
+		/// [coroutines] tests currently executed by workers, by the id of the tested input
+		/// </summary>
+		std::unordered_map<FormID, std::shared_ptr<RunningTest>> running;
+
 		void Reset()
 		{
 			std::unique_lock<std::mutex> guard(testqueuelock);
@@ -166,6 +197,7 @@ namespace DeltaDebugging
 			dinfo.clear();
 			splits.clear();
 			testqueue.clear();
+			next = 0;
 		}
 	};
 
@@ -189,6 +221,8 @@ namespace DeltaDebugging
 
 			std::vector<FormID> splitids;
 			std::vector<FormID> complementids;
+
+			std::vector<FormID> runningids;
 		};
 
 		LoadData* _loadData = nullptr;
@@ -202,7 +236,14 @@ namespace DeltaDebugging
 		/// </summary>
 		bool Start(DDParameters* params, std::shared_ptr<SessionData> sessiondata, std::shared_ptr<Input> input, std::shared_ptr<Functions::BaseFunction> callback);
 
-		void CallbackTest(std::shared_ptr<Input> input, uint64_t batchident, std::shared_ptr<Tasks> tasks);
+		/// <summary>
+		/// Handles a finished test
+		/// </summary>
+		/// <param name="input">input to evaluate</param>
+		/// <param name="batchident">batch the test belongs to</param>
+		/// <param name="tasks">task structure of the batch</param>
+		/// <param name="tested">id of the tested input, if it differs from [input]</param>
+		void CallbackTest(std::shared_ptr<Input> input, uint64_t batchident, std::shared_ptr<Tasks> tasks, FormID tested = 0);
 		void CallbackExplicitEvaluate();
 
 		DDGoal GetGoal()
@@ -223,6 +264,13 @@ namespace DeltaDebugging
 
 		int32_t GetTests() { return _tests; }
 		int32_t GetTestsRemaining() { 
+			if (genCompData.coroutines) {
+				std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+				int32_t remaining = (int32_t)(genCompData.dinfo.size() - std::min(genCompData.next, genCompData.dinfo.size()));
+				if (auto ptr = genCompData.tasks.load(); ptr)
+					return (int32_t)ptr->tasks.load() + remaining;
+				return remaining;
+			}
 			if (auto ptr = genCompData.tasks.load(); ptr)
 				return (int32_t)ptr->tasks.load() + (int32_t)genCompData.testqueue.size();
 			else
@@ -238,7 +286,7 @@ namespace DeltaDebugging
 		std::unordered_map<std::shared_ptr<Input>, std::tuple<double, double, int32_t>>* GetResults() { return &_results; }
 		std::shared_ptr<Input> GetInput() { return _input; }
 		std::shared_ptr<Input> GetOriginalInput() { return _origInput; }
-		ts_set<std::shared_ptr<Input>, FormIDLess<Input>>* GetActiveInputs() { return &_activeInputs; }
+		ts_formid_set<Input>* GetActiveInputs() { return &_activeInputs; }
 
 		/// <summary>
 		/// Adds a callback to the controller [if the controller has already finished the callback is not called
@@ -320,7 +368,7 @@ namespace DeltaDebugging
 		void Clear();
 
 	private:
-		const int32_t classversion = 0x4;
+		const int32_t classversion = 0x5;
 		static inline bool _registeredFactories = false;
 
 		/// <summary>
@@ -332,6 +380,15 @@ namespace DeltaDebugging
 		/// <returns></returns>
 		std::shared_ptr<Input> GetComplement(int32_t begin, int32_t end, double approxthreshold, std::shared_ptr<Input> parent);
 		/// <summary>
+		/// generates a single split
+		/// </summary>
+		/// <param name="begin"></param>
+		/// <param name="length"></param>
+		/// <param name="approxthreshold"></param>
+		/// <param name="parent"></param>
+		/// <returns></returns>
+		std::shared_ptr<Input> GetSplit(int32_t begin, int32_t length, double approxthreshold, std::shared_ptr<Input> parent);
+		/// <summary>
 		/// checks an input for its feasability (derivation from grammar)
 		/// </summary>
 		/// <param name="parent"></param>
@@ -420,6 +477,35 @@ namespace DeltaDebugging
 		/// </summary>
 		void StandardGenerateNextLevel_End();
 		/// <summary>
+		/// prepares the splits and complements of the next level and starts the coroutines testing them for standard mode
+		/// </summary>
+		void StandardGenerateNextLevel_Coroutines();
+		/// <summary>
+		/// Coroutine that generates and tests the splits and complements of a level one at a time, until the level
+		/// is exhausted or has been stopped. The last worker of a level to exit starts its evaluation.
+		/// </summary>
+		/// <param name="batchident">batchident of the level</param>
+		/// <param name="tasks">task structure of the level, counting its workers</param>
+		/// <param name="test">test that is already running, that the worker awaits first</param>
+		/// <returns></returns>
+		Coroutines::Task StandardTestWorker(uint64_t batchident, std::shared_ptr<Tasks> tasks, std::shared_ptr<RunningTest> test);
+		/// <summary>
+		/// starts a worker coroutine for the current level
+		/// </summary>
+		void StartTestWorker(uint64_t batchident, std::shared_ptr<Tasks> tasks, std::shared_ptr<RunningTest> test = {});
+		/// <summary>
+		/// restarts the workers of a level that was saved while running in coroutines
+		/// </summary>
+		void ResumeStandardLevel_Coroutines(std::vector<std::shared_ptr<Input>> running);
+		/// <summary>
+		/// ends the level of [tasks] and starts its evaluation, if it is the current level and hasn't been ended yet
+		/// </summary>
+		void EndLevel(std::shared_ptr<Tasks> tasks);
+		/// <summary>
+		/// unsets the DoNotFree flags of an input that is no longer needed and frees its memory
+		/// </summary>
+		void FreeInput(std::shared_ptr<Input> input);
+		/// <summary>
 		/// evaluates a completed level for standard mode
 		/// </summary>
 		void StandardEvaluateLevel();
@@ -551,11 +637,7 @@ namespace DeltaDebugging
 		/// <summary>
 		/// set of inputs active in this iteration
 		/// </summary>
-		ts_set<std::shared_ptr<Input>, FormIDLess<Input>> _activeInputs;
-		/// <summary>
-		/// atomic flag for spinlock access to _activeInputs
-		/// </summary>
-		std::atomic_flag _activeInputsFlag = ATOMIC_FLAG_INIT;
+		ts_formid_set<Input> _activeInputs;
 		/// <summary>
 		/// tests completed in the current iteration
 		/// </summary>
@@ -587,7 +669,7 @@ namespace DeltaDebugging
 		/// <summary>
 		/// number of currently active tests
 		/// </summary>
-		int32_t _activetests = 0;
+		std::atomic<int32_t> _activetests = 0;
 		/// <summary>
 		/// if true, after the current has been completed the iteration is stopped
 		/// </summary>
@@ -825,6 +907,8 @@ namespace Functions
 		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
 
 		FunctionType GetFunctionType() override { return FunctionType::Light; }
+		FunctionPriority GetPriority() override { return FunctionPriority::High; }
+		std::chrono::nanoseconds GetDeadline() override;
 
 		bool ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
 		bool ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
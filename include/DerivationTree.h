@@ -5,28 +5,127 @@
 #include "Logging.h"
 #include "Allocatable.h"
 
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <list>
+#include <memory>
 #include <set>
 
+class StringTable;
+
 class DerivationTree : public Form
 {
 
 private:
-	const int32_t classversion = 0x2;
+	const int32_t classversion = 0x4;
 
 	bool _regenerate = false;
 
 	void ClearInternal();
 
 public:
-	enum class NodeType
+	enum class NodeType : uint32_t
 	{
 		Terminal = 0,
 		NonTerminal = 1,
 		Sequence = 2,
 	};
+
+	/// <summary>
+	/// algorithm used to derive the tree, it is recorded so that the tree can be regenerated from its seed
+	/// </summary>
+	enum class Strategy : uint32_t
+	{
+		/// <summary>
+		/// grows sequences until the target length is reached and closes all remaining nodes at random
+		/// </summary>
+		Growing = 0,
+		/// <summary>
+		/// chooses expansions based on the number of sequence nodes they can produce to meet the target length
+		/// </summary>
+		LengthAware = 1,
+		/// <summary>
+		/// derives the top of the tree like LengthAware and derives the subtrees below it independently, each with a
+		/// seed drawn from the seed of the tree, so that they can be derived in parallel
+		/// </summary>
+		Parallel = 2,
+		/// <summary>
+		/// chooses expansions like LengthAware, but always expands the leftmost open node, so that the entries of new
+		/// inputs are written while deriving
+		/// </summary>
+		Streaming = 3,
+	};
+
+	/// <summary>
+	/// how character class terminals are produced, it is recorded so that the tree can be regenerated from its seed
+	/// </summary>
+	enum class CharacterClasses : uint32_t
+	{
+		/// <summary>
+		/// terminals are detected and produced as by trees saved before version 0x4
+		/// </summary>
+		Legacy = 0,
+		/// <summary>
+		/// terminals of the form [:class:] produce the characters of their class
+		/// </summary>
+		Tables = 1,
+	};
+
+	/// <summary>
+	/// index of a node in the node arena of its tree
+	/// </summary>
+	typedef uint32_t NodeIndex;
+	static inline constexpr NodeIndex NoNode = UINT32_MAX;
+
+	/// <summary>
+	/// Node of a derivation tree. Nodes are fixed-size records in the node arena of their tree and reference each
+	/// other by index, the children of a nonterminal are a list linked through [_sibling]
+	/// </summary>
+	struct NodeRecord
+	{
+		uint64_t _grammarID = 0;
+		union
+		{
+			/// <summary>
+			/// first child of nonterminals
+			/// </summary>
+			NodeIndex _child = NoNode;
+			/// <summary>
+			/// id of the content of terminals in the symbol table
+			/// </summary>
+			uint32_t _symbol;
+		};
+		NodeIndex _sibling = NoNode;
+		/// <summary>
+		/// last child of nonterminals, so that children are appended in constant time
+		/// </summary>
+		NodeIndex _last = NoNode;
+		NodeType _type = NodeType::Terminal;
+
+		bool IsTerminal() const { return _type == NodeType::Terminal; }
+	};
+
+	/// <summary>
+	/// Nodes created by one tree. Once a tree is derived from it the block is shared and never changed again, so the
+	/// derived trees refer to the unchanged subtrees of their parent instead of copying them
+	/// </summary>
+	struct NodeBlock
+	{
+		std::vector<NodeRecord> _nodes;
+		/// <summary>
+		/// index of the first node of the block
+		/// </summary>
+		NodeIndex _begin = 0;
+		/// <summary>
+		/// set once the tree that created the block no longer holds it, so that the trees sharing it may compact it away
+		/// </summary>
+		mutable std::atomic<bool> _released = false;
+	};
+
+	// pointer-based node layout, only used by the node allocators
 	struct Node : public Allocatable
 	{
 		virtual NodeType Type() = 0;
@@ -201,15 +300,33 @@ public:
 
 	~DerivationTree();
 
-	Node* _root;
-	int64_t _nodes;
+	NodeIndex _root = NoNode;
+	/// <summary>
+	/// number of nodes created by this tree
+	/// </summary>
+	int64_t _nodes = 0;
 	int64_t _sequenceNodes = 0;
 	bool _valid = false;
 
 private:
+	/// <summary>
+	/// nodes created by this tree, their indexes start at [_ownBegin]
+	/// </summary>
+	std::shared_ptr<NodeBlock> _own = std::make_shared<NodeBlock>();
+	/// <summary>
+	/// node blocks of the trees this tree has been derived from, in index order. They are released with the last tree
+	/// referring to them
+	/// </summary>
+	std::vector<std::shared_ptr<const NodeBlock>> _shared;
+	NodeIndex _ownBegin = 0;
+
+	const NodeRecord& GetSharedNode(NodeIndex index) const;
+
 	FormID _grammarID;
 	uint32_t _seed = 0;
 	int32_t _targetlen = 0;
+	Strategy _strategy = Strategy::Growing;
+	CharacterClasses _characterClasses = CharacterClasses::Tables;
 	ParentTree _parent;
 	FormID _inputID = 0;
 
@@ -236,6 +353,22 @@ public:
 	void SetTargetLength(int32_t len) {
 		CheckChanged(_targetlen, len);
 	}
+	Strategy GetStrategy()
+	{
+		return _strategy;
+	}
+	void SetStrategy(Strategy strategy)
+	{
+		CheckChanged(_strategy, strategy);
+	}
+	CharacterClasses GetCharacterClasses()
+	{
+		return _characterClasses;
+	}
+	void SetCharacterClasses(CharacterClasses classes)
+	{
+		CheckChanged(_characterClasses, classes);
+	}
 	ParentTree& GetParent() {
 		return _parent;
 	}
@@ -269,6 +402,156 @@ public:
 
 
 public:
+	/// <summary>
+	/// Creates a nonterminal or sequence node without children
+	/// </summary>
+	NodeIndex CreateNode(NodeType type, uint64_t grammarID)
+	{
+		auto& nodes = _own->_nodes;
+		NodeRecord& node = nodes.emplace_back();
+		node._grammarID = grammarID;
+		node._type = type;
+		_nodes++;
+		return _ownBegin + (NodeIndex)(nodes.size() - 1);
+	}
+	/// <summary>
+	/// Creates a terminal node with the content [symbol]
+	/// </summary>
+	NodeIndex CreateTerminal(uint64_t grammarID, uint32_t symbol)
+	{
+		auto& nodes = _own->_nodes;
+		NodeRecord& node = nodes.emplace_back();
+		node._grammarID = grammarID;
+		node._symbol = symbol;
+		_nodes++;
+		return _ownBegin + (NodeIndex)(nodes.size() - 1);
+	}
+	/// <summary>
+	/// Appends [child] to the children of [parent]. [parent] and its children must have been created by this tree
+	/// </summary>
+	void AddChild(NodeIndex parent, NodeIndex child)
+	{
+		NodeRecord& node = GetOwnNode(parent);
+		if (node._last == NoNode)
+			node._child = child;
+		else
+			GetOwnNode(node._last)._sibling = child;
+		node._last = child;
+	}
+	/// <summary>
+	/// returns the node at [index], the reference is invalidated by the creation of nodes
+	/// </summary>
+	const NodeRecord& GetNode(NodeIndex index) const
+	{
+		if (index >= _ownBegin)
+			return _own->_nodes[index - _ownBegin];
+		return GetSharedNode(index);
+	}
+	/// <summary>
+	/// returns the node at [index] created by this tree for modification, the reference is invalidated by the creation of nodes
+	/// </summary>
+	NodeRecord& GetOwnNode(NodeIndex index) { return _own->_nodes[index - _ownBegin]; }
+	/// <summary>
+	/// returns whether the node at [index] has been created by this tree
+	/// </summary>
+	bool IsOwnNode(NodeIndex index) const { return index >= _ownBegin; }
+	/// <summary>
+	/// Makes room for [count] nodes created by this tree in total
+	/// </summary>
+	void ReserveNodes(size_t count)
+	{
+		auto& nodes = _own->_nodes;
+		if (count > nodes.capacity())
+			nodes.reserve(std::max(count, nodes.capacity() * 2));
+	}
+
+	/// <summary>
+	/// Makes all nodes of [source] available under the same indexes without copying them, nodes created afterwards are
+	/// stored after them. This tree must be empty, and [source] must not be changed afterwards
+	/// </summary>
+	void ShareNodes(DerivationTree& source);
+	/// <summary>
+	/// Creates a copy of the shared [node] that refers to the same children, which isn't attached to any parent.
+	/// Children must not be added to the copy
+	/// </summary>
+	NodeIndex ShareSubtree(NodeIndex node);
+	/// <summary>
+	/// Replaces the shared children of [node], which has been created by this tree, with copies, so that children
+	/// can be added to it
+	/// </summary>
+	void UnshareChildren(NodeIndex node);
+
+	/// <summary>
+	/// Copies [node] of [source] and all its descendants into this tree and returns the copy, which isn't attached to
+	/// any parent. Sequence nodes below [node] are added to [sequenceNodes]
+	/// </summary>
+	NodeIndex CopySubtree(const DerivationTree& source, NodeIndex node, int64_t& sequenceNodes);
+	/// <summary>
+	/// Copies the descendants of the root of [source] into this tree as children of [node], which must have been
+	/// created by this tree and must not have children. [source] must not share nodes of other trees, and its root must
+	/// be the first node it created
+	/// </summary>
+	void GraftChildren(NodeIndex node, const DerivationTree& source);
+	/// <summary>
+	/// Appends all sequence nodes at or below [node] to [nodes], in the order of the sequence
+	/// </summary>
+	void GatherSequenceNodes(NodeIndex node, std::vector<NodeIndex>& nodes);
+	/// <summary>
+	/// Appends the contents of the terminals below [node] from left to right to [out]
+	/// </summary>
+	void AppendContent(NodeIndex node, std::string& out);
+
+	/// <summary>
+	/// Entries of an input sequence, written back to back into a single buffer
+	/// </summary>
+	struct SequenceBuffer
+	{
+		std::string data;
+		/// <summary>
+		/// begin and end offset of each entry in [data], in the order of the sequence
+		/// </summary>
+		std::vector<std::pair<uint32_t, uint32_t>> entries;
+
+		void Clear()
+		{
+			data.clear();
+			entries.clear();
+		}
+		size_t Size() const { return entries.size(); }
+		std::string_view Get(size_t index) const { return std::string_view(data.data() + entries[index].first, entries[index].second - entries[index].first); }
+	};
+	/// <summary>
+	/// Writes the entries of all sequence nodes into [buffer] in a single walk over the tree. A terminal root is a single entry
+	/// </summary>
+	void EmitSequence(SequenceBuffer& buffer);
+	/// <summary>
+	/// Removes all nodes from the tree, but keeps the arena for the next derivation unless it is shared
+	/// </summary>
+	void ResetNodes()
+	{
+		if (_own.use_count() > 1) {
+			_own->_released = true;
+			_own = std::make_shared<NodeBlock>();
+		}
+		else
+			_own->_nodes.clear();
+		_own->_begin = 0;
+		_shared.clear();
+		_ownBegin = 0;
+		_root = NoNode;
+		_nodes = 0;
+		_sequenceNodes = 0;
+		_valid = false;
+	}
+
+	/// <summary>
+	/// Returns the id of the symbol [symbol], the contents of terminals are shared by all trees
+	/// </summary>
+	static uint32_t InternSymbol(std::string_view symbol);
+	/// <summary>
+	/// Returns the symbol with [id]
+	/// </summary>
+	static std::string_view GetSymbol(uint32_t id);
 
 	void SetRegenerate(bool vaue);
 	bool GetRegenerate();
@@ -322,7 +605,17 @@ public:
 	/// </summary>
 	/// <returns></returns>
 	bool Freed() override;
+	/// <summary>
+	/// returns the memory released by freeing this tree. Node blocks shared with other trees are accounted to the last
+	/// tree holding them
+	/// </summary>
 	size_t MemorySize() override;
+	/// <summary>
+	/// Copies the nodes reachable from the root into a block of its own once a source tree has released the nodes the
+	/// tree shares with it, and the tree only reaches a small part of the nodes it holds. Returns whether the tree has
+	/// been compacted
+	/// </summary>
+	bool CompactNodes();
 
 	#pragma endregion
 };
@@ -69,569 +69,193 @@
  * work with this projects grammar structure. It removes i/o functions etc.
  * Additionally recursive functions such as Node::~Node and Node::expandNode have been rewritten
  * to work iteratively due to significant stackoverflows in the original functions.
+ * The chart has since been rewritten to work on compiled grammars: states and their back pointers are stored in
+ * arenas, states are deduplicated with per-column hash sets, right recursion is completed with Leo's transitive
+ * items, and the parse forest is shared instead of expanded into all trees.
  */
-	
 
+#pragma once
 
+#include <cstdint>
+#include <vector>
 
+#include "CompiledGrammar.h"
 
-
-
-
-#include "Grammar.h"
-#include "DerivationTree.h"
-#include "Logging.h"
-
-#include <string>
-#include <unordered_map>
-#include <stack>
-
-
-class State
-{
-public:
-	State(std::shared_ptr<GrammarNode> _nonterminal, std::shared_ptr<GrammarExpansion> productionPointer, State* backtraceState, int64_t inputStringProgress, int64_t productionProgress)
-	{
-		this->nonTerminal = _nonterminal;
-		this->productionPointer = productionPointer;
-
-		this->backtraceStateVector.push_back(backtraceState);
-
-		this->inputStringProgress = inputStringProgress;
-		this->productionProgress = productionProgress;
-	}
-
-	//State();
-
-	virtual ~State()
-	{
-
-	}
-
-	std::vector<State*>* getBacktraceStateVector()
-	{
-		return &(this->backtraceStateVector);
-	}
-	const std::shared_ptr<GrammarNode> getNonTerminal()
-	{
-		return this->nonTerminal;
-	}
-
-	std::shared_ptr<GrammarExpansion> getProductionPointer()
-	{
-		return this->productionPointer;
-	}
-	int64_t getProductionProgress()
-	{
-		return this->productionProgress;
-	}
-	int64_t getInputStringProgress()
-	{
-		return this->inputStringProgress;
-	}
-
-	bool isComplete()
-	{
-		if (this->getProductionProgress() == (nonTerminal->IsSequence() ? 0 : (int64_t)this->getProductionPointer()->_nodes.size()))
-			return true;
-		else
-			return false;
-	}
-	std::shared_ptr<GrammarNode> nextSymbolToProcess()
-	{
-		return this->getProductionPointer()->_nodes.at(this->productionProgress);
-	}
-
-	bool getPrinted()
-	{
-		return this->printed;
-	}
-	void setPrintedTrue()
-	{
-		this->printed = true;
-	}
-
-private:
-	explicit State() :
-		productionPointer(NULL) {}
-
-	std::shared_ptr<GrammarNode> nonTerminal;
-	std::shared_ptr<GrammarExpansion> productionPointer;
-
-	std::vector<State*> backtraceStateVector;
-
-	int64_t productionProgress;
-	int64_t inputStringProgress;
-
-	bool printed;
-};
-
-
-class Node
+/// <summary>
+/// Earley parser for sequences of sequence nodes of a compiled grammar.
+///
+/// States of all columns are stored in one arena, each state is created once per column and found through a hash set
+/// of the column. Every way a state is reached is recorded as a link to its predecessor and the completed child, so the
+/// chart forms a binarized shared packed parse forest from which one derivation is extracted. Completions of right
+/// recursive rules use Leo's transitive items, which keeps the chart linear for LR-regular grammars.
+/// </summary>
+class EarleyParser
 {
 public:
-	Node(Node* father, std::shared_ptr<GrammarNode> grammarElement, std::shared_ptr<GrammarExpansion> productionPointer, float productionProbability)
-	{
-		this->father = father;
-
-		this->grammarElement = grammarElement;
-		this->productionProbability = productionProbability;
-
-		this->productionPointer = productionPointer;
-	}
-
-	virtual ~Node()
-	{
-		std::stack<Node*> stack;
-		for (std::vector<Node*>::iterator it = this->children.begin(); it != this->children.end(); it++) {
-			stack.push(*it);
-		}
-		Node* tmp = nullptr;
-		while (stack.size() > 0)
-		{
-			tmp = stack.top();
-			stack.pop();
-
-			for (auto itr = tmp->children.begin(); itr != tmp->children.end(); itr++) {
-				stack.push(*itr);
-			}
-			tmp->children.clear();
-			delete tmp;
-		}
-	}
-
-	State* expandNode(State* stateToExpand)
-	{
-		// contains the next statetoexpand for the next item
-		std::stack<State*> resultstack;
-		// node, state, reverse order, child to handle
-		std::stack<std::tuple<Node*, State*, bool, int64_t>> stack;
-		stack.push({ this, stateToExpand, false, -1 });
-
-		while (stack.size() > 0) {
-			auto [self, currentStateToExpand, reverse, chnum] = stack.top();
-			stack.pop();
-
-			State* nextStateToExpand = nullptr;
-
-			if (resultstack.size() > 0) {
-				currentStateToExpand = resultstack.top();
-				resultstack.pop();
-			}
-
-			if (reverse) {
-				resultstack.push(currentStateToExpand);
-				continue;
-			}
-
-			// if we are not on the reverse track
-			// we add ourselves for reversing onto the stack
-			// begin with ourselves
-			stack.push({ self, currentStateToExpand, true, -1 });
-
-			if (!reverse && chnum == -1) {
-				for (int64_t i = 0; i < (int64_t)self->productionPointer->_nodes.size(); i++) {
-					stack.push({ self, currentStateToExpand, false, i });
-				}
-				continue;
-			}
-
-			std::shared_ptr<GrammarNode> got = self->productionPointer->_nodes.at(chnum);
-			if (got->IsSequence() == false) {
-				/*
-					* the element contained in the production
-					* at current position of loop is NON TERMINAL
-					* and needs to be expanded
-					*/
-				if (currentStateToExpand->getBacktraceStateVector()->size() > 1) {
-					for (int64_t j = 0; j < (int64_t)currentStateToExpand->getBacktraceStateVector()->size(); j++) {
-						if (self->father->getProductionPointer() == currentStateToExpand->getBacktraceStateVector()->at(j)->getProductionPointer()) {
-							nextStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(j);
-							//	cout << "[DEBUG]: matching production pointer at position " << j << endl;
-							break;
-						}
-
-						if (j == (int64_t)currentStateToExpand->getBacktraceStateVector()->size() - 1) {
-							logcritical("[ERROR]: no matching production pointer correspondent to production in this node!");
-							exit(1);
-						}
-					}
-
-				} else {
-					nextStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(0);
-				}
-
-				Node* child;
-				if (self->productionProbability >= 0) {
-					child = new Node(
-						self,
-						nextStateToExpand->getNonTerminal(),
-						nextStateToExpand->getProductionPointer(),
-						nextStateToExpand->getProductionPointer()->_weight);
-				} else {
-					child = new Node(
-						self,
-						nextStateToExpand->getNonTerminal(),
-						nextStateToExpand->getProductionPointer(),
-						-1);
-				}
-
-				/*
-					* insert at beginning of vector
-					*/
-				self->children.insert(self->children.begin(), child);
-
-				// stack operation ended so push next one onto stack and continue
-				stack.push({ child, nextStateToExpand, false, -1 });
-
-			} else {
-				/*
-					* the element is TERMINAL
-					* and needs not to be exapanded
-					*/
-
-				Node* child;
-				if (self->productionProbability >= 0) {
-					child = new Node(
-						self,
-						self->productionPointer->_nodes.at(chnum),
-						std::make_shared<GrammarExpansion>(),
-						1);
-				} else {
-					child = new Node(
-						self,
-						self->productionPointer->_nodes.at(chnum),
-						std::make_shared<GrammarExpansion>(),
-						-1);
-				}
-
-				self->children.insert(self->children.begin(), child);
-
-				if (currentStateToExpand->getBacktraceStateVector()->size() > 1) {
-					for (int64_t j = 0; j < (int64_t)currentStateToExpand->getBacktraceStateVector()->size(); j++) {
-						State* state = currentStateToExpand->getBacktraceStateVector()->at(j);
-					}
-
-					for (int64_t j = 0; j < (int64_t)currentStateToExpand->getBacktraceStateVector()->size(); j++) {
-						if (self->father->getProductionPointer() == currentStateToExpand->getBacktraceStateVector()->at(j)->getProductionPointer()) {
-							currentStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(j);
-							//cout << "[DEBUG]: matching production pointer at position " << j << endl;
-							break;
-						}
-
-						if (j == (int64_t)currentStateToExpand->getBacktraceStateVector()->size() - 1) {
-							logcritical("[ERROR]: no matching production pointer correspondent to production in this node!");
-							return nullptr;
-						}
-					}
-
-				} else {
-					currentStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(0);
-				}
-
-				if (currentStateToExpand->getBacktraceStateVector()->size() > 1) {
-					for (unsigned j = 0; j < currentStateToExpand->getBacktraceStateVector()->size(); j++) {
-						State* state = currentStateToExpand->getBacktraceStateVector()->at(j);
-					}
-
-					//for( unsigned j = currentStateToExpand->getBacktraceStateVector()->size() - 1; j >= 0; j-- )
-					for (int64_t j = 0; j < (int64_t)currentStateToExpand->getBacktraceStateVector()->size(); j++) {
-						if (self->father->getProductionPointer() == currentStateToExpand->getBacktraceStateVector()->at(j)->getProductionPointer()) {
-							currentStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(j);
-							break;
-						} else {
-						}
-
-						if (j == (int64_t)currentStateToExpand->getBacktraceStateVector()->size() - 1 /*0*/) {
-							logcritical("[ERROR]: no matching production pointer correspondent to production in this node!");
-							return nullptr;
-						}
-					}
-
-				} else {
-					currentStateToExpand = currentStateToExpand->getBacktraceStateVector()->at(0);
-				}
-
-				// we have a new currentStateToExpand that we need to give back to the upper node
-				resultstack.push(currentStateToExpand);
-			}
-		}
-		if (resultstack.size() > 0)
-			return resultstack.top();
-		return stateToExpand;
-	}
+	static inline constexpr uint32_t None = UINT32_MAX;
 
-	float print(bool printProbabilities)
+	/// <summary>
+	/// node of an extracted derivation, children are linked as first child and next sibling
+	/// </summary>
+	struct TreeNode
 	{
-		float prob = -1;
-
-		//cout << "Node [" << this->grammarElement << "]{";
-
-		if (printProbabilities == true) {
-			if (this->children.size() == 0) {
-				/*
-			 * we are in a leaf node
-			 */
-				prob = this->productionProbability;
-
-			} else {
-				prob = this->productionProbability;
-				for (std::vector<Node*>::iterator it = this->children.begin(); it != this->children.end(); it++) {
-					prob = prob * (*it)->print(printProbabilities);
-				}
-			}
-		} else {
-			for (std::vector<Node*>::iterator it = this->children.begin(); it != this->children.end(); it++) {
-				prob = (*it)->print(printProbabilities);
-			}
-		}
-		//cout << "prob [" << prob << "]}";
+		/// <summary>
+		/// index of the compiled grammar node
+		/// </summary>
+		uint32_t node = None;
+		uint32_t child = None;
+		uint32_t sibling = None;
+	};
 
-		return prob;
-	}
+	EarleyParser(const CompiledGrammar& grammar);
 
-	std::shared_ptr<GrammarExpansion> getProductionPointer()
-	{
-		return this->productionPointer;
-	}
-
-	std::vector<Node*> getChildren()
-	{
-		return children;
-	}
-	std::shared_ptr<GrammarNode> getGrammarElement()
-	{
-		return grammarElement;
-	}
+	/// <summary>
+	/// Parses [input], a sequence of compiled node indexes of sequence nodes. Returns whether the root derives the input
+	/// </summary>
+	bool Parse(const std::vector<uint32_t>& input);
+	/// <summary>
+	/// Extracts one derivation of the last parsed input into [tree], the root is at index 0. Sequence nodes of the input
+	/// are leaves and appear in input order
+	/// </summary>
+	bool ExtractTree(std::vector<TreeNode>& tree);
 
+	size_t GetItemCount() const { return _items.size(); }
+	size_t GetLinkCount() const { return _links.size(); }
+	size_t MemorySize() const;
 
 private:
-	explicit Node() {}
-
-	std::shared_ptr<GrammarNode> grammarElement;
-	Node* father;
-
-	std::vector<Node*> children;
-
-	float productionProbability;
-
-	std::shared_ptr<GrammarExpansion> productionPointer;
-};
-
-
-class EarleyParser
-{
-public:
-	std::vector<std::vector<State*>> earleyParserChart;
-	std::vector<std::shared_ptr<GrammarNode>> inputVector;
-	bool probabilityParser;
-
-	std::vector<Node*> returnVector;
-
-	std::vector<std::shared_ptr<GrammarExpansion>> lonely = { std::make_shared<GrammarExpansion>() };
-
-
-	EarleyParser()
+	enum class LinkType : uint8_t
 	{
-		lonely[0]->_nodes.push_back(std::make_shared<GrammarNode>());
-		lonely[0]->_nodes[0]->_type = GrammarNode::NodeType::Terminal;
-	}
-	~EarleyParser()
-	{
-		for (int64_t i = 0; i <= (int64_t)this->inputVector.size(); i++) {
-			for (std::vector<State*>::iterator it = this->earleyParserChart.at(i).begin(); it != this->earleyParserChart.at(i).end(); it++) {
-				delete *it;
-			}
-		}
-
-		for (std::vector<Node*>::iterator it = this->returnVector.begin(); it != this->returnVector.end(); it++) {
-			delete *(it);
-		}
-	}
-
-	void initialize(bool a_probabilityParser)
-	{
-		this->probabilityParser = a_probabilityParser;
-	}
+		/// <summary>
+		/// [left] advanced over the input at position [right]
+		/// </summary>
+		Scan,
+		/// <summary>
+		/// [left] advanced over the completed item [right]
+		/// </summary>
+		Complete,
+		/// <summary>
+		/// [left] advanced over the nullable node [right]
+		/// </summary>
+		Nullable,
+		/// <summary>
+		/// top of the Leo chain [left] completed by item [right]
+		/// </summary>
+		Leo,
+	};
 
 	/// <summary>
-	/// returns the parent of a grammar node as those are basically their productions
+	/// state of the chart, a position [dot] in [expansion] started in column [origin]
 	/// </summary>
-	/// <param name=""></param>
-	/// <returns></returns>
-	std::vector<std::shared_ptr<GrammarExpansion>> getProduction(std::shared_ptr<GrammarNode> node)
-	{ 
-		return node->IsSequence() ? std::vector<std::shared_ptr<GrammarExpansion>>{} : node->_expansions;
-	}
-	int64_t createChart(std::shared_ptr<GrammarNode> root)
+	struct Item
 	{
-		earleyParserChart.resize(inputVector.size() + 1);
-		auto expansions = getProduction(root);
-		for (auto expansion : expansions)
-		{
-			State* initialState = new State(root, expansion, NULL, 0, 0);
-			earleyParserChart[0].push_back(initialState);
-		}
-		size_t sz = inputVector.size();
-		for (size_t i = 0; i < sz; i++)
-			earleyParserChart[i].reserve(sz + 1);
-		return 1;
-	}
-	void parse()
+		uint32_t expansion;
+		uint32_t dot;
+		uint32_t origin;
+		/// <summary>
+		/// link that created the item, further links follow it
+		/// </summary>
+		uint32_t link;
+	};
+
+	struct Link
 	{
-		for (int64_t i = 0; i <= (int64_t)inputVector.size(); i++)
-		{
-			//StartProfiling
-			//std::cout << i << "\n";
-			for (int64_t j = 0; j < (int64_t)earleyParserChart[i].size(); j++)
-			{
-				if (!(earleyParserChart[i].at(j)->isComplete())) {
-					/*
-					* the state is not complete
-					* the production corresponding to the state has not
-					* been yet analized completely
-					*/
-					if (this->getProduction(earleyParserChart[i].at(j)->nextSymbolToProcess()).size() != 0)
-					{
-						predictor(earleyParserChart[i].at(j), i);
-					} else
-						scanner(earleyParserChart[i].at(j), i);
-				}
-				else
-				{
-					completer(earleyParserChart[i].at(j), i);
-				}
-			}
-			//profile(TimeProfiling, "");
-		}
-	}
+		uint32_t left;
+		uint32_t right;
+		uint32_t next;
+		LinkType type;
+	};
 
-	std::vector<Node*>* returnParsingTrees(std::shared_ptr<GrammarNode> mainNonTerminal)
+	/// <summary>
+	/// item of a column waiting for a nonterminal [symbol]
+	/// </summary>
+	struct Waiting
 	{
-		for (std::vector<State*>::iterator it = this->earleyParserChart[this->inputVector.size()].begin();
-			 it != this->earleyParserChart[this->inputVector.size()].end(); it++) {
-			if ((*it)->getNonTerminal() == mainNonTerminal && (*it)->getProductionProgress() == (int64_t)(*it)->getProductionPointer()->_nodes.size()) {
-				State* stateBookmark = (*it);
-				Node* rootOfParsingTree;
-
-				if (this->probabilityParser == true) {
-					rootOfParsingTree =
-						new Node(
-							NULL,
-							stateBookmark->getNonTerminal(),
-							stateBookmark->getProductionPointer(),
-							stateBookmark->getProductionPointer()->_weight);
-				} else {
-					rootOfParsingTree =
-						new Node(
-							NULL,
-							stateBookmark->getNonTerminal(),
-							stateBookmark->getProductionPointer(),
-							-1);
-				}
-
-				//std::vector<State*>* test;
-				State* test2;
-				test2 = rootOfParsingTree->expandNode(stateBookmark);
+		uint32_t symbol;
+		uint32_t item;
+	};
 
-				this->returnVector.push_back(rootOfParsingTree);
-			}
-		}
-
-		return &this->returnVector;
-	}
-
-	void predictor(State* stateToExpand, int64_t positionInputString)
+	/// <summary>
+	/// Leo item: the single penultimate [item] waiting for a symbol in a column, and the top item of its chain
+	/// </summary>
+	struct Leo
 	{
-		std::shared_ptr<GrammarExpansion> productionInStateToExpand = stateToExpand->getProductionPointer();
-		if (stateToExpand->getProductionProgress() >= (int64_t)productionInStateToExpand->_nodes.size()) {
-			logcritical("[ERROR]: overflow in predictor!");
-			return;
-		}
-		std::shared_ptr<GrammarNode> nonTerminalToExpand = productionInStateToExpand->_nodes.at(stateToExpand->getProductionProgress());
-
-		auto listProductions = getProduction(nonTerminalToExpand);
-
-		for (int64_t i = 0; i < (int64_t)listProductions.size(); i++)
-		{
-			State* stateToInsert = new State(nonTerminalToExpand, listProductions[i], stateToExpand, positionInputString, 0);
+		uint32_t item;
+		/// <summary>
+		/// Leo item one level up, None for the top
+		/// </summary>
+		uint32_t next;
+		uint32_t expansion;
+		uint32_t origin;
+	};
+
+	const CompiledGrammar& _grammar;
+	/// <summary>
+	/// node of each expansion
+	/// </summary>
+	std::vector<uint32_t> _owner;
+	/// <summary>
+	/// expansion deriving the empty sequence for nullable nodes, None otherwise
+	/// </summary>
+	std::vector<uint32_t> _nullable;
+	/// <summary>
+	/// last column + 1 a node has been predicted in
+	/// </summary>
+	std::vector<uint32_t> _predicted;
 
-			int64_t positionOfState = stateExists(positionInputString, stateToInsert);
-			if (positionOfState < 0)
-			{
-				/*
-				 * state not already in the chart
-				 */
+	const std::vector<uint32_t>* _input = nullptr;
+	std::vector<Item> _items;
+	std::vector<Link> _links;
+	/// <summary>
+	/// index of the first item of each column
+	/// </summary>
+	std::vector<uint32_t> _columns;
+	/// <summary>
+	/// open addressing hash set of the items of the current column
+	/// </summary>
+	std::vector<uint32_t> _table;
+	/// <summary>
+	/// items of the current column that scan the next input
+	/// </summary>
+	std::vector<uint32_t> _pending;
+	/// <summary>
+	/// waiting items of all finished columns sorted by symbol, and the index of the first one of each column
+	/// </summary>
+	std::vector<Waiting> _waiting;
+	std::vector<uint32_t> _waitingBegin;
+	std::vector<Waiting> _scratch;
+	/// <summary>
+	/// Leo item of each group of waiting items, None if there is none, Unknown if not computed yet
+	/// </summary>
+	std::vector<uint32_t> _leoIndex;
+	std::vector<Leo> _leos;
+	std::vector<uint32_t> _leoPath;
+	/// <summary>
+	/// complete root item of the last column
+	/// </summary>
+	uint32_t _accepted = None;
 
-				this->earleyParserChart[positionInputString].push_back(stateToInsert);
-			} else {
-				/*
-				 * state already in chart
-				 * pushes back the state from which it comes inside it's backtrace state vector
-				 */
-				this->earleyParserChart[positionInputString].at(positionOfState)->getBacktraceStateVector()->push_back(stateToExpand);
-				delete stateToInsert;
-			}
-		}
-	}
-	void scanner(State* stateToScan, int64_t positionInputString)
-	{
-		std::shared_ptr<GrammarExpansion> productionInStateToScan = stateToScan->getProductionPointer();
-		if (positionInputString >= (int64_t)inputVector.size())
-		{
-			//logcritical("[DEBUG]: scanner fail, input string end reached");
-			return;
-		}
-		if (inputVector.at(positionInputString) == productionInStateToScan->_nodes.at(stateToScan->getProductionProgress()))
-		{
-			/*
-			* the symbol to be scanned in the production is the same of the input string
-			* a new state must be created in the next position of the chart
-			*
-			* must check for equal states in the chart and avoid insertion in case
-			*/
+	static inline constexpr uint32_t Unknown = UINT32_MAX - 1;
 
-			State* stateToInsert = new State(stateToScan->getNonTerminal(), stateToScan->getProductionPointer(), stateToScan, stateToScan->getInputStringProgress(), stateToScan->getProductionProgress() + 1);
-			//cout << "[DEBUG]: scanner is inserting state in chart position " << positionInputString + 1 << endl;
-			this->earleyParserChart[positionInputString + 1].push_back(stateToInsert);
-		} else {
-			/*
-			* do nothing
-			* symbol to be scanned does not match with symbol in the input string
-			*/
-		}
-	}
-	void completer(State* stateCompleted, int64_t positionInputString)
-	{
-		if (stateCompleted->getInputStringProgress() >= (int64_t)this->earleyParserChart.size()) {
-			logcritical("[ERROR] : COMPLETER OVERFLOW");
-			return;
-		}
-		for (std::vector<State*>::iterator it = this->earleyParserChart[stateCompleted->getInputStringProgress()].begin();
-			 it != this->earleyParserChart[stateCompleted->getInputStringProgress()].end(); it++) {
-			if ((int64_t)(*it)->getProductionPointer()->_nodes.size() <= (*it)->getProductionProgress())
-				continue;
-			if (stateCompleted->getNonTerminal() == (*it)->getProductionPointer()->_nodes.at((*it)->getProductionProgress())) {
-				//cout << "before constructor in complete" << endl;
-				State* stateToInsert = new State((*it)->getNonTerminal(), (*it)->getProductionPointer(), stateCompleted, (*it)->getInputStringProgress(), (*it)->getProductionProgress() + 1);
-				this->earleyParserChart[positionInputString].push_back(stateToInsert);
-				//cout << "after push back in complete" << endl;
-			}
-			//cout << "destructor called in complete" << endl;
-		}
-	}
+	void ComputeNullable();
+	void ResetTable(size_t expected);
+	/// <summary>
+	/// adds the item to the current column, or a further link to it if it exists
+	/// </summary>
+	void AddItem(uint32_t expansion, uint32_t dot, uint32_t origin, LinkType type, uint32_t left, uint32_t right);
+	void Complete(uint32_t item, uint32_t column);
+	/// <summary>
+	/// returns the first of the items in [column] waiting for [symbol], and their number in [count]
+	/// </summary>
+	uint32_t FindWaiting(uint32_t column, uint32_t symbol, uint32_t& count) const;
+	/// <summary>
+	/// returns the Leo item for [symbol] in [column], or None
+	/// </summary>
+	uint32_t GetLeo(uint32_t column, uint32_t symbol);
 
-	int64_t stateExists(int64_t chartPosition, State* stateToCheck)
-	{
-		for (std::vector<State*>::iterator it = this->earleyParserChart[chartPosition].begin(); it != this->earleyParserChart[chartPosition].end(); it++) {
-			if ((*it)->getNonTerminal() == stateToCheck->getNonTerminal() &&
-				(*it)->getInputStringProgress() == stateToCheck->getInputStringProgress() &&
-				(*it)->getProductionPointer() == stateToCheck->getProductionPointer() &&
-				(*it)->getProductionProgress() == stateToCheck->getProductionProgress()) {
-				//cout << "[DEBUG]: found same state at position " << it - this->earleyParserChart[chartPosition].begin() << " of chart[" << chartPosition << "]" << endl;
-				return (it - this->earleyParserChart[chartPosition].begin());
-			}
-		}
-		return -1;
-	}
+	bool IsComplete(const Item& item) const;
+	/// <summary>
+	/// returns the node after the dot of [item], or None
+	/// </summary>
+	uint32_t NextSymbol(const Item& item) const;
 };
@@ -37,6 +37,11 @@ private:
 	std::shared_ptr<SessionData> _sessiondata;
 	Data* _data;
 	std::filesystem::path _resultpath;
+	/// <summary>
+	/// number of inputs printed, forms read from a lazily loaded save are evicted every [_evictEvery] inputs
+	/// </summary>
+	size_t _printed = 0;
+	const size_t _evictEvery = 256;
 
 	void WriteFile(std::string filename, std::string subpath, std::string content);
 	std::string PrintInput(std::shared_ptr<Input> input, std::string& str, std::string& scriptargs, std::string& cmdargs, std::string& dump,bool skipargs = false);
@@ -4,6 +4,7 @@
 #include <functional>
 #include <cstdint>
 #include <memory>
+#include <chrono>
 
 class LoadResolver;
 
@@ -16,6 +17,16 @@ namespace Functions
 		Heavy,
 	};
 
+	/// <summary>
+	/// Scheduling priority of a function within its FunctionType queue
+	/// </summary>
+	enum class FunctionPriority : int32_t
+	{
+		Low = -1,
+		Normal = 0,
+		High = 1,
+	};
+
 	class BaseFunction
 	{
 	public:
@@ -68,6 +79,20 @@ namespace Functions
 		
 		virtual FunctionType GetFunctionType() = 0;
 
+		/// <summary>
+		/// Returns the priority of the function. Functions with higher priority are executed before
+		/// other functions of the same FunctionType
+		/// </summary>
+		/// <returns></returns>
+		virtual FunctionPriority GetPriority() { return FunctionPriority::Normal; }
+		/// <summary>
+		/// Returns the maximum time the function should wait in the queue before being executed.
+		/// Functions with earlier deadlines are executed first among functions with the same priority.
+		/// [0 = no deadline]
+		/// </summary>
+		/// <returns></returns>
+		virtual std::chrono::nanoseconds GetDeadline() { return std::chrono::nanoseconds(0); }
+
 		virtual std::shared_ptr<BaseFunction> DeepCopy() = 0;
 
 		template <class T, typename = std::enable_if<std::is_base_of<BaseFunction, T>::value>>
@@ -42,6 +42,10 @@ public:
 	bool Generate(std::shared_ptr<Input> input, std::shared_ptr<Input> parent, std::shared_ptr<Grammar> grammar, std::shared_ptr<SessionData> sessiondata);
 	void GenInputFromDevTree(std::shared_ptr<Input> input);
 	/// <summary>
+	/// Adds the entries of [sequence] to [input], up to its trimmed length
+	/// </summary>
+	void AddSequence(std::shared_ptr<Input> input, const DerivationTree::SequenceBuffer& sequence);
+	/// <summary>
 	/// resets all progress made
 	/// </summary>
 	virtual void Clean();
@@ -8,7 +8,6 @@
 #include <unordered_map>
 #include <queue>
 #include <random>
-#include <regex>
 
 #include "Utility.h"
 #include "TaskController.h"
@@ -18,6 +17,8 @@
 class GrammarExpansion;
 class Grammar;
 class LoadResolverGrammar;
+class CompiledGrammar;
+class DerivationQueue;
 class DerivationTree;
 class Input;
 
@@ -344,6 +345,14 @@ private:
 	std::unordered_map<uint64_t, std::shared_ptr<GrammarNode>> _hashmap;
 	std::unordered_map<uint64_t, std::shared_ptr<GrammarExpansion>> _hashmap_expansions;
 	std::vector<uint64_t> _ruleorder;
+	/// <summary>
+	/// non-terminals by identifier, held weakly so that pruned nodes are released
+	/// </summary>
+	std::unordered_map<std::string, std::weak_ptr<GrammarNode>> _identifiers;
+	/// <summary>
+	/// adds [node] to the identifier lookup of FindNode
+	/// </summary>
+	void AddIdentifier(std::shared_ptr<GrammarNode> node);
 
 	std::shared_ptr<GrammarNode> _root;
 
@@ -359,15 +368,28 @@ private:
 	int32_t _numcycles = 0;
 	uint64_t _nextid = 0;
 
+	/// <summary>
+	/// flat representation of the tree used for derivation, built once the tree is complete
+	/// </summary>
+	std::shared_ptr<CompiledGrammar> _compiled;
+
 	uint64_t GetNextID();
 
 	friend class Grammar;
 	friend class LoadResolverGrammar;
+	friend class CompiledGrammar;
 
 	/// <summary>
-	/// Finds cycles in the grammar
+	/// Builds the compiled representation of the tree, must be called after all changes to the tree
 	/// </summary>
-	void FindCycles();
+	void Compile();
+
+	/// <summary>
+	/// Finds the strongly connected components of the nodes reachable from the root with Tarjan's algorithm, and marks
+	/// them reachable. Components are returned in reverse topological order, so that a component only derives into
+	/// itself and earlier components. The number of components that form cycles is stored in [_numcycles]
+	/// </summary>
+	std::vector<std::vector<GrammarNode*>> FindCycles();
 
 	/// <summary>
 	/// Returns the weight extracted from [production]
@@ -377,15 +399,10 @@ private:
 	float GetWeight(std::string production);
 
 	/// <summary>
-	/// Recursively gathers all node flags
+	/// Gathers the flags of all nodes and expansions, and whether they are reachable and producing, in time linear
+	/// in the size of the grammar
 	/// </summary>
-	/// <param name="node"></param>
-	void GatherFlags(std::shared_ptr<GrammarNode> node, std::set<uint64_t> path, bool reset = false);
-	/// <summary>
-	/// Recusively gathers all node flags
-	/// </summary>
-	/// <param name="expansion"></param>
-	void GatherFlags(std::shared_ptr<GrammarExpansion> expansion, std::set<uint64_t> path);
+	void GatherFlags();
 
 	/// <summary>
 	/// Prunes the grammar tree and removes all non-reachable and non-producing subtrees
@@ -501,6 +518,33 @@ public:
 
 	void Derive(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, int32_t maxsteps = 100000);
 
+	/// <summary>
+	/// number of open nodes that can still produce sequence nodes at which parallel derivations split the tree. It
+	/// doesn't depend on the number of workers, so that trees are regenerated the same way on every machine
+	/// </summary>
+	static constexpr size_t ParallelFrontier = 64;
+
+	/// <summary>
+	/// sets the TaskController whose workers derive the subtrees of parallel derivations. Without one, the subtrees
+	/// are derived by the calling thread
+	/// </summary>
+	void SetTaskController(std::shared_ptr<TaskController> controller)
+	{
+		_controller = controller;
+	}
+
+	/// <summary>
+	/// subtrees of a parallel derivation, shared with the workers deriving them
+	/// </summary>
+	struct ParallelDerivation;
+
+	/// <summary>
+	/// Derives a tree like Derive and writes its sequence entries into [sequence]. Streaming trees write them while
+	/// they are derived, all others in a single walk after the derivation. Without [keepTree] the derivation happens in
+	/// a reused scratch tree, and [dtree] only receives the parameters needed to regenerate it later
+	/// </summary>
+	void Generate(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, DerivationTree::SequenceBuffer& sequence, bool keepTree);
+
 	void ExtractEarley(std::shared_ptr<DerivationTree> stree, std::shared_ptr<DerivationTree> dtree, int64_t begin, int64_t length, int64_t stop, bool complement);
 
 	void Extract(std::shared_ptr<DerivationTree> stree, std::shared_ptr<DerivationTree> dtree, std::vector<std::pair<int64_t, int64_t>>& segments, int64_t stop, bool complement);
@@ -510,7 +554,41 @@ public:
 	#pragma endregion
 
 private:
-	void DeriveFromNode(std::shared_ptr<DerivationTree> dtree, std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>>& qnonterminals, std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>>& qseqnonterminals, std::mt19937& randan, int32_t& seq);
+	/// <summary>
+	/// Derives [dtree] from the root of the grammar. Returns whether the entries of the tree have been written into
+	/// [sequence] while deriving it
+	/// </summary>
+	bool DeriveRoot(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, DerivationTree::SequenceBuffer* sequence);
+	void DeriveFromNode(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, DerivationTree::SequenceBuffer* sequence = nullptr);
+	/// <summary>
+	/// Chooses the expansion of the grammar node [gindex] whose yield bounds keep the target length reachable, given
+	/// the [slack] the node should produce and the maximal yield [hiOther] of all other open nodes
+	/// </summary>
+	uint32_t ChooseLengthAware(const CompiledGrammar& grammar, uint32_t gindex, int64_t slack, int64_t hiOther, size_t split, std::vector<uint32_t>& candidates, std::mt19937& randan);
+	/// <summary>
+	/// Returns how often the node [regex] of a regular expansion is repeated to produce [slack] sequence nodes
+	/// </summary>
+	int64_t RepeatLengthAware(const CompiledGrammar& grammar, uint32_t regex, int32_t min, int64_t slack);
+	/// <summary>
+	/// Expands the queued nodes with expansions whose yield bounds keep the target length reachable, and closes the
+	/// nodes with their smallest derivation once it has been reached. Stops once [split] open nodes can still produce
+	/// sequence nodes, and returns the open nodes in [qnonterminals]
+	/// </summary>
+	void DeriveLengthAware(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, size_t split = SIZE_MAX);
+	/// <summary>
+	/// Derives like DeriveLengthAware, but always expands the leftmost open node, so that the contents of the tree are
+	/// complete from left to right. Writes the entries of the sequence nodes into [sequence] while deriving, if given
+	/// </summary>
+	void DeriveStreaming(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, DerivationTree::SequenceBuffer* sequence);
+	/// <summary>
+	/// Derives the top of the tree until it can be split into ParallelFrontier growing subtrees, distributes the
+	/// remaining sequence nodes over them and derives each subtree with its own seed
+	/// </summary>
+	void DeriveParallel(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq);
+	/// <summary>
+	/// derives the subtree [index] of [derivation] into a tree of its own
+	/// </summary>
+	void DerivePiece(ParallelDerivation& derivation, size_t index);
 
 	std::shared_ptr<GrammarTree> _tree;
 	std::shared_ptr<GrammarTree> _treeParse;
@@ -520,12 +598,48 @@ private:
 	int32_t _backtrack_min = 0;
 	int32_t _backtrack_max = 0;
 
+	std::weak_ptr<TaskController> _controller;
+
 	const int32_t classversion = 0x2;
 
 	bool ReadData0x1(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver, LoadResolverGrammar* lresolve);
 	bool ReadData0x2(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver, LoadResolverGrammar* lresolve);
 };
 
+namespace Functions
+{
+	/// <summary>
+	/// Derives subtrees of a parallel derivation on a worker thread of the TaskController
+	/// </summary>
+	class DerivePiecesCallback : public BaseFunction
+	{
+	public:
+		std::shared_ptr<Grammar::ParallelDerivation> _derivation;
+
+		void Run() override;
+		static uint64_t GetTypeStatic() { return 'GRDP'; }
+		uint64_t GetType() override { return 'GRDP'; }
+
+		FunctionType GetFunctionType() override { return FunctionType::Medium; }
+		FunctionPriority GetPriority() override { return FunctionPriority::High; }
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
+
+		bool ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver) override;
+		bool WriteData(std::ostream* buffer, size_t& offset) override;
+
+		static std::shared_ptr<BaseFunction> Create() { return dynamic_pointer_cast<BaseFunction>(std::make_shared<DerivePiecesCallback>()); }
+		void Dispose() override;
+		size_t GetLength() override;
+
+		virtual const char* GetName() override
+		{
+			return "DerivePiecesCallback";
+		}
+	};
+}
+
 class LoadResolverGrammar
 {
 
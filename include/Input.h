@@ -170,6 +170,10 @@ private:
 	/// number of derived inputs that failed
 	/// </summary>
 	uint64_t _derivedFails = 0;
+	/// <summary>
+	/// number of times this input has been the parent of an input that was regenerated, isn't saved
+	/// </summary>
+	uint64_t _regenerationUses = 0;
 
 	/// <summary>
 	/// runtime at which this input was generated
@@ -320,6 +324,10 @@ public:
 	/// </summary>
 	/// <param name="entry"></param>
 	void AddEntry(std::string entry);
+	/// <summary>
+	/// Adds the first [count] entries of [buffer] at the end of the input
+	/// </summary>
+	void AddEntries(const DerivationTree::SequenceBuffer& buffer, size_t count = SIZE_MAX);
 	void ReserveSequence(size_t size)
 	{
 		_sequence.reserve(size);
@@ -522,6 +530,14 @@ public:
 	/// </summary>
 	/// <returns></returns>
 	uint64_t GetDerivedFails();
+	/// <summary>
+	/// Increments the number of times this input has been the parent of a regenerated input
+	/// </summary>
+	void IncRegenerationUses();
+	/// <summary>
+	/// Returns the number of times this input has been the parent of a regenerated input
+	/// </summary>
+	uint64_t GetRegenerationUses();
 
 	/// <summary>
 	/// Sets the runtime at which this input was generated
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Form.h"
+
+/// <summary>
+/// Append-only journal of changed forms, applied on top of a full savefile [the base].
+///
+/// A journal file starts with a FileHeader and is followed by segments. Each segment holds the forms that
+/// changed during one save epoch, serialized as regular records into a single block, and ends with a commit
+/// marker. Segments without a valid commit marker have been torn by a crash and are discarded.
+/// </summary>
+namespace Journal
+{
+	inline constexpr const char* Extension = ".tfjournal";
+
+	struct FileHeader
+	{
+		uint64_t guid1 = 0;
+		uint64_t guid2 = 0;
+		/// <summary>
+		/// number of the base savefile
+		/// </summary>
+		int32_t base = 0;
+
+		static constexpr size_t Size = 8 + 4 + 16 + 4;
+	};
+
+	struct SegmentHeader
+	{
+		uint64_t epoch = 0;
+		FormID nextformid = 0;
+		bool globalTasks = false;
+		bool globalExec = false;
+		std::chrono::nanoseconds runtime = std::chrono::nanoseconds(0);
+		/// <summary>
+		/// Codecs::CodecType of the data
+		/// </summary>
+		int32_t codec = 0;
+		uint64_t records = 0;
+		uint64_t rawsize = 0;
+		uint64_t storedsize = 0;
+
+		static constexpr size_t Size = 8 + 8 + 1 + 1 + 8 + 4 + 8 + 8 + 8;
+	};
+
+	/// <summary>
+	/// Returns the path of the journal belonging to the savefile at [base]
+	/// </summary>
+	std::filesystem::path GetPath(std::filesystem::path base);
+
+	void WriteFileHeader(std::ostream* out, FileHeader& header);
+	bool ReadFileHeader(std::istream* in, FileHeader& header);
+
+	/// <summary>
+	/// Writes a segment with [data], which holds [header.storedsize] bytes
+	/// </summary>
+	void WriteSegment(std::ostream* out, SegmentHeader& header, const std::string& data);
+	/// <summary>
+	/// Reads the next segment. Returns false at the end of the journal or if the segment is incomplete.
+	/// </summary>
+	bool ReadSegment(std::istream* in, SegmentHeader& header, std::string& data);
+	/// <summary>
+	/// Collects the ids of the forms stored in the uncompressed [data] of a segment
+	/// </summary>
+	bool ReadFormIDs(const std::string& data, uint64_t records, std::vector<FormID>& formids);
+
+	struct CompactArgs
+	{
+		/// <summary>
+		/// base savefile
+		/// </summary>
+		std::filesystem::path base;
+		std::filesystem::path journal;
+		/// <summary>
+		/// offset in the journal up to which segments are merged
+		/// </summary>
+		uint64_t end = 0;
+		/// <summary>
+		/// new base savefile
+		/// </summary>
+		std::filesystem::path output;
+		int32_t compressionLevel = 1;
+		size_t blockRecords = 8192;
+	};
+
+	/// <summary>
+	/// Merges the segments of a journal into its base and writes the result as a new full savefile.
+	/// Only works on files and can run while the session continues.
+	/// </summary>
+	bool Compact(CompactArgs& args);
+}
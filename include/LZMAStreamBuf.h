@@ -7,12 +7,19 @@
 * date 2024/10/24
 */
 
+#pragma once
+
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <lzma.h>
 
-class Streambuf : public std::streambuf
+#include "BufferOperations.h"
+#include "Codecs.h"
+
+class Streambuf : public Buffer::ViewStreambuf
 {
 public:
 	Streambuf(std::istream* pIn);
@@ -49,3 +56,67 @@ private:
 	lzma_stream _lzmaStream;
 	lzma_mt _lzmaOptions;
 };
+
+/// <summary>
+/// Reads a sequence of independently compressed blocks as a single stream.
+/// Each block starts with a header [uint64_t raw size, uint64_t stored size, uint64_t records], followed by the CRC32C of the
+/// stored data and the CRC32C of the header itself in savefiles with checksums. A block with a raw size of 0 ends the sequence.
+/// </summary>
+class BlockStreambuf : public Streambuf
+{
+public:
+	static constexpr size_t HeaderSize = 32;
+	/// <summary>
+	/// size of block headers without checksums
+	/// </summary>
+	static constexpr size_t LegacyHeaderSize = 24;
+
+	static size_t GetHeaderSize(bool checksums) { return checksums ? HeaderSize : LegacyHeaderSize; }
+	/// <summary>
+	/// Writes a block header with checksums to [header]
+	/// </summary>
+	static void WriteHeader(unsigned char* header, uint64_t rawsize, uint64_t storedsize, uint64_t records, uint32_t checksum);
+	/// <summary>
+	/// Reads a block header, returns false if the checksum of the header doesn't match
+	/// </summary>
+	static bool ReadHeader(const unsigned char* header, bool checksums, uint64_t& rawsize, uint64_t& storedsize, uint64_t& records, uint32_t& checksum);
+
+	/// <summary>
+	/// Reads blocks from [pIn] that have been compressed with [codec], or are stored uncompressed if [codec] is nullptr.
+	/// If [checksums] is set, blocks are verified before they are decompressed and reading stops at the first damaged block
+	/// </summary>
+	BlockStreambuf(std::istream* pIn, Codecs::Codec* codec, bool checksums = false);
+
+	virtual int underflow() override final;
+
+	/// <summary>
+	/// Blocks whose entry in [skip] is true are passed over without being read or decompressed
+	/// </summary>
+	void SetSkipBlocks(std::vector<bool> skip) { _skip = std::move(skip); }
+	/// <summary>
+	/// Only reads the blocks starting at [offsets], in order, instead of the contiguous sequence
+	/// </summary>
+	void SetBlockOffsets(std::vector<uint64_t> offsets)
+	{
+		_offsets = std::move(offsets);
+		_useoffsets = true;
+	}
+
+	/// <summary>
+	/// returns whether reading stopped at a block whose checksum doesn't match
+	/// </summary>
+	bool IsDamaged() { return _damaged; }
+
+private:
+	std::istream* _in;
+	Codecs::Codec* _codec = nullptr;
+	bool _checksums = false;
+	bool _end = false;
+	bool _damaged = false;
+	std::vector<bool> _skip;
+	std::vector<uint64_t> _offsets;
+	bool _useoffsets = false;
+	size_t _block = 0;
+	std::unique_ptr<char[]> _compressedBuffer, _decompressedBuffer;
+	size_t _compressedSize = 0, _decompressedSize = 0;
+};
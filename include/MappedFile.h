@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <iostream>
+
+#include "BufferOperations.h"
+
+/// <summary>
+/// Maps a file copy-on-write into memory, changes to the mapping are never written back to the file
+/// </summary>
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	/// <summary>
+	/// Maps the file at [path], returns false if the file cannot be opened or is empty
+	/// </summary>
+	bool Open(const std::filesystem::path& path);
+	/// <summary>
+	/// Unmaps the file, pointers into the mapping become invalid
+	/// </summary>
+	void Close();
+
+	bool IsOpen() { return _data != nullptr; }
+	char* GetData() { return _data; }
+	size_t GetSize() { return _size; }
+
+private:
+	char* _data = nullptr;
+	size_t _size = 0;
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
+
+/// <summary>
+/// Reads a range of memory as a stream, without copying it
+/// </summary>
+class MappedStreambuf : public Buffer::ViewStreambuf
+{
+public:
+	MappedStreambuf(char* data, size_t size);
+
+protected:
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in) override;
+	virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in) override;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Data;
+class Input;
+
+/// <summary>
+/// Decides which inputs keep their memory when memory is reclaimed.
+///
+/// Freed inputs are regenerated from their parents, which may have to be regenerated themselves. Inputs that are
+/// often the parent of regenerated inputs and are expensive to regenerate are kept in a cache of bounded size, the
+/// others are freed cheapest to regenerate first.
+/// </summary>
+class RegenerationCache
+{
+public:
+	/// <summary>
+	/// estimated cost of regenerating an input, in entries processed
+	/// </summary>
+	struct Cost
+	{
+		uint64_t cost = 0;
+		/// <summary>
+		/// number of inputs that are regenerated, including the input itself
+		/// </summary>
+		int32_t depth = 0;
+	};
+
+	/// <summary>
+	/// relative cost per entry of deriving, extending and extracting with a simple grammar
+	/// </summary>
+	static constexpr uint64_t DeriveWeight = 1;
+	/// <summary>
+	/// relative cost per entry of extracting with a grammar that needs the earley parser
+	/// </summary>
+	static constexpr uint64_t ParseWeight = 8;
+	/// <summary>
+	/// maximum number of parents followed
+	/// </summary>
+	static constexpr int32_t MaxDepth = 1000;
+
+	/// <summary>
+	/// Estimates the cost of regenerating [input] once it has been freed. Parents are followed until one that holds
+	/// its sequence and derivation tree
+	/// </summary>
+	static Cost Estimate(Data* data, std::shared_ptr<Input> input, bool simpleGrammar);
+
+	/// <summary>
+	/// Orders [inputs] so that the inputs to free come first, cheapest to regenerate per byte first, followed by the
+	/// inputs kept in the cache of [cacheSize] bytes. Returns the number of inputs to free
+	/// </summary>
+	static size_t Order(Data* data, std::vector<std::shared_ptr<Input>>& inputs, bool simpleGrammar, uint64_t cacheSize);
+
+	/// <summary>
+	/// returns the memory released by freeing [input] and its derivation tree. Nodes the tree shares with other trees
+	/// are only counted once it is the last tree holding them
+	/// </summary>
+	static uint64_t GetMemorySize(std::shared_ptr<Input> input);
+
+private:
+	/// <summary>
+	/// returns whether [input] has to be regenerated before inputs derived from it can be regenerated
+	/// </summary>
+	static bool NeedsRegeneration(std::shared_ptr<Input> input);
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BufferOperations.h"
+#include "Codecs.h"
+#include "Data.h"
+#include "Form.h"
+
+/// <summary>
+/// Helpers for tools that work on savefiles directly, without loading them into a session.
+/// Only full savefiles of version 0x6 or newer are supported, savefiles written by these helpers are always of the current version.
+/// </summary>
+namespace SaveFile
+{
+	/// <summary>
+	/// fixed part of the header: version, guid, data fields, compression, prior saves and callback
+	/// </summary>
+	inline constexpr size_t RecordCountOffset = 38 + 5 + 8 + 256;
+
+	struct Header
+	{
+		int32_t version = 0;
+		FormID nextformid = 0;
+		bool globalTasks = false;
+		bool globalExec = false;
+		std::chrono::nanoseconds runtime = std::chrono::nanoseconds(0);
+		int32_t compressionLevel = -1;
+		bool compressionExtreme = false;
+		uint64_t records = 0;
+		Codecs::CodecType codec = Codecs::CodecType::None;
+		std::string dictionary;
+		/// <summary>
+		/// guid, copied verbatim
+		/// </summary>
+		char guid[16] = {};
+	};
+
+	/// <summary>
+	/// Reads the header of the full savefile in [data]
+	/// </summary>
+	bool ReadHeader(const char* data, size_t size, Header& header);
+	/// <summary>
+	/// Writes a header of the current save version without prior saves and callback. The record count can be patched later with WriteRecordCount
+	/// </summary>
+	void WriteHeader(std::ostream* out, Header& header);
+	void WriteRecordCount(std::ostream* out, uint64_t records);
+	/// <summary>
+	/// returns the size of [header] in the file, which is the offset of the first block
+	/// </summary>
+	uint64_t GetHeaderSize(Header& header);
+
+	/// <summary>
+	/// returns the stored data of block [entry] in the savefile [file] of [version], or nullptr if the block exceeds the file,
+	/// doesn't match its header or is damaged
+	/// </summary>
+	const char* GetBlockData(const char* file, size_t size, int32_t version, const Data::SaveBlockIndexEntry& entry);
+	/// <summary>
+	/// writes a block with its header and sets the offset and checksum of [entry]
+	/// </summary>
+	void WriteBlock(std::ostream* out, Data::SaveBlockIndexEntry& entry, const char* data);
+	/// <summary>
+	/// writes the block and form index, followed by the checksum of both and their positions
+	/// </summary>
+	void WriteIndex(std::ostream* out, std::vector<Data::SaveBlockIndexEntry>& index, std::vector<Data::SaveFormIndexEntry>& forms);
+	/// <summary>
+	/// Finds the intact blocks of the savefile [file] of version 0x7 or newer by following the block headers from [start].
+	/// Damaged regions are passed over by searching for the next valid block header, [damaged] counts them
+	/// </summary>
+	void ScanBlocks(const char* file, size_t size, uint64_t start, std::vector<Data::SaveBlockIndexEntry>& blocks, uint64_t& damaged);
+
+	/// <summary>
+	/// Flushes [temp] to disk and renames it to [path], so that [path] either holds its prior content or the complete new file
+	/// </summary>
+	bool CommitFile(const std::filesystem::path& temp, const std::filesystem::path& path);
+
+	struct VerifyResult
+	{
+		int32_t version = 0;
+		/// <summary>
+		/// whether the block and form index are intact
+		/// </summary>
+		bool index = false;
+		uint64_t blocks = 0;
+		uint64_t damaged = 0;
+		uint64_t records = 0;
+		uint64_t bytes = 0;
+		std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+	};
+
+	/// <summary>
+	/// Verifies the checksums of all blocks and the index of the savefile at [path] on [threads] threads [0 = number of hardware threads].
+	/// Returns true if the savefile is intact
+	/// </summary>
+	bool Verify(const std::filesystem::path& path, size_t threads, VerifyResult& result);
+
+	/// <summary>
+	/// form records start with the class version, followed by the form version, formid and flags
+	/// </summary>
+	bool ReadFormHeader(const char* record, size_t length, FormID& formid, EnumType& flags);
+	/// <summary>
+	/// overwrites the flags in the header of a form [record]
+	/// </summary>
+	void WriteFormFlags(char* record, size_t length, EnumType flags);
+
+	/// <summary>
+	/// calls [func] with the type, data and length of every record in an uncompressed block
+	/// </summary>
+	template <class F>
+	bool ForEachRecord(const char* data, size_t size, uint64_t records, F func)
+	{
+		size_t pos = 0;
+		for (uint64_t i = 0; i < records; i++) {
+			if (pos + 12 > size)
+				return false;
+			size_t offset = 0;
+			size_t rlen = Buffer::ReadSize((unsigned char*)data + pos, offset);
+			int32_t rtype = Buffer::ReadInt32((unsigned char*)data + pos, offset);
+			if (rlen > size - pos - 12)
+				return false;
+			func(rtype, data + pos, 12 + rlen);
+			pos += 12 + rlen;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// writes records into compressed blocks and keeps the block and form index
+	/// </summary>
+	struct BlockWriter
+	{
+		std::ostream* out = nullptr;
+		Codecs::Codec* codec = nullptr;
+		size_t blockRecords = 8192;
+
+		std::string block;
+		uint64_t records = 0;
+		uint64_t written = 0;
+		std::vector<Data::SaveBlockIndexEntry> index;
+		std::vector<Data::SaveFormIndexEntry> forms;
+		std::vector<Data::SaveFormIndexEntry> pending;
+		bool failed = false;
+
+		void Add(int32_t type, const char* record, size_t length);
+		/// <summary>
+		/// writes the current block, the next record starts a new one
+		/// </summary>
+		void Flush();
+		void WriteBlock(uint64_t rawsize, const std::string& stored, uint64_t count);
+		/// <summary>
+		/// writes the last block, the end of blocks, and the block and form index
+		/// </summary>
+		void Finish();
+	};
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+
+#include "Form.h"
+
+class Input;
+
+/// <summary>
+/// Streaming queries over the Inputs of a savefile, without loading the session.
+///
+/// The blocks of the savefile are decoded by multiple threads, one wave of blocks at a time, so memory use only
+/// depends on the number of threads and the block size. Matching Inputs are written to a new savefile, a CSV file
+/// or a list of form ids.
+/// </summary>
+namespace SaveQuery
+{
+	struct Filter
+	{
+		/// <summary>
+		/// OracleResult bits of which at least one must be set [0 = any result]
+		/// </summary>
+		EnumType result = 0;
+		/// <summary>
+		/// length of the input as stored in the savefile, which is either its trimmed length or its number of individual scores
+		/// </summary>
+		int64_t minLength = -1;
+		int64_t maxLength = -1;
+		double minPrimary = -std::numeric_limits<double>::infinity();
+		double maxPrimary = std::numeric_limits<double>::infinity();
+		double minSecondary = -std::numeric_limits<double>::infinity();
+		double maxSecondary = std::numeric_limits<double>::infinity();
+		/// <summary>
+		/// generation the input belongs to [0 = any generation]
+		/// </summary>
+		FormID generation = 0;
+		/// <summary>
+		/// flags that must be set
+		/// </summary>
+		EnumType flags = 0;
+		/// <summary>
+		/// flags that must not be set
+		/// </summary>
+		EnumType noflags = 0;
+
+		bool Matches(Input* input);
+	};
+
+	/// <summary>
+	/// Parses a filter of the form "key=value,key=value". Keys are result, minlength, maxlength, minprimary, maxprimary,
+	/// minsecondary, maxsecondary, generation, flags and noflags. Results are given by name [passing|failing|undefined|prefix|repeat],
+	/// multiple results are separated by '|'. Form ids and flags are given in hex.
+	/// </summary>
+	bool ParseFilter(const std::string& text, Filter& filter);
+
+	enum class Format
+	{
+		/// <summary>
+		/// savefile holding the matching Inputs and their DerivationTrees, together with the Settings, Oracle and Grammars
+		/// </summary>
+		Save,
+		/// <summary>
+		/// one line per matching Input with its statistics
+		/// </summary>
+		CSV,
+		/// <summary>
+		/// one form id per line
+		/// </summary>
+		IDs,
+	};
+
+	/// <summary>
+	/// returns the format matching the extension of [path]
+	/// </summary>
+	Format GetFormat(std::filesystem::path path);
+
+	struct Args
+	{
+		std::filesystem::path save;
+		std::filesystem::path output;
+		Format format = Format::CSV;
+		Filter filter;
+		/// <summary>
+		/// also keeps the ancestors of matching Inputs in savefiles, so that they can be regenerated
+		/// </summary>
+		bool ancestors = false;
+		/// <summary>
+		/// [0 = number of hardware threads]
+		/// </summary>
+		size_t threads = 0;
+		int32_t compressionLevel = 1;
+		size_t blockRecords = 8192;
+	};
+
+	struct Stats
+	{
+		uint64_t blocks = 0;
+		uint64_t inputs = 0;
+		uint64_t matches = 0;
+		/// <summary>
+		/// number of records written to the output
+		/// </summary>
+		uint64_t written = 0;
+	};
+
+	bool Run(Args& args, Stats& stats);
+}
@@ -51,6 +51,15 @@ struct LoadSessionArgs
 	/// clears all tasks and active tests from the session
 	/// </summary>
 	bool clearTasks = false;
+	/// <summary>
+	/// Only reads the index of Inputs and DerivationTrees and loads them once they are accessed.
+	/// Intended for sessions that are only inspected and not resumed.
+	/// </summary>
+	bool lazyLoad = false;
+	/// <summary>
+	/// Loads the intact blocks of a damaged savefile instead of failing
+	/// </summary>
+	bool recover = false;
 	bool customsavepath = false;
 	std::filesystem::path savepath;
 
@@ -100,6 +109,9 @@ struct SessionStatus
 	int32_t task_waiting_light = 0;
 	int32_t task_waiting_medium = 0;
 	uint64_t task_completed = 0;
+	uint64_t task_deadlines_light = 0;
+	uint64_t task_deadlines_missed_light = 0;
+	std::chrono::nanoseconds task_deadlines_lateness_light = std::chrono::nanoseconds(0);
 
 	// -----ExecutionHandler-----
 	int32_t exec_waiting = 0;
@@ -230,6 +242,11 @@ public:
 	/// <param name="status"></param>
 	void UI_GetThreadStatus(std::vector<TaskController::ThreadStatus>& status, std::vector<const char*>& names, std::vector<std::string>& time);
 	/// <summary>
+	/// returns the busy, idle and lock wait times of the taskcontroller workers and the queue depths
+	/// </summary>
+	/// <param name="sample"></param>
+	void UI_GetThreadStatistics(TaskController::Sample& sample);
+	/// <summary>
 	/// Returns the formids of all generations in this session
 	/// </summary>
 	/// <param name="generations"></param>
@@ -254,7 +254,8 @@ public:
 	static bool EndCheck(std::shared_ptr<SessionData> sessiondata, bool generationEnded = false);
 
 	/// <summary>
-	/// Attempts to free up as much memory as possible
+	/// Frees memory of forms. Above the memory limit all inputs are freed, otherwise inputs are freed cheapest to
+	/// regenerate first until the soft limit is reached, keeping the regeneration cache
 	/// </summary>
 	/// <param name="sessiondata"></param>
 	static void ReclaimMemory(std::shared_ptr<SessionData> sessiondata);
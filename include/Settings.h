@@ -38,6 +38,7 @@ public:
 	static inline bool _debug = false;
 	static inline bool _updateGrammar = false;
 	static inline bool _doNotLoadExclusionTree = false;
+	static inline bool _recover = false;
 	static inline bool _clearTasks = false;
 	static inline bool _consoleUI = false;
 	static inline bool _saveStatus = false;
@@ -65,7 +66,7 @@ class Settings : public Form
 {
 private:
 	bool initialized = false;
-	const int32_t classversion = 0x5;
+	const int32_t classversion = 0x10;
 	/// <summary>
 	/// skip reading from savefile
 	/// </summary>
@@ -226,6 +227,33 @@ public:
 		/// </summary>
 		int32_t numAllThreads = 0;
 		const char* numAllThreads_NAME = "NumberOfAllThreads";
+
+		/// <summary>
+		/// maximum time the callback of a finished test may wait before being executed [in microseconds]
+		/// [set to 0 to disable]
+		/// </summary>
+		int64_t testCallbackDeadline = 50000;
+		const char* testCallbackDeadline_NAME = "TestCallbackDeadline";
+
+		/// <summary>
+		/// interval in which worker statistics and queue depths are sampled [in milliseconds]
+		/// [set to 0 to disable]
+		/// </summary>
+		int64_t statisticsInterval = 1000;
+		const char* statisticsInterval_NAME = "StatisticsInterval";
+
+		/// <summary>
+		/// number of samples kept in memory
+		/// </summary>
+		int32_t statisticsHistory = 300;
+		const char* statisticsHistory_NAME = "StatisticsHistory";
+
+		/// <summary>
+		/// file samples are written to, files ending in .json receive json lines, other files csv
+		/// [leave empty to disable]
+		/// </summary>
+		std::string statisticsDumpPath = "";
+		const char* statisticsDumpPath_NAME = "StatisticsDumpPath";
 	};
 
 	Controller controller;
@@ -274,6 +302,13 @@ public:
 		std::chrono::milliseconds memory_sweep_period = std::chrono::milliseconds(10000);
 		const char* memory_sweep_period_NAME = "MemorySweepPeriod";
 
+		/// <summary>
+		/// memory in MB kept for the inputs that are the most expensive to regenerate and are used most often as
+		/// parents of regenerated inputs, when memory is freed
+		/// </summary>
+		int64_t memory_regeneration_cache = 128;
+		const char* memory_regeneration_cache_NAME = "MemoryRegenerationCache";
+
 		/// <summary>
 		/// period of the execution handler
 		/// </summary>
@@ -329,7 +364,7 @@ public:
 		std::string savename = "USS Enterprise";
 		const char* savename_NAME = "SaveName";
 		/// <summary>
-		/// compression level for LZMA compression
+		/// compression level for the codec used for save files [LZMA: 0-9, zstd: 1-22]
 		/// set to -1 to disable compression
 		/// </summary>
 		int32_t compressionLevel = -1;
@@ -351,6 +386,27 @@ public:
 		/// </summary>
 		int32_t createFullSaveEvery = 0;
 		const char* createFullSaveEvery_NAME = "CreateFullSaveEverySaves";
+		/// <summary>
+		/// Saves serialize all records into memory while the session is frozen, and compress and write them while
+		/// the session continues. The task queues are saved while frozen, like in every other save
+		/// </summary>
+		bool compressAfterThaw = false;
+		const char* compressAfterThaw_NAME = "CompressAfterThaw";
+		/// <summary>
+		/// Codec used to compress save files [1 = LZMA, 2 = zstd, 3 = zstd with a dictionary trained on the records of the save]
+		/// </summary>
+		int32_t compressionCodec = 2;
+		const char* compressionCodec_NAME = "CompressionCodec";
+		/// <summary>
+		/// Saves after the first full save only append the changed forms to a journal
+		/// </summary>
+		bool journal = false;
+		const char* journal_NAME = "Journal";
+		/// <summary>
+		/// Number of journal segments after which the journal is merged into a new full save in the background
+		/// </summary>
+		int32_t journalCompactSegments = 16;
+		const char* journalCompactSegments_NAME = "JournalCompactSegments";
 	};
 
 	SaveFiles saves;
@@ -491,6 +547,12 @@ public:
 		/// </summary>
 		int32_t budgetGenEnd = 0;
 		const char* budgetGenEnd_NAME = "Budget";
+
+		/// <summary>
+		/// [Standard mode] runs the tests of a level as coroutines instead of callback chains
+		/// </summary>
+		bool coroutines = false;
+		const char* coroutines_NAME = "Coroutines";
 	};
 
 	DeltaDebugging dd;
@@ -601,6 +663,33 @@ public:
 		/// </summary>
 		bool globalSources = false;
 		const char* globalSources_NAME = "UseGlobalSources";
+
+		/// <summary>
+		/// [true] Derivation trees of newly generated inputs are kept until memory is reclaimed
+		/// [false] Only the entries of new inputs are generated, their derivation trees are regenerated when they are
+		/// extended or delta debugged
+		/// </summary>
+		bool keepDerivationTrees = true;
+		const char* keepDerivationTrees_NAME = "KeepDerivationTrees";
+
+		/// <summary>
+		/// algorithm used to derive new inputs
+		/// [0] Grows sequences until the target length is reached and closes the remaining nodes at random
+		/// [1] Chooses expansions by the number of sequence nodes they can produce and closes the remaining nodes with
+		/// their smallest derivations, so that inputs meet their target length
+		/// [3] Chooses expansions like [1], but derives inputs from left to right and writes their entries while deriving
+		/// [2] cannot be set, it is chosen automatically for inputs derived with [1] above the parallelDerivationThreshold.
+		/// Other values are replaced by [1] when the settings are loaded
+		/// </summary>
+		int32_t derivationStrategy = 1;
+		const char* derivationStrategy_NAME = "DerivationStrategy";
+
+		/// <summary>
+		/// new inputs with at least this target length are derived in parallel, if they are derived with strategy [1].
+		/// [0] disables parallel derivation
+		/// </summary>
+		int32_t parallelDerivationThreshold = 10000;
+		const char* parallelDerivationThreshold_NAME = "ParallelDerivationThreshold";
 	};
 
 	Generation generation;
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Form.h"
+
+/// <summary>
+/// Append-only registry of strings with dense ids.
+///
+/// Strings are stored in arenas in the layout of the string hashmap record [id, length, characters], so saving
+/// copies entries verbatim and loading copies a whole record at once. Lookups are lock-free, insertion is sharded by
+/// hash, so only threads inserting strings with the same shard block each other.
+/// </summary>
+class StringTable
+{
+public:
+	StringTable(FormID firstid = 100);
+	StringTable(const StringTable&) = delete;
+	StringTable& operator=(const StringTable&) = delete;
+	~StringTable();
+
+	/// <summary>
+	/// Returns the id of [str], adding it if it isn't present yet
+	/// </summary>
+	FormID Intern(std::string_view str);
+	/// <summary>
+	/// Finds the id of [str] without adding it
+	/// </summary>
+	bool Find(std::string_view str, FormID& id);
+	/// <summary>
+	/// Finds the string with [id], the view stays valid until the table is cleared
+	/// </summary>
+	bool Get(FormID id, std::string_view& str);
+
+	/// <summary>
+	/// returns the id the next string will receive
+	/// </summary>
+	FormID GetNextID() { return _firstid + _next.load(std::memory_order_acquire); }
+	/// <summary>
+	/// returns the number of strings
+	/// </summary>
+	size_t Size() { return _count.load(std::memory_order_acquire); }
+	/// <summary>
+	/// returns the number of bytes allocated by the table
+	/// </summary>
+	size_t GetMemoryUsage();
+
+	/// <summary>
+	/// Appends a string hashmap record payload with all strings with an id of at least [minid] to [out], and returns
+	/// the id of the next string at the time of writing
+	/// </summary>
+	FormID Write(std::string& out, FormID minid = 0);
+	/// <summary>
+	/// Adds the strings of a string hashmap record payload. Strings with ids already in use are skipped
+	/// </summary>
+	bool Read(const char* data, size_t size);
+
+	/// <summary>
+	/// Removes all strings, must not run concurrently with other accesses. Ids of removed strings aren't reused
+	/// </summary>
+	void Clear();
+
+	static inline constexpr int32_t version = 0x1;
+
+private:
+	static inline constexpr size_t EntryHeader = 16;
+	static inline constexpr size_t ChunkSize = 1 << 16;
+	static inline constexpr size_t FirstSegmentBits = 10;
+	static inline constexpr size_t Shards = 16;
+
+	/// <summary>
+	/// open-addressing hash index, slots hold the upper half of the hash and the index of the string + 1
+	/// </summary>
+	struct Index
+	{
+		uint64_t mask = 0;
+		std::unique_ptr<std::atomic<uint64_t>[]> slots;
+	};
+
+	struct Arena
+	{
+		std::vector<std::unique_ptr<char[]>> chunks;
+		char* pos = nullptr;
+		char* end = nullptr;
+		size_t allocated = 0;
+
+		char* Allocate(size_t size);
+	};
+
+	struct Shard
+	{
+		std::mutex lock;
+		std::atomic<Index*> index = nullptr;
+		size_t count = 0;
+		/// <summary>
+		/// indexes replaced by larger ones, lock-free readers may still use them until the table is cleared
+		/// </summary>
+		std::vector<std::unique_ptr<Index>> retired;
+		Arena arena;
+	};
+
+	FormID _firstid = 100;
+	/// <summary>
+	/// index of the next string
+	/// </summary>
+	std::atomic<uint64_t> _next = 0;
+	std::atomic<size_t> _count = 0;
+
+	/// <summary>
+	/// entries by index, in segments of doubling size so that they never move
+	/// </summary>
+	std::array<std::atomic<std::atomic<const char*>*>, 64 - FirstSegmentBits> _segments;
+	std::mutex _segmentlock;
+	/// <summary>
+	/// arena for records read from savefiles
+	/// </summary>
+	Arena _bulk;
+
+	std::array<Shard, Shards> _shards;
+
+	static uint64_t Hash(std::string_view str);
+	static std::string_view GetString(const char* entry);
+	static FormID GetID(const char* entry);
+
+	std::atomic<const char*>* GetSlot(uint64_t index, bool create);
+	const char* GetEntry(uint64_t index);
+	/// <summary>
+	/// searches [index] for [str], returns the index of the string + 1 or 0
+	/// </summary>
+	uint64_t Lookup(Index* index, uint64_t hash, std::string_view str);
+	/// <summary>
+	/// adds the string with [index] to the hash index of [shard], which must be locked
+	/// </summary>
+	void Insert(Shard& shard, uint64_t hash, uint64_t index);
+	/// <summary>
+	/// publishes [entry] under [index] and inserts it into the hash index of its shard, [shard] must be locked
+	/// </summary>
+	bool Add(Shard& shard, uint64_t hash, uint64_t index, const char* entry);
+};
@@ -7,6 +7,10 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
 
 #include "Form.h"
 #include "Function.h"
@@ -16,6 +20,113 @@ class LoadResolver;
 class LoadResolverGrammar;
 class SessionData;
 
+/// <summary>
+/// Task queue that orders tasks by [priority, bypass, deadline, insertion order]
+/// </summary>
+class TaskQueue
+{
+public:
+	struct Entry
+	{
+		std::shared_ptr<Functions::BaseFunction> task;
+		/// <summary>
+		/// priority of the task
+		/// </summary>
+		int32_t priority = 0;
+		/// <summary>
+		/// whether the task was added to the front of the queue
+		/// </summary>
+		bool bypass = false;
+		/// <summary>
+		/// point in time at which the task should have started its execution
+		/// </summary>
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		/// <summary>
+		/// insertion order, front insertions are assigned decreasing negative numbers
+		/// </summary>
+		int64_t sequence = 0;
+
+		bool HasDeadline() const
+		{
+			return deadline != std::chrono::steady_clock::time_point::max();
+		}
+	};
+
+private:
+	std::deque<Entry> _queue;
+	int64_t _sequenceBack = 0;
+	int64_t _sequenceFront = -1;
+
+	/// <summary>
+	/// returns whether [lhs] is to be executed before [rhs]
+	/// </summary>
+	static bool Before(const Entry& lhs, const Entry& rhs)
+	{
+		if (lhs.priority != rhs.priority)
+			return lhs.priority > rhs.priority;
+		if (lhs.bypass != rhs.bypass)
+			return lhs.bypass;
+		if (lhs.deadline != rhs.deadline)
+			return lhs.deadline < rhs.deadline;
+		return lhs.sequence < rhs.sequence;
+	}
+
+	Entry MakeEntry(std::shared_ptr<Functions::BaseFunction> task, bool bypass)
+	{
+		Entry entry;
+		entry.task = task;
+		entry.priority = (int32_t)task->GetPriority();
+		entry.bypass = bypass;
+		auto deadline = task->GetDeadline();
+		if (deadline.count() > 0)
+			entry.deadline = std::chrono::steady_clock::now() + deadline;
+		return entry;
+	}
+
+	void Insert(Entry&& entry)
+	{
+		// fast paths: most tasks share the same priority and have no deadline, so they
+		// either belong at the back [regular] or at the front [bypass]
+		if (_queue.empty() || !Before(entry, _queue.back()))
+			_queue.push_back(std::move(entry));
+		else if (Before(entry, _queue.front()))
+			_queue.push_front(std::move(entry));
+		else
+			_queue.insert(std::upper_bound(_queue.begin(), _queue.end(), entry, Before), std::move(entry));
+	}
+
+public:
+	void push_back(std::shared_ptr<Functions::BaseFunction> task)
+	{
+		Entry entry = MakeEntry(task, false);
+		entry.sequence = _sequenceBack++;
+		Insert(std::move(entry));
+	}
+
+	void push_front(std::shared_ptr<Functions::BaseFunction> task)
+	{
+		Entry entry = MakeEntry(task, true);
+		entry.sequence = _sequenceFront--;
+		Insert(std::move(entry));
+	}
+
+	std::shared_ptr<Functions::BaseFunction>& front() { return _queue.front().task; }
+	const Entry& front_entry() const { return _queue.front(); }
+	void pop_front() { _queue.pop_front(); }
+	bool empty() const { return _queue.empty(); }
+	size_t size() const { return _queue.size(); }
+	auto begin() { return _queue.begin(); }
+	auto end() { return _queue.end(); }
+
+	/// <summary>
+	/// returns whether the first task in the queue has exceeded its deadline
+	/// </summary>
+	bool FrontOverdue(std::chrono::steady_clock::time_point now) const
+	{
+		return !_queue.empty() && _queue.front().deadline < now;
+	}
+};
+
 class TaskController : public Form
 {
 public:
@@ -26,7 +137,70 @@ public:
 		Waiting
 	};
 
+	/// <summary>
+	/// Accumulated timings of a single worker thread [in nanoseconds]
+	/// </summary>
+	struct WorkerSample
+	{
+		/// <summary>
+		/// time spent executing tasks
+		/// </summary>
+		int64_t busy = 0;
+		/// <summary>
+		/// time spent waiting for new tasks
+		/// </summary>
+		int64_t idle = 0;
+		/// <summary>
+		/// time spent waiting for queue locks
+		/// </summary>
+		int64_t lockwait = 0;
+		/// <summary>
+		/// longest wall time of a single task
+		/// </summary>
+		int64_t maxtask = 0;
+		/// <summary>
+		/// number of executed tasks
+		/// </summary>
+		uint64_t tasks = 0;
+	};
+
+	/// <summary>
+	/// Snapshot of the worker statistics and queue depths at a point in time
+	/// </summary>
+	struct Sample
+	{
+		std::chrono::steady_clock::time_point time;
+		uint64_t completedjobs = 0;
+		int32_t waitingLight = 0;
+		int32_t waitingMedium = 0;
+		int32_t waitingHeavy = 0;
+		std::vector<WorkerSample> workers;
+	};
+
 private:
+	/// <summary>
+	/// Statistics written by a single worker thread, aligned to avoid false sharing between workers
+	/// </summary>
+	struct alignas(64) WorkerStatistics
+	{
+		std::atomic<int64_t> busy = 0;
+		std::atomic<int64_t> idle = 0;
+		std::atomic<int64_t> lockwait = 0;
+		std::atomic<int64_t> maxtask = 0;
+		std::atomic<uint64_t> tasks = 0;
+		/// <summary>
+		/// end of the last task or start of the thread, relative to the start time of the statistics. While the worker
+		/// executes a task it is [NotWaiting], so that samples can add the idle time of waiting workers
+		/// </summary>
+		std::atomic<int64_t> waitingSince = 0;
+		/// <summary>
+		/// lock wait time of the current iteration, only written by the worker
+		/// </summary>
+		std::atomic<int64_t> currentlockwait = 0;
+
+		static constexpr int64_t NotWaiting = -1;
+	};
+
 	const int32_t classversion = 0x2;
 
 	friend class LoadResolver;
@@ -56,6 +230,41 @@ private:
 	/// <param name="number"></param>
 	void InternalLoop_SingleThread(int32_t number);
 
+	/// <summary>
+	/// Removes the first task from [queue] and updates the deadline statistics. [queue] must be locked
+	/// </summary>
+	/// <param name="queue"></param>
+	/// <returns></returns>
+	std::shared_ptr<Functions::BaseFunction> TakeTask(TaskQueue& queue);
+
+	/// <summary>
+	/// Acquires the lock of [guard] and records the time spent waiting for it
+	/// </summary>
+	/// <param name="guard"></param>
+	/// <param name="number"></param>
+	void LockQueue(std::unique_lock<std::mutex>& guard, int32_t number);
+	/// <summary>
+	/// Executes [task] on worker [number] and updates the worker statistics
+	/// </summary>
+	/// <param name="task"></param>
+	/// <param name="number"></param>
+	void ExecuteTask(std::shared_ptr<Functions::BaseFunction>& task, int32_t number);
+	/// <summary>
+	/// Allocates the status and statistics entries of [numthreads] worker threads
+	/// </summary>
+	/// <param name="numthreads"></param>
+	void InitWorkerStatistics(int32_t numthreads);
+
+	/// <summary>
+	/// Periodically records samples and writes them to the dump file
+	/// </summary>
+	void InternalLoop_Statistics();
+	/// <summary>
+	/// Writes [sample] to the statistics dump file
+	/// </summary>
+	/// <param name="sample"></param>
+	void DumpSample(Sample& sample);
+
 	/// <summary>
 	/// shared pointer to session
 	/// </summary>
@@ -88,15 +297,15 @@ private:
 	/// <summary>
 	/// light queue, tasks will be handled before medium and regular tasks if available
 	/// </summary>
-	std::deque<std::shared_ptr<Functions::BaseFunction>> _tasks_light;
+	TaskQueue _tasks_light;
 	/// <summary>
 	/// medium queue, tasks will be handled before regular tasks if available
 	/// </summary>
-	std::deque<std::shared_ptr<Functions::BaseFunction>> _tasks_medium;
+	TaskQueue _tasks_medium;
 	/// <summary>
-	/// regular queue, tasks will be handled first come first serve
+	/// regular queue, tasks will be handled by priority and deadline, otherwise first come first serve
 	/// </summary>
-	std::deque<std::shared_ptr<Functions::BaseFunction>> _tasks;
+	TaskQueue _tasks;
 	/// <summary>
 	/// locks access to _tasks
 	/// </summary>
@@ -114,6 +323,53 @@ private:
 	/// </summary>
 	std::atomic<uint64_t> _completedjobs;
 	/// <summary>
+	/// number of executed tasks with a deadline, per FunctionType
+	/// </summary>
+	std::atomic<uint64_t> _deadlineTasks[3] = { 0, 0, 0 };
+	/// <summary>
+	/// number of tasks that started after their deadline, per FunctionType
+	/// </summary>
+	std::atomic<uint64_t> _missedDeadlines[3] = { 0, 0, 0 };
+	/// <summary>
+	/// maximum time a task started after its deadline, per FunctionType [in nanoseconds]
+	/// </summary>
+	std::atomic<int64_t> _maxLateness[3] = { 0, 0, 0 };
+	/// <summary>
+	/// per-worker timings
+	/// </summary>
+	std::unique_ptr<WorkerStatistics[]> _workerStats;
+	int32_t _workerStatsCount = 0;
+	/// <summary>
+	/// disables the collection of worker timings
+	/// </summary>
+	bool _disableStatistics = false;
+	/// <summary>
+	/// time the controller was started
+	/// </summary>
+	std::chrono::steady_clock::time_point _startTime = std::chrono::steady_clock::now();
+	/// <summary>
+	/// recorded samples, oldest first
+	/// </summary>
+	std::deque<Sample> _samples;
+	/// <summary>
+	/// maximum number of samples kept in [_samples]
+	/// </summary>
+	size_t _samplesMax = 0;
+	std::mutex _samplesLock;
+	/// <summary>
+	/// interval between two recorded samples
+	/// </summary>
+	std::chrono::milliseconds _samplesInterval = std::chrono::milliseconds(0);
+	/// <summary>
+	/// file samples are written to, [.json] files receive one json object per line, other files csv
+	/// </summary>
+	std::string _samplesDumpPath;
+	std::ofstream _samplesDump;
+	bool _samplesDumpJson = false;
+	bool _terminateStatistics = false;
+	std::condition_variable _conditionStatistics;
+	std::thread _statisticsThread;
+	/// <summary>
 	/// current thread status
 	/// </summary>
 	std::vector<ThreadStatus> _status;
@@ -370,6 +626,33 @@ public:
 	/// </summary>
 	inline void SetDisableLua() { _disableLua = true; }
 
+	/// <summary>
+	/// Disables the collection of worker timings. Must be called before the controller is started
+	/// </summary>
+	inline void SetDisableStatistics() { _disableStatistics = true; }
+
+	/// <summary>
+	/// Starts periodic sampling of the worker statistics and queue depths
+	/// </summary>
+	/// <param name="interval">time between two samples</param>
+	/// <param name="history">number of samples that are kept in memory</param>
+	/// <param name="dumppath">file the samples are written to, [.json] for json lines, otherwise csv [empty to disable]</param>
+	void StartStatistics(std::chrono::milliseconds interval, size_t history, std::string dumppath);
+	/// <summary>
+	/// Stops periodic sampling
+	/// </summary>
+	void StopStatistics();
+	/// <summary>
+	/// Returns a snapshot of the current worker statistics and queue depths
+	/// </summary>
+	/// <returns></returns>
+	Sample GetSample();
+	/// <summary>
+	/// Returns the periodically recorded samples, oldest first
+	/// </summary>
+	/// <param name="samples"></param>
+	void GetSamples(std::vector<Sample>& samples);
+
 	/// <summary>
 	/// Returns the number of completed jobs
 	/// </summary>
@@ -384,6 +667,25 @@ public:
 	int32_t GetWaitingMediumJobs();
 	int32_t GetWaitingHeavyJobs();
 
+	/// <summary>
+	/// Returns the number of executed tasks of the given type that had a deadline
+	/// </summary>
+	/// <param name="type"></param>
+	/// <returns></returns>
+	uint64_t GetDeadlineTasks(Functions::FunctionType type);
+	/// <summary>
+	/// Returns the number of executed tasks of the given type that started after their deadline
+	/// </summary>
+	/// <param name="type"></param>
+	/// <returns></returns>
+	uint64_t GetMissedDeadlines(Functions::FunctionType type);
+	/// <summary>
+	/// Returns the maximum time a task of the given type started after its deadline
+	/// </summary>
+	/// <param name="type"></param>
+	/// <returns></returns>
+	std::chrono::nanoseconds GetMaxDeadlineLateness(Functions::FunctionType type);
+
 	std::pair<bool, uint64_t> IsActive();
 	int64_t Working();
 
@@ -367,6 +367,8 @@ namespace Functions
 		uint64_t GetType() override { return 'TEST'; }
 
 		FunctionType GetFunctionType() override { return FunctionType::Light; }
+		FunctionPriority GetPriority() override { return FunctionPriority::High; }
+		std::chrono::nanoseconds GetDeadline() override;
 
 		virtual std::shared_ptr<BaseFunction> DeepCopy() override;
 
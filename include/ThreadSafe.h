@@ -7,6 +7,11 @@
 #include <Threading.h>
 #include <deque>
 #include <ranges>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <iterator>
+#include <cstdint>
 
 template <typename T>
 class TSQueue
@@ -24,14 +29,16 @@ public:
 		locked.clear(std::memory_order_release);
 	}
 
-	void Pop()
+	std::optional<T> Pop()
 	{
 		while (locked.test_and_set(std::memory_order_acquire)) {
 			;
 		}
 		std::optional<T> val = _queue.empty() ? std::optional<T>() : std::optional<T>(_queue.front());
-		_queue.pop();
+		if (val)
+			_queue.pop();
 		locked.clear(std::memory_order_release);
+		return val;
 	}
 
 	bool Empty()
@@ -579,3 +586,436 @@ public:
 		}
 	}
 };
+
+/// <summary>
+/// Bounded lock-free multi-producer multi-consumer queue.
+/// The capacity is rounded up to the next power of two.
+/// </summary>
+template <typename T>
+class TSRingQueue
+{
+	struct alignas(64) Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> _buffer;
+	size_t _mask = 0;
+	alignas(64) std::atomic<size_t> _enqueue = 0;
+	alignas(64) std::atomic<size_t> _dequeue = 0;
+
+public:
+	TSRingQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		_buffer = std::make_unique<Cell[]>(size);
+		_mask = size - 1;
+		for (size_t i = 0; i < size; i++)
+			_buffer[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	TSRingQueue(const TSRingQueue&) = delete;
+	TSRingQueue& operator=(const TSRingQueue&) = delete;
+
+	/// <summary>
+	/// Adds [val] to the end of the queue, returns false if the queue is full
+	/// </summary>
+	bool Push(T val)
+	{
+		Cell* cell;
+		size_t pos = _enqueue.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &_buffer[pos & _mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+			if (dif == 0) {
+				if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (dif < 0)
+				return false;
+			else
+				pos = _enqueue.load(std::memory_order_relaxed);
+		}
+		cell->value = std::move(val);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// <summary>
+	/// Removes and returns the first element of the queue, if there is one
+	/// </summary>
+	std::optional<T> Pop()
+	{
+		Cell* cell;
+		size_t pos = _dequeue.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &_buffer[pos & _mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (dif == 0) {
+				if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			} else if (dif < 0)
+				return std::optional<T>();
+			else
+				pos = _dequeue.load(std::memory_order_relaxed);
+		}
+		std::optional<T> val = std::move(cell->value);
+		// release resources held by the element
+		cell->value = T();
+		cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+		return val;
+	}
+
+	/// <summary>
+	/// Returns whether the queue is empty [approximation under concurrent access]
+	/// </summary>
+	bool Empty()
+	{
+		return Size() == 0;
+	}
+
+	/// <summary>
+	/// Returns the number of elements in the queue [approximation under concurrent access]
+	/// </summary>
+	size_t Size()
+	{
+		size_t dequeue = _dequeue.load(std::memory_order_relaxed);
+		size_t enqueue = _enqueue.load(std::memory_order_relaxed);
+		return enqueue > dequeue ? enqueue - dequeue : 0;
+	}
+
+	size_t Capacity()
+	{
+		return _mask + 1;
+	}
+};
+
+/// <summary>
+/// Unbounded multi-producer single-consumer queue made of fixed-size segments.
+/// Producers never block each other, Pop may only be called by one thread at a time.
+/// </summary>
+template <typename T, size_t SegmentSize = 1024>
+class TSSegmentedQueue
+{
+	struct Slot
+	{
+		std::atomic<bool> ready = false;
+		std::optional<T> value;
+	};
+
+	struct Segment
+	{
+		std::atomic<Segment*> next = nullptr;
+		alignas(64) std::atomic<size_t> reserved = 0;
+		Slot slots[SegmentSize];
+	};
+
+	alignas(64) std::atomic<Segment*> _tail;
+	alignas(64) std::atomic<int64_t> _producers = 0;
+	alignas(64) std::atomic<size_t> _size = 0;
+	// consumer only
+	alignas(64) Segment* _head;
+	size_t _headIndex = 0;
+	/// <summary>
+	/// consumed segments that may still be accessed by producers
+	/// </summary>
+	std::vector<Segment*> _retired;
+
+	void FreeRetired()
+	{
+		// producers increment [_producers] before reading the tail, and the tail has moved past
+		// all retired segments, so if no producer is active no one can hold a retired segment
+		if (_retired.empty() || _producers.load() != 0)
+			return;
+		for (Segment* segment : _retired)
+			delete segment;
+		_retired.clear();
+	}
+
+public:
+	TSSegmentedQueue()
+	{
+		_head = new Segment();
+		_tail.store(_head);
+	}
+
+	TSSegmentedQueue(const TSSegmentedQueue&) = delete;
+	TSSegmentedQueue& operator=(const TSSegmentedQueue&) = delete;
+
+	~TSSegmentedQueue()
+	{
+		Segment* segment = _head;
+		while (segment) {
+			Segment* next = segment->next.load();
+			delete segment;
+			segment = next;
+		}
+		for (Segment* retired : _retired)
+			delete retired;
+	}
+
+	/// <summary>
+	/// Adds [val] to the end of the queue
+	/// </summary>
+	void Push(T val)
+	{
+		_producers.fetch_add(1);
+		while (true) {
+			Segment* segment = _tail.load();
+			size_t index = segment->reserved.fetch_add(1, std::memory_order_relaxed);
+			if (index < SegmentSize) {
+				segment->slots[index].value.emplace(std::move(val));
+				segment->slots[index].ready.store(true, std::memory_order_release);
+				break;
+			}
+			// segment is full, make sure there is a next segment and advance the tail
+			Segment* next = segment->next.load(std::memory_order_acquire);
+			if (next == nullptr) {
+				Segment* created = new Segment();
+				if (segment->next.compare_exchange_strong(next, created))
+					next = created;
+				else
+					delete created;
+			}
+			_tail.compare_exchange_strong(segment, next);
+		}
+		_size.fetch_add(1, std::memory_order_relaxed);
+		_producers.fetch_sub(1);
+	}
+
+	/// <summary>
+	/// Removes and returns the first element of the queue, if there is one. Must only be called by one thread at a time
+	/// </summary>
+	std::optional<T> Pop()
+	{
+		if (_headIndex == SegmentSize) {
+			Segment* next = _head->next.load(std::memory_order_acquire);
+			if (next == nullptr)
+				return std::optional<T>();
+			// make sure new producers cannot pick up the consumed segment
+			Segment* expected = _head;
+			_tail.compare_exchange_strong(expected, next);
+			_retired.push_back(_head);
+			_head = next;
+			_headIndex = 0;
+		}
+		FreeRetired();
+		Slot& slot = _head->slots[_headIndex];
+		if (!slot.ready.load(std::memory_order_acquire))
+			return std::optional<T>();
+		std::optional<T> val = std::move(slot.value);
+		slot.value.reset();
+		_headIndex++;
+		_size.fetch_sub(1, std::memory_order_relaxed);
+		return val;
+	}
+
+	bool Empty()
+	{
+		return _size.load(std::memory_order_relaxed) == 0;
+	}
+
+	size_t Size()
+	{
+		return _size.load(std::memory_order_relaxed);
+	}
+};
+
+/// <summary>
+/// Concurrent hash set of forms keyed by their FormID. The set is split into independently
+/// locked shards, so that concurrent accesses to different forms rarely contend.
+/// Iteration is not synchronized, like ts_set, and must not happen concurrently to modifications.
+/// </summary>
+template <class T, size_t Shards = 64>
+class ts_formid_set
+{
+	struct alignas(64) Shard
+	{
+		std::atomic_flag flag = ATOMIC_FLAG_INIT;
+		std::unordered_map<uint64_t, std::shared_ptr<T>> map;
+	};
+
+	std::unique_ptr<Shard[]> _shards = std::make_unique<Shard[]>(Shards);
+	std::atomic<size_t> _size = 0;
+
+	static size_t ShardIndex(uint64_t formid)
+	{
+		// formids are handed out sequentially, so mix the bits before choosing a shard
+		formid ^= formid >> 33;
+		formid *= 0xff51afd7ed558ccdULL;
+		formid ^= formid >> 33;
+		return (size_t)(formid % Shards);
+	}
+
+public:
+	class iterator
+	{
+		Shard* _shards = nullptr;
+		size_t _shard = Shards;
+		typename std::unordered_map<uint64_t, std::shared_ptr<T>>::iterator _itr;
+
+		void Skip()
+		{
+			while (_shard < Shards && _itr == _shards[_shard].map.end()) {
+				_shard++;
+				if (_shard < Shards)
+					_itr = _shards[_shard].map.begin();
+			}
+		}
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::shared_ptr<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::shared_ptr<T>*;
+		using reference = std::shared_ptr<T>&;
+
+		iterator() {}
+		iterator(Shard* shards, size_t shard) :
+			_shards(shards), _shard(shard)
+		{
+			if (_shard < Shards) {
+				_itr = _shards[_shard].map.begin();
+				Skip();
+			}
+		}
+
+		std::shared_ptr<T>& operator*() { return _itr->second; }
+		std::shared_ptr<T>* operator->() { return &_itr->second; }
+
+		iterator& operator++()
+		{
+			_itr++;
+			Skip();
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator tmp = *this;
+			++(*this);
+			return tmp;
+		}
+
+		bool operator==(const iterator& other) const
+		{
+			if (_shard >= Shards || other._shard >= Shards)
+				return _shard >= Shards && other._shard >= Shards;
+			return _shard == other._shard && _itr == other._itr;
+		}
+	};
+
+	ts_formid_set() {}
+
+	ts_formid_set(const ts_formid_set&) = delete;
+	ts_formid_set& operator=(const ts_formid_set&) = delete;
+
+	/// <summary>
+	/// Inserts [value], returns false if a form with the same FormID is already present
+	/// </summary>
+	bool insert(const std::shared_ptr<T>& value)
+	{
+		if (!value)
+			return false;
+		uint64_t formid = value->GetFormID();
+		Shard& shard = _shards[ShardIndex(formid)];
+		SpinlockA guard(shard.flag);
+		bool inserted = shard.map.insert({ formid, value }).second;
+		if (inserted)
+			_size.fetch_add(1, std::memory_order_relaxed);
+		return inserted;
+	}
+
+	/// <summary>
+	/// Removes the form with the given FormID, returns the number of removed elements
+	/// </summary>
+	size_t erase(uint64_t formid)
+	{
+		Shard& shard = _shards[ShardIndex(formid)];
+		SpinlockA guard(shard.flag);
+		size_t erased = shard.map.erase(formid);
+		if (erased)
+			_size.fetch_sub(erased, std::memory_order_relaxed);
+		return erased;
+	}
+
+	size_t erase(const std::shared_ptr<T>& value)
+	{
+		if (!value)
+			return 0;
+		return erase(value->GetFormID());
+	}
+
+	bool contains(uint64_t formid)
+	{
+		Shard& shard = _shards[ShardIndex(formid)];
+		SpinlockA guard(shard.flag);
+		return shard.map.contains(formid);
+	}
+
+	bool contains(const std::shared_ptr<T>& value)
+	{
+		if (!value)
+			return false;
+		return contains(value->GetFormID());
+	}
+
+	/// <summary>
+	/// Returns the form with the given FormID, or nullptr
+	/// </summary>
+	std::shared_ptr<T> find(uint64_t formid)
+	{
+		Shard& shard = _shards[ShardIndex(formid)];
+		SpinlockA guard(shard.flag);
+		auto itr = shard.map.find(formid);
+		if (itr != shard.map.end())
+			return itr->second;
+		return {};
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < Shards; i++) {
+			SpinlockA guard(_shards[i].flag);
+			_size.fetch_sub(_shards[i].map.size(), std::memory_order_relaxed);
+			_shards[i].map.clear();
+		}
+	}
+
+	bool empty()
+	{
+		return _size.load(std::memory_order_relaxed) == 0;
+	}
+
+	size_t size()
+	{
+		return _size.load(std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Calls [func] for every element, locking one shard at a time
+	/// </summary>
+	template <class Func>
+	void for_each(Func func)
+	{
+		for (size_t i = 0; i < Shards; i++) {
+			SpinlockA guard(_shards[i].flag);
+			for (auto& [formid, value] : _shards[i].map)
+				func(value);
+		}
+	}
+
+	iterator begin()
+	{
+		return iterator(_shards.get(), 0);
+	}
+
+	iterator end()
+	{
+		return iterator(_shards.get(), Shards);
+	}
+};
@@ -0,0 +1,131 @@
+#include "Checksum.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#	define CRC32C_X86
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#	endif
+#	include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#	define CRC32C_ARM
+#	include <arm_acle.h>
+#endif
+
+namespace Checksum
+{
+	namespace
+	{
+		/// <summary>
+		/// tables for slicing by 8 bytes at a time
+		/// </summary>
+		struct Tables
+		{
+			std::array<std::array<uint32_t, 256>, 8> table;
+
+			Tables()
+			{
+				for (uint32_t i = 0; i < 256; i++) {
+					uint32_t crc = i;
+					for (int bit = 0; bit < 8; bit++)
+						crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+					table[0][i] = crc;
+				}
+				for (uint32_t i = 0; i < 256; i++)
+					for (size_t t = 1; t < 8; t++)
+						table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+			}
+		};
+
+		uint32_t CRC32CSoftware(const unsigned char* data, size_t size, uint32_t crc)
+		{
+			static const Tables tables;
+			auto& t = tables.table;
+			while (size >= 8) {
+				uint64_t value = 0;
+				memcpy(&value, data, 8);
+				value ^= crc;
+				crc = t[7][value & 0xFF] ^ t[6][(value >> 8) & 0xFF] ^ t[5][(value >> 16) & 0xFF] ^ t[4][(value >> 24) & 0xFF] ^
+				      t[3][(value >> 32) & 0xFF] ^ t[2][(value >> 40) & 0xFF] ^ t[1][(value >> 48) & 0xFF] ^ t[0][value >> 56];
+				data += 8;
+				size -= 8;
+			}
+			while (size-- > 0)
+				crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+			return crc;
+		}
+
+#if defined(CRC32C_X86)
+#	if defined(__GNUC__) || defined(__clang__)
+		__attribute__((target("sse4.2")))
+#	endif
+		uint32_t CRC32CHardware(const unsigned char* data, size_t size, uint32_t crc)
+		{
+			uint64_t value = crc;
+			while (size >= 8) {
+				uint64_t word = 0;
+				memcpy(&word, data, 8);
+				value = _mm_crc32_u64(value, word);
+				data += 8;
+				size -= 8;
+			}
+			uint32_t result = (uint32_t)value;
+			while (size-- > 0)
+				result = _mm_crc32_u8(result, *data++);
+			return result;
+		}
+
+		bool DetectHardware()
+		{
+#	if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 20)) != 0;
+#	else
+			return __builtin_cpu_supports("sse4.2");
+#	endif
+		}
+#elif defined(CRC32C_ARM)
+		uint32_t CRC32CHardware(const unsigned char* data, size_t size, uint32_t crc)
+		{
+			while (size >= 8) {
+				uint64_t word = 0;
+				memcpy(&word, data, 8);
+				crc = __crc32cd(crc, word);
+				data += 8;
+				size -= 8;
+			}
+			while (size-- > 0)
+				crc = __crc32cb(crc, *data++);
+			return crc;
+		}
+
+		bool DetectHardware()
+		{
+			return true;
+		}
+#endif
+	}
+
+	bool IsHardwareAccelerated()
+	{
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+		static const bool hardware = DetectHardware();
+		return hardware;
+#else
+		return false;
+#endif
+	}
+
+	uint32_t CRC32C(const void* data, size_t size, uint32_t crc)
+	{
+		crc = ~crc;
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+		if (IsHardwareAccelerated())
+			return ~CRC32CHardware((const unsigned char*)data, size, crc);
+#endif
+		return ~CRC32CSoftware((const unsigned char*)data, size, crc);
+	}
+}
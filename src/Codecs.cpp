@@ -0,0 +1,199 @@
+#include "Codecs.h"
+#include "Logging.h"
+
+#include <limits>
+
+#include <lzma.h>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace Codecs
+{
+	class LZMACodec : public Codec
+	{
+	public:
+		LZMACodec(int32_t level, bool extreme) :
+			_preset((uint32_t)std::max(level, 0) | (extreme ? LZMA_PRESET_EXTREME : 0))
+		{}
+
+		CodecType GetType() override { return CodecType::LZMA; }
+		const char* GetName() override { return "LZMA"; }
+
+		bool Compress(const char* in, size_t length, std::string& out) override
+		{
+			out.resize(lzma_stream_buffer_bound(length));
+			size_t outpos = 0;
+			lzma_ret ret = lzma_easy_buffer_encode(_preset, LZMA_CHECK_CRC64, nullptr, reinterpret_cast<const uint8_t*>(in), length, reinterpret_cast<uint8_t*>(out.data()), &outpos, out.size());
+			if (ret != LZMA_OK) {
+				logcritical("Error occured while encoding LZMA block, Code: {}", (int32_t)ret);
+				out.clear();
+				return false;
+			}
+			out.resize(outpos);
+			return true;
+		}
+
+		bool Decompress(const char* in, size_t length, char* out, size_t outlength) override
+		{
+			uint64_t memlimit = std::numeric_limits<uint64_t>::max();
+			size_t inpos = 0;
+			size_t outpos = 0;
+			lzma_ret ret = lzma_stream_buffer_decode(&memlimit, 0, nullptr, reinterpret_cast<const uint8_t*>(in), &inpos, length, reinterpret_cast<uint8_t*>(out), &outpos, outlength);
+			if (ret != LZMA_OK || outpos != outlength) {
+				logcritical("Error occured while decoding LZMA block, Code: {}", (int32_t)ret);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		uint32_t _preset;
+	};
+
+	class ZstdCodec : public Codec
+	{
+	public:
+		ZstdCodec(int32_t level) :
+			_level(std::min(std::max(level, 1), ZSTD_maxCLevel()))
+		{}
+
+		CodecType GetType() override { return CodecType::Zstd; }
+		const char* GetName() override { return "zstd"; }
+
+		bool Compress(const char* in, size_t length, std::string& out) override
+		{
+			out.resize(ZSTD_compressBound(length));
+			size_t ret = ZSTD_compress(out.data(), out.size(), in, length, _level);
+			if (ZSTD_isError(ret)) {
+				logcritical("Error occured while encoding zstd block: {}", ZSTD_getErrorName(ret));
+				out.clear();
+				return false;
+			}
+			out.resize(ret);
+			return true;
+		}
+
+		bool Decompress(const char* in, size_t length, char* out, size_t outlength) override
+		{
+			size_t ret = ZSTD_decompress(out, outlength, in, length);
+			if (ZSTD_isError(ret) || ret != outlength) {
+				logcritical("Error occured while decoding zstd block: {}", ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size mismatch");
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		int32_t _level;
+	};
+
+	class ZstdDictionaryCodec : public Codec
+	{
+	public:
+		ZstdDictionaryCodec(int32_t level, const std::string& dictionary)
+		{
+			level = std::min(std::max(level, 1), ZSTD_maxCLevel());
+			// digested dictionaries are read-only and can be shared by all threads
+			_cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), level);
+			_ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+		}
+		~ZstdDictionaryCodec()
+		{
+			if (_cdict)
+				ZSTD_freeCDict(_cdict);
+			if (_ddict)
+				ZSTD_freeDDict(_ddict);
+		}
+
+		bool Valid() { return _cdict != nullptr && _ddict != nullptr; }
+
+		CodecType GetType() override { return CodecType::ZstdDictionary; }
+		const char* GetName() override { return "zstd-dictionary"; }
+
+		bool Compress(const char* in, size_t length, std::string& out) override
+		{
+			ZSTD_CCtx* cctx = ZSTD_createCCtx();
+			out.resize(ZSTD_compressBound(length));
+			size_t ret = ZSTD_compress_usingCDict(cctx, out.data(), out.size(), in, length, _cdict);
+			ZSTD_freeCCtx(cctx);
+			if (ZSTD_isError(ret)) {
+				logcritical("Error occured while encoding zstd block: {}", ZSTD_getErrorName(ret));
+				out.clear();
+				return false;
+			}
+			out.resize(ret);
+			return true;
+		}
+
+		bool Decompress(const char* in, size_t length, char* out, size_t outlength) override
+		{
+			ZSTD_DCtx* dctx = ZSTD_createDCtx();
+			size_t ret = ZSTD_decompress_usingDDict(dctx, out, outlength, in, length, _ddict);
+			ZSTD_freeDCtx(dctx);
+			if (ZSTD_isError(ret) || ret != outlength) {
+				logcritical("Error occured while decoding zstd block: {}", ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size mismatch");
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		ZSTD_CDict* _cdict = nullptr;
+		ZSTD_DDict* _ddict = nullptr;
+	};
+
+	std::unique_ptr<Codec> CreateCodec(CodecType type, int32_t level, bool extreme, const std::string& dictionary)
+	{
+		switch (type) {
+		case CodecType::LZMA:
+			return std::make_unique<LZMACodec>(level, extreme);
+		case CodecType::Zstd:
+			return std::make_unique<ZstdCodec>(level);
+		case CodecType::ZstdDictionary:
+			{
+				if (dictionary.empty()) {
+					logcritical("Cannot create zstd codec without dictionary");
+					return nullptr;
+				}
+				auto codec = std::make_unique<ZstdDictionaryCodec>(level, dictionary);
+				if (!codec->Valid()) {
+					logcritical("Failed to load zstd dictionary of {} bytes", dictionary.size());
+					return nullptr;
+				}
+				return codec;
+			}
+		case CodecType::None:
+		default:
+			return nullptr;
+		}
+	}
+
+	bool TrainDictionary(const std::string& buffer, const std::vector<size_t>& samples, size_t capacity, std::string& dictionary)
+	{
+		dictionary.resize(capacity);
+		size_t ret = ZDICT_trainFromBuffer(dictionary.data(), capacity, buffer.data(), samples.data(), (unsigned)samples.size());
+		if (ZDICT_isError(ret)) {
+			logwarn("Failed to train zstd dictionary from {} samples: {}", samples.size(), ZDICT_getErrorName(ret));
+			dictionary.clear();
+			return false;
+		}
+		dictionary.resize(ret);
+		return true;
+	}
+
+	const char* ToString(CodecType type)
+	{
+		switch (type) {
+		case CodecType::None:
+			return "None";
+		case CodecType::LZMA:
+			return "LZMA";
+		case CodecType::Zstd:
+			return "zstd";
+		case CodecType::ZstdDictionary:
+			return "zstd-dictionary";
+		default:
+			return "Unknown";
+		}
+	}
+}
@@ -0,0 +1,480 @@
+#include "CompiledGrammar.h"
+#include "Logging.h"
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+namespace
+{
+	int64_t AddYield(int64_t lhs, int64_t rhs)
+	{
+		return std::min(lhs + rhs, CompiledGrammar::Unbounded);
+	}
+
+	int64_t MultiplyYield(int64_t count, int64_t yield)
+	{
+		if (yield == 0 || count == 0)
+			return 0;
+		return count >= CompiledGrammar::Unbounded / yield ? CompiledGrammar::Unbounded : count * yield;
+	}
+
+	/// <summary>
+	/// returns the character class flags of the terminal [identifier] as detected by trees saved before character
+	/// classes were recorded. The patterns used back then were bracket expressions, which match any identifier
+	/// containing one of their characters
+	/// </summary>
+	EnumType LegacyClassFlags(std::string_view identifier)
+	{
+		auto contains = [identifier](std::string_view characters) { return identifier.find_first_of(characters) != std::string_view::npos; };
+		if (!contains(":.*"))
+			return 0;
+		EnumType flags = GrammarNode::NodeFlags::TerminalCharClass;
+		if (contains(":asci"))
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAscii;
+		else if (contains(":alph"))
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAlpha;
+		else if (contains(":alnum"))
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric;
+		else if (contains(":digt"))
+			flags |= GrammarNode::NodeFlags::TerminalCharClassDigit;
+		return flags;
+	}
+
+	/// <summary>
+	/// returns the characters of the character class set in [flags], in the order they are drawn
+	/// </summary>
+	std::string ClassCharacters(EnumType flags, DerivationTree::CharacterClasses classes)
+	{
+		std::string characters;
+		auto range = [&characters](int32_t first, int32_t last) {
+			for (int32_t c = first; c <= last; c++)
+				characters.push_back((char)c);
+		};
+		if ((flags & GrammarNode::NodeFlags::TerminalCharClassAscii) > 0)
+			range(0x1, 0x7E);
+		else if (classes == DerivationTree::CharacterClasses::Legacy) {
+			// letters used to be offset from the start of the class instead of the start of the lowercase letters
+			if ((flags & GrammarNode::NodeFlags::TerminalCharClassAlpha) > 0) {
+				range(0x41, 0x41 + 25);
+				range(0x61 + 26, 0x61 + 52);
+			} else if ((flags & GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric) > 0) {
+				range(0x41, 0x41 + 25);
+				range(0x61 + 26, 0x61 + 51);
+				range(0x30 + 52, 0x30 + 62);
+			} else if ((flags & GrammarNode::NodeFlags::TerminalCharClassDigit) > 0)
+				range('0', '9');
+		} else if ((flags & GrammarNode::NodeFlags::TerminalCharClassAlpha) > 0) {
+			range('A', 'Z');
+			range('a', 'z');
+		} else if ((flags & GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric) > 0) {
+			range('A', 'Z');
+			range('a', 'z');
+			range('0', '9');
+		} else if ((flags & GrammarNode::NodeFlags::TerminalCharClassDigit) > 0)
+			range('0', '9');
+		return characters;
+	}
+}
+
+std::shared_ptr<CompiledGrammar> CompiledGrammar::Compile(GrammarTree& tree)
+{
+	auto compiled = std::make_shared<CompiledGrammar>();
+	if (!tree._root)
+		return compiled;
+
+	// number the nodes reachable from the root in breadth-first order
+	std::vector<std::shared_ptr<GrammarNode>> nodes;
+	std::unordered_map<GrammarNode*, uint32_t> indexes;
+	auto add = [&nodes, &indexes](const std::shared_ptr<GrammarNode>& node) {
+		if (indexes.emplace(node.get(), (uint32_t)nodes.size()).second)
+			nodes.push_back(node);
+	};
+	add(tree._root);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		for (auto& expansion : nodes[i]->_expansions) {
+			for (auto& child : expansion->_nodes)
+				add(child);
+			if (expansion->IsRegex())
+				add(std::dynamic_pointer_cast<GrammarExpansionRegex>(expansion)->_node);
+		}
+	}
+
+	compiled->_root = 0;
+	compiled->_nodes.resize(nodes.size());
+	// the byte table of each character class is stored once, nodes refer to it by position and size
+	std::unordered_map<EnumType, std::pair<uint32_t, uint32_t>> alphabets[2];
+	auto alphabet = [&compiled, &alphabets](EnumType flags, DerivationTree::CharacterClasses classes) {
+		flags &= GrammarNode::NodeFlags::TerminalCharClassAscii | GrammarNode::NodeFlags::TerminalCharClassAlpha |
+		         GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric | GrammarNode::NodeFlags::TerminalCharClassDigit;
+		auto [itr, inserted] = alphabets[(uint32_t)classes].try_emplace(flags);
+		if (inserted) {
+			auto characters = ClassCharacters(flags, classes);
+			itr->second = { (uint32_t)compiled->_alphabet.size(), (uint32_t)characters.size() };
+			for (char c : characters)
+				compiled->_alphabet.push_back(DerivationTree::InternSymbol(std::string_view(&c, 1)));
+		}
+		return itr->second;
+	};
+	uint64_t maxid = 0;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		auto& gnode = nodes[i];
+		auto& node = compiled->_nodes[i];
+		node.id = gnode->_id;
+		node.type = gnode->_type;
+		node.flags = gnode->_flags;
+		maxid = std::max(maxid, gnode->_id);
+		if (gnode->_type == GrammarNode::NodeType::Terminal) {
+			node.symbol = DerivationTree::InternSymbol(gnode->_identifier);
+			const uint32_t tables = (uint32_t)DerivationTree::CharacterClasses::Tables;
+			const uint32_t legacy = (uint32_t)DerivationTree::CharacterClasses::Legacy;
+			if ((gnode->_flags & GrammarNode::NodeFlags::TerminalCharClass) > 0)
+				std::tie(node.alphabet[tables], node.alphabetSize[tables]) = alphabet(gnode->_flags, DerivationTree::CharacterClasses::Tables);
+			if (EnumType flags = LegacyClassFlags(gnode->_identifier); flags != 0)
+				std::tie(node.alphabet[legacy], node.alphabetSize[legacy]) = alphabet(flags, DerivationTree::CharacterClasses::Legacy);
+		}
+		node.expansions = (uint32_t)compiled->_expansions.size();
+		node.expansionCount = (uint32_t)gnode->_expansions.size();
+		for (auto& gexp : gnode->_expansions) {
+			Expansion expansion;
+			expansion.children = (uint32_t)compiled->_children.size();
+			expansion.childCount = (uint32_t)gexp->_nodes.size();
+			expansion.flags = gexp->_flags;
+			expansion.weight = gexp->_weight;
+			for (auto& child : gexp->_nodes)
+				compiled->_children.push_back(indexes[child.get()]);
+			if (gexp->IsRegex()) {
+				auto regex = std::dynamic_pointer_cast<GrammarExpansionRegex>(gexp);
+				expansion.regex = indexes[regex->_node.get()];
+				expansion.min = regex->_min;
+			}
+			compiled->_expansions.push_back(expansion);
+		}
+
+		// while growing sequences the expansion with the most sequence symbols is used, unless there are weighted
+		// ones, then the one with the highest weight. On ties the first one in scan direction wins
+		for (int32_t direction = 0; direction < 2; direction++) {
+			int32_t cnodes = 0;
+			float cweight = 0.f;
+			int32_t count = (int32_t)gnode->_expansions.size();
+			for (int32_t c = 0; c < count; c++) {
+				int32_t i = direction == 0 ? c : count - 1 - c;
+				auto& gexp = gnode->_expansions[i];
+				if (cnodes < gexp->_seqnonterminals && cweight == 0) {
+					cnodes = gexp->_seqnonterminals;
+					node.preferred[direction] = (uint32_t)i;
+				} else if (cweight < gexp->_weight) {
+					cnodes = gexp->_seqnonterminals;
+					cweight = gexp->_weight;
+					node.preferred[direction] = (uint32_t)i;
+				}
+			}
+		}
+
+		node.sequence = compiled->AddCandidates(node, [](const Expansion& exp) { return (exp.flags & GrammarNode::NodeFlags::ProduceSequence) != 0; });
+		node.final = compiled->AddCandidates(node, [](const Expansion& exp) { return (exp.flags & GrammarNode::NodeFlags::ProduceSequence) == 0; });
+		node.all = compiled->AddCandidates(node, [](const Expansion&) { return true; });
+	}
+
+	compiled->_index.assign(maxid + 1, None);
+	for (size_t i = 0; i < nodes.size(); i++)
+		compiled->_index[nodes[i]->_id] = (uint32_t)i;
+
+	compiled->ComputeYields();
+	return compiled;
+}
+
+void CompiledGrammar::ComputeYields()
+{
+	// the yield of a child includes the child itself if it is a sequence node
+	auto childMin = [this](uint32_t child) {
+		return AddYield(_nodes[child].minYield, _nodes[child].IsSequence() ? 1 : 0);
+	};
+	auto childMax = [this](uint32_t child) {
+		return AddYield(_nodes[child].maxYield, _nodes[child].IsSequence() ? 1 : 0);
+	};
+	auto expansionMin = [this, &childMin](const Expansion& expansion) {
+		if (expansion.regex != None)
+			return MultiplyYield(expansion.min, childMin(expansion.regex));
+		int64_t yield = 0;
+		for (uint32_t c = 0; c < expansion.childCount; c++)
+			yield = AddYield(yield, childMin(_children[expansion.children + c]));
+		return yield;
+	};
+	auto expansionMax = [this, &childMax](const Expansion& expansion) {
+		// repetitions aren't bounded
+		if (expansion.regex != None)
+			return childMax(expansion.regex) > 0 ? Unbounded : (int64_t)0;
+		int64_t yield = 0;
+		for (uint32_t c = 0; c < expansion.childCount; c++)
+			yield = AddYield(yield, childMax(_children[expansion.children + c]));
+		return yield;
+	};
+	auto expansionDepth = [this](const Expansion& expansion) {
+		uint64_t depth = 0;
+		if (expansion.regex != None) {
+			if (expansion.min > 0)
+				depth = _nodes[expansion.regex].minDepth;
+		} else {
+			for (uint32_t c = 0; c < expansion.childCount; c++)
+				depth = std::max(depth, (uint64_t)_nodes[_children[expansion.children + c]].minDepth);
+		}
+		return (uint32_t)std::min(depth + 1, (uint64_t)UINT32_MAX);
+	};
+
+	// nodes and expansions that contain a node as child, an occurrence per child so that repeated children are counted
+	// as often as they appear
+	std::vector<uint32_t> owners(_expansions.size());
+	std::vector<uint32_t> parentBegin(_nodes.size() + 1, 0);
+	std::vector<uint32_t> parents;
+	auto forChildren = [this](const Expansion& expansion, auto&& func) {
+		if (expansion.regex != None)
+			func(expansion.regex);
+		for (uint32_t c = 0; c < expansion.childCount; c++)
+			func(_children[expansion.children + c]);
+	};
+	for (uint32_t n = 0; n < (uint32_t)_nodes.size(); n++)
+		for (uint32_t i = 0; i < _nodes[n].expansionCount; i++) {
+			owners[_nodes[n].expansions + i] = n;
+			forChildren(_expansions[_nodes[n].expansions + i], [&parentBegin](uint32_t child) { parentBegin[child + 1]++; });
+		}
+	for (size_t n = 0; n < _nodes.size(); n++)
+		parentBegin[n + 1] += parentBegin[n];
+	parents.resize(parentBegin.back());
+	{
+		std::vector<uint32_t> fill(parentBegin.begin(), parentBegin.end() - 1);
+		for (uint32_t e = 0; e < (uint32_t)_expansions.size(); e++)
+			forChildren(_expansions[e], [&parents, &fill, e](uint32_t child) { parents[fill[child]++] = e; });
+	}
+
+	// Knuth's generalization of Dijkstra's algorithm: an expansion is evaluated once all of its children are final and
+	// the node with the smallest evaluated expansion is final next. Both the yield and the depth of an expansion are at
+	// least those of its children, so that the values taken from the queue never decrease. Repetitions without a
+	// minimum don't depend on their child
+	auto dependencies = [](const Expansion& expansion) {
+		if (expansion.regex != None)
+			return expansion.min > 0 ? (uint32_t)1 : (uint32_t)0;
+		return expansion.childCount;
+	};
+	auto shortest = [this, &owners, &parentBegin, &parents, &dependencies](auto&& value, auto&& considered, auto&& assign) {
+		using Value = std::invoke_result_t<decltype(value), const Expansion&>;
+		using Entry = std::pair<Value, uint32_t>;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		std::vector<uint32_t> missing(_expansions.size(), 0);
+		std::vector<bool> final(_nodes.size(), false);
+		for (uint32_t n = 0; n < (uint32_t)_nodes.size(); n++)
+			if (_nodes[n].expansionCount == 0)
+				queue.push({ Value(0), n });
+		for (uint32_t e = 0; e < (uint32_t)_expansions.size(); e++) {
+			if (!considered(_expansions[e]))
+				continue;
+			missing[e] = dependencies(_expansions[e]);
+			if (missing[e] == 0)
+				queue.push({ value(_expansions[e]), owners[e] });
+		}
+		while (!queue.empty()) {
+			auto [val, n] = queue.top();
+			queue.pop();
+			if (final[n])
+				continue;
+			final[n] = true;
+			assign(_nodes[n], val);
+			for (uint32_t p = parentBegin[n]; p < parentBegin[n + 1]; p++) {
+				uint32_t e = parents[p];
+				// unconsidered expansions and repetitions without minimum never wait on their children
+				if (missing[e] == 0)
+					continue;
+				if (--missing[e] == 0)
+					queue.push({ value(_expansions[e]), owners[e] });
+			}
+		}
+	};
+
+	// every node has a finite derivation since the grammar has been pruned
+	for (auto& node : _nodes)
+		node.minYield = node.expansionCount > 0 ? Unbounded : 0;
+	shortest(expansionMin, [](const Expansion&) { return true; }, [](Node& node, int64_t yield) { node.minYield = yield; });
+
+	// the smallest derivation only uses expansions with minimal yield, so that closing nodes with their cheapest
+	// expansion never adds more sequence nodes than needed
+	for (auto& node : _nodes)
+		node.minDepth = node.expansionCount > 0 ? UINT32_MAX : 0;
+	shortest(
+		expansionDepth, [this, &owners, &expansionMin](const Expansion& expansion) { return expansionMin(expansion) == _nodes[owners[&expansion - _expansions.data()]].minYield; },
+		[](Node& node, uint32_t depth) { node.minDepth = depth; });
+	for (auto& node : _nodes) {
+		for (uint32_t i = 0; i < node.expansionCount; i++) {
+			auto& expansion = _expansions[node.expansions + i];
+			if (expansionMin(expansion) == node.minYield && expansionDepth(expansion) == node.minDepth) {
+				node.cheapest = i;
+				break;
+			}
+		}
+	}
+
+	// maximal yields are computed per strongly connected component, children first. Within a component all nodes
+	// derive each other, so that they share the same maximal yield, unless one of its cycles adds sequence nodes with
+	// each pass, then the yield is unbounded
+	for (auto& node : _nodes)
+		node.maxYield = 0;
+	for (auto& component : FindComponents()) {
+		auto inComponent = [&component](uint32_t node) { return std::binary_search(component.begin(), component.end(), node); };
+		std::sort(component.begin(), component.end());
+		int64_t yield = 0;
+		bool cyclic = false;
+		for (uint32_t n : component) {
+			for (uint32_t i = 0; i < _nodes[n].expansionCount; i++) {
+				auto& expansion = _expansions[_nodes[n].expansions + i];
+				bool inner = false;
+				forChildren(expansion, [&inner, &inComponent](uint32_t child) { inner |= inComponent(child); });
+				if (inner)
+					cyclic = true;
+				else
+					yield = std::max(yield, expansionMax(expansion));
+			}
+		}
+		for (uint32_t n : component)
+			_nodes[n].maxYield = yield;
+		if (!cyclic)
+			continue;
+		// with all members set to the yield of the component, any cycle adding to it grows without bound
+		bool pumping = false;
+		for (uint32_t n : component)
+			for (uint32_t i = 0; i < _nodes[n].expansionCount && !pumping; i++) {
+				auto& expansion = _expansions[_nodes[n].expansions + i];
+				bool inner = false;
+				forChildren(expansion, [&inner, &inComponent](uint32_t child) { inner |= inComponent(child); });
+				if (inner && expansionMax(expansion) > yield)
+					pumping = true;
+			}
+		if (pumping)
+			for (uint32_t n : component)
+				_nodes[n].maxYield = Unbounded;
+	}
+
+	for (auto& expansion : _expansions) {
+		expansion.minYield = expansionMin(expansion);
+		expansion.maxYield = expansionMax(expansion);
+		expansion.minDepth = expansionDepth(expansion);
+	}
+}
+
+std::vector<std::vector<uint32_t>> CompiledGrammar::FindComponents() const
+{
+	// tarjan's algorithm without recursion, so that long chains of rules don't exhaust the stack
+	std::vector<std::vector<uint32_t>> components;
+	std::vector<uint32_t> index(_nodes.size(), None);
+	std::vector<uint32_t> lowlink(_nodes.size(), 0);
+	std::vector<bool> onstack(_nodes.size(), false);
+	std::vector<uint32_t> stack;
+	struct Frame
+	{
+		uint32_t node;
+		uint32_t expansion;
+		uint32_t child;
+	};
+	std::vector<Frame> frames;
+	uint32_t counter = 0;
+	// returns the next child of the frame, or None if all children have been visited
+	auto next = [this](Frame& frame) {
+		auto& node = _nodes[frame.node];
+		while (frame.expansion < node.expansionCount) {
+			auto& expansion = _expansions[node.expansions + frame.expansion];
+			uint32_t count = expansion.childCount + (expansion.regex != None ? 1 : 0);
+			if (frame.child < count) {
+				uint32_t c = frame.child++;
+				return c < expansion.childCount ? _children[expansion.children + c] : expansion.regex;
+			}
+			frame.expansion++;
+			frame.child = 0;
+		}
+		return None;
+	};
+	auto visit = [&](uint32_t node) {
+		index[node] = lowlink[node] = counter++;
+		stack.push_back(node);
+		onstack[node] = true;
+		frames.push_back({ node, 0, 0 });
+	};
+	for (uint32_t start = 0; start < (uint32_t)_nodes.size(); start++) {
+		if (index[start] != None)
+			continue;
+		visit(start);
+		while (!frames.empty()) {
+			uint32_t node = frames.back().node;
+			uint32_t child = next(frames.back());
+			if (child != None) {
+				if (index[child] == None)
+					visit(child);
+				else if (onstack[child])
+					lowlink[node] = std::min(lowlink[node], index[child]);
+				continue;
+			}
+			frames.pop_back();
+			if (!frames.empty())
+				lowlink[frames.back().node] = std::min(lowlink[frames.back().node], lowlink[node]);
+			if (lowlink[node] == index[node]) {
+				auto& component = components.emplace_back();
+				uint32_t member;
+				do {
+					member = stack.back();
+					stack.pop_back();
+					onstack[member] = false;
+					component.push_back(member);
+				} while (member != node);
+			}
+		}
+	}
+	return components;
+}
+
+CompiledGrammar::Candidates CompiledGrammar::AddCandidates(const Node& node, bool (*filter)(const Expansion&))
+{
+	Candidates candidates;
+	candidates.begin = (uint32_t)_candidates.size();
+	// the weights are summed in the same order as the choice scans them, so that the same targets select the same
+	// expansions
+	for (uint32_t i = 0; i < node.expansionCount; i++) {
+		auto& expansion = _expansions[node.expansions + i];
+		if (filter(expansion)) {
+			candidates.weight += expansion.weight;
+			_candidates.push_back(i);
+			_cumulative.push_back(candidates.weight);
+			candidates.count++;
+		}
+	}
+	return candidates;
+}
+
+uint32_t CompiledGrammar::Choose(const Candidates& candidates, float scale, std::mt19937& randan) const
+{
+	if (candidates.weight == 0.f) {
+		std::uniform_int_distribution<signed> dist(0, (int32_t)candidates.count - 1);
+		return _candidates[candidates.begin + dist(randan)];
+	}
+	std::uniform_int_distribution<signed> dist(0, 100000000);
+	// calc target weight and adjust for the total weight not being 1
+	float target = ((float)dist(randan) / 100000000.f) * scale;
+	// first candidate whose running weight reaches the target
+	auto begin = _cumulative.begin() + candidates.begin;
+	auto pos = (uint32_t)(std::lower_bound(begin, begin + candidates.count, target) - begin);
+	return _candidates[candidates.begin + std::min(pos, candidates.count - 1)];
+}
+
+uint32_t CompiledGrammar::GetSymbol(const Node& node, DerivationTree::CharacterClasses classes, std::mt19937& randan) const
+{
+	uint32_t size = node.alphabetSize[(uint32_t)classes];
+	if (size == 0)
+		return node.symbol;
+	std::uniform_int_distribution<signed> dist(0, (int32_t)size - 1);
+	return _alphabet[node.alphabet[(uint32_t)classes] + dist(randan)];
+}
+
+size_t CompiledGrammar::MemorySize() const
+{
+	return sizeof(CompiledGrammar) + _nodes.capacity() * sizeof(Node) + _expansions.capacity() * sizeof(Expansion) +
+	       _children.capacity() * sizeof(uint32_t) + _candidates.capacity() * sizeof(uint32_t) + _cumulative.capacity() * sizeof(float) +
+	       _alphabet.capacity() * sizeof(uint32_t) + _index.capacity() * sizeof(uint32_t);
+}
@@ -0,0 +1,353 @@
+#include "Coroutines.h"
+#include "BufferOperations.h"
+#include "Logging.h"
+#include "Utility.h"
+
+namespace Functions
+{
+	/// <summary>
+	/// Reports a coroutine callback restored from a savefile. The coroutine frame is not part of the save,
+	/// so the flow either is restarted by its owner or is lost.
+	/// </summary>
+	static void ReportRestored(const char* name, FormID owner)
+	{
+		if (owner == 0) {
+			logcritical("{}: A coroutine without owner has been saved while it was suspended, its flow cannot be resumed after loading.", name);
+		} else {
+			logdebug("{}: The flow of the saved coroutine is restarted by its owner {}.", name, Utility::GetHex(owner));
+		}
+	}
+
+	void CoroutineResumeCallback::Run()
+	{
+		// callbacks restored from a savefile do not have a coroutine attached, their owner resumes the flow
+		if (_handle) {
+			auto handle = std::exchange(_handle, nullptr);
+			handle.resume();
+		}
+	}
+
+	std::shared_ptr<BaseFunction> CoroutineResumeCallback::DeepCopy()
+	{
+		// a coroutine can only be resumed once, so copies do not receive the handle
+		auto ptr = std::make_shared<CoroutineResumeCallback>();
+		ptr->_type = _type;
+		ptr->_owner = _owner;
+		return dynamic_pointer_cast<BaseFunction>(ptr);
+	}
+
+	bool CoroutineResumeCallback::ReadData(std::istream* buffer, size_t& offset, size_t, LoadResolver*)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		return true;
+	}
+
+	bool CoroutineResumeCallback::ReadData(unsigned char* buffer, size_t& offset, size_t, LoadResolver*)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		return true;
+	}
+
+	bool CoroutineResumeCallback::WriteData(std::ostream* buffer, size_t& offset)
+	{
+		BaseFunction::WriteData(buffer, offset);
+		Buffer::Write(_owner, buffer, offset);  // +8
+		return true;
+	}
+
+	size_t CoroutineResumeCallback::GetLength()
+	{
+		return BaseFunction::GetLength() + 8;
+	}
+
+	void CoroutineResumeCallback::Dispose()
+	{
+		_handle = nullptr;
+	}
+
+	void CoroutineTaskCallback::Run()
+	{
+		if (_function)
+			_function->Run();
+		if (_handle) {
+			auto handle = std::exchange(_handle, nullptr);
+			handle.resume();
+		}
+	}
+
+	std::shared_ptr<BaseFunction> CoroutineTaskCallback::DeepCopy()
+	{
+		auto ptr = std::make_shared<CoroutineTaskCallback>();
+		if (_function)
+			ptr->_function = _function->DeepCopy();
+		ptr->_owner = _owner;
+		return dynamic_pointer_cast<BaseFunction>(ptr);
+	}
+
+	bool CoroutineTaskCallback::ReadData(std::istream* buffer, size_t& offset, size_t length, LoadResolver* resolver)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		bool hasfunction = Buffer::ReadBool(buffer, offset);
+		if (hasfunction)
+			_function = BaseFunction::Create(buffer, offset, length, resolver);
+		return true;
+	}
+
+	bool CoroutineTaskCallback::ReadData(unsigned char* buffer, size_t& offset, size_t length, LoadResolver* resolver)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		bool hasfunction = Buffer::ReadBool(buffer, offset);
+		if (hasfunction)
+			_function = BaseFunction::Create(buffer, offset, length, resolver);
+		return true;
+	}
+
+	bool CoroutineTaskCallback::WriteData(std::ostream* buffer, size_t& offset)
+	{
+		// the wrapped function is saved so that it is still executed after loading,
+		// the coroutine itself cannot be restored and is restarted by its owner
+		BaseFunction::WriteData(buffer, offset);
+		Buffer::Write(_owner, buffer, offset);           // +8
+		Buffer::Write((bool)_function, buffer, offset);  // +1
+		if (_function)
+			_function->WriteData(buffer, offset);
+		return true;
+	}
+
+	size_t CoroutineTaskCallback::GetLength()
+	{
+		return BaseFunction::GetLength() + 8 + 1 + (_function ? _function->GetLength() : 0);
+	}
+
+	void CoroutineTaskCallback::Dispose()
+	{
+		if (_function)
+			_function->Dispose();
+		_function.reset();
+		_handle = nullptr;
+	}
+
+	void CoroutineCompletionCallback::Run()
+	{
+		// if the coroutine is still suspending, it sees the completion and continues by itself
+		if (_status.exchange(2) == 1) {
+			// coroutine is suspended and waiting for us
+			auto handle = std::exchange(_handle, nullptr);
+			if (handle)
+				handle.resume();
+		}
+	}
+
+	std::shared_ptr<BaseFunction> CoroutineCompletionCallback::DeepCopy()
+	{
+		auto ptr = std::make_shared<CoroutineCompletionCallback>();
+		ptr->_type = _type;
+		ptr->_owner = _owner;
+		return dynamic_pointer_cast<BaseFunction>(ptr);
+	}
+
+	bool CoroutineCompletionCallback::ReadData(std::istream* buffer, size_t& offset, size_t, LoadResolver*)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		return true;
+	}
+
+	bool CoroutineCompletionCallback::ReadData(unsigned char* buffer, size_t& offset, size_t, LoadResolver*)
+	{
+		_owner = Buffer::ReadUInt64(buffer, offset);
+		ReportRestored(GetName(), _owner);
+		return true;
+	}
+
+	bool CoroutineCompletionCallback::WriteData(std::ostream* buffer, size_t& offset)
+	{
+		BaseFunction::WriteData(buffer, offset);
+		Buffer::Write(_owner, buffer, offset);  // +8
+		return true;
+	}
+
+	size_t CoroutineCompletionCallback::GetLength()
+	{
+		return BaseFunction::GetLength() + 8;
+	}
+
+	void CoroutineCompletionCallback::Dispose()
+	{
+		_handle = nullptr;
+	}
+}
+
+namespace Coroutines
+{
+	void Task::promise_type::unhandled_exception()
+	{
+		state->exception = std::current_exception();
+		try {
+			std::rethrow_exception(state->exception);
+		} catch (std::exception& e) {
+			logcritical("Unhandled exception in coroutine: {}", e.what());
+		} catch (...) {
+			logcritical("Unhandled exception in coroutine");
+		}
+	}
+
+	void Task::Start(TaskController* controller, Functions::FunctionType type)
+	{
+		if (!_handle || controller == nullptr)
+			return;
+		auto handle = std::exchange(_handle, nullptr);
+		handle.promise().controller = controller;
+		handle.promise().type = type;
+		auto callback = std::make_shared<Functions::CoroutineResumeCallback>();
+		callback->_handle = handle;
+		callback->_type = type;
+		callback->_owner = handle.promise().state->owner;
+		controller->AddTask(callback);
+	}
+
+	void Task::Wait()
+	{
+		if (!_state)
+			return;
+		{
+			std::unique_lock<std::mutex> guard(_state->lock);
+			_state->condition.wait(guard, [this]() { return _state->finished.load(); });
+		}
+		if (_state->exception)
+			std::rethrow_exception(_state->exception);
+	}
+
+	void Schedule::await_suspend(Task::handle_type handle)
+	{
+		_handle = handle;
+		auto& promise = handle.promise();
+		if (!_keepType)
+			promise.type = _type;
+		promise.Suspend();
+		auto callback = std::make_shared<Functions::CoroutineResumeCallback>();
+		callback->_handle = handle;
+		callback->_type = promise.type;
+		callback->_owner = promise.state->owner;
+		// the coroutine may be resumed by another thread as soon as the task has been added
+		promise.controller->AddTask(callback);
+	}
+
+	void AwaitTask::await_suspend(Task::handle_type handle)
+	{
+		_handle = handle;
+		auto& promise = handle.promise();
+		promise.Suspend();
+		auto callback = std::make_shared<Functions::CoroutineTaskCallback>();
+		callback->_function = _function;
+		callback->_handle = handle;
+		callback->_owner = promise.state->owner;
+		promise.controller->AddTask(callback);
+	}
+
+	void Sleep::await_suspend(Task::handle_type handle)
+	{
+		_handle = handle;
+		auto& promise = handle.promise();
+		promise.Suspend();
+		auto callback = std::make_shared<Functions::CoroutineResumeCallback>();
+		callback->_handle = handle;
+		callback->_type = promise.type;
+		callback->_owner = promise.state->owner;
+		Timer::GetSingleton()->Schedule(std::chrono::steady_clock::now() + _duration, promise.controller, callback);
+	}
+
+	Completion::Completion(Functions::FunctionType type)
+	{
+		_callback = std::make_shared<Functions::CoroutineCompletionCallback>();
+		_callback->_type = type;
+	}
+
+	bool Completion::await_suspend(Task::handle_type handle)
+	{
+		int32_t expected = 0;
+		// the event has been completed after await_ready, continue without suspending
+		if (!_callback->_status.compare_exchange_strong(expected, 3))
+			return false;
+		_handle = handle;
+		auto& promise = handle.promise();
+		_callback->_handle = handle;
+		_callback->_owner = promise.state->owner;
+		// the callback cannot resume the coroutine while it is suspending, so the checkpoint
+		// runs before the coroutine may continue on another thread
+		promise.Suspend();
+		expected = 3;
+		// the coroutine may be resumed by another thread as soon as it is marked as suspended
+		if (_callback->_status.compare_exchange_strong(expected, 1))
+			return true;
+		// the event has been completed during the checkpoint, the coroutine never suspended
+		_callback->_handle = nullptr;
+		promise.Abandon();
+		return false;
+	}
+
+	Timer* Timer::GetSingleton()
+	{
+		static Timer timer;
+		return std::addressof(timer);
+	}
+
+	Timer::~Timer()
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_terminate = true;
+		}
+		_condition.notify_all();
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	void Timer::Schedule(std::chrono::steady_clock::time_point time, TaskController* controller, std::shared_ptr<Functions::BaseFunction> function)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			if (!_thread.joinable())
+				_thread = std::thread(&Timer::InternalLoop, this);
+			_entries.push({ time, _sequence++, controller, function });
+		}
+		_condition.notify_one();
+	}
+
+	void Timer::InternalLoop()
+	{
+		std::unique_lock<std::mutex> guard(_lock);
+		while (!_terminate) {
+			if (_entries.empty()) {
+				_condition.wait(guard, [this]() { return _terminate || !_entries.empty(); });
+				continue;
+			}
+			auto time = _entries.top().time;
+			if (std::chrono::steady_clock::now() < time) {
+				_condition.wait_until(guard, time);
+				continue;
+			}
+			Entry entry = _entries.top();
+			_entries.pop();
+			guard.unlock();
+			entry.controller->AddTask(entry.function);
+			guard.lock();
+		}
+	}
+
+	static bool _registeredFactories = false;
+
+	void RegisterFactories()
+	{
+		if (!_registeredFactories) {
+			_registeredFactories = !_registeredFactories;
+			Functions::RegisterFactory(Functions::CoroutineResumeCallback::GetTypeStatic(), Functions::CoroutineResumeCallback::Create);
+			Functions::RegisterFactory(Functions::CoroutineTaskCallback::GetTypeStatic(), Functions::CoroutineTaskCallback::Create);
+			Functions::RegisterFactory(Functions::CoroutineCompletionCallback::GetTypeStatic(), Functions::CoroutineCompletionCallback::Create);
+		}
+	}
+}
@@ -4,11 +4,16 @@
 #include "ExecutionHandler.h"
 #include "LuaEngine.h"
 #include "LZMAStreamBuf.h"
+#include "MappedFile.h"
+#include "Codecs.h"
 #include "SessionData.h"
 #include "DeltaDebugging.h"
 #include "Generation.h"
 #include "BufferOperations.h"
 #include "SessionFunctions.h"
+#include "Journal.h"
+#include "SaveFile.h"
+#include "Checksum.h"
 
 #include <memory>
 #include <iostream>
@@ -17,6 +22,8 @@
 #include <exception>
 #include <algorithm>
 #include <execution>
+#include <sstream>
+#include <thread>
 
 Data::Data()
 {
@@ -87,6 +94,83 @@ void Data::SetSavePath(std::filesystem::path path)
 	_savepath = path;
 }
 
+bool Data::WriteRecord(IForm* form, std::ostream* buffer, SaveStats& stats)
+{
+	size_t offset = 0;
+	size_t length = 0;
+	switch (form->GetType()) {
+	case FormType::Input:
+		Records::CreateRecord<Input>(dynamic_cast<Input*>(form), buffer, offset, length);
+		stats._Input++;
+		break;
+	case FormType::Grammar:
+		Records::CreateRecord<Grammar>(dynamic_cast<Grammar*>(form), buffer, offset, length);
+		stats._Grammar++;
+		break;
+	case FormType::DevTree:
+		Records::CreateRecord<DerivationTree>(dynamic_cast<DerivationTree*>(form), buffer, offset, length);
+		stats._DevTree++;
+		break;
+	case FormType::ExclTree:
+		Records::CreateRecord<ExclusionTree>(dynamic_cast<ExclusionTree*>(form), buffer, offset, length);
+		stats._ExclTree++;
+		break;
+	case FormType::ExclTreeNode:
+		Records::CreateRecord<ExclusionTreeNode>(dynamic_cast<ExclusionTreeNode*>(form), buffer, offset, length);
+		stats._ExclTreeNode++;
+		break;
+	case FormType::Generator:
+		Records::CreateRecord<Generator>(dynamic_cast<Generator*>(form), buffer, offset, length);
+		stats._Generator++;
+		break;
+	case FormType::Session:
+		Records::CreateRecord<Session>(dynamic_cast<Session*>(form), buffer, offset, length);
+		stats._Session++;
+		break;
+	case FormType::Settings:
+		Records::CreateRecord<Settings>(dynamic_cast<Settings*>(form), buffer, offset, length);
+		stats._Settings++;
+		break;
+	case FormType::Test:
+		Records::CreateRecord<Test>(dynamic_cast<Test*>(form), buffer, offset, length);
+		stats._Test++;
+		break;
+	case FormType::TaskController:
+		Records::CreateRecord<TaskController>(dynamic_cast<TaskController*>(form), buffer, offset, length);
+		stats._TaskController++;
+		break;
+	case FormType::ExecutionHandler:
+		Records::CreateRecord<ExecutionHandler>(dynamic_cast<ExecutionHandler*>(form), buffer, offset, length);
+		stats._ExecutionHandler++;
+		break;
+	case FormType::Oracle:
+		Records::CreateRecord<Oracle>(dynamic_cast<Oracle*>(form), buffer, offset, length);
+		stats._Oracle++;
+		break;
+	case FormType::SessionData:
+		Records::CreateRecord<SessionData>(dynamic_cast<SessionData*>(form), buffer, offset, length);
+		stats._SessionData++;
+		break;
+	case FormType::DeltaController:
+		Records::CreateRecord<DeltaDebugging::DeltaController>(dynamic_cast<DeltaDebugging::DeltaController*>(form), buffer, offset, length);
+		stats._DeltaController++;
+		break;
+	case FormType::Generation:
+		Records::CreateRecord<Generation>(dynamic_cast<Generation*>(form), buffer, offset, length);
+		stats._Generation++;
+		break;
+	default:
+		stats._Fail++;
+		logcritical("Trying to save unknown formtype");
+		return false;
+	}
+	if (offset > length) {
+		logcritical("Buffer overflow in record: {}", FormType::ToString(form->GetType()));
+		return false;
+	}
+	return true;
+}
+
 void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 {
 	if (_savelock.try_lock()) {
@@ -104,9 +188,21 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 
 		auto settings = CreateForm<Settings>();
 
+		// once a full save exists, only the changes are appended to its journal
+		if (settings->saves.journal && _journal && _journal->number > 0) {
+			SaveJournal(callback, settings);
+			_savelock.unlock();
+			return;
+		} else if (!settings->saves.journal && _journal)
+			_journal.reset();
+
+		// forms that haven't been read from a lazily loaded save would be missing from the new save
+		if (_lazy)
+			LoadLazyForms();
+
 		auto sessiondata = CreateForm<SessionData>();
 
-		bool useincrementalsave = settings->saves.incrementalSaveFiles && (settings->saves.createFullSaveEvery == 0 || _savenumber % settings->saves.createFullSaveEvery != 0);
+		bool useincrementalsave = settings->saves.incrementalSaveFiles && !settings->saves.journal && (settings->saves.createFullSaveEvery == 0 || _savenumber % settings->saves.createFullSaveEvery != 0);
 
 		// create new file on disc
 		std::string name = GetSaveName();
@@ -114,7 +210,10 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 			std::filesystem::create_directories(_savepath);
 		logdebug("{}", (_savepath / name).string());
 		std::cout << "path: " << (_savepath / name).string() << "\n";
-		std::ofstream fsave = std::ofstream((_savepath / name), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		// the save is written to a temporary file that replaces the savefile once it is complete, so a crash
+		// while saving never leaves a truncated savefile behind
+		std::filesystem::path temp = _savepath / (name + ".tmp");
+		std::ofstream fsave = std::ofstream(temp, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
 		size_t writtenbytes = 0;
 		if (fsave.is_open()) {
 			// lock access to taskcontroller and executionhandler
@@ -125,6 +224,13 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 			//execcontrol->Freeze(true);
 			execcontrol->Freeze(false);
 			taskcontrol->Freeze();
+			// all records are serialized into memory while the session is frozen, and are compressed and
+			// written once it continues
+			bool compressafterthaw = settings->saves.compressAfterThaw;
+			bool thawed = false;
+			// strings interned from here on are written to the journal
+			FormID strings = _strings.GetNextID();
+
 
 			// write main information about savefile: name, _savenumber, nextformid, _runtime etc.
 			{
@@ -202,6 +308,7 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 			_status = "Writing save...";
 
 			std::streamsize recordpos = 0;
+			std::vector<std::shared_ptr<IForm>> forms;
 			// write session data
 			{
 				/*std::shared_lock<std::shared_mutex> guard(_hashmaplock);
@@ -217,7 +324,21 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 				} else
 					recordnum = _hashmap.size();
 				*/
-				size_t recordnum = _hashmap.size();
+				{
+					std::shared_lock<std::shared_mutex> guard(_hashmaplock);
+					forms.reserve(_hashmap.size());
+					for (auto& [formid, form] : _hashmap)
+						forms.push_back(form);
+				}
+				// Inputs and DerivationTrees are written last, so that a lazy load can skip their blocks entirely.
+				// Tests are written right before them, so that their blocks can be skipped or decoded in parallel as well
+				auto bulk = std::stable_partition(forms.begin(), forms.end(), [](const std::shared_ptr<IForm>& form) {
+					return form->GetType() != FormType::Input && form->GetType() != FormType::DevTree;
+				});
+				std::stable_partition(forms.begin(), bulk, [](const std::shared_ptr<IForm>& form) {
+					return form->GetType() != FormType::Test;
+				});
+				size_t recordnum = forms.size();
 
 				logmessage("Saving {} records... with hashtable with {}", recordnum, _hashmap.size());
 				_actionloadsave_max = recordnum + 1;
@@ -233,209 +354,230 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 				}
 			}
 
-			Streambuf* sbuf = nullptr;
-			if (settings->saves.compressionLevel != -1) {
-				sbuf = new LZMAStreambuf(&fsave, settings->saves.compressionLevel, settings->saves.compressionExtreme, settings->general.numthreads);
-			} else
-				sbuf = new Streambuf(&fsave);
-			std::ostream save(sbuf);
 			loginfo("Opened save-file \"{}\"", name);
 
+			// write codec used for the blocks and its dictionary
+			std::unique_ptr<Codecs::Codec> codec;
+			{
+				Codecs::CodecType codectype = Codecs::CodecType::None;
+				std::string dictionary;
+				if (settings->saves.compressionLevel != -1) {
+					codectype = (Codecs::CodecType)settings->saves.compressionCodec;
+					if (codectype < Codecs::CodecType::LZMA || codectype > Codecs::CodecType::ZstdDictionary) {
+						logwarn("Unknown compression codec {}, using zstd", settings->saves.compressionCodec);
+						codectype = Codecs::CodecType::Zstd;
+					}
+				}
+				if (codectype == Codecs::CodecType::ZstdDictionary) {
+					// train the dictionary on evenly spaced Input and DerivationTree records, they make up
+					// most of a save and are too small to be compressed well on their own
+					std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+					std::vector<size_t> samples;
+					SaveStats samplestats;
+					size_t step = std::max(forms.size() / _saveDictionarySamples, (size_t)1);
+					for (size_t i = 0; i < forms.size() && samples.size() < _saveDictionarySamples; i += step) {
+						auto form = forms[i].get();
+						if (form->GetType() != FormType::Input && form->GetType() != FormType::DevTree)
+							continue;
+						if (useincrementalsave && form->HasChanged() == false)
+							continue;
+						std::streamoff begin = stream.tellp();
+						if (WriteRecord(form, &stream, samplestats))
+							samples.push_back((size_t)(stream.tellp() - begin));
+					}
+					if (Codecs::TrainDictionary(std::move(stream).str(), samples, _saveDictionarySize, dictionary)) {
+						loginfo("Trained dictionary of {} bytes from {} records", dictionary.size(), samples.size());
+					} else
+						codectype = Codecs::CodecType::Zstd;
+				}
+				codec = Codecs::CreateCodec(codectype, settings->saves.compressionLevel, settings->saves.compressionExtreme, dictionary);
+				if (!codec && codectype != Codecs::CodecType::None) {
+					logcritical("Failed to create codec {}, save is written uncompressed", Codecs::ToString(codectype));
+					codectype = Codecs::CodecType::None;
+					dictionary.clear();
+				}
+				size_t len = 12;
+				size_t offset = 0;
+				unsigned char* buffer = new unsigned char[len];
+				Buffer::Write((int32_t)codectype, buffer, offset);
+				Buffer::WriteSize(dictionary.size(), buffer, offset);
+				fsave.write((char*)buffer, len);
+				fsave.write(dictionary.data(), dictionary.size());
+				delete[] buffer;
+			}
+
+			// records are serialized into blocks by multiple threads, each block is compressed independently
+			// and the blocks are written in order, followed by an index of all blocks
+			std::vector<SaveBlockIndexEntry> index;
+			std::vector<SaveFormIndexEntry> formindex;
+			auto writeBlock = [&fsave, &index, &formindex](SaveBlock& block) {
+				SaveBlockIndexEntry entry;
+				entry.rawsize = block.rawsize;
+				entry.storedsize = block.data.size();
+				entry.records = block.records;
+				SaveFile::WriteBlock(&fsave, entry, block.data.data());
+				for (auto& form : block.forms) {
+					form.block = index.size();
+					formindex.push_back(form);
+				}
+				index.push_back(entry);
+			};
+			auto finishBlock = [&codec](SaveBlock& block) {
+				block.rawsize = block.data.size();
+				if (codec && block.rawsize > 0) {
+					std::string compressed;
+					if (codec->Compress(block.data.data(), block.data.size(), compressed))
+						block.data = std::move(compressed);
+					else
+						block.failed = true;
+				}
+			};
+
 			size_t writtenrecords = 1;
+			bool failed = false;
 
-			// write hashmap;
+			// write string hashmap [its coded as a type of record]
 			{
-				// write string hashmap [its coded as a type of record]
+				SaveBlock block;
+				std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+				WriteStringHashmap(&stream);
+				block.data = std::move(stream).str();
+				block.records = 1;
+				finishBlock(block);
+				failed |= block.failed;
+				writeBlock(block);
+				writtenbytes += block.rawsize;
+				loginfo("Wrote string hashmap. {} entries.", _strings.Size());
+				_actionloadsave_current++;
+			}
+
+			// writes the end of the blocks, the block and form index, and the number of records written
+			auto finishFile = [&]() {
+				SaveBlock terminator;
+				writeBlock(terminator);
+				index.pop_back();
+				SaveFile::WriteIndex(&fsave, index, formindex);
+				fsave.flush();
+				// update record num
+				fsave.seekp(recordpos);
 				{
-					size_t sz = GetStringHashmapSize();  // record length
-					_actionrecord_offset = 0;
-					_actionrecord_len = sz;
-					Records::CreateRecordHeaderStringHashmap(&save, _actionrecord_len, _actionrecord_offset);
-					WriteStringHashmap(&save, _actionrecord_offset, _actionrecord_len);
-					loginfo("Wrote string hashmap. {} entries.", _stringHashmap.left.size());
-					_actionloadsave_current++;
-					if (fsave.bad())
-						logcritical("critical error in underlying savefile");
+					size_t len = 8;
+					size_t offset = 0;
+					unsigned char* buffer = new unsigned char[len];
+					Buffer::WriteSize(writtenrecords, buffer, offset);
+					fsave.write((char*)buffer, len);
+					delete[] buffer;
 				}
+				fsave.flush();
+				fsave.close();
+				return !fsave.fail();
+			};
 
-				writtenbytes += _actionrecord_len;
-
-				for (auto& [formid, form] : _hashmap) {
-					// if we are writing incremental saves
-					_actionloadsave_current++;
-					if (useincrementalsave && form->HasChanged() == false) {
-						continue;
-					}
-					writtenrecords++;
-					_actionrecord_len = 0;
-					_actionrecord_offset = 0;
-					//unsigned char* buffer = nullptr;
-					_record = form->GetType();
-					switch (_record) {
-					case FormType::Input:
-						//logdebug("Write Record:      Input");
-						Records::CreateRecord<Input>(dynamic_pointer_cast<Input>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Input");
-						}
-						stats._Input++;
-						break;
-					case FormType::Grammar:
-						//logdebug("Write Record:      Grammar");
-						Records::CreateRecord<Grammar>(dynamic_pointer_cast<Grammar>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Grammar");
-						}
-						stats._Grammar++;
-						break;
-					case FormType::DevTree:
-						//logdebug("Write Record:      DerivationTree");
-						Records::CreateRecord<DerivationTree>(dynamic_pointer_cast<DerivationTree>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: DerivationTree");
-						}
-						stats._DevTree++;
-						break;
-					case FormType::ExclTree:
-						//logdebug("Write Record:      ExclusionTree");
-						Records::CreateRecord<ExclusionTree>(dynamic_pointer_cast<ExclusionTree>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: ExclusionTree");
-						}
-						stats._ExclTree++;
-						break;
-					case FormType::ExclTreeNode:
-						//logdebug("Write Record:      ExclusionTreeNode");
-						Records::CreateRecord<ExclusionTreeNode>(dynamic_pointer_cast<ExclusionTreeNode>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: ExclusionTreeNode");
-							auto sz = dynamic_pointer_cast<ExclusionTreeNode>(form)->GetDynamicSize();
-						}
-						stats._ExclTreeNode++;
-						break;
-					case FormType::Generator:
-						//logdebug("Write Record:      Generator");
-						Records::CreateRecord<Generator>(dynamic_pointer_cast<Generator>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Generator");
-						}
-						stats._Generator++;
-						break;
-					case FormType::Session:
-						//logdebug("Write Record:      Session");
-						Records::CreateRecord<Session>(dynamic_pointer_cast<Session>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Session");
-						}
-						stats._Session++;
-						break;
-					case FormType::Settings:
-						//logdebug("Write Record:      Settings");
-						Records::CreateRecord<Settings>(dynamic_pointer_cast<Settings>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Settings");
-						}
-						stats._Settings++;
-						break;
-					case FormType::Test:
-						//logdebug("Write Record:      Test");
-						Records::CreateRecord<Test>(dynamic_pointer_cast<Test>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Test");
-							auto sz = dynamic_pointer_cast<Test>(form)->GetDynamicSize();
-						}
-						stats._Test++;
-						break;
-					case FormType::TaskController:
-						//logdebug("Write Record:      TaskController");
-						Records::CreateRecord<TaskController>(dynamic_pointer_cast<TaskController>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: TaskController");
-						}
-						stats._TaskController++;
-						break;
-					case FormType::ExecutionHandler:
-						//logdebug("Write Record:      ExecutionHandler");
-						Records::CreateRecord<ExecutionHandler>(dynamic_pointer_cast<ExecutionHandler>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: ExecutionHandler");
-						}
-						stats._ExecutionHandler++;
-						break;
-					case FormType::Oracle:
-						//logdebug("Write Record:      Oracle");
-						Records::CreateRecord<Oracle>(dynamic_pointer_cast<Oracle>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Oracle");
-						}
-						stats._Oracle++;
-						break;
-					case FormType::SessionData:
-						//logdebug("Write Record:      SessionData");
-						Records::CreateRecord<SessionData>(dynamic_pointer_cast<SessionData>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: SessionData");
-						}
-						stats._SessionData++;
-						break;
-					case FormType::DeltaController:
-						//logdebug("Write Record:      DeltaController");
-						Records::CreateRecord<DeltaDebugging::DeltaController>(dynamic_pointer_cast<DeltaDebugging::DeltaController>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: DeltaController");
-						}
-						stats._DeltaController++;
-						break;
-					case FormType::Generation:
-						//logdebug("Write Record:      Generation");
-						Records::CreateRecord<Generation>(dynamic_pointer_cast<Generation>(form), &save, _actionrecord_offset, _actionrecord_len);
-						if (_actionrecord_offset > _actionrecord_len) {
-							logcritical("Buffer overflow in record: Generation");
+			// write forms
+			// forms whose changed flags have been cleared, they are marked again if the save fails
+			std::vector<uint8_t> cleared(forms.size(), 0);
+			{
+				size_t threads = _saveThreads > 0 ? _saveThreads : std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+				size_t numblocks = (forms.size() + _saveBlockRecords - 1) / _saveBlockRecords;
+				auto serialize = [this, &forms, &cleared, useincrementalsave](SaveBlock& block, size_t blocknum) {
+					block = SaveBlock();
+					std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+					size_t end = std::min(forms.size(), (blocknum + 1) * _saveBlockRecords);
+					for (size_t i = blocknum * _saveBlockRecords; i < end; i++) {
+						auto& form = forms[i];
+						// if we are writing incremental saves
+						if (useincrementalsave && form->HasChanged() == false)
+							continue;
+						std::streamoff begin = stream.tellp();
+						if (WriteRecord(form.get(), &stream, block.stats)) {
+							block.records++;
+							block.forms.push_back({ form->GetFormID(), form->GetType(), form->GetFlags(), 0, (uint64_t)begin });
 						}
-						stats._Generation++;
-						break;
-					default:
-						stats._Fail++;
-						logcritical("Trying to save unknown formtype");
-						break;
+						form->ClearChanged();
+						cleared[i] = 1;
+					}
+					block.data = std::move(stream).str();
+				};
+				// runs [work] for the first [count] slots of a wave, each on its own thread
+				auto runWave = [](size_t count, auto work) {
+					std::vector<std::thread> workers;
+					for (size_t t = 1; t < count; t++)
+						workers.emplace_back(work, t);
+					work(0);
+					for (auto& worker : workers)
+						worker.join();
+				};
+				auto storeBlock = [&](SaveBlock& block) {
+					failed |= block.failed;
+					if (block.records > 0)
+						writeBlock(block);
+					writtenrecords += block.records;
+					writtenbytes += block.rawsize;
+					stats += block.stats;
+					block.data.clear();
+				};
+				auto reportProgress = [&](size_t blocks) {
+					_actionloadsave_current = std::min(forms.size(), blocks * _saveBlockRecords) + 1;
+					if (fsave.bad())
+						logcritical("critical error in underlying savefile");
+				};
+				if (compressafterthaw) {
+					std::vector<SaveBlock> blocks(numblocks);
+					for (size_t first = 0; first < numblocks; first += threads)
+						runWave(std::min(threads, numblocks - first), [&serialize, &blocks, first](size_t t) { serialize(blocks[first + t], first + t); });
+					// the save no longer depends on the session, so it continues while the blocks are compressed
+					_sessionBegin = std::chrono::steady_clock::now();
+					taskcontrol->Thaw();
+					execcontrol->Thaw();
+					thawed = true;
+					for (size_t first = 0; first < numblocks; first += threads) {
+						size_t count = std::min(threads, numblocks - first);
+						runWave(count, [&finishBlock, &blocks, first](size_t t) { finishBlock(blocks[first + t]); });
+						for (size_t t = 0; t < count; t++)
+							storeBlock(blocks[first + t]);
+						reportProgress(first + count);
+					}
+				} else {
+					std::vector<SaveBlock> wave(threads);
+					for (size_t first = 0; first < numblocks; first += threads) {
+						size_t count = std::min(threads, numblocks - first);
+						runWave(count, [&serialize, &finishBlock, &wave, first](size_t t) {
+							serialize(wave[t], first + t);
+							finishBlock(wave[t]);
+						});
+						for (size_t t = 0; t < count; t++)
+							storeBlock(wave[t]);
+						reportProgress(first + count);
 					}
-					//if (buffer != nullptr) {
-					//	save.write((char*)buffer, _actionrecord_len);
-					//	if (fsave.bad())
-					//		logcritical("critical error in underlying savefile")
-					//} else {
-					//	stats._Fail++;
-					//	logcritical("record buffer could not be created");
-					//}
-					form->ClearChanged();
-					writtenbytes += _actionrecord_len;
 				}
 			}
-			sbuf->flush();
-			save.flush();
-			fsave.flush();
-			// update record num
-			fsave.seekp(recordpos);
-			{
-				size_t len = 8;
-				size_t offset = 0;
-				unsigned char* buffer = new unsigned char[len];
-				Buffer::WriteSize(writtenrecords, buffer, offset);
-				fsave.write((char*)buffer, len);
-				delete[] buffer;
+			if (failed)
+				logcritical("Failed to compress one or more blocks");
+
+			bool written = finishFile();
+			if (written)
+				written = SaveFile::CommitFile(temp, _savepath / name);
+			else {
+				logcritical("Failed to write savefile, the previous savefiles are kept");
+				std::error_code err;
+				std::filesystem::remove(temp, err);
 			}
-			fsave.flush();
-			fsave.close();
-			if (sbuf != nullptr) {
-				delete sbuf;
-				sbuf = nullptr;
+			if (!written) {
+				// the changes of the forms are not part of any save, so they are written by the next one
+				for (size_t i = 0; i < forms.size(); i++)
+					if (cleared[i])
+						forms[i]->SetChanged();
 			}
 			// set proper
-			_sessionBegin = std::chrono::steady_clock::now();
-			// unlock taskcontroller and executionhandler
-			taskcontrol->Thaw();
-			execcontrol->Thaw();
+			if (!thawed) {
+				_sessionBegin = std::chrono::steady_clock::now();
+				// unlock taskcontroller and executionhandler
+				taskcontrol->Thaw();
+				execcontrol->Thaw();
+			}
 			loginfo("Saved session");
+			if (settings->saves.journal && written)
+				ResetJournal(_savepath / name, _loadedsavenumber, strings);
 		} else {
 			logcritical("Cannot open new savefile");
 		}
@@ -468,6 +610,201 @@ void Data::Save(std::shared_ptr<Functions::BaseFunction> callback)
 	}
 }
 
+void Data::ResetJournal(std::filesystem::path base, int32_t number, FormID strings)
+{
+	_journal = std::make_unique<JournalState>();
+	_journal->base = base;
+	_journal->file = Journal::GetPath(base);
+	_journal->number = number;
+	_journal->strings = strings;
+	// a journal left behind by an earlier session with the same save number doesn't belong to this savefile
+	std::error_code err;
+	std::filesystem::remove(_journal->file, err);
+}
+
+void Data::SaveJournal(std::shared_ptr<Functions::BaseFunction> callback, std::shared_ptr<Settings> settings)
+{
+	StartProfiling;
+	SaveStats stats;
+
+	// lock access to taskcontroller and executionhandler
+	_status = "Freezing controllers...";
+	std::shared_ptr<TaskController> taskcontrol = CreateForm<TaskController>();
+	std::shared_ptr<ExecutionHandler> execcontrol = CreateForm<ExecutionHandler>();
+	taskcontrol->RequestFreeze();
+	execcontrol->Freeze(false);
+	taskcontrol->Freeze();
+
+	_status = "Writing journal...";
+	std::vector<std::shared_ptr<IForm>> forms;
+	{
+		std::shared_lock<std::shared_mutex> guard(_hashmaplock);
+		for (auto& [formid, form] : _hashmap)
+			if (form->HasChanged())
+				forms.push_back(form);
+	}
+	_actionloadsave_max = forms.size() + 1;
+	_actionloadsave_current = 0;
+
+	std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+	Journal::SegmentHeader header;
+	// strings interned since the last segment
+	FormID strings = _journal->strings;
+	{
+		_journal->strings = WriteStringHashmap(&stream, _journal->strings);
+		header.records++;
+		_actionloadsave_current++;
+	}
+	for (auto& form : forms) {
+		if (WriteRecord(form.get(), &stream, stats))
+			header.records++;
+		form->ClearChanged();
+		_actionloadsave_current++;
+	}
+	header.nextformid = _nextformid;
+	header.globalTasks = _globalTasks;
+	header.globalExec = _globalExec;
+	header.runtime = _runtime;
+
+	// unlock taskcontroller and executionhandler, the segment is compressed and appended while the session continues
+	taskcontrol->Thaw();
+	execcontrol->Thaw();
+	_sessionBegin = std::chrono::steady_clock::now();
+
+	std::string raw = std::move(stream).str();
+	std::string compressed;
+	const std::string* data = &raw;
+	header.rawsize = raw.size();
+	if (settings->saves.compressionLevel != -1) {
+		// segments are too small to train a dictionary for
+		Codecs::CodecType codectype = (Codecs::CodecType)settings->saves.compressionCodec;
+		if (codectype != Codecs::CodecType::LZMA)
+			codectype = Codecs::CodecType::Zstd;
+		auto codec = Codecs::CreateCodec(codectype, settings->saves.compressionLevel, settings->saves.compressionExtreme);
+		if (codec && codec->Compress(raw.data(), raw.size(), compressed)) {
+			header.codec = (int32_t)codectype;
+			data = &compressed;
+		}
+	}
+	header.storedsize = data->size();
+
+	bool compact = false;
+	bool success = false;
+	{
+		std::unique_lock<std::mutex> guard(_journal->lock);
+		header.epoch = _journal->epoch;
+		bool exists = std::filesystem::exists(_journal->file);
+		std::error_code err;
+		uintmax_t end = exists ? std::filesystem::file_size(_journal->file, err) : 0;
+		std::ofstream file(_journal->file, std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+		if (!exists) {
+			Journal::FileHeader fheader;
+			fheader.guid1 = guid1;
+			fheader.guid2 = guid2;
+			fheader.base = _journal->number;
+			Journal::WriteFileHeader(&file, fheader);
+		}
+		Journal::WriteSegment(&file, header, *data);
+		file.flush();
+		if (file.fail()) {
+			logcritical("Failed to write to journal \"{}\"", _journal->file.string());
+			file.close();
+			// cut off the partial segment, so that the next segment is appended to the last complete one
+			if (exists) {
+				if (end != static_cast<uintmax_t>(-1))
+					std::filesystem::resize_file(_journal->file, end, err);
+			} else
+				std::filesystem::remove(_journal->file, err);
+			// the records are missing from the journal, they are written again with the next segment
+			_journal->strings = strings;
+			for (auto& form : forms)
+				form->SetChanged();
+		} else {
+			success = true;
+			_journal->epoch++;
+			_journal->segments++;
+			compact = settings->saves.journalCompactSegments > 0 && _journal->segments >= (uint64_t)settings->saves.journalCompactSegments;
+		}
+	}
+	if (success)
+		loginfo("Appended {} records to journal, {} bytes", header.records, header.storedsize);
+	if (compact)
+		CompactJournal(settings->saves.compressionLevel);
+
+	if (callback) {
+		auto sessdata = CreateForm<SessionData>();
+		sessdata->_controller->AddTask(callback);
+	}
+	_actionloadsave = false;
+	_status = "Running...";
+	profile(TimeProfiling, "Saved session to journal");
+}
+
+void Data::CompactJournal(int32_t compressionLevel)
+{
+	if (_journal->compacting.exchange(true))
+		return;
+	if (_journal->compactor.joinable())
+		_journal->compactor.join();
+	Journal::CompactArgs args;
+	uint64_t segments = 0;
+	{
+		std::unique_lock<std::mutex> guard(_journal->lock);
+		args.base = _journal->base;
+		args.journal = _journal->file;
+		args.end = std::filesystem::file_size(_journal->file);
+		segments = _journal->segments;
+	}
+	int32_t number = _savenumber++;
+	args.output = _savepath / (_uniquename + "_" + std::to_string(number) + _extension);
+	args.compressionLevel = compressionLevel;
+	args.blockRecords = _saveBlockRecords;
+	std::filesystem::path output = args.output;
+	args.output += ".tmp";
+	// the thread only works on the files and the journal state, the session continues while it runs
+	JournalState* state = _journal.get();
+	uint64_t id1 = guid1;
+	uint64_t id2 = guid2;
+	state->compactor = std::thread([state, args, output, number, segments, id1, id2]() mutable {
+		if (Journal::Compact(args)) {
+			std::unique_lock<std::mutex> guard(state->lock);
+			// segments appended during the compaction are moved to the journal of the new savefile
+			std::filesystem::path journal = Journal::GetPath(output);
+			{
+				std::ifstream in(state->file, std::ios_base::in | std::ios_base::binary);
+				in.seekg(args.end);
+				std::string rest((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+				std::ofstream out(journal, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+				Journal::FileHeader fheader;
+				fheader.guid1 = id1;
+				fheader.guid2 = id2;
+				fheader.base = number;
+				Journal::WriteFileHeader(&out, fheader);
+				out.write(rest.data(), rest.size());
+			}
+			std::error_code err;
+			if (!SaveFile::CommitFile(args.output, output)) {
+				logcritical("Cannot commit compacted savefile");
+				std::filesystem::remove(journal, err);
+			} else {
+				std::filesystem::remove(state->file, err);
+				state->base = output;
+				state->file = journal;
+				state->number = number;
+				state->segments -= segments;
+			}
+		}
+		state->compacting = false;
+	});
+}
+
+void Data::WaitForCompaction()
+{
+	std::unique_lock<std::mutex> guard(_savelock);
+	if (_journal && _journal->compactor.joinable())
+		_journal->compactor.join();
+}
+
 void Data::Load(std::string name, LoadSaveArgs& loadArgs)
 {
 	StartProfiling;
@@ -598,12 +935,33 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 	_actionrecord_offset = 0;
 	_lresolve->_data = this;
 	_lresolve->finalsave = ignorepriorsaves;
+	// time spent in the phases of loading, the phases of prior saves are added to the final save
+	if (!ignorepriorsaves)
+		_loadTimes.clear();
+	auto phase = std::chrono::steady_clock::now();
+	auto measure = [this, &phase](std::string name) {
+		auto now = std::chrono::steady_clock::now();
+		auto itr = std::find_if(_loadTimes.begin(), _loadTimes.end(), [&name](auto& entry) { return entry.first == name; });
+		if (itr != _loadTimes.end())
+			itr->second += now - phase;
+		else
+			_loadTimes.push_back({ name, now - phase });
+		phase = now;
+	};
 	// callback after load
 	std::shared_ptr<Functions::BaseFunction> callback;
 	StartProfiling;
 	SaveStats stats;
-	std::ifstream fsave = std::ifstream(path, std::ios_base::in | std::ios_base::binary);
-	if (fsave.is_open()) {
+	// the savefile is read through a memory mapping if possible, so that records can be parsed in place
+	MappedFile mapped;
+	std::unique_ptr<MappedStreambuf> mappedbuf;
+	std::filebuf filebuf;
+	if (loadArgs.mapFile && mapped.Open(path))
+		mappedbuf = std::make_unique<MappedStreambuf>(mapped.GetData(), mapped.GetSize());
+	else
+		filebuf.open(path, std::ios_base::in | std::ios_base::binary);
+	std::istream fsave(mappedbuf ? (std::streambuf*)mappedbuf.get() : (std::streambuf*)&filebuf);
+	if (mappedbuf || filebuf.is_open()) {
 		loginfo("Opened save-file \"{}\"", path.filename().string());
 		size_t BUFSIZE = 4096;
 		unsigned char* buffer = new unsigned char[BUFSIZE];
@@ -636,6 +994,7 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 			pos += 16;
 		}
 		int64_t readbytes = 0;
+		std::unique_ptr<LazySave> lazy;
 		if (guid1 == ident1 && guid2 == ident2) {
 			logdebug("GUID matches");
 			bool abort = false;
@@ -785,12 +1144,124 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 
 			logmessage("Records to load: {}", _actionloadsave_max);
 
+			// read codec and dictionary, older block based saves are always compressed with LZMA
+			Codecs::CodecType codectype = compressionLevel != -1 ? Codecs::CodecType::LZMA : Codecs::CodecType::None;
+			std::string dictionary;
+			if (version >= 0x5 && !abort) {
+				fsave.read(reinterpret_cast<char*>(buffer), 12);
+				offset = 0;
+				if (fsave.gcount() == 12) {
+					codectype = (Codecs::CodecType)Buffer::ReadInt32(buffer, offset);
+					dictionary.resize(Buffer::ReadSize(buffer, offset));
+					fsave.read(dictionary.data(), dictionary.size());
+					if (fsave.gcount() != (std::streamsize)dictionary.size()) {
+						logcritical("Save file does not appear to have the proper format: failed to read compression dictionary");
+						abort = true;
+					}
+				} else {
+					logcritical("Save file does not appear to have the proper format: failed to read compression codec");
+					abort = true;
+				}
+			}
+			std::unique_ptr<Codecs::Codec> codec;
+			if (version >= 0x4 && !abort && codectype != Codecs::CodecType::None) {
+				codec = Codecs::CreateCodec(codectype, 0, false, dictionary);
+				if (!codec) {
+					logcritical("Save file uses unsupported compression codec {}", (int32_t)codectype);
+					abort = true;
+				}
+			}
+
+			// blocks that only contain Input, DerivationTree and Test records are skipped by the sequential reader.
+			// They are either decoded in parallel from the mapped file, or read on demand using the form index
+			std::vector<bool> skipblocks;
+			std::vector<size_t> bulkblocks;
+			std::vector<SaveBlockIndexEntry> blocks;
+			bool lazyload = loadArgs.lazyLoad && !ignorepriorsaves;
+			if (lazyload && (version < 0x6 || priorsaves > 0)) {
+				logwarn("Lazy loading requires a full save of version 0x6 or newer, loading all records");
+				lazyload = false;
+			}
+			if (lazyload && std::filesystem::exists(Journal::GetPath(path))) {
+				logwarn("Lazy loading isn't supported for savefiles with a journal, loading all records");
+				lazyload = false;
+			}
+			// a damaged savefile is searched for intact blocks, which are read in order without using the index
+			bool recover = loadArgs.recover && !ignorepriorsaves && !abort;
+			std::vector<uint64_t> recoverblocks;
+			if (recover && version < 0x7) {
+				logwarn("Recovery requires a savefile of version 0x7 or newer, loading all records");
+				recover = false;
+			}
+			if (recover) {
+				if (!mapped.IsOpen() && !mapped.Open(path)) {
+					logcritical("Recovery requires the savefile to be mapped into memory");
+					abort = true;
+				} else {
+					std::vector<SaveBlockIndexEntry> intact;
+					uint64_t damaged = 0;
+					SaveFile::ScanBlocks(mapped.GetData(), mapped.GetSize(), (uint64_t)fsave.tellg(), intact, damaged);
+					_actionloadsave_max = 0;
+					for (auto& entry : intact) {
+						recoverblocks.push_back(entry.offset);
+						_actionloadsave_max += entry.records;
+					}
+					if (damaged > 0)
+						logcritical("Savefile is damaged, recovering {} records from {} intact blocks and skipping {} damaged regions", _actionloadsave_max, intact.size(), damaged);
+					lazyload = false;
+				}
+			}
+			if ((lazyload || mappedbuf) && version >= 0x6 && !abort && !recover) {
+				std::vector<SaveFormIndexEntry> forms;
+				auto pos = fsave.tellg();
+				if (!ReadSaveIndex(fsave, version, blocks, forms)) {
+					logwarn("Failed to read the form index, loading all records sequentially");
+					blocks.clear();
+					forms.clear();
+					lazyload = false;
+				}
+				fsave.clear();
+				fsave.seekg(pos);
+				std::vector<uint64_t> bulkrecords(blocks.size(), 0);
+				for (auto& entry : forms)
+					if ((entry.type == FormType::Input || entry.type == FormType::DevTree || entry.type == FormType::Test) && entry.block < blocks.size())
+						bulkrecords[entry.block]++;
+				skipblocks.resize(blocks.size(), false);
+				for (size_t i = 0; i < blocks.size(); i++) {
+					if (blocks[i].records > 0 && bulkrecords[i] == blocks[i].records) {
+						skipblocks[i] = true;
+						bulkblocks.push_back(i);
+						_actionloadsave_max -= blocks[i].records;
+					}
+				}
+				if (lazyload) {
+					lazy = std::make_unique<LazySave>();
+					lazy->file.open(path, std::ios_base::in | std::ios_base::binary);
+					lazy->version = version;
+					if (codectype != Codecs::CodecType::None)
+						lazy->codec = Codecs::CreateCodec(codectype, 0, false, dictionary);
+					// Tests are read lazily as well, as resolving their Input on load would read all Inputs
+					for (auto& entry : forms)
+						if ((entry.type == FormType::Input || entry.type == FormType::DevTree || entry.type == FormType::Test) && entry.block < blocks.size() && (entry.flags & Form::FormFlags::Deleted) == 0)
+							lazy->forms.insert({ entry.formid, entry });
+					lazy->blocks = blocks;
+					bulkblocks.clear();
+					logmessage("Lazy loading {} forms", lazy->forms.size());
+				}
+			}
+
 			_actionloadsave_current = 0;
 			if (!abort) {
 				logdebug("decide compression");
 				// init compression etc.
 				Streambuf* sbuf = nullptr;
-				if (compressionLevel != -1)
+				if (version >= 0x4) {
+					auto bbuf = new BlockStreambuf(&fsave, codec.get(), version >= 0x7);
+					bbuf->SetSkipBlocks(std::move(skipblocks));
+					if (recover)
+						bbuf->SetBlockOffsets(std::move(recoverblocks));
+					sbuf = bbuf;
+				} else if (compressionLevel != -1)
 					sbuf = new LZMAStreambuf(&fsave);
 				else
 					sbuf = new Streambuf(&fsave);
@@ -811,344 +1282,22 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 					return;
 				case 0x2:  // save file version 2
 				case 0x3:  // save file version 3
+				case 0x4:  // save file version 4, records are stored in independent blocks
+				case 0x5:  // save file version 5, blocks are compressed with a selectable codec
+				case 0x6:  // save file version 6, form index at the end of the file
+				case 0x7:  // save file version 7, blocks and index are checksummed
 					{
-						size_t rlen = 0;
-						int32_t rtype = 0;
-						bool cbuf = false;
-						while (fileerror == false && _actionloadsave_current < _actionloadsave_max) {
-							rlen = 0;
-							rtype = 0;
-							// read length of record, type of record
-							//if (flen - pos >= 12) {
-								rlen = Buffer::ReadSize(&save, offset);
-								rtype = Buffer::ReadInt32(&save, offset);
-								if (save.bad() || save.eof())
-								{
-									// we haven't read as much as we want, probs end-of-file, so end iteration and continue
-									logwarn("Found unexpected end-of-file");
-									fileerror = true;
-									continue;
-								}
-								pos += 12;
-							//}
-							//else
-							//{
-							//	fileerror = true;
-							//	continue;
-							//}
-							if (rlen > 0) {
-								/*// if the record is small enough to fit into our regular buffer, use that one, else use a new custom buffer we have to delete later
-								if (rlen <= BUFSIZE) {
-									cbuf = false;
-									save.read((char*)buffer, rlen);
-									pos += rlen;
-									if (save.eof() || save.fail()) {
-										// we haven't read as much as we want, probs end-of-file, so end iteration and continue
-										logwarn("Found unexpected end-of-file");
-										fileerror = true;
-										continue;
-									}
-									buf = buffer;
-								} else {
-									cbuf = true;
-									cbuffer = new unsigned char[rlen];
-									save.read((char*)cbuffer, rlen);
-									pos += rlen;
-									if (save.eof() || save.fail()) {
-										// we haven't read as much as we want, probs end-of-file, so end iteration and continue
-										logwarn("Found unexpected end-of-file");
-										fileerror = true;
-										delete[] cbuffer;
-										cbuffer = nullptr;
-										continue;
-									}
-									buf = cbuffer;
-								}*/
-								//logdebug("read record data.");
-								offset = 0;
-								_actionrecord_len = rlen;
-								_actionrecord_offset = 0;
-								_record = rtype;
-								// create the correct record type
-								switch (rtype) {
-								case 'STRH':
-									{
-										bool res = ReadStringHashmap(&save, _actionrecord_offset, rlen);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											loginfo("Read String Hashmap. {} entries.", _stringHashmap.left.size());
-										} else {
-											logcritical("Failed to read String Hashmap");
-										}
-									}
-								break;
-								case FormType::Input:
-									{
-										//logdebug("Read Record:      Input");
-										auto record = Records::ReadRecord<Input>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._Input++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    Input");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    Input");
-										}
-									}
-									break;
-								case FormType::Grammar:
-									{
-										//logdebug("Read Record:      Grammar");
-										auto record = Records::ReadRecord<Grammar>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._Grammar++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    Grammar");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    Grammar");
-										}
-									}
-									break;
-								case FormType::DevTree:
-									{
-										//logdebug("Read Record:      DerivationTree");
-										auto record = Records::ReadRecord<DerivationTree>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._DevTree++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    DerivationTree");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    DerivationTree");
-										}
-									}
-									break;
-								case FormType::ExclTree:
-									{
-										//logdebug("Read Record:      ExclusionTree");
-										if (loadArgs.skipExlusionTree)
-											CreateForm<Settings>()->runtime.enableExclusionTree = false;
-										auto excl = CreateForm<ExclusionTree>();
-										bool res = excl->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._ExclTree++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    ExclusionTree");
-										}
-										if (loadArgs.skipExlusionTree)
-											loginfo("Skipped Reading Record:	ExclusionTree");
-									}
-									break;
-								case FormType::ExclTreeNode:
-									{
-										//logdebug("Read Record:      ExclusionTreeNode");
-										auto record = Records::ReadRecord<ExclusionTreeNode>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											if (!loadArgs.skipExlusionTree) {
-												bool res = RegisterForm(record);
-												if (res) {
-													stats._ExclTreeNode++;
-												} else {
-													stats._Fail++;
-													logcritical("Failed Record:    ExclusionTreeNode");
-												}
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    ExclusionTreeNode");
-										}
-									}
-									break;
-								case FormType::Generator:
-									{
-										//logdebug("Read Record:      Generator");
-										auto gen = CreateForm<Generator>();
-										bool res = gen->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._Generator++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    Generator");
-										}
-									}
-									break;
-								case FormType::Session:
-									{
-										//logdebug("Read Record:      Session");
-										auto session = CreateForm<Session>();
-										bool res = session->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._Session++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    Session");
-										}
-									}
-									break;
-								case FormType::Settings:
-									{
-										//logdebug("Read Record:      Settings");
-										auto sett = CreateForm<Settings>();
-										bool res = sett->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._Settings++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    Settings");
-										}
-									}
-									break;
-								case FormType::Test:
-									{
-										//logdebug("Read Record:      Test");
-										auto record = Records::ReadRecord<Test>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._Test++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    Test");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    Test");
-										}
-									}
-									break;
-								case FormType::TaskController:
-									{
-										//logdebug("Read Record:      TaskController");
-										auto tcontrol = CreateForm<TaskController>();
-										bool res = tcontrol->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._TaskController++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    TaskController");
-										}
-									}
-									break;
-								case FormType::ExecutionHandler:
-									{
-										//logdebug("Read Record:      ExecutionHandler");
-										auto exec = CreateForm<ExecutionHandler>();
-										bool res = exec->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._ExecutionHandler++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    ExecutionHandler");
-										}
-									}
-									break;
-								case FormType::Oracle:
-									{
-										//logdebug("Read Record:      Oracle");
-										auto oracle = CreateForm<Oracle>();
-										bool res = oracle->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._Oracle++;
-											_lresolve->_oracle = oracle;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    Oracle");
-										}
-									}
-									break;
-								case FormType::SessionData:
-									{
-										//logdebug("Read Record:      SessionData");
-										auto sessdata = CreateForm<SessionData>();
-										bool res = sessdata->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
-										if (_actionrecord_offset > rlen)
-											res = false;
-										if (res) {
-											stats._SessionData++;
-										} else {
-											stats._Fail++;
-											logcritical("Failed Record:    SessionData");
-										}
-									}
-									break;
-								case FormType::DeltaController:
-									{
-										//logdebug("Read Record:      Test");
-										auto record = Records::ReadRecord<DeltaDebugging::DeltaController>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._DeltaController++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    DeltaController");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    DeltaController");
-										}
-									}
-									break;
-								case FormType::Generation:
-									{
-										//logdebug("Read Record:      Generation");
-										auto record = Records::ReadRecord<Generation>(&save, offset, _actionrecord_offset, rlen, _lresolve);
-										if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
-											bool res = RegisterForm(record);
-											if (res) {
-												stats._Generation++;
-											} else {
-												stats._Fail++;
-												logcritical("Failed Record:    Generation");
-											}
-										} else {
-											stats._Fail++;
-											logcritical("Deleted Record:    Generation");
-										}
-									}
-									break;
-								default:
-									stats._Fail++;
-									logcritical("Trying to read unknown formtype");
-								}
-								//if (cbuf)
-								//	delete[] cbuffer;
-
-							} else {
-								logmessage("rlen is < 0")
-							}
-							// update progress
-							_actionloadsave_current++;
-							readbytes += rlen;
+						phase = std::chrono::steady_clock::now();
+						fileerror = !ReadRecords(save, _actionloadsave_max, loadArgs, stats, (bool)lazy, readbytes);
+						measure("Read records");
+						if (fileerror == false && !bulkblocks.empty()) {
+							fileerror = !ReadBlocksParallel(mapped, version, codec.get(), blocks, bulkblocks, stats, readbytes);
+							measure("Decode blocks");
+						}
+						// older savefiles cannot tell damaged records apart, so whatever could be read is kept
+						if (fileerror && version >= 0x7) {
+							logcritical("Savefile is damaged. Use --verify to check it and --recover to load its intact blocks");
+							break;
 						}
 						_loaded = true;
 						loginfo("Loaded save");
@@ -1162,6 +1311,18 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 					delete sbuf;
 					sbuf = nullptr;
 				}
+
+				// full savefiles can have a journal with the changes made after they were written.
+				// Only the most recent savefile is continued, older ones keep their history
+				if (_loaded && ignorepriorsaves == false && version >= 0x6 && priorsaves == 0 && _loadedsavenumber == _savenumber - 1) {
+					auto journal = Journal::GetPath(path);
+					if (std::filesystem::exists(journal)) {
+						phase = std::chrono::steady_clock::now();
+						ReplayJournal(journal, path, loadArgs, stats, readbytes);
+						measure("Replay journal");
+					} else
+						ResetJournal(path, _loadedsavenumber, _strings.GetNextID());
+				}
 			}
 		} else {
 			// this cannot be our savefile
@@ -1185,7 +1346,9 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 		logmessage("Bytes Read: {}", readbytes);
 
 		delete[] buffer;
-		fsave.close();
+		filebuf.close();
+		mappedbuf.reset();
+		mapped.Close();
 		std::cout << "hashtable size: " << _hashmap.size() << "\n";
 		if (ignorepriorsaves == false) {
 			if (!_lresolve->_oracle) {
@@ -1205,21 +1368,29 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 
 			Visit(visitor);
 
+			// from here on, lookups of skipped forms read them from the savefile
+			_lazy = std::move(lazy);
+
+			// forms read on demand are initialized on their own and added to the hashmap while iterating
+			std::vector<std::shared_ptr<IForm>> loadedforms;
+			loadedforms.reserve(_hashmap.size());
+			for (auto& [id, form] : _hashmap)
+				loadedforms.push_back(form);
+
 			_status = "Initializing Records Early...";
-			_actionloadsave_max = _hashmap.size();
+			_actionloadsave_max = loadedforms.size();
 			_actionloadsave_current = 0;
-			for (auto& [id, form] : _hashmap) {
-				if (form)
-					form->InitializeEarly(_lresolve);
-				_actionloadsave_current++;
-			}
+			phase = std::chrono::steady_clock::now();
+			InitializeForms(loadedforms, false);
+			measure("Initialize early");
 
 			_status = "Resolving Records...";
 
 			loginfo("Resolving records.");
 			_actionloadsave_max = _lresolve->TaskCountEarly();
 			_actionloadsave_current = 0;
-			_lresolve->Resolve(_actionloadsave_current);
+			_lresolve->Resolve(_actionloadsave_current, GetLoadThreads());
+			measure("Resolve");
 
 			loginfo("Resolved records.");
 			loginfo("Resolving late records.");
@@ -1231,18 +1402,18 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 			bool registeredLua = Lua::RegisterThread(sessdata);  // session is already fully loaded for the most part, so we can use the command
 
 			_status = "Initializing Records Late...";
-			_actionloadsave_max = _hashmap.size();
+			_actionloadsave_max = loadedforms.size();
 			_actionloadsave_current = 0;
-			for (auto& [id, form] : _hashmap) {
-				if (form)
-					form->InitializeLate(_lresolve);
-				_actionloadsave_current++;
-			}
+			phase = std::chrono::steady_clock::now();
+			InitializeForms(loadedforms, true);
+			loadedforms.clear();
+			measure("Initialize late");
 
 			_status = "Resolving Records Late...";
 			_actionloadsave_max = _lresolve->TaskCountLate();
 			_actionloadsave_current = 0;
-			_lresolve->ResolveLate(_actionloadsave_current);
+			_lresolve->ResolveLate(_actionloadsave_current, GetLoadThreads());
+			measure("Resolve late");
 
 			sessdata->_oracle = CreateForm<Oracle>();
 			sessdata->_controller = CreateForm<TaskController>();
@@ -1273,7 +1444,9 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 			_status = "Regenerating Inpputs...";
 			_actionloadsave_max = 0;
 			_actionloadsave_current = 0;
+			phase = std::chrono::steady_clock::now();
 			_lresolve->Regenerate(_actionloadsave_current, _actionloadsave_max, sessdata, sessdata->_settings->general.numthreads);
+			measure("Regenerate");
 
 			// unregister ourselves from the lua wrapper if we registered ourselves above
 			if (registeredLua)
@@ -1285,6 +1458,13 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 
 			loginfo("Resolved late records.");
 			loginfo("Loaded session");
+
+			std::chrono::nanoseconds total = std::chrono::nanoseconds(0);
+			for (auto& [name, time] : _loadTimes) {
+				logmessage("Load phase {}: {}", name, Logging::FormatTimeNS(time.count()));
+				total += time;
+			}
+			logmessage("Load phases total: {}", Logging::FormatTimeNS(total.count()));
 		}
 	} else
 		logcritical("Cannot open savefile");
@@ -1311,6 +1491,363 @@ void Data::LoadIntern(std::filesystem::path path, LoadSaveArgs& loadArgs, bool i
 }
 
 
+bool Data::ReadRecords(std::istream& save, uint64_t count, LoadSaveArgs& loadArgs, SaveStats& stats, bool skipbulk, int64_t& readbytes)
+{
+	bool fileerror = false;
+	size_t offset = 0;
+	uint64_t records = 0;
+	size_t rlen = 0;
+	int32_t rtype = 0;
+	while (fileerror == false && records < count) {
+		rlen = 0;
+		rtype = 0;
+		// read length of record, type of record
+		//if (flen - pos >= 12) {
+			rlen = Buffer::ReadSize(&save, offset);
+			rtype = Buffer::ReadInt32(&save, offset);
+			if (save.bad() || save.eof())
+			{
+				// we haven't read as much as we want, probs end-of-file, so end iteration and continue
+				logwarn("Found unexpected end-of-file");
+				fileerror = true;
+				continue;
+			}
+		//}
+		//else
+		//{
+		//	fileerror = true;
+		//	continue;
+		//}
+		if (rlen > 0) {
+			/*// if the record is small enough to fit into our regular buffer, use that one, else use a new custom buffer we have to delete later
+			if (rlen <= BUFSIZE) {
+				cbuf = false;
+				save.read((char*)buffer, rlen);
+				pos += rlen;
+				if (save.eof() || save.fail()) {
+					// we haven't read as much as we want, probs end-of-file, so end iteration and continue
+					logwarn("Found unexpected end-of-file");
+					fileerror = true;
+					continue;
+				}
+				buf = buffer;
+			} else {
+				cbuf = true;
+				cbuffer = new unsigned char[rlen];
+				save.read((char*)cbuffer, rlen);
+				pos += rlen;
+				if (save.eof() || save.fail()) {
+					// we haven't read as much as we want, probs end-of-file, so end iteration and continue
+					logwarn("Found unexpected end-of-file");
+					fileerror = true;
+					delete[] cbuffer;
+					cbuffer = nullptr;
+					continue;
+				}
+				buf = cbuffer;
+			}*/
+			//logdebug("read record data.");
+			offset = 0;
+			_actionrecord_len = rlen;
+			_actionrecord_offset = 0;
+			_record = rtype;
+			// create the correct record type
+			switch (rtype) {
+			case 'STRH':
+				{
+					bool res = ReadStringHashmap(&save, _actionrecord_offset, rlen);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						loginfo("Read String Hashmap. {} entries.", _strings.Size());
+					} else {
+						logcritical("Failed to read String Hashmap");
+					}
+				}
+			break;
+			case FormType::Input:
+				if (skipbulk) {
+					save.ignore(rlen);
+					break;
+				}
+				{
+					//logdebug("Read Record:      Input");
+					auto record = Records::ReadRecord<Input>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._Input++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    Input");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    Input");
+					}
+				}
+				break;
+			case FormType::Grammar:
+				{
+					//logdebug("Read Record:      Grammar");
+					auto record = Records::ReadRecord<Grammar>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._Grammar++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    Grammar");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    Grammar");
+					}
+				}
+				break;
+			case FormType::DevTree:
+				if (skipbulk) {
+					save.ignore(rlen);
+					break;
+				}
+				{
+					//logdebug("Read Record:      DerivationTree");
+					auto record = Records::ReadRecord<DerivationTree>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._DevTree++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    DerivationTree");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    DerivationTree");
+					}
+				}
+				break;
+			case FormType::ExclTree:
+				{
+					//logdebug("Read Record:      ExclusionTree");
+					if (loadArgs.skipExlusionTree)
+						CreateForm<Settings>()->runtime.enableExclusionTree = false;
+					auto excl = CreateForm<ExclusionTree>();
+					bool res = excl->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._ExclTree++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    ExclusionTree");
+					}
+					if (loadArgs.skipExlusionTree)
+						loginfo("Skipped Reading Record:	ExclusionTree");
+				}
+				break;
+			case FormType::ExclTreeNode:
+				{
+					//logdebug("Read Record:      ExclusionTreeNode");
+					auto record = Records::ReadRecord<ExclusionTreeNode>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						if (!loadArgs.skipExlusionTree) {
+							bool res = RegisterForm(record);
+							if (res) {
+								stats._ExclTreeNode++;
+							} else {
+								stats._Fail++;
+								logcritical("Failed Record:    ExclusionTreeNode");
+							}
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    ExclusionTreeNode");
+					}
+				}
+				break;
+			case FormType::Generator:
+				{
+					//logdebug("Read Record:      Generator");
+					auto gen = CreateForm<Generator>();
+					bool res = gen->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._Generator++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    Generator");
+					}
+				}
+				break;
+			case FormType::Session:
+				{
+					//logdebug("Read Record:      Session");
+					auto session = CreateForm<Session>();
+					bool res = session->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._Session++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    Session");
+					}
+				}
+				break;
+			case FormType::Settings:
+				{
+					//logdebug("Read Record:      Settings");
+					auto sett = CreateForm<Settings>();
+					bool res = sett->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._Settings++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    Settings");
+					}
+				}
+				break;
+			case FormType::Test:
+				if (skipbulk) {
+					save.ignore(rlen);
+					break;
+				}
+				{
+					//logdebug("Read Record:      Test");
+					auto record = Records::ReadRecord<Test>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._Test++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    Test");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    Test");
+					}
+				}
+				break;
+			case FormType::TaskController:
+				{
+					//logdebug("Read Record:      TaskController");
+					auto tcontrol = CreateForm<TaskController>();
+					bool res = tcontrol->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._TaskController++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    TaskController");
+					}
+				}
+				break;
+			case FormType::ExecutionHandler:
+				{
+					//logdebug("Read Record:      ExecutionHandler");
+					auto exec = CreateForm<ExecutionHandler>();
+					bool res = exec->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._ExecutionHandler++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    ExecutionHandler");
+					}
+				}
+				break;
+			case FormType::Oracle:
+				{
+					//logdebug("Read Record:      Oracle");
+					auto oracle = CreateForm<Oracle>();
+					bool res = oracle->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._Oracle++;
+						_lresolve->_oracle = oracle;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    Oracle");
+					}
+				}
+				break;
+			case FormType::SessionData:
+				{
+					//logdebug("Read Record:      SessionData");
+					auto sessdata = CreateForm<SessionData>();
+					bool res = sessdata->ReadData(&save, _actionrecord_offset, rlen, _lresolve);
+					if (_actionrecord_offset > rlen)
+						res = false;
+					if (res) {
+						stats._SessionData++;
+					} else {
+						stats._Fail++;
+						logcritical("Failed Record:    SessionData");
+					}
+				}
+				break;
+			case FormType::DeltaController:
+				{
+					//logdebug("Read Record:      Test");
+					auto record = Records::ReadRecord<DeltaDebugging::DeltaController>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._DeltaController++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    DeltaController");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    DeltaController");
+					}
+				}
+				break;
+			case FormType::Generation:
+				{
+					//logdebug("Read Record:      Generation");
+					auto record = Records::ReadRecord<Generation>(&save, offset, _actionrecord_offset, rlen, _lresolve);
+					if (record && record->HasFlag(Form::FormFlags::Deleted) == false) {
+						bool res = RegisterForm(record);
+						if (res) {
+							stats._Generation++;
+						} else {
+							stats._Fail++;
+							logcritical("Failed Record:    Generation");
+						}
+					} else {
+						stats._Fail++;
+						logcritical("Deleted Record:    Generation");
+					}
+				}
+				break;
+			default:
+				stats._Fail++;
+				logcritical("Trying to read unknown formtype");
+			}
+			//if (cbuf)
+			//	delete[] cbuffer;
+
+		} else {
+			logmessage("rlen is < 0")
+		}
+		// update progress
+		records++;
+		_actionloadsave_current++;
+		readbytes += rlen;
+	}
+	return fileerror == false;
+}
+
 LoadResolver* LoadResolver::GetSingleton()
 {
 	static LoadResolver resolver;
@@ -1353,38 +1890,66 @@ void LoadResolver::SetData(Data* dat)
 	_data = dat;
 }
 
-void LoadResolver::Resolve(uint64_t& progress)
+void LoadResolver::Resolve(uint64_t& progress, size_t threads)
 {
 	StartProfiling;
-	while (!_tasks.empty()) {
-		current = "";
-		TaskDelegate* del;
-		del = _tasks.front();
-		_tasks.pop();
-		del->Run();
-		del->Dispose();
-		progress++;
-	}
+	RunTasks(_tasks, progress, threads);
 	profile(TimeProfiling, "Performing Post-load operations");
 }
 
-void LoadResolver::ResolveLate(uint64_t& progress)
+void LoadResolver::ResolveLate(uint64_t& progress, size_t threads)
 {
 	StartProfiling;
-	while (!_latetasks.empty()) {
-		current = "";
-		TaskDelegate* del;
-		del = _latetasks.front();
-		_latetasks.pop();
-		del->Run();
-		del->Dispose();
-		progress++;
-	}
+	RunTasks(_latetasks, progress, threads);
 	profile(TimeProfiling, "Performing Post-load operations");
 }
 
+void LoadResolver::RunTasks(std::queue<TaskDelegate*>& queue, uint64_t& progress, size_t threads)
+{
+	if (threads <= 1) {
+		while (!queue.empty()) {
+			current = "";
+			TaskDelegate* del;
+			del = queue.front();
+			queue.pop();
+			del->Run();
+			del->Dispose();
+			progress++;
+		}
+		return;
+	}
+	// tasks only link their own form to others, so they can run in any order. Tasks added while
+	// running are picked up by the next round
+	while (!queue.empty()) {
+		std::vector<TaskDelegate*> tasks;
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			tasks.reserve(queue.size());
+			while (!queue.empty()) {
+				tasks.push_back(queue.front());
+				queue.pop();
+			}
+		}
+		std::atomic<size_t> next = 0;
+		auto run = [&tasks, &next]() {
+			for (size_t i = next++; i < tasks.size(); i = next++) {
+				tasks[i]->Run();
+				tasks[i]->Dispose();
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < std::min(threads, tasks.size()); t++)
+			workers.emplace_back(run);
+		run();
+		for (auto& worker : workers)
+			worker.join();
+		progress += tasks.size();
+	}
+}
+
 void LoadResolver::AddRegeneration(FormID formid)
 {
+	std::unique_lock<std::mutex> guard(_regenlock);
 	_regeneration.insert(formid);
 }
 
@@ -1741,83 +2306,534 @@ size_t Data::GetHashmapSize()
 	return _hashmap.size();
 }
 
-FormID Data::GetIDFromString(std::string str)
+FormID Data::GetIDFromString(std::string_view str)
 {
-	//_stringHashmapLock.lock_shared();
-	//boost::upgrade_lock<boost::upgrade_mutex> guard(_stringHashmapLock);
-	auto itr = _stringHashmap.right.find(str);
-	if (itr != _stringHashmap.right.end()) {
-		return itr->second;
-	} else {
-		//boost::upgrade_to_unique_lock<boost::upgrade_mutex> guardunique(guard);
-		std::unique_lock<std::mutex> guard(_stringHashmapLock);
-		FormID formid = 0;
+	return _strings.Intern(str);
+}
+
+std::pair<std::string, bool> Data::GetStringFromID(FormID id)
+{
+	std::string_view str;
+	if (_strings.Get(id, str))
+		return { std::string(str), true };
+	else
+		return { "", false };
+}
+
+FormID Data::WriteStringHashmap(std::ostream* buffer, FormID minid)
+{
+	std::string payload;
+	FormID next = _strings.Write(payload, minid);
+	size_t offset = 0;
+	size_t length = payload.size();
+	Records::CreateRecordHeaderStringHashmap(buffer, length, offset);
+	buffer->write(payload.data(), payload.size());
+	return next;
+}
+
+bool Data::ReadStringHashmap(std::istream* buffer, size_t& offset, size_t length)
+{
+	// mapped savefiles are read in place
+	Buffer::ArrayBuffer payload(buffer, length);
+	offset += length;
+	auto [data, size] = payload.GetBuffer();
+	return _strings.Read((const char*)data, size);
+}
+
+bool Data::ReadSaveIndex(std::istream& file, int32_t version, std::vector<SaveBlockIndexEntry>& blocks, std::vector<SaveFormIndexEntry>& forms)
+{
+	// the index ends with the position of the form and block index, preceded by the checksum of both indexes
+	bool checksums = version >= 0x7;
+	size_t trailer = checksums ? 20 : 16;
+	size_t entrysize = checksums ? 36 : 32;
+	file.seekg(0, std::ios_base::end);
+	uint64_t size = (uint64_t)file.tellg();
+	if (size < trailer)
+		return false;
+	unsigned char buffer[20];
+	file.seekg(size - trailer);
+	file.read((char*)buffer, trailer);
+	if (file.gcount() != (std::streamsize)trailer)
+		return false;
+	size_t offset = 0;
+	uint32_t checksum = checksums ? Buffer::ReadUInt32(buffer, offset) : 0;
+	uint64_t formindexpos = Buffer::ReadUInt64(buffer, offset);
+	uint64_t indexpos = Buffer::ReadUInt64(buffer, offset);
+	if (indexpos > size - trailer || formindexpos > size - trailer || formindexpos < indexpos)
+		return false;
+
+	file.seekg(indexpos);
+	Buffer::ArrayBuffer index(&file, (int64_t)(size - trailer - indexpos));
+	auto [data, length] = index.GetBuffer();
+	if ((uint64_t)length != size - trailer - indexpos || (checksums && Checksum::CRC32C(data, length) != checksum))
+		return false;
+	offset = 0;
+	if (length < 8)
+		return false;
+	size_t count = Buffer::ReadSize(data, offset);
+	if (count > ((uint64_t)length - offset) / entrysize)
+		return false;
+	blocks.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		blocks[i].offset = Buffer::ReadUInt64(data, offset);
+		blocks[i].rawsize = Buffer::ReadUInt64(data, offset);
+		blocks[i].storedsize = Buffer::ReadUInt64(data, offset);
+		blocks[i].records = Buffer::ReadUInt64(data, offset);
+		if (checksums)
+			blocks[i].checksum = Buffer::ReadUInt32(data, offset);
+	}
+
+	offset = formindexpos - indexpos;
+	if (offset + 8 > (uint64_t)length)
+		return false;
+	count = Buffer::ReadSize(data, offset);
+	if (count > ((uint64_t)length - offset) / 36)
+		return false;
+	forms.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		forms[i].formid = Buffer::ReadUInt64(data, offset);
+		forms[i].type = Buffer::ReadInt32(data, offset);
+		forms[i].flags = Buffer::ReadUInt64(data, offset);
+		forms[i].block = Buffer::ReadUInt64(data, offset);
+		forms[i].offset = Buffer::ReadUInt64(data, offset);
+	}
+	return true;
+}
+
+bool Data::ReplayJournal(std::filesystem::path path, std::filesystem::path base, LoadSaveArgs& loadArgs, SaveStats& stats, int64_t& readbytes)
+{
+	_status = "Replaying journal...";
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	Journal::FileHeader fheader;
+	if (!Journal::ReadFileHeader(&file, fheader) || fheader.guid1 != guid1 || fheader.guid2 != guid2 || fheader.base != _loadedsavenumber) {
+		logwarn("Journal \"{}\" doesn't belong to the savefile, ignoring it", path.filename().string());
+		return false;
+	}
+	uint64_t valid = Journal::FileHeader::Size;
+	uint64_t segments = 0;
+	uint64_t epoch = 0;
+	Journal::SegmentHeader header;
+	std::string data;
+	std::string raw;
+	while (Journal::ReadSegment(&file, header, data)) {
+		std::string* block = &data;
+		if (header.codec != (int32_t)Codecs::CodecType::None) {
+			auto codec = Codecs::CreateCodec((Codecs::CodecType)header.codec);
+			raw.resize(header.rawsize);
+			if (!codec || !codec->Decompress(data.data(), data.size(), raw.data(), raw.size())) {
+				logcritical("Cannot decompress segment {} of the journal", header.epoch);
+				break;
+			}
+			block = &raw;
+		}
+		// forms in the segment replace the loaded ones, static forms are read into the existing objects
+		std::vector<FormID> formids;
+		if (!Journal::ReadFormIDs(*block, header.records, formids)) {
+			logcritical("Segment {} of the journal is corrupted", header.epoch);
+			break;
+		}
 		{
-			formid = _stringNextFormID++;
+			std::unique_lock<std::shared_mutex> guard(_hashmaplock);
+			for (FormID formid : formids)
+				if (formid >= _baseformid)
+					_hashmap.erase(formid);
+		}
+		MappedStreambuf buf(block->data(), block->size());
+		std::istream stream(&buf);
+		_actionloadsave_max += header.records;
+		if (!ReadRecords(stream, header.records, loadArgs, stats, false, readbytes)) {
+			logcritical("Segment {} of the journal is corrupted", header.epoch);
+			break;
 		}
-		_stringHashmap.insert(StringHashmap::value_type(formid, str));
-		return formid;
+		_nextformid = std::max(_nextformid, header.nextformid);
+		_globalTasks = header.globalTasks;
+		_globalExec = header.globalExec;
+		_runtime = header.runtime;
+		valid = (uint64_t)file.tellg();
+		epoch = header.epoch + 1;
+		segments++;
 	}
+	file.close();
+	loginfo("Replayed {} segments from the journal", segments);
+	// segments torn by a crash are cut off, so that new segments are appended to the last complete one
+	if (valid < std::filesystem::file_size(path)) {
+		logwarn("Discarding incomplete data at the end of the journal");
+		std::error_code err;
+		std::filesystem::resize_file(path, valid, err);
+	}
+	_journal = std::make_unique<JournalState>();
+	_journal->base = base;
+	_journal->file = path;
+	_journal->number = _loadedsavenumber;
+	_journal->epoch = epoch;
+	_journal->segments = segments;
+	_journal->strings = _strings.GetNextID();
+	return true;
 }
-std::pair<std::string, bool> Data::GetStringFromID(FormID id)
+
+bool Data::ReadBlocksParallel(MappedFile& mapped, int32_t version, Codecs::Codec* codec, std::vector<SaveBlockIndexEntry>& blocks, std::vector<size_t>& bulk, SaveStats& stats, int64_t& readbytes)
 {
-	//std::shared_lock<std::shared_mutex> guard(_stringHashmapLock);
-	auto itr = _stringHashmap.left.find(id);
-	if (itr != _stringHashmap.left.end()) {
-		return { itr->second, true };
+	Input::RegisterFactories();
+	DerivationTree::RegisterFactories();
+	Test::RegisterFactories();
+	size_t threads = std::min(GetLoadThreads(), bulk.size());
+	for (size_t n : bulk)
+		_actionloadsave_max += blocks[n].records;
+
+	// records are only decoded by the workers, registering them happens in order on this thread
+	std::vector<std::vector<std::shared_ptr<IForm>>> decoded(bulk.size());
+	std::atomic<size_t> next = 0;
+	std::atomic<bool> damaged = false;
+	auto decode = [this, &mapped, version, codec, &blocks, &bulk, &decoded, &next, &damaged]() {
+		std::unique_ptr<char[]> raw;
+		size_t rawcapacity = 0;
+		for (size_t n = next++; n < bulk.size(); n = next++) {
+			auto& entry = blocks[bulk[n]];
+			char* data = (char*)SaveFile::GetBlockData(mapped.GetData(), mapped.GetSize(), version, entry);
+			if (data == nullptr) {
+				logcritical("Block {} is damaged", bulk[n]);
+				damaged = true;
+				continue;
+			}
+			if (codec) {
+				if (entry.rawsize > rawcapacity) {
+					raw.reset(new char[entry.rawsize]);
+					rawcapacity = entry.rawsize;
+				}
+				if (!codec->Decompress(data, entry.storedsize, raw.get(), entry.rawsize))
+					continue;
+				data = raw.get();
+			}
+			MappedStreambuf buf(data, entry.rawsize);
+			std::istream stream(&buf);
+			decoded[n].reserve(entry.records);
+			for (uint64_t i = 0; i < entry.records; i++) {
+				size_t offset = 0;
+				size_t rlen = Buffer::ReadSize(&stream, offset);
+				int32_t rtype = Buffer::ReadInt32(&stream, offset);
+				if (stream.fail())
+					break;
+				size_t recordoffset = 0;
+				if (rtype == FormType::Input)
+					decoded[n].push_back(Records::ReadRecord<Input>(&stream, 0, recordoffset, rlen, _lresolve));
+				else if (rtype == FormType::DevTree)
+					decoded[n].push_back(Records::ReadRecord<DerivationTree>(&stream, 0, recordoffset, rlen, _lresolve));
+				else if (rtype == FormType::Test)
+					decoded[n].push_back(Records::ReadRecord<Test>(&stream, 0, recordoffset, rlen, _lresolve));
+				else {
+					decoded[n].push_back({});
+					stream.ignore(rlen);
+				}
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; t++)
+		workers.emplace_back(decode);
+	decode();
+	for (auto& worker : workers)
+		worker.join();
+
+	for (size_t n = 0; n < bulk.size(); n++) {
+		auto& entry = blocks[bulk[n]];
+		if (decoded[n].size() != entry.records) {
+			stats._Fail += entry.records - decoded[n].size();
+			logcritical("Failed to read {} records from block {}", entry.records - decoded[n].size(), bulk[n]);
+		}
+		for (auto& form : decoded[n]) {
+			if (form && form->HasFlag(Form::FormFlags::Deleted) == false) {
+				if (RegisterForm(form)) {
+					if (form->GetType() == FormType::Input)
+						stats._Input++;
+					else if (form->GetType() == FormType::Test)
+						stats._Test++;
+					else
+						stats._DevTree++;
+				} else {
+					stats._Fail++;
+					logcritical("Failed Record:    {}", FormType::ToString(form->GetType()));
+				}
+			} else {
+				stats._Fail++;
+				logcritical("Deleted Record:    {}", form ? FormType::ToString(form->GetType()) : "Unknown");
+			}
+			_actionloadsave_current++;
+		}
+		readbytes += entry.rawsize;
+		decoded[n].clear();
+	}
+	return !damaged;
+}
+
+size_t Data::GetLoadThreads()
+{
+	return _loadThreads > 0 ? _loadThreads : std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+}
+
+void Data::InitializeForms(std::vector<std::shared_ptr<IForm>>& forms, bool late)
+{
+	// Grammars come first, followed by the singletons and the SessionData, which other forms depend on.
+	// Generations and DeltaControllers write to other forms and the resolver, so they stay on one thread
+	auto stage = [](int32_t type) {
+		switch (type) {
+		case FormType::Grammar:
+			return 0;
+		case FormType::Settings:
+		case FormType::Session:
+		case FormType::Oracle:
+		case FormType::TaskController:
+		case FormType::ExecutionHandler:
+		case FormType::Generator:
+		case FormType::ExclTree:
+			return 1;
+		case FormType::SessionData:
+			return 2;
+		case FormType::Generation:
+		case FormType::DeltaController:
+			return 3;
+		case FormType::Input:
+		case FormType::DevTree:
+		case FormType::ExclTreeNode:
+			return 4;
+		case FormType::Test:
+			return 5;
+		default:
+			return 6;
+		}
+	};
+	const std::array<bool, 7> parallel = { true, false, false, false, true, true, false };
+	std::array<std::vector<IForm*>, 7> stages;
+	for (auto& form : forms)
+		if (form)
+			stages[stage(form->GetType())].push_back(form.get());
+		else
+			_actionloadsave_current++;
+
+	size_t threads = GetLoadThreads();
+	for (size_t s = 0; s < stages.size(); s++) {
+		auto& list = stages[s];
+		std::atomic<size_t> next = 0;
+		auto init = [this, &list, &next, late]() {
+			for (size_t i = next++; i < list.size(); i = next++) {
+				if (late)
+					list[i]->InitializeLate(_lresolve);
+				else
+					list[i]->InitializeEarly(_lresolve);
+			}
+		};
+		std::vector<std::thread> workers;
+		if (parallel[s])
+			for (size_t t = 1; t < std::min(threads, list.size()); t++)
+				workers.emplace_back(init);
+		init();
+		for (auto& worker : workers)
+			worker.join();
+		_actionloadsave_current += list.size();
+	}
+}
+
+const std::string* Data::ReadLazyBlock(uint64_t block)
+{
+	for (auto itr = _lazy->cache.begin(); itr != _lazy->cache.end(); itr++) {
+		if (itr->first == block) {
+			_lazy->cache.splice(_lazy->cache.begin(), _lazy->cache, itr);
+			return &_lazy->cache.front().second;
+		}
+	}
+	if (block >= _lazy->blocks.size())
+		return nullptr;
+	auto& entry = _lazy->blocks[block];
+	std::string stored(entry.storedsize, '\0');
+	_lazy->file.clear();
+	_lazy->file.seekg(entry.offset + BlockStreambuf::GetHeaderSize(_lazy->version >= 0x7));
+	_lazy->file.read(stored.data(), stored.size());
+	if (_lazy->file.gcount() != (std::streamsize)stored.size()) {
+		logcritical("Failed to read block {} of lazily loaded save", block);
+		return nullptr;
+	}
+	if (_lazy->version >= 0x7 && Checksum::CRC32C(stored.data(), stored.size()) != entry.checksum) {
+		logcritical("Block {} of lazily loaded save is damaged", block);
+		return nullptr;
+	}
+	std::string raw;
+	if (_lazy->codec) {
+		raw.resize(entry.rawsize);
+		if (!_lazy->codec->Decompress(stored.data(), stored.size(), raw.data(), raw.size()))
+			return nullptr;
 	} else
-		return { "", false };
+		raw = std::move(stored);
+	_lazy->cache.emplace_front(block, std::move(raw));
+	if (_lazy->cache.size() > _lazyCacheBlocks)
+		_lazy->cache.pop_back();
+	return &_lazy->cache.front().second;
 }
 
-size_t Data::GetStringHashmapSize()
+std::shared_ptr<IForm> Data::LoadLazyForm(FormID formid)
 {
-	size_t size = 0;
-	size += 4; // version
-	size += 8; // number of entries
-	for (auto [id, str] : _stringHashmap.left)
+	if (!_lazy)
+		return {};
+	std::unique_lock<std::recursive_mutex> guard(_lazy->lock);
+	// the form may have been read by another thread in the meantime
 	{
-		size += 8, // id
-		size += Buffer::CalcStringLength(str); // string
+		std::shared_lock<std::shared_mutex> hashguard(_hashmaplock);
+		auto itr = _hashmap.find(formid);
+		if (itr != _hashmap.end()) {
+			if (itr->second->HasFlag(Form::FormFlags::Deleted))
+				return {};
+			return itr->second;
+		}
+	}
+	auto itr = _lazy->forms.find(formid);
+	if (itr == _lazy->forms.end())
+		return {};
+	auto entry = itr->second;
+	const std::string* block = ReadLazyBlock(entry.block);
+	if (!block || entry.offset + 12 > block->size()) {
+		logcritical("Failed to read record of form {}", Utility::GetHex(formid));
+		return {};
+	}
+	size_t offset = entry.offset;
+	size_t rlen = Buffer::ReadSize((unsigned char*)block->data(), offset);
+	int32_t rtype = Buffer::ReadInt32((unsigned char*)block->data(), offset);
+	if (offset + rlen > block->size() || rtype != entry.type) {
+		logcritical("Record of form {} does not match the form index", Utility::GetHex(formid));
+		return {};
 	}
-	return size;
+	// the record is copied, as resolving its references may read other blocks
+	std::istringstream stream(block->substr(offset, rlen), std::ios_base::in | std::ios_base::binary);
+	LoadResolver resolver;
+	resolver.SetData(this);
+	resolver._oracle = _lresolve->_oracle;
+	size_t recordoffset = 0;
+	std::shared_ptr<IForm> form;
+	switch (rtype) {
+	case FormType::Input:
+		form = Records::ReadRecord<Input>(&stream, 0, recordoffset, rlen, &resolver);
+		break;
+	case FormType::DevTree:
+		form = Records::ReadRecord<DerivationTree>(&stream, 0, recordoffset, rlen, &resolver);
+		break;
+	case FormType::Test:
+		form = Records::ReadRecord<Test>(&stream, 0, recordoffset, rlen, &resolver);
+		break;
+	default:
+		return {};
+	}
+	if (!form) {
+		logcritical("Failed Record:    {}", FormType::ToString(rtype));
+		return {};
+	}
+	RegisterForm(form);
+	uint64_t progress = 0;
+	form->InitializeEarly(&resolver);
+	resolver.Resolve(progress);
+	form->InitializeLate(&resolver);
+	resolver.ResolveLate(progress);
+	// the form matches its record, so it can be evicted again as long as it isn't changed
+	form->ClearChanged();
+	return form;
 }
 
-bool Data::WriteStringHashmap(std::ostream* buffer, size_t& offset, size_t)
+void Data::LoadLazyForms(int32_t type)
 {
-	static int32_t version = 0x1;
-	Buffer::Write(version, buffer, offset);
-	Buffer::WriteSize(_stringHashmap.left.size(), buffer, offset);
-	for (auto [id, str] : _stringHashmap.left)
+	if (!_lazy)
+		return;
+	std::vector<std::pair<uint64_t, FormID>> order;
 	{
-		Buffer::Write(id, buffer, offset);
-		Buffer::Write(str, buffer, offset);
+		std::unique_lock<std::recursive_mutex> guard(_lazy->lock);
+		for (auto& [formid, entry] : _lazy->forms)
+			if (type == 0 || entry.type == type)
+				order.push_back({ (entry.block << 32) | (entry.offset & 0xFFFFFFFF), formid });
 	}
-	return true;
+	// read forms in the order they are stored in, so that every block is only decompressed once
+	std::sort(order.begin(), order.end());
+	for (auto& [_, formid] : order)
+		LoadLazyForm(formid);
 }
 
-bool Data::ReadStringHashmap(std::istream* buffer, size_t& offset, size_t length)
+size_t Data::EvictLazyForms()
 {
-	int32_t version = Buffer::ReadInt32(buffer, offset);
-	switch (version)
-	{
-	case 0x1:
-		size_t num = Buffer::ReadSize(buffer, offset);
-		for (size_t i = 0; i < num; i++)
-		{
-			// do this as the resolve direction of functions in another function call is from right to left
-			// which would seriously mess up the buffer
-			FormID id = Buffer::ReadUInt64(buffer, offset);
-			std::string str = Buffer::ReadString(buffer, offset);
-			_stringHashmap.insert(StringHashmap::value_type(id, str));
-			if (offset >= length)
-				break;
+	if (!_lazy)
+		return 0;
+	std::unique_lock<std::recursive_mutex> guard(_lazy->lock);
+	std::unique_lock<std::shared_mutex> hashguard(_hashmaplock);
+	size_t evicted = 0;
+	size_t pass = 0;
+	// evicting an Input releases its DerivationTree, so repeat until nothing changes
+	do {
+		pass = 0;
+		// Tests only hold a weak link to their Input, which must stay in memory as long as the Test does.
+		// A Test that is only held by its Input is evicted together with it
+		std::unordered_set<FormID> pinned;
+		for (auto& [formid, entry] : _lazy->forms) {
+			if (entry.type != FormType::Test)
+				continue;
+			auto itr = _hashmap.find(formid);
+			if (itr == _hashmap.end())
+				continue;
+			if (itr->second.use_count() == 1 && itr->second->HasChanged() == false) {
+				_hashmap.erase(itr);
+				pass++;
+				continue;
+			}
+			bool held = itr->second.use_count() > 2;
+			auto test = dynamic_pointer_cast<Test>(itr->second);
+			if (auto input = test->_input.lock(); input && (input->test != test || held))
+				pinned.insert(input->GetFormID());
 		}
-		return true;
-	}
-	return false;
+		for (auto& [formid, entry] : _lazy->forms) {
+			if (entry.type == FormType::Test)
+				continue;
+			auto itr = _hashmap.find(formid);
+			if (itr == _hashmap.end())
+				continue;
+			// forms that are referenced elsewhere or have changed since they were read stay in memory
+			if (itr->second.use_count() > 1 || itr->second->HasChanged() || pinned.contains(formid))
+				continue;
+			std::shared_ptr<Test> test;
+			if (entry.type == FormType::Input) {
+				test = dynamic_pointer_cast<Input>(itr->second)->test;
+				if (test && (test->HasChanged() || _lazy->forms.contains(test->GetFormID()) == false))
+					continue;
+			}
+			_hashmap.erase(itr);
+			pass++;
+			if (test) {
+				_hashmap.erase(test->GetFormID());
+				pass++;
+			}
+		}
+		evicted += pass;
+	} while (pass > 0);
+	_lazy->cache.clear();
+	return evicted;
+}
+
+int64_t Data::CountOlderLazyForms(int32_t type, FormID formid)
+{
+	if (!_lazy)
+		return 0;
+	std::unique_lock<std::recursive_mutex> guard(_lazy->lock);
+	std::shared_lock<std::shared_mutex> hashguard(_hashmaplock);
+	int64_t count = 0;
+	for (auto& [id, entry] : _lazy->forms)
+		if (entry.type == type && id < formid)
+			count++;
+	// forms created after the load aren't part of the index
+	for (auto& [id, form] : _hashmap)
+		if (form->GetType() == type && id < formid && _lazy->forms.contains(id) == false)
+			count++;
+	return count;
 }
 
 void Data::Visit(std::function<VisitAction(std::shared_ptr<IForm>)> visitor)
+{
+	if (_lazy)
+		LoadLazyForms();
+	VisitLoaded(visitor);
+}
+
+void Data::VisitLoaded(std::function<VisitAction(std::shared_ptr<IForm>)> visitor)
 {
 	bool writelock = false;
 	_hashmaplock.lock_shared();
@@ -1849,6 +2865,7 @@ void Data::Clear()
 {
 	_actionloadsave = true;
 	_status = "Clearing hashmap...";
+	_journal.reset();
 	//if (_lresolve != nullptr) {
 	//	delete _lresolve;
 	//}
@@ -1866,6 +2883,6 @@ void Data::Clear()
 	for (auto& [id, stor] : _objectRecycler)
 		delete stor;
 	_objectRecycler.clear();
-	_stringHashmap.clear();
+	_strings.Clear();
 	_actionloadsave = false;
 }
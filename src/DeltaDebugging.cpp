@@ -21,6 +21,8 @@ namespace Functions
 		if (!_sessiondata) {
 			logcritical("DDTestCallback was called, but _sessiondata was empty.");
 		}
+		// id of the tested input, as duplicates are replaced by the input they duplicate
+		FormID tested = _input->GetFormID();
 		// check whether the input length doesn't match the devtree size
 		if (_input->derive && (int64_t)_input->GetSequenceLength() > _input->derive->_sequenceNodes) {
 			logcritical("Input is longer than dev tree large, Form: {}", Utility::PrintForm(_input));
@@ -76,7 +78,7 @@ namespace Functions
 			}
 		}
 
-		_DDcontroller->CallbackTest(_input, _batchident, _batchtasks);
+		_DDcontroller->CallbackTest(_input, _batchident, _batchtasks, tested);
 
 		// ----- SESSION STUFF -----
 		// contrary to normal test cases, we do not need to generate new tests as this
@@ -93,6 +95,13 @@ namespace Functions
 			SessionFunctions::GenerateTests(_sessiondata);
 	}
 
+	std::chrono::nanoseconds DDTestCallback::GetDeadline()
+	{
+		if (_sessiondata)
+			return std::chrono::microseconds(_sessiondata->_settings->controller.testCallbackDeadline);
+		return std::chrono::nanoseconds(0);
+	}
+
 	std::shared_ptr<BaseFunction> DDTestCallback::DeepCopy()
 	{
 		auto ptr = std::make_shared<DDTestCallback>();
@@ -541,6 +550,8 @@ namespace DeltaDebugging
 		}
 		// set starting time point
 		_DD_begin = sessiondata->data->GetRuntime();
+		// standard mode can run the tests of its levels in coroutines
+		genCompData.coroutines = _params->mode == DDMode::Standard && _sessiondata->_settings->dd.coroutines;
 
 		switch (_params->mode) {
 		case DDMode::Standard:
@@ -598,10 +609,31 @@ namespace DeltaDebugging
 		return true;
 	}
 
-	void DeltaController::CallbackTest(std::shared_ptr<Input> input, uint64_t batchident, std::shared_ptr<DeltaDebugging::Tasks> tasks)
+	void DeltaController::CallbackTest(std::shared_ptr<Input> input, uint64_t batchident, std::shared_ptr<DeltaDebugging::Tasks> tasks, FormID tested)
 	{
 		// taint changed
 		SetChanged();
+		if (genCompData.coroutines) {
+			// the worker that started the test evaluates it. It is resumed on this thread, so that it has reached
+			// its next suspension point once this callback has finished
+			std::shared_ptr<RunningTest> test;
+			{
+				std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+				if (auto itr = genCompData.running.find(tested != 0 ? tested : input->GetFormID()); itr != genCompData.running.end()) {
+					test = itr->second;
+					genCompData.running.erase(itr);
+				}
+			}
+			if (test) {
+				test->result = input;
+				test->completion->Run();
+			} else {
+				// there is no worker for tests of levels that were superseded before the session was saved
+				_totaltests++;
+				FreeInput(input);
+			}
+			return;
+		}
 		// update test status
 		{
 			std::unique_lock<std::mutex> guard(_completedTestsLock);
@@ -972,10 +1004,7 @@ namespace DeltaDebugging
 					if (prefixID != 0) {
 						auto ptr = _sessiondata->data->LookupFormID<Input>(prefixID);
 						if (ptr) {
-							{
-								Utility::SpinLock lock(_activeInputsFlag);
-								_activeInputs.insert(ptr);
-							}
+							_activeInputs.insert(ptr);
 							ptr->SetFlag(Form::FormFlags::DoNotFree);
 							if (ptr->derive)
 								ptr->derive->SetFlag(Form::FormFlags::DoNotFree);
@@ -1007,10 +1036,7 @@ namespace DeltaDebugging
 					if (prefixID != 0) {
 						auto ptr = _sessiondata->data->LookupFormID<Input>(prefixID);
 						if (ptr) {
-							{
-								Utility::SpinLock lock(_activeInputsFlag);
-								_activeInputs.insert(ptr);
-							}
+							_activeInputs.insert(ptr);
 							ptr->SetFlag(Form::FormFlags::DoNotFree);
 							if (ptr->derive)
 								ptr->derive->SetFlag(Form::FormFlags::DoNotFree);
@@ -1109,6 +1135,31 @@ namespace DeltaDebugging
 			return {};
 	}
 
+	std::shared_ptr<Input> DeltaController::GetSplit(int32_t begin, int32_t length, double approxthreshold, std::shared_ptr<Input> parent)
+	{
+		StartProfiling;
+
+		auto inp = _sessiondata->data->CreateForm<Input>();
+		inp->SetFlag(Form::FormFlags::DoNotFree);
+		inp->SetParentSplitInformation(parent->GetFormID(), { { begin, length } }, false);
+		{
+			ReadLockHolder<Input> parentlock(parent);
+			int32_t count = 0;
+			auto itr = parent->begin();
+			while (itr != parent->end() && count < begin + length) {
+				if (count >= begin)
+					inp->AddEntry(*itr);
+				count++;
+				itr++;
+			}
+		}
+		profile(TimeProfiling, "{}: Time taken for split generation", Utility::PrintForm(parent));
+		if (CheckInput(parent, inp, approxthreshold))
+			return inp;
+		else
+			return {};
+	}
+
 	void DeltaController::AddTests(std::vector<std::shared_ptr<Input>>& inputs)
 	{
 		int32_t fails = 0;
@@ -1144,7 +1195,6 @@ namespace DeltaDebugging
 			call->Dispose();
 			return false;
 		} else {
-			Utility::SpinLock lock(_activeInputsFlag);
 			_activeInputs.insert(input);
 			_activetests++;
 		}
@@ -1307,6 +1357,11 @@ namespace DeltaDebugging
 		}
 		ReadLockHolder<Input> holder(_input);
 
+		if (genCompData.coroutines) {
+			StandardGenerateNextLevel_Coroutines();
+			return;
+		}
+
 		std::vector<DeltaInformation> splitinfo;
 		GenerateSplits_Async(_level);
 	}
@@ -1387,6 +1442,238 @@ namespace DeltaDebugging
 		profile(__NextGenTime, "Time taken to generate next dd level.");
 	}
 
+	void DeltaController::StandardGenerateNextLevel_Coroutines()
+	{
+		_stopbatch = false;
+		_tests = 0;
+		_activetests = 0;
+
+		auto tasks = genCompData.tasks.load();
+		uint64_t batchident = genCompData.batchident;
+		int64_t workers = 0;
+		{
+			std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+			// the splits are calculated the same way as in GenerateSplits_Async
+			int32_t number = _level;
+			int32_t tmp = (int32_t)(std::trunc(_input->Length() / number));
+			if (tmp < 1)
+				tmp = 1;
+			number = (int32_t)(_input->Length() / tmp);
+			int32_t splitsize = (int32_t)(_input->Length() / number);
+			std::vector<DeltaInformation> complements;
+			for (int32_t i = 0; i < number; i++) {
+				DeltaInformation df;
+				df.positionbegin = i * splitsize;
+				if (i == number - 1)
+					df.length = (int32_t)_input->Length() - df.positionbegin;
+				else
+					df.length = splitsize;
+				df.complement = false;
+				// skip splits that are beneath the min exec length, their complements are still tested
+				if (df.length >= _sessiondata->_settings->dd.executeAboveLength)
+					genCompData.dinfo.push_back(df);
+				df.complement = true;
+				complements.push_back(df);
+			}
+			// splits are tested before complements
+			genCompData.dinfo.insert(genCompData.dinfo.end(), complements.begin(), complements.end());
+			genCompData.next = 0;
+			_remainingtests = (int32_t)genCompData.dinfo.size();
+
+			// every worker runs one test at a time, so the number of workers is the size of a batch
+			workers = (int64_t)genCompData.dinfo.size();
+			if (_sessiondata->_settings->dd.batchprocessing > 0)
+				workers = std::min(workers, (int64_t)_sessiondata->_settings->dd.batchprocessing);
+			tasks->tasks = workers;
+		}
+		if (workers == 0) {
+			loginfo("{} no tests", batchident);
+			EndLevel(tasks);
+			profile(__NextGenTime, "Time taken to generate next dd level.");
+			return;
+		}
+		for (int64_t i = 0; i < workers; i++)
+			StartTestWorker(batchident, tasks);
+		profile(__NextGenTime, "Time taken to generate next dd level.");
+	}
+
+	Coroutines::Task DeltaController::StandardTestWorker(uint64_t batchident, std::shared_ptr<Tasks> tasks, std::shared_ptr<RunningTest> test)
+	{
+		double approxthreshold = _origInput->GetPrimaryScore() - _origInput->GetPrimaryScore() * _sessiondata->_settings->dd.approximativeExecutionThreshold;
+		while (true) {
+			if (!test) {
+				// take the next split or complement of the level
+				DeltaInformation dinfo;
+				std::shared_ptr<Input> parent;
+				{
+					std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+					if (batchident != genCompData.batchident || genCompData.active == false || genCompData.next >= genCompData.dinfo.size())
+						break;
+					dinfo = genCompData.dinfo[genCompData.next++];
+					parent = _input;
+				}
+				std::shared_ptr<Input> input;
+				if (dinfo.complement)
+					input = GetComplement(dinfo.positionbegin, dinfo.length, approxthreshold, parent);
+				else
+					input = GetSplit(dinfo.positionbegin, dinfo.length, approxthreshold, parent);
+				if (!input) {
+					// the input is not valid or its result is already known
+					_remainingtests--;
+					continue;
+				}
+				// register the test before starting it, as it may finish before we are waiting for it
+				FormID id = input->GetFormID();
+				test = std::make_shared<RunningTest>();
+				test->batchident = batchident;
+				{
+					std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+					genCompData.running.insert_or_assign(id, test);
+				}
+				if (DoTest(input, batchident, tasks) == false) {
+					std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+					genCompData.running.erase(id);
+					test.reset();
+					_remainingtests--;
+					continue;
+				}
+			}
+
+			// wait for the test to finish, the worker is resumed by CallbackTest
+			co_await Coroutines::Completion(test->completion);
+			auto input = test->result;
+			test.reset();
+			if (!input)
+				continue;
+
+			bool current = false;
+			{
+				std::unique_lock<std::mutex> guard(_completedTestsLock);
+				_totaltests++;
+				if (batchident == genCompData.batchident) {
+					current = genCompData.active;
+					_tests++;
+					_remainingtests--;
+					_activetests--;
+				}
+			}
+			if (!current) {
+				// the level has already been ended
+				FreeInput(input);
+				break;
+			}
+
+			bool res = StandardEvaluateInput(input);
+			_completedTests.insert(input);
+
+			// evaluate whether the level should be ended prematurely
+			if (_sessiondata->_settings->dd.batchprocessing != 0 /*enabled*/) {
+				if (res)
+					_stopbatch = true;
+				bool stop = false;
+				{
+					std::unique_lock<std::mutex> guard(_batchlock);
+					// check whether we have exceeded our budget
+					if (_params->budget != 0 && _params->budget <= _totaltests)
+						_stopbatch = true;
+					stop = _stopbatch;
+				}
+				if (stop) {
+					{
+						// skip the remaining splits and complements of the level
+						std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+						if (genCompData.next < genCompData.dinfo.size())
+							_skippedTests += (int32_t)(genCompData.dinfo.size() - genCompData.next);
+						genCompData.next = genCompData.dinfo.size();
+						_remainingtests = 0;
+					}
+					EndLevel(tasks);
+					break;
+				}
+			}
+
+			// continue on a medium worker, as we have been resumed by the light test callback
+			co_await Coroutines::Schedule(Functions::FunctionType::Medium);
+		}
+		// the last worker of the level starts its evaluation
+		if (--tasks->tasks <= 0)
+			EndLevel(tasks);
+	}
+
+	void DeltaController::StartTestWorker(uint64_t batchident, std::shared_ptr<Tasks> tasks, std::shared_ptr<RunningTest> test)
+	{
+		auto worker = StandardTestWorker(batchident, tasks, test);
+		// workers are only suspended while they are waiting for a test or for a worker thread, the controller is
+		// saved with the state of both and restarts its workers after loading
+		worker.SetOwner(GetFormID());
+		worker.SetCheckpoint([this](uint64_t) { SetChanged(); });
+		worker.Start(_sessiondata->_controller.get(), Functions::FunctionType::Medium);
+	}
+
+	void DeltaController::ResumeStandardLevel_Coroutines(std::vector<std::shared_ptr<Input>> running)
+	{
+		auto tasks = genCompData.tasks.load();
+		if (!tasks || genCompData.active == false || tasks->sendEndEvent)
+			return;
+		uint64_t batchident = genCompData.batchident;
+		std::vector<std::shared_ptr<RunningTest>> tests;
+		{
+			std::unique_lock<std::mutex> guard(genCompData.testqueuelock);
+			for (auto input : running) {
+				auto test = std::make_shared<RunningTest>();
+				test->batchident = batchident;
+				genCompData.running.insert_or_assign(input->GetFormID(), test);
+				tests.push_back(test);
+			}
+		}
+		// workers that weren't waiting for a test were waiting to take the next split or complement
+		int64_t workers = std::max(tasks->tasks.load(), (int64_t)tests.size());
+		tasks->tasks = workers;
+		if (workers == 0) {
+			EndLevel(tasks);
+			return;
+		}
+		for (auto& test : tests)
+			StartTestWorker(batchident, tasks, test);
+		for (int64_t i = (int64_t)tests.size(); i < workers; i++)
+			StartTestWorker(batchident, tasks);
+		loginfo("Resumed {} workers of level {}, {} of them waiting for tests", workers, _level, tests.size());
+	}
+
+	void DeltaController::EndLevel(std::shared_ptr<Tasks> tasks)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_completedTestsLock);
+			if (!tasks || tasks != genCompData.tasks.load() || tasks->sendEndEvent)
+				return;
+			tasks->sendEndEvent = true;
+			genCompData.active = false;
+		}
+		// evaluate in a separate task, so that we aren't blocking the worker
+		auto callback = dynamic_pointer_cast<Functions::DDEvaluateExplicitCallback>(Functions::DDEvaluateExplicitCallback::Create());
+		callback->_DDcontroller = _self;
+		_sessiondata->_controller->AddTask(callback);
+	}
+
+	void DeltaController::FreeInput(std::shared_ptr<Input> input)
+	{
+		if (!input)
+			return;
+		input->UnsetFlag(Form::FormFlags::DoNotFree);
+		if (input->test)
+			input->test->UnsetFlag(Form::FormFlags::DoNotFree);
+		if (input->derive)
+			input->derive->UnsetFlag(Form::FormFlags::DoNotFree);
+		// free memory to save reclaim time
+		input->FreeMemory();
+		if (input->GetGenerated() == false && input->test && input->test->IsValid() == false) {
+			if (input->derive)
+				input->derive->FreeMemory();
+			if (input->test)
+				input->test->FreeMemory();
+		}
+	}
+
 	bool DeltaController::StandardEvaluateInput(std::shared_ptr<Input> input)
 	{
 		// taint changed
@@ -2797,6 +3084,9 @@ namespace DeltaDebugging
 		                        + 8;     // Time::_DD_end
 		static size_t size0x4 = size0x3  // prior size
 		                        + 4;     // _approxTests
+		static size_t size0x5 = size0x4  // prior size
+		                        + 1      // GenerateComplementsData::coroutines
+		                        + 8;     // GenerateComplementsData::next
 
 
 		switch (version)
@@ -2809,6 +3099,8 @@ namespace DeltaDebugging
 			return size0x3;
 		case 0x4:
 			return size0x4;
+		case 0x5:
+			return size0x5;
 		default:
 			return 0;
 		}
@@ -2825,7 +3117,8 @@ namespace DeltaDebugging
 		            + 8 /*size of waitingTests*/ + 8 * _waitingTests.size()                                    // formids in waitingTests
 		            + 8 /*size of GenerateComplementsData::splits*/ + 8 * genCompData.splits.size()            // formids in GenerateComplementsData::splits
 		            + 8 /*size of GenerateComplementsData::complements*/ + 8 * genCompData.complements.size()  // formids in GenerateComplementsData::complements
-		            + 8 /*size of GenerateComplementsData::dinfo*/ + (4 + 4 + 1) * genCompData.dinfo.size();   // split info in GenerateComplementsData::dinfo
+		            + 8 /*size of GenerateComplementsData::dinfo*/ + (4 + 4 + 1) * genCompData.dinfo.size()    // split info in GenerateComplementsData::dinfo
+		            + 8;                                                                                        // size of GenerateComplementsData::running
 
 		switch (_params->GetGoal()) {
 		case DDGoal::MaximizePrimaryScore:
@@ -2856,6 +3149,10 @@ namespace DeltaDebugging
 			if (ptr)
 				sz += ptr->GetLength();
 		}
+		std::unique_lock<std::mutex> guardtests(genCompData.testqueuelock);
+		for (auto& [id, test] : genCompData.running)
+			if (test->batchident == genCompData.batchident)
+				sz += 8;
 		return sz;
 	}
 
@@ -2978,7 +3275,7 @@ namespace DeltaDebugging
 		Buffer::Write(_skippedTests, buffer, offset);
 		Buffer::Write(_prefixTests, buffer, offset);
 		Buffer::Write(_invalidTests, buffer, offset);
-		Buffer::Write(_activetests, buffer, offset);
+		Buffer::Write(_activetests.load(), buffer, offset);
 		Buffer::Write(_stopbatch, buffer, offset);
 		// _waitingTests
 		Buffer::WriteSize(_waitingTests.size(), buffer, offset);
@@ -3030,6 +3327,18 @@ namespace DeltaDebugging
 		Buffer::Write(_DD_end, buffer, offset);
 		// VERSION 0x4
 		Buffer::Write(_approxTests, buffer, offset);
+		// VERSION 0x5
+		Buffer::Write(genCompData.coroutines, buffer, offset);
+		std::unique_lock<std::mutex> guardtests(genCompData.testqueuelock);
+		Buffer::WriteSize(genCompData.next, buffer, offset);
+		// tests of the current level that workers are waiting for, tests of older levels are discarded when they finish
+		std::vector<FormID> running;
+		for (auto& [id, test] : genCompData.running)
+			if (test->batchident == genCompData.batchident)
+				running.push_back(id);
+		Buffer::WriteSize(running.size(), buffer, offset);
+		for (auto id : running)
+			Buffer::Write(id, buffer, offset);
 		return true;
 	}
 
@@ -3133,6 +3442,7 @@ namespace DeltaDebugging
 		case 0x2:
 		case 0x3:
 		case 0x4:
+		case 0x5:
 			{
 				Form::ReadData(buffer, offset, length, resolver);
 				_tasks = Buffer::ReadInt32(buffer, offset);
@@ -3272,6 +3582,14 @@ namespace DeltaDebugging
 					// VERSION 0x4
 					_approxTests = Buffer::ReadInt32(buffer, offset);
 				}
+				if (version >= 0x5) {
+					// VERSION 0x5
+					genCompData.coroutines = Buffer::ReadBool(buffer, offset);
+					genCompData.next = Buffer::ReadSize(buffer, offset);
+					size_t runningsize = Buffer::ReadSize(buffer, offset);
+					for (size_t i = 0; i < runningsize; i++)
+						_loadData->runningids.push_back(Buffer::ReadUInt64(buffer, offset));
+				}
 				return true;
 			}
 			break;
@@ -3315,10 +3633,7 @@ namespace DeltaDebugging
 				for (size_t i = 0; i < _loadData->actI.size(); i++) {
 					auto ptr = resolver->ResolveFormID<Input>(_loadData->actI[i]);
 					if (ptr) {
-						{
-							Utility::SpinLock lock(_activeInputsFlag);
-							_activeInputs.insert(ptr);
-						}
+						_activeInputs.insert(ptr);
 						if (ptr->HasFlag(Form::FormFlags::DoNotFree) == false)
 							ptr->SetFlag(Form::FormFlags::DoNotFree);
 					}
@@ -3333,6 +3648,7 @@ namespace DeltaDebugging
 			case 0x2:
 			case 0x3:
 			case 0x4:
+			case 0x5:
 				resolver->current = "DeltaDebugging 1";
 				_sessiondata = resolver->ResolveFormID<SessionData>(Data::StaticFormIDs::SessionData);
 				_self = resolver->ResolveFormID<DeltaController>(this->GetFormID());
@@ -3358,10 +3674,7 @@ namespace DeltaDebugging
 				for (size_t i = 0; i < _loadData->actI.size(); i++) {
 					auto ptr = resolver->ResolveFormID<Input>(_loadData->actI[i]);
 					if (ptr) {
-						{
-							Utility::SpinLock lock(_activeInputsFlag);
-							_activeInputs.insert(ptr);
-						}
+						_activeInputs.insert(ptr);
 						if (ptr->HasFlag(Form::FormFlags::DoNotFree) == false)
 							ptr->SetFlag(Form::FormFlags::DoNotFree);
 					}
@@ -3398,6 +3711,7 @@ namespace DeltaDebugging
 			case 0x2:
 			case 0x3:
 			case 0x4:
+			case 0x5:
 				// create _inputRanges, _input, and _origInput
 				if (_finished == false) {
 					resolver->current = "DeltaDebugging Late 1";
@@ -3421,6 +3735,16 @@ namespace DeltaDebugging
 						if (_input->GetGenerated() == false)
 							logcritical("DeltaDebugging input could not be reconstructed");
 					}*/
+					if (genCompData.coroutines) {
+						std::vector<std::shared_ptr<Input>> running;
+						for (auto id : _loadData->runningids)
+							if (auto input = resolver->ResolveFormID<Input>(id); input)
+								running.push_back(input);
+						// coroutines cannot be saved, so the workers of the level are restarted once all forms are initialized
+						resolver->AddLateTask([this, running]() {
+							ResumeStandardLevel_Coroutines(running);
+						});
+					}
 				}
 				break;
 			}
@@ -3450,7 +3774,7 @@ namespace DeltaDebugging
 
 	size_t DeltaController::MemorySize()
 	{
-		return sizeof(DeltaController) + _completedTests.size() * sizeof(std::shared_ptr<Input>) + _activeInputs.size() * sizeof(std::pair<std::shared_ptr<Input>, FormIDLess<Input>>) + sizeof(std::pair<size_t, size_t>) * _inputRanges.size() + sizeof(std::pair<std::shared_ptr<Input>, std::tuple<double, double, int32_t>>) * _results.size();
+		return sizeof(DeltaController) + _completedTests.size() * sizeof(std::shared_ptr<Input>) + _activeInputs.size() * sizeof(std::pair<FormID, std::shared_ptr<Input>>) + sizeof(std::pair<size_t, size_t>) * _inputRanges.size() + sizeof(std::pair<std::shared_ptr<Input>, std::tuple<double, double, int32_t>>) * _results.size();
 	}
 }
 
@@ -2,9 +2,253 @@
 #include "BufferOperations.h"
 #include "Data.h"
 #include "Allocators.h"
+#include "StringTable.h"
 
 #include <stack>
 
+/// <summary>
+/// contents of terminals, grammars only produce a bounded set of symbols so the table is never cleared
+/// </summary>
+static StringTable& Symbols()
+{
+	static StringTable symbols(0);
+	return symbols;
+}
+
+uint32_t DerivationTree::InternSymbol(std::string_view symbol)
+{
+	return (uint32_t)Symbols().Intern(symbol);
+}
+
+std::string_view DerivationTree::GetSymbol(uint32_t id)
+{
+	std::string_view symbol;
+	Symbols().Get(id, symbol);
+	return symbol;
+}
+
+const DerivationTree::NodeRecord& DerivationTree::GetSharedNode(NodeIndex index) const
+{
+	// the first block stems from the generated tree and holds most nodes, later ones only the edited parts of
+	// derived trees
+	for (auto& block : _shared)
+		if (index - block->_begin < block->_nodes.size())
+			return block->_nodes[index - block->_begin];
+	logcritical("Node {} is not part of the tree", index);
+	static const NodeRecord none;
+	return none;
+}
+
+void DerivationTree::ShareNodes(DerivationTree& source)
+{
+	_shared = source._shared;
+	if (!source._own->_nodes.empty())
+		_shared.push_back(source._own);
+	_ownBegin = source._ownBegin + (NodeIndex)source._own->_nodes.size();
+	if (_own.use_count() > 1) {
+		_own->_released = true;
+		_own = std::make_shared<NodeBlock>();
+	}
+	else
+		_own->_nodes.clear();
+	_own->_begin = _ownBegin;
+	_root = NoNode;
+	_nodes = 0;
+}
+
+DerivationTree::NodeIndex DerivationTree::ShareSubtree(NodeIndex node)
+{
+	NodeRecord record = GetNode(node);
+	record._sibling = NoNode;
+	_own->_nodes.push_back(record);
+	_nodes++;
+	return _ownBegin + (NodeIndex)(_own->_nodes.size() - 1);
+}
+
+void DerivationTree::UnshareChildren(NodeIndex node)
+{
+	// children are either all shared or all created by this tree
+	NodeIndex child = GetOwnNode(node)._child;
+	if (GetOwnNode(node).IsTerminal() || child == NoNode || IsOwnNode(child))
+		return;
+	GetOwnNode(node)._child = NoNode;
+	GetOwnNode(node)._last = NoNode;
+	while (child != NoNode) {
+		NodeIndex next = GetNode(child)._sibling;
+		AddChild(node, ShareSubtree(child));
+		child = next;
+	}
+}
+
+DerivationTree::NodeIndex DerivationTree::CopySubtree(const DerivationTree& source, NodeIndex node, int64_t& sequenceNodes)
+{
+	// records are copied by value, as the arena may grow while copying from the tree itself
+	NodeRecord record = source.GetNode(node);
+	NodeIndex root = record.IsTerminal() ? CreateTerminal(record._grammarID, record._symbol) : CreateNode(record._type, record._grammarID);
+	std::vector<std::pair<NodeIndex, NodeIndex>> stack;
+	if (!record.IsTerminal())
+		stack.push_back({ node, root });
+	while (stack.size() > 0) {
+		auto [snode, dnode] = stack.back();
+		stack.pop_back();
+		for (NodeIndex child = source.GetNode(snode)._child; child != NoNode; child = record._sibling) {
+			record = source.GetNode(child);
+			NodeIndex copy = 0;
+			if (record.IsTerminal())
+				copy = CreateTerminal(record._grammarID, record._symbol);
+			else {
+				copy = CreateNode(record._type, record._grammarID);
+				if (record._type == NodeType::Sequence)
+					sequenceNodes++;
+				stack.push_back({ child, copy });
+			}
+			AddChild(dnode, copy);
+		}
+	}
+	return root;
+}
+
+void DerivationTree::GraftChildren(NodeIndex node, const DerivationTree& source)
+{
+	auto& nodes = source._own->_nodes;
+	if (source._root == NoNode || nodes.size() <= 1)
+		return;
+	// the nodes after the root keep their order, so that all their indexes move by the same offset
+	NodeIndex offset = _ownBegin + (NodeIndex)_own->_nodes.size() - (source._ownBegin + 1);
+	auto move = [offset](NodeIndex index) { return index == NoNode ? NoNode : index + offset; };
+	ReserveNodes(_own->_nodes.size() + nodes.size() - 1);
+	for (size_t i = 1; i < nodes.size(); i++) {
+		NodeRecord record = nodes[i];
+		if (!record.IsTerminal())
+			record._child = move(record._child);
+		record._sibling = move(record._sibling);
+		record._last = move(record._last);
+		_own->_nodes.push_back(record);
+	}
+	auto& root = source.GetNode(source._root);
+	auto& target = GetOwnNode(node);
+	target._child = move(root._child);
+	target._last = move(root._last);
+	_nodes += (int64_t)nodes.size() - 1;
+	_sequenceNodes += source._sequenceNodes;
+}
+
+void DerivationTree::GatherSequenceNodes(NodeIndex node, std::vector<NodeIndex>& nodes)
+{
+	if (node == NoNode || GetNode(node).IsTerminal())
+		return;
+	if (GetNode(node)._type == NodeType::Sequence)
+		nodes.push_back(node);
+	// preorder traversal, the stack holds the nonterminals whose siblings are still to be visited
+	std::vector<NodeIndex> stack;
+	NodeIndex current = GetNode(node)._child;
+	while (true) {
+		if (current == NoNode) {
+			if (stack.empty())
+				break;
+			current = GetNode(stack.back())._sibling;
+			stack.pop_back();
+			continue;
+		}
+		auto& record = GetNode(current);
+		// skip terminal children, they cannot produce sequences
+		if (record.IsTerminal())
+			current = record._sibling;
+		else {
+			if (record._type == NodeType::Sequence)
+				nodes.push_back(current);
+			stack.push_back(current);
+			current = record._child;
+		}
+	}
+}
+
+void DerivationTree::AppendContent(NodeIndex node, std::string& out)
+{
+	if (node == NoNode)
+		return;
+	if (GetNode(node).IsTerminal()) {
+		out += GetSymbol(GetNode(node)._symbol);
+		return;
+	}
+	std::vector<NodeIndex> stack;
+	NodeIndex current = GetNode(node)._child;
+	while (true) {
+		if (current == NoNode) {
+			if (stack.empty())
+				break;
+			current = GetNode(stack.back())._sibling;
+			stack.pop_back();
+			continue;
+		}
+		auto& record = GetNode(current);
+		if (record.IsTerminal()) {
+			out += GetSymbol(record._symbol);
+			current = record._sibling;
+		} else {
+			stack.push_back(current);
+			current = record._child;
+		}
+	}
+}
+
+
+void DerivationTree::EmitSequence(SequenceBuffer& buffer)
+{
+	if (_root == NoNode)
+		return;
+	if (GetNode(_root).IsTerminal()) {
+		auto symbol = GetSymbol(GetNode(_root)._symbol);
+		buffer.entries.push_back({ (uint32_t)buffer.data.size(), (uint32_t)(buffer.data.size() + symbol.size()) });
+		buffer.data.append(symbol);
+		return;
+	}
+	buffer.entries.reserve(buffer.entries.size() + _sequenceNodes);
+	// symbols are never removed from the table, so their views can be cached per thread
+	thread_local std::vector<std::string_view> symbols;
+	auto symbol = [](uint32_t id) {
+		if (id >= symbols.size())
+			symbols.resize(id + 1);
+		if (symbols[id].data() == nullptr)
+			symbols[id] = GetSymbol(id);
+		return symbols[id];
+	};
+	// preorder traversal, the stack holds the ancestors of the current node and the entry each sequence ancestor has
+	// opened. Entries are opened when a sequence node is entered, which is the order of the sequence, and closed once
+	// all of its descendants have been written
+	constexpr uint32_t noEntry = UINT32_MAX;
+	std::vector<std::pair<NodeIndex, uint32_t>> stack;
+	auto enter = [this, &buffer, &stack](NodeIndex node) {
+		uint32_t entry = noEntry;
+		auto& record = GetNode(node);
+		if (record._type == NodeType::Sequence) {
+			entry = (uint32_t)buffer.entries.size();
+			buffer.entries.push_back({ (uint32_t)buffer.data.size(), 0 });
+		}
+		stack.push_back({ node, entry });
+		return record._child;
+	};
+	NodeIndex current = enter(_root);
+	while (true) {
+		if (current == NoNode) {
+			if (stack.empty())
+				break;
+			auto [node, entry] = stack.back();
+			stack.pop_back();
+			if (entry != noEntry)
+				buffer.entries[entry].second = (uint32_t)buffer.data.size();
+			current = GetNode(node)._sibling;
+			continue;
+		}
+		auto& record = GetNode(current);
+		if (record.IsTerminal()) {
+			buffer.data.append(symbol(record._symbol));
+			current = record._sibling;
+		} else
+			current = enter(current);
+	}
+}
+
 
 void DerivationTree::NonTerminalNode::__Clear(Allocators* alloc)
 {
@@ -101,12 +345,20 @@ size_t DerivationTree::GetStaticSize(int32_t version)
 	                 + 8   // _parent._length
 	                 + 1   // _parent._complement
 	                 + 8;  // inputID
+	size_t size0x3 = size0x2  // prior version
+	                 + 4;     // strategy
+	size_t size0x4 = size0x3  // prior version
+	                 + 4;     // character classes
 
 	switch (version) {
 	case 0x1:
 		return size0x1;
 	case 0x2:
 		return size0x2;
+	case 0x3:
+		return size0x3;
+	case 0x4:
+		return size0x4;
 	default:
 		return 0;
 	}
@@ -146,6 +398,10 @@ bool DerivationTree::WriteData(std::ostream* buffer, size_t& offset, size_t leng
 		CHECK(abuf.Write<int64_t>(_parent._stop));
 		CHECK(abuf.Write<bool>(_parent._complement));
 		CHECK(abuf.Write<FormID>(_inputID));
+		// VERSION 0x3
+		CHECK(abuf.Write<uint32_t>((uint32_t)_strategy));
+		// VERSION 0x4
+		CHECK(abuf.Write<uint32_t>((uint32_t)_characterClasses));
 	}
 	catch (std::exception&) {
 		auto [data, sz] = abuf.GetBuffer();
@@ -181,6 +437,8 @@ bool DerivationTree::ReadData(std::istream* buffer, size_t& offset, size_t lengt
 			return true;
 		}
 	case 0x2:
+	case 0x3:
+	case 0x4:
 		{
 			Form::ReadData(buffer, offset, length, resolver);
 			try {
@@ -202,6 +460,14 @@ bool DerivationTree::ReadData(std::istream* buffer, size_t& offset, size_t lengt
 				_parent._stop = data.Read<int64_t>();
 				_parent._complement = data.Read<bool>();
 				_inputID = data.Read<FormID>();
+				// trees saved before the strategy was recorded have been grown
+				_strategy = Strategy::Growing;
+				if (version >= 0x3)
+					_strategy = (Strategy)data.Read<uint32_t>();
+				// trees saved before character classes were recorded produce them as they were produced back then
+				_characterClasses = CharacterClasses::Legacy;
+				if (version >= 0x4)
+					_characterClasses = (CharacterClasses)data.Read<uint32_t>();
 			} catch (std::exception& e) {
 				logcritical("Exception in read method: {}", e.what());
 			}
@@ -238,83 +504,20 @@ void DerivationTree::Delete(Data*)
 void DerivationTree::ClearInternal()
 {
 	_valid = false;
-	if (_root == nullptr)
-		return;
-
-	auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-	//delete _root;
-	_root->__Delete(allocators);
-	/*auto itr = _nodes.begin();
-	int count = 0;
-	while (itr != _nodes.end()) {
-		switch ((*itr)->Type()) {
-		case NodeType::Terminal:
-			{
-				TerminalNode* n = (TerminalNode*)*itr;
-				delete n;
-			}
-			break;
-		case NodeType::NonTerminal:
-			{
-				NonTerminalNode* n = (NonTerminalNode*)*itr;
-				delete n;
-			}
-			break;
-		case NodeType::Sequence:
-			{
-				SequenceNode* n = (SequenceNode*)*itr;
-				delete n;
-			}
-			break;
-		}
-		count++;
-		itr++;
-	}*/
-	/*std::stack<Node*> stack;
-	 stack.push(_root);
-	while (stack.size() > 0)
-	{
-		auto node = stack.top();
-		stack.pop();
-		switch (node->Type()) {
-		case NodeType::Terminal:
-			{
-				TerminalNode* n = (TerminalNode*)node;
-				delete n;
-			}
-			break;
-		case NodeType::NonTerminal:
-			{
-				NonTerminalNode* n = (NonTerminalNode*)node;
-				for (auto child : n->_children)
-					stack.push(child);
-				delete n;
-			}
-			break;
-		case NodeType::Sequence:
-			{
-				SequenceNode* n = (SequenceNode*)node;
-				for (auto child : n->_children)
-					stack.push(child);
-				delete n;
-			}
-			break;
-		}
-	}*/
+	// nodes don't own any memory, so the whole tree is released at once. Shared blocks are released with the last
+	// tree referring to them
+	if (_own.use_count() > 1 || _own->_nodes.capacity() > 0) {
+		_own->_released = true;
+		_own = std::make_shared<NodeBlock>();
+	}
+	std::vector<std::shared_ptr<const NodeBlock>>().swap(_shared);
+	_ownBegin = 0;
 	_nodes = 0;
-	//_grammarID = 0;
-	//_valid = false;
-	//_seed = 0;
-	//_targetlen = 0;
-	//_sequenceNodes = 0;
-	//_parent = {};
-	//_inputID = 0;
-	_root = nullptr;
+	_root = NoNode;
 }
 
 DerivationTree::~DerivationTree()
 {
-	ClearInternal();
 	Form::ClearFormInternal();
 }
 
@@ -335,27 +538,22 @@ void DerivationTree::RegisterFactories()
 
 void DerivationTree::FreeMemory()
 {
-	DerivationTree::Node* tmp = nullptr;
+	std::shared_ptr<NodeBlock> tmp = std::make_shared<NodeBlock>();
+	std::vector<std::shared_ptr<const NodeBlock>> shared;
 	if (TryLock()) {
 		if (!HasFlag(FormFlags::DoNotFree))
 		{
-			//ClearInternal();
 			_valid = false;
-			if (_root == nullptr) {
-				Form::Unlock();
-				return;
-			}
-			tmp = _root;
-			_root = nullptr;
+			tmp.swap(_own);
+			tmp->_released = true;
+			shared.swap(_shared);
+			_ownBegin = 0;
+			_root = NoNode;
 			_nodes = 0;
 		}
 		Form::Unlock();
 	}
-	if (tmp != nullptr) {
-		auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-		//delete tmp;
-		tmp->__Delete(allocators);
-	}
+	// the nodes are released outside of the lock
 }
 
 bool DerivationTree::Freed()
@@ -383,22 +581,92 @@ size_t DerivationTree::MemorySize()
 {
 	if (_nodes > 0)
 		logdebug("haha");
-	return sizeof(DerivationTree) + sizeof(std::pair<int64_t, int64_t>) * _parent.segments.size() + (8 + 8 + sizeof(NonTerminalNode)) * _nodes;
+	// blocks are only released with the last tree holding them
+	size_t nodes = 0;
+	if (_own.use_count() == 1)
+		nodes += _own->_nodes.capacity();
+	for (auto& block : _shared)
+		if (block.use_count() == 1)
+			nodes += block->_nodes.capacity();
+	return sizeof(DerivationTree) + sizeof(std::pair<int64_t, int64_t>) * _parent.segments.size() + sizeof(NodeBlock) + sizeof(NodeRecord) * nodes +
+	       sizeof(std::shared_ptr<const NodeBlock>) * _shared.capacity();
+}
+
+bool DerivationTree::CompactNodes()
+{
+	std::shared_ptr<NodeBlock> block;
+	std::vector<std::shared_ptr<const NodeBlock>> shared;
+	if (!TryLock())
+		return false;
+	// only the nodes of released blocks can be freed, the other blocks are held by their source trees anyway
+	bool released = false;
+	size_t held = _own->_nodes.size();
+	for (auto& sharedBlock : _shared) {
+		released |= sharedBlock->_released.load();
+		held += sharedBlock->_nodes.size();
+	}
+	size_t reachable = 0;
+	if (released && _root != NoNode) {
+		std::vector<NodeIndex> stack = { _root };
+		while (stack.size() > 0) {
+			auto& node = GetNode(stack.back());
+			stack.pop_back();
+			reachable++;
+			if (!node.IsTerminal())
+				for (NodeIndex child = node._child; child != NoNode; child = GetNode(child)._sibling)
+					stack.push_back(child);
+		}
+	}
+	// copying trees that reach most of their nodes would only duplicate the nodes still held by other trees
+	if (!released || _root == NoNode || reachable * 2 > held) {
+		Form::Unlock();
+		return false;
+	}
+	block = std::make_shared<NodeBlock>();
+	auto& nodes = block->_nodes;
+	nodes.reserve(reachable);
+	nodes.push_back(GetNode(_root));
+	nodes[0]._sibling = NoNode;
+	// the children of each node are copied next to each other, so that their siblings are the following records
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].IsTerminal() || nodes[i]._child == NoNode)
+			continue;
+		NodeIndex child = nodes[i]._child;
+		NodeIndex first = (NodeIndex)nodes.size();
+		while (child != NoNode) {
+			NodeRecord record = GetNode(child);
+			child = record._sibling;
+			record._sibling = child == NoNode ? NoNode : (NodeIndex)nodes.size() + 1;
+			nodes.push_back(record);
+		}
+		nodes[i]._child = first;
+		nodes[i]._last = (NodeIndex)nodes.size() - 1;
+	}
+	_own.swap(block);
+	block->_released = true;
+	_shared.swap(shared);
+	_ownBegin = 0;
+	_root = 0;
+	_nodes = (int64_t)_own->_nodes.size();
+	Form::Unlock();
+	// the previous blocks are released outside of the lock
+	return true;
 }
 
 void DerivationTree::DeepCopy(std::shared_ptr<DerivationTree> other)
 {
 	other->_inputID = _inputID;
 	other->_parent = _parent;
-	other->_sequenceNodes = _sequenceNodes;
-	other->_nodes = _nodes;
 	other->_seed = _seed;
 	other->_targetlen = _targetlen;
+	other->_strategy = _strategy;
+	other->_characterClasses = _characterClasses;
 	other->_valid = _valid;
 	other->_grammarID = _grammarID;
-	if (_root != nullptr) {
-		other->_root = _root->CopyRecursive().first;
-	} else
-		other->_root = nullptr;
+	// the copy shares all nodes except for its root
+	other->ShareNodes(*this);
+	if (_root != NoNode)
+		other->_root = other->ShareSubtree(_root);
+	other->_sequenceNodes = _sequenceNodes;
 	other->_regenerate = _regenerate;
 }
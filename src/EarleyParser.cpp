@@ -0,0 +1,416 @@
+#include "EarleyParser.h"
+
+#include <algorithm>
+
+namespace
+{
+	uint32_t HashItem(uint32_t expansion, uint32_t dot, uint32_t origin)
+	{
+		uint32_t hash = expansion * 0x9E3779B1u ^ dot * 0x85EBCA77u ^ origin * 0xC2B2AE3Du;
+		hash ^= hash >> 15;
+		hash *= 0x2C1B3C6Du;
+		hash ^= hash >> 12;
+		return hash;
+	}
+}
+
+EarleyParser::EarleyParser(const CompiledGrammar& grammar) :
+	_grammar(grammar)
+{
+	_owner.resize(_grammar.GetExpansionCount());
+	for (uint32_t n = 0; n < _grammar.GetNodeCount(); n++) {
+		auto& node = _grammar.GetNode(n);
+		for (uint32_t e = 0; e < node.expansionCount; e++)
+			_owner[node.expansions + e] = n;
+	}
+	ComputeNullable();
+}
+
+void EarleyParser::ComputeNullable()
+{
+	// a node is nullable once one of its expansions only contains nullable nodes. The expansion recorded for a node
+	// only refers to nodes that became nullable before it, so empty derivations built from them are finite
+	_nullable.assign(_grammar.GetNodeCount(), None);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (uint32_t n = 0; n < _grammar.GetNodeCount(); n++) {
+			auto& node = _grammar.GetNode(n);
+			if (_nullable[n] != None || node.type != GrammarNode::NodeType::NonTerminal)
+				continue;
+			for (uint32_t e = 0; e < node.expansionCount; e++) {
+				auto& expansion = _grammar.GetExpansion(node, e);
+				bool nullable = true;
+				if (expansion.regex != CompiledGrammar::None)
+					nullable = expansion.min == 0 || _nullable[expansion.regex] != None;
+				else {
+					auto children = _grammar.GetChildren(expansion);
+					for (uint32_t c = 0; c < expansion.childCount && nullable; c++)
+						nullable = _nullable[children[c]] != None;
+				}
+				if (nullable) {
+					_nullable[n] = node.expansions + e;
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+bool EarleyParser::IsComplete(const Item& item) const
+{
+	auto& expansion = _grammar.GetExpansion(item.expansion);
+	if (expansion.regex != CompiledGrammar::None)
+		return (int32_t)item.dot >= expansion.min;
+	return item.dot == expansion.childCount;
+}
+
+uint32_t EarleyParser::NextSymbol(const Item& item) const
+{
+	auto& expansion = _grammar.GetExpansion(item.expansion);
+	// regular expansions repeat their node any number of times
+	if (expansion.regex != CompiledGrammar::None)
+		return expansion.regex;
+	if (item.dot < expansion.childCount)
+		return _grammar.GetChildren(expansion)[item.dot];
+	return None;
+}
+
+void EarleyParser::ResetTable(size_t expected)
+{
+	size_t size = 64;
+	while (size < expected * 4)
+		size <<= 1;
+	_table.assign(size, None);
+}
+
+void EarleyParser::AddItem(uint32_t expansion, uint32_t dot, uint32_t origin, LinkType type, uint32_t left, uint32_t right)
+{
+	uint32_t mask = (uint32_t)_table.size() - 1;
+	uint32_t slot = HashItem(expansion, dot, origin) & mask;
+	while (_table[slot] != None) {
+		auto& item = _items[_table[slot]];
+		if (item.expansion == expansion && item.dot == dot && item.origin == origin) {
+			// another derivation of an existing item, the creating link stays first
+			if (left != None) {
+				uint32_t link = (uint32_t)_links.size();
+				_links.push_back({ left, right, _links[item.link].next, type });
+				_links[item.link].next = link;
+			}
+			return;
+		}
+		slot = (slot + 1) & mask;
+	}
+	uint32_t link = None;
+	if (left != None) {
+		link = (uint32_t)_links.size();
+		_links.push_back({ left, right, None, type });
+	}
+	_table[slot] = (uint32_t)_items.size();
+	_items.push_back({ expansion, dot, origin, link });
+
+	// keep the load factor below one half
+	uint32_t begin = _columns.back();
+	if ((_items.size() - begin) * 2 > _table.size()) {
+		_table.assign(_table.size() * 2, None);
+		mask = (uint32_t)_table.size() - 1;
+		for (uint32_t i = begin; i < (uint32_t)_items.size(); i++) {
+			auto& item = _items[i];
+			slot = HashItem(item.expansion, item.dot, item.origin) & mask;
+			while (_table[slot] != None)
+				slot = (slot + 1) & mask;
+			_table[slot] = i;
+		}
+	}
+}
+
+uint32_t EarleyParser::FindWaiting(uint32_t column, uint32_t symbol, uint32_t& count) const
+{
+	auto begin = _waiting.begin() + _waitingBegin[column];
+	auto end = column + 1 < _waitingBegin.size() ? _waiting.begin() + _waitingBegin[column + 1] : _waiting.end();
+	auto first = std::lower_bound(begin, end, symbol, [](const Waiting& waiting, uint32_t symbol) { return waiting.symbol < symbol; });
+	auto last = first;
+	while (last != end && last->symbol == symbol)
+		last++;
+	count = (uint32_t)(last - first);
+	return (uint32_t)(first - _waiting.begin());
+}
+
+uint32_t EarleyParser::GetLeo(uint32_t column, uint32_t symbol)
+{
+	// follow the chain of single penultimate items down to the first column whose Leo item is known, or that has none
+	uint32_t result = None;
+	_leoPath.clear();
+	while (true) {
+		uint32_t count = 0;
+		uint32_t first = FindWaiting(column, symbol, count);
+		if (count == 0)
+			break;
+		if (_leoIndex[first] != Unknown) {
+			result = _leoIndex[first];
+			break;
+		}
+		auto& item = _items[_waiting[first].item];
+		auto& expansion = _grammar.GetExpansion(item.expansion);
+		// the complete root item must exist, and items predicted in the same column may form unit cycles
+		if (count != 1 || (column == 0 && symbol == _grammar.GetRoot()) || expansion.regex != CompiledGrammar::None || item.dot + 1 != expansion.childCount || item.origin == column) {
+			_leoIndex[first] = None;
+			break;
+		}
+		_leoPath.push_back(first);
+		symbol = _owner[item.expansion];
+		column = item.origin;
+	}
+	for (auto itr = _leoPath.rbegin(); itr != _leoPath.rend(); itr++) {
+		auto& item = _items[_waiting[*itr].item];
+		Leo leo = { _waiting[*itr].item, result, item.expansion, item.origin };
+		if (result != None) {
+			leo.expansion = _leos[result].expansion;
+			leo.origin = _leos[result].origin;
+		}
+		result = (uint32_t)_leos.size();
+		_leoIndex[*itr] = result;
+		_leos.push_back(leo);
+	}
+	return result;
+}
+
+void EarleyParser::Complete(uint32_t index, uint32_t column)
+{
+	Item item = _items[index];
+	// empty completions are handled by advancing over nullable nodes during prediction
+	if (item.origin == column)
+		return;
+	uint32_t symbol = _owner[item.expansion];
+	if (uint32_t leo = GetLeo(item.origin, symbol); leo != None) {
+		Leo top = _leos[leo];
+		AddItem(top.expansion, _grammar.GetExpansion(top.expansion).childCount, top.origin, LinkType::Leo, leo, index);
+		return;
+	}
+	uint32_t count = 0;
+	uint32_t first = FindWaiting(item.origin, symbol, count);
+	for (uint32_t w = first; w < first + count; w++) {
+		uint32_t parent = _waiting[w].item;
+		Item waiting = _items[parent];
+		AddItem(waiting.expansion, waiting.dot + 1, waiting.origin, LinkType::Complete, parent, index);
+	}
+}
+
+bool EarleyParser::Parse(const std::vector<uint32_t>& input)
+{
+	_input = &input;
+	_items.clear();
+	_links.clear();
+	_columns.clear();
+	_pending.clear();
+	_waiting.clear();
+	_waitingBegin.clear();
+	_scratch.clear();
+	_leoIndex.clear();
+	_leos.clear();
+	_accepted = None;
+	_predicted.assign(_grammar.GetNodeCount(), 0);
+	if (_grammar.GetRoot() == CompiledGrammar::None)
+		return false;
+
+	uint32_t length = (uint32_t)input.size();
+	for (uint32_t i = 0; i <= length; i++) {
+		_columns.push_back((uint32_t)_items.size());
+		ResetTable(_pending.size());
+		if (i == 0) {
+			auto& root = _grammar.GetNode(_grammar.GetRoot());
+			_predicted[_grammar.GetRoot()] = 1;
+			for (uint32_t e = 0; e < root.expansionCount; e++)
+				AddItem(root.expansions + e, 0, 0, LinkType::Scan, None, None);
+		} else {
+			// nothing could scan the last input
+			if (_pending.empty())
+				return false;
+			for (uint32_t parent : _pending) {
+				Item item = _items[parent];
+				AddItem(item.expansion, item.dot + 1, item.origin, LinkType::Scan, parent, i - 1);
+			}
+			_pending.clear();
+		}
+
+		for (uint32_t k = _columns[i]; k < (uint32_t)_items.size(); k++) {
+			Item item = _items[k];
+			if (IsComplete(item))
+				Complete(k, i);
+			uint32_t next = NextSymbol(item);
+			if (next == None)
+				continue;
+			auto& node = _grammar.GetNode(next);
+			// sequence nodes are the tokens of the input, other terminals are never part of it
+			if (node.IsSequence()) {
+				if (i < length && input[i] == next)
+					_pending.push_back(k);
+			} else if (node.type == GrammarNode::NodeType::NonTerminal) {
+				_scratch.push_back({ next, k });
+				if (_predicted[next] != i + 1) {
+					_predicted[next] = i + 1;
+					for (uint32_t e = 0; e < node.expansionCount; e++)
+						AddItem(node.expansions + e, 0, i, LinkType::Scan, None, None);
+				}
+				if (_nullable[next] != None) {
+					auto& expansion = _grammar.GetExpansion(item.expansion);
+					if (expansion.regex == CompiledGrammar::None || (int32_t)item.dot < expansion.min)
+						AddItem(item.expansion, item.dot + 1, item.origin, LinkType::Nullable, k, next);
+				}
+			}
+		}
+
+		// the waiting items of the column are final, sort them for lookups by later completions
+		std::stable_sort(_scratch.begin(), _scratch.end(), [](const Waiting& lhs, const Waiting& rhs) { return lhs.symbol < rhs.symbol; });
+		_waitingBegin.push_back((uint32_t)_waiting.size());
+		_waiting.insert(_waiting.end(), _scratch.begin(), _scratch.end());
+		_leoIndex.resize(_waiting.size(), Unknown);
+		_scratch.clear();
+	}
+
+	for (uint32_t k = _columns[length]; k < (uint32_t)_items.size(); k++) {
+		auto& item = _items[k];
+		if (item.origin == 0 && _owner[item.expansion] == _grammar.GetRoot() && IsComplete(item)) {
+			_accepted = k;
+			break;
+		}
+	}
+	return _accepted != None;
+}
+
+bool EarleyParser::ExtractTree(std::vector<TreeNode>& tree)
+{
+	tree.clear();
+	if (_accepted == None)
+		return false;
+
+	enum class ChildType : uint8_t
+	{
+		Item,
+		Input,
+		Nullable,
+		/// <summary>
+		/// tree node that has already been created
+		/// </summary>
+		Node,
+	};
+	struct Child
+	{
+		ChildType type;
+		uint32_t value;
+	};
+	struct Task
+	{
+		Child child;
+		uint32_t tree;
+	};
+	std::vector<Task> stack;
+	std::vector<Child> children;
+	std::vector<uint32_t> chain;
+
+	// creates the nodes for [children], which are in reverse order, below [parent]
+	auto attach = [this, &tree, &stack, &children](uint32_t parent) {
+		uint32_t previous = None;
+		for (auto itr = children.rbegin(); itr != children.rend(); itr++) {
+			uint32_t index = itr->value;
+			if (itr->type != ChildType::Node) {
+				index = (uint32_t)tree.size();
+				switch (itr->type) {
+				case ChildType::Item:
+					tree.push_back({ _owner[_items[itr->value].expansion] });
+					break;
+				case ChildType::Input:
+					tree.push_back({ (*_input)[itr->value] });
+					break;
+				default:
+					tree.push_back({ itr->value });
+					break;
+				}
+				if (itr->type != ChildType::Input)
+					stack.push_back({ *itr, index });
+			}
+			if (previous == None)
+				tree[parent].child = index;
+			else
+				tree[previous].sibling = index;
+			previous = index;
+		}
+		children.clear();
+	};
+	// gathers the children [item] has advanced over by following the links that created it, followed by [last]
+	auto gather = [this, &children](uint32_t item, Child last) {
+		if (last.value != None)
+			children.push_back(last);
+		while (_items[item].dot > 0) {
+			auto& link = _links[_items[item].link];
+			switch (link.type) {
+			case LinkType::Scan:
+				children.push_back({ ChildType::Input, link.right });
+				break;
+			case LinkType::Complete:
+				children.push_back({ ChildType::Item, link.right });
+				break;
+			case LinkType::Nullable:
+				children.push_back({ ChildType::Nullable, link.right });
+				break;
+			case LinkType::Leo:
+				break;
+			}
+			item = link.left;
+		}
+	};
+
+	tree.push_back({ _owner[_items[_accepted].expansion] });
+	stack.push_back({ { ChildType::Item, _accepted }, 0 });
+	while (!stack.empty()) {
+		auto [child, parent] = stack.back();
+		stack.pop_back();
+		if (child.type == ChildType::Item) {
+			auto& item = _items[child.value];
+			if (item.link != None && _links[item.link].type == LinkType::Leo) {
+				// the item completes a chain of right recursive items, rebuild the skipped items from the top down
+				auto& link = _links[item.link];
+				chain.clear();
+				for (uint32_t leo = link.left; leo != None; leo = _leos[leo].next)
+					chain.push_back(leo);
+				for (size_t level = chain.size(); level-- > 0;) {
+					auto& leo = _leos[chain[level]];
+					if (level > 0) {
+						uint32_t below = (uint32_t)tree.size();
+						tree.push_back({ _owner[_items[_leos[chain[level - 1]].item].expansion] });
+						gather(leo.item, { ChildType::Node, below });
+						attach(parent);
+						parent = below;
+					} else {
+						gather(leo.item, { ChildType::Item, link.right });
+						attach(parent);
+					}
+				}
+			} else {
+				gather(child.value, { ChildType::Item, None });
+				attach(parent);
+			}
+		} else if (child.type == ChildType::Nullable) {
+			auto& expansion = _grammar.GetExpansion(_nullable[child.value]);
+			if (expansion.regex != CompiledGrammar::None) {
+				if (expansion.min > 0)
+					children.push_back({ ChildType::Nullable, expansion.regex });
+			} else {
+				auto nodes = _grammar.GetChildren(expansion);
+				for (uint32_t c = expansion.childCount; c-- > 0;)
+					children.push_back({ ChildType::Nullable, nodes[c] });
+			}
+			attach(parent);
+		}
+	}
+	return true;
+}
+
+size_t EarleyParser::MemorySize() const
+{
+	return sizeof(EarleyParser) + _owner.capacity() * sizeof(uint32_t) + _nullable.capacity() * sizeof(uint32_t) + _predicted.capacity() * sizeof(uint32_t) +
+	       _items.capacity() * sizeof(Item) + _links.capacity() * sizeof(Link) + _columns.capacity() * sizeof(uint32_t) + _table.capacity() * sizeof(uint32_t) +
+	       _pending.capacity() * sizeof(uint32_t) + _waiting.capacity() * sizeof(Waiting) + _waitingBegin.capacity() * sizeof(uint32_t) +
+	       _scratch.capacity() * sizeof(Waiting) + _leoIndex.capacity() * sizeof(uint32_t) + _leos.capacity() * sizeof(Leo) + _leoPath.capacity() * sizeof(uint32_t);
+}
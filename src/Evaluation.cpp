@@ -137,6 +137,10 @@ std::string Evaluation::PrintInput(std::shared_ptr<Input> input, std::string& st
 			tmp = _sessiondata->data->LookupFormID<Input>(tmp->GetParentID());
 		}
 	}
+	// the inputs and parents read from a lazily loaded save are dropped again, so that printing doesn't keep the
+	// whole save in memory
+	if (_data->IsLazyLoaded() && ++_printed % _evictEvery == 0)
+		_data->EvictLazyForms();
 	return str;
 }
 
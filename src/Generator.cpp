@@ -11,6 +11,20 @@
 
 static std::mt19937 randan((unsigned int)(std::chrono::system_clock::now().time_since_epoch().count()));
 
+/// <summary>
+/// returns the strategy used to derive a new input of [length] entries
+/// </summary>
+static DerivationTree::Strategy GetDerivationStrategy(std::shared_ptr<Settings> settings, int32_t length)
+{
+	auto strategy = (DerivationTree::Strategy)settings->generation.derivationStrategy;
+	// settings stored in older saves may contain strategies that cannot be set
+	if (strategy != DerivationTree::Strategy::Growing && strategy != DerivationTree::Strategy::LengthAware && strategy != DerivationTree::Strategy::Streaming)
+		strategy = DerivationTree::Strategy::LengthAware;
+	if (strategy == DerivationTree::Strategy::LengthAware && settings->generation.parallelDerivationThreshold > 0 && length >= settings->generation.parallelDerivationThreshold)
+		return DerivationTree::Strategy::Parallel;
+	return strategy;
+}
+
 Generator::~Generator()
 {
 	Clear();
@@ -129,59 +143,21 @@ void DummyGenerate(std::shared_ptr<Input>& input)
 
 void Generator::GenInputFromDevTree(std::shared_ptr<Input> input)
 {
-	if (input->derive->_root->Type() == DerivationTree::NodeType::Terminal) {
-		input->AddEntry(((DerivationTree::TerminalNode*)(input->derive->_root))->_content);
-	} else {
-		std::vector<DerivationTree::SequenceNode*> seqnodes;
-		seqnodes.reserve(input->derive->_sequenceNodes);
-		input->ReserveSequence(input->derive->_sequenceNodes);
-
-		std::stack<DerivationTree::NonTerminalNode*> stack;
-		stack.push((DerivationTree::NonTerminalNode*)(input->derive->_root));
-		DerivationTree::NonTerminalNode* tmp = nullptr;
-		DerivationTree::Node* ntmp = nullptr;
-
-		while (stack.size() > 0) {
-			tmp = stack.top();
-			stack.pop();
-			if (tmp->Type() == DerivationTree::NodeType::Sequence)
-				seqnodes.push_back((DerivationTree::SequenceNode*)tmp);
-			// push children in reverse order to stack: We explore from left to right
-			// skip terminal children, they cannot produce sequences
-			for (int32_t i = (int32_t)tmp->_children.size() - 1; i >= 0; i--) {
-				if (tmp->_children[i]->Type() != DerivationTree::NodeType::Terminal)
-					stack.push((DerivationTree::NonTerminalNode*)(tmp->_children[i]));
-			}
-		}
-		// we have found all sequence nodes
-		// now traverse each one from left to right with depth first search and patch together
-		// the individual _input sequences
-		std::stack<DerivationTree::Node*> nstack;
-		for (int32_t c = 0; c < (int32_t)seqnodes.size(); c++) {
-			std::string entry = "";
-			// push root node to stack
-			nstack.push(seqnodes[c]);
-			// gather _input fragments
-			while (nstack.size() > 0) {
-				ntmp = nstack.top();
-				nstack.pop();
-				// if the current child is terminal, it has to be left-most child in the remaining tree
-				// and gets added to the entry
-				if (ntmp->Type() == DerivationTree::NodeType::Terminal)
-					entry += ((DerivationTree::TerminalNode*)ntmp)->_content;
-				else {
-					tmp = (DerivationTree::NonTerminalNode*)ntmp;
-					// push children in reverse order: we traverse from left to right
-					for (int32_t i = (int32_t)tmp->_children.size() - 1; i >= 0; i--) {
-						nstack.push((tmp->_children[i]));
-					}
-				}
-			}
-			input->AddEntry(entry);
-			if (input->GetTrimmedLength() != -1 && (int64_t)input->GetSequenceLength() == input->GetTrimmedLength())
-				break;
-		}
-	}
+	thread_local DerivationTree::SequenceBuffer sequence;
+	sequence.Clear();
+	input->derive->EmitSequence(sequence);
+	AddSequence(input, sequence);
+}
+
+void Generator::AddSequence(std::shared_ptr<Input> input, const DerivationTree::SequenceBuffer& sequence)
+{
+	// trimmed inputs only regenerate the entries up to their trimmed length
+	int64_t trimmed = input->GetTrimmedLength();
+	int64_t length = (int64_t)input->GetSequenceLength();
+	if (trimmed != -1 && trimmed > length)
+		input->AddEntries(sequence, (size_t)(trimmed - length));
+	else
+		input->AddEntries(sequence);
 }
 
 bool Generator::BuildSequence(std::shared_ptr<Input> input)
@@ -205,19 +181,38 @@ bool Generator::BuildSequence(std::shared_ptr<Input> input)
 bool Generator::GenerateInputGrammar(std::shared_ptr<Input> input, std::shared_ptr<Grammar> gram, std::shared_ptr<SessionData> sessiondata)
 {
 	if (input->derive->_valid == false) {
+		int32_t sequencelen = 0;
+		uint32_t seed = 0;
 		if (input->derive && input->derive->GetRegenerate() == true) {
 			// we already generated the _input some time ago, so we will reuse the past generation parameters to
 			// regenerate the same derivation tree
-			int32_t sequencelen = input->derive->GetTargetLength();
-			uint32_t seed = input->derive->GetSeed();
-			gram->Derive(input->derive, sequencelen, seed);
+			sequencelen = input->derive->GetTargetLength();
+			seed = input->derive->GetSeed();
 		} else {
 			std::uniform_int_distribution<signed> dist(sessiondata->_settings->generation.generationLengthMin, sessiondata->_settings->generation.generationLengthMax);
-			int32_t sequencelen = dist(randan);
-			// derive a derivation tree from the grammar
-			gram->Derive(input->derive, sequencelen, (unsigned int)(std::chrono::system_clock::now().time_since_epoch().count()));
+			sequencelen = dist(randan);
+			seed = (unsigned int)(std::chrono::system_clock::now().time_since_epoch().count());
+			input->derive->SetStrategy(GetDerivationStrategy(sessiondata->_settings, sequencelen));
 			input->SetFlag(Input::Flags::GeneratedGrammar);
-			// gather the complete _input sequence
+		}
+		if (input->GetSequenceLength() > 0) {
+			// only the derivation tree is missing
+			gram->Derive(input->derive, sequencelen, seed);
+		} else {
+			// derive the tree and gather the complete _input sequence in one go
+			thread_local DerivationTree::SequenceBuffer sequence;
+			sequence.Clear();
+			bool keepTree = sessiondata->_settings->generation.keepDerivationTrees;
+			gram->Generate(input->derive, sequencelen, seed, sequence, keepTree);
+			AddSequence(input, sequence);
+			if (!keepTree) {
+				input->SetGenerated();
+				if ((int64_t)input->GetSequenceLength() != input->derive->_sequenceNodes && (!input->IsTrimmed() || (int64_t)input->GetSequenceLength() != input->GetTrimmedLength()))
+					logwarn("The input length is different from the generated sequence. Length: {}, Expected: {}, Trimmed: {}", input->GetSequenceLength(), input->derive->_sequenceNodes, input->GetTrimmedLength());
+				if ((int64_t)input->GetSequenceLength() == 0)
+					logwarn("The input length is 0.");
+				return true;
+			}
 		}
 	}
 	bool ret = BuildSequence(input);
@@ -318,6 +313,8 @@ bool Generator::Generate(std::shared_ptr<Input> input, std::shared_ptr<Input> pa
 					//if (partree)
 					//	par = sessiondata->data->LookupFormID<Input>(partree->_inputID);
 					par = sessiondata->data->LookupFormID<Input>(inp->GetParentID());
+					if (par)
+						par->IncRegenerationUses();
 				}
 				// check parent
 				if (!par || !par->derive) {
@@ -386,6 +383,7 @@ bool Generator::Generate(std::shared_ptr<Input> input, std::shared_ptr<Input> pa
 				return false;
 			} else {
 				parentflags.push_back(std::make_unique<FlagHolder<Input>>(par, Form::FormFlags::DoNotFree));
+				par->IncRegenerationUses();
 			}
 			if (par->GetGenerated() == false || par->GetSequenceLength() == 0) {
 				// we need to regenerate the parent, so push it onto the stack please
@@ -469,6 +467,7 @@ bool Generator::Generate(std::shared_ptr<Input> input, std::shared_ptr<Input> pa
 						// this is a new input
 						std::uniform_int_distribution<signed> dist(sessiondata->_settings->generation.generationLengthMin, sessiondata->_settings->generation.generationLengthMax);
 						int32_t sequencelen = dist(randan);
+						inp->derive->SetStrategy(GetDerivationStrategy(sessiondata->_settings, sequencelen));
 						// now extend input
 						if (inp->HasFlag(Input::Flags::GeneratedGrammarParentBacktrack)) {
 							int32_t backtrack = 0;
@@ -635,6 +634,7 @@ bool Generator::Generate(std::shared_ptr<Input>& input, std::shared_ptr<Grammar>
 						// this is a new input
 						std::uniform_int_distribution<signed> dist(sessiondata->_settings->generation.generationLengthMin, sessiondata->_settings->generation.generationLengthMax);
 						int32_t sequencelen = dist(randan);
+						input->derive->SetStrategy(GetDerivationStrategy(sessiondata->_settings, sequencelen));
 						// now extend input
 						if (input->HasFlag(Input::Flags::GeneratedGrammarParentBacktrack))
 							gram->Extend(parent, input->derive, true, sequencelen, (unsigned int)(std::chrono::system_clock::now().time_since_epoch().count()));
@@ -657,6 +657,7 @@ bool Generator::Generate(std::shared_ptr<Input>& input, std::shared_ptr<Grammar>
 					} else {
 						std::uniform_int_distribution<signed> dist(sessiondata->_settings->generation.generationLengthMin, sessiondata->_settings->generation.generationLengthMax);
 						int32_t sequencelen = dist(randan);
+						input->derive->SetStrategy(GetDerivationStrategy(sessiondata->_settings, sequencelen));
 						// derive a derivation tree from the grammar
 						gram->Derive(input->derive, sequencelen, (unsigned int)(std::chrono::system_clock::now().time_since_epoch().count()));
 						input->SetFlag(Input::Flags::GeneratedGrammar);
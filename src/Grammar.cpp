@@ -6,8 +6,12 @@
 #include "EarleyParser.h"
 #include "Data.h"
 #include "Input.h"
-#include "Allocators.h"
+#include "CompiledGrammar.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <stack>
 #include <random>
 
@@ -427,7 +431,16 @@ void GrammarTree::Clear()
 			dynamic_pointer_cast<GrammarExpansionRegex>(expansion)->_node.reset();
 	}
 	_hashmap_expansions.clear();
+	_identifiers.clear();
 	_root.reset();
+	_compiled.reset();
+}
+
+void GrammarTree::Compile()
+{
+	_compiled.reset();
+	if (_valid && _root)
+		_compiled = CompiledGrammar::Compile(*this);
 }
 
 bool GrammarTree::IsValid()
@@ -452,6 +465,7 @@ void GrammarTree::SetRoot(std::string symbol, std::string derivation)
 	_root->_type = GrammarNode::NodeType::Terminal;
 	_root->_id = GetNextID();
 	_nonterminals.insert(_root);
+	AddIdentifier(_root);
 	_ruleorder.push_back(_root->_id);
 }
 
@@ -475,6 +489,7 @@ void GrammarTree::AddSymbol(std::string symbol, std::string derivation)
 	node->_type = GrammarNode::NodeType::NonTerminal;
 	node->_id = GetNextID();
 	_nonterminals.insert(node);
+	AddIdentifier(node);
 	_ruleorder.push_back(node->_id);
 }
 
@@ -492,11 +507,23 @@ void GrammarTree::AddSequenceSymbol(std::string symbol, std::string derivation)
 	node->_type = GrammarNode::NodeType::Sequence;
 	node->_id = GetNextID();
 	_nonterminals.insert(node);
+	AddIdentifier(node);
 	_ruleorder.push_back(node->_id);
 }
 
+void GrammarTree::AddIdentifier(std::shared_ptr<GrammarNode> node)
+{
+	// the first node with an identifier is found, unless it has been removed since
+	auto [itr, inserted] = _identifiers.try_emplace(node->_identifier, node);
+	if (!inserted && itr->second.expired())
+		itr->second = node;
+}
+
 std::shared_ptr<GrammarNode> GrammarTree::FindNode(std::string identifier)
 {
+	if (auto itr = _identifiers.find(identifier); itr != _identifiers.end())
+		if (auto node = itr->second.lock(); node && _nonterminals.contains(node))
+			return node;
 	std::string symbols;
 	for (auto& node : _nonterminals) {
 		symbols += "|" + node->_identifier;
@@ -605,7 +632,7 @@ void GrammarTree::Construct()
 	}
 
 	// gather all flags for all tree nodes
-	GatherFlags(_root, {}, true);
+	GatherFlags();
 
 	// prune tree to valid expansion and nodes
 	Prune();
@@ -642,162 +669,266 @@ float GrammarTree::GetWeight(std::string production)
 	return -1.0f;
 }
 
-// list of nodes that have been fully explored
-std::set<uint64_t> finished_ids;
-
-void GrammarTree::GatherFlags(std::shared_ptr<GrammarNode> node, std::set<uint64_t> path, bool reset)
+std::vector<std::vector<GrammarNode*>> GrammarTree::FindCycles()
 {
-	// define terminal patterns
-	static std::regex class_pattern("[:.*:]");
-	static std::regex class_pattern_ascii("[:ascii:]");
-	static std::regex class_pattern_alpha("[:alpha:]");
-	static std::regex class_pattern_alnum("[:alnum:]");
-	static std::regex class_pattern_digit("[:digit:]");
+	std::vector<std::vector<GrammarNode*>> components;
+	_numcycles = 0;
+	if (!_root)
+		return components;
 
-	// if we are starting of from a new non-recursive function call, delete prior finished ids
-	StartProfiling;
-	if (reset) {
-		loginfo("enter");
-		finished_ids.clear();
-		for (auto [id, nd] : _hashmap) {
-			nd->_reachable = false;
-			nd->_producing = false;
-			nd->_remove = false;
-			nd->_flags = 0;
-		}
-		for (auto [id, exp] : _hashmap_expansions)
-		{
-			exp->_flags = 0;
-			exp->_producing = false;
-			exp->_remove = false;
-		}
-		TimeProfiling = std::chrono::steady_clock::now();
-	}
-	// this node is reachable
-	node->_reachable = true;
-	// add node to path
-	path.insert(node->_id);
-	// if this is a terminal, it was reached and it is producing
-	if (node->IsLeaf()) {
-		node->_producing = true;
-		finished_ids.insert(node->_id);
-		if (std::regex_search(node->_identifier, class_pattern)) {
-			node->_flags |= GrammarNode::NodeFlags::TerminalCharClass;
-			if (std::regex_search(node->_identifier, class_pattern_ascii)) {
-				node->_flags |= GrammarNode::NodeFlags::TerminalCharClassAscii;
-			} else if (std::regex_search(node->_identifier, class_pattern_alpha)) {
-				node->_flags |= GrammarNode::NodeFlags::TerminalCharClassAlpha;
-			} else if (std::regex_search(node->_identifier, class_pattern_alnum)) {
-				node->_flags |= GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric;
-			} else if (std::regex_search(node->_identifier, class_pattern_digit)) {
-				node->_flags |= GrammarNode::NodeFlags::TerminalCharClassDigit;
+	struct Info
+	{
+		uint32_t index = 0;
+		uint32_t lowlink = 0;
+		bool onstack = false;
+	};
+	std::unordered_map<GrammarNode*, Info> info;
+	// nodes whose component hasn't been completed yet
+	std::vector<GrammarNode*> stack;
+	// explicit call stack of the depth-first search, with the position of the next child to visit
+	struct Frame
+	{
+		GrammarNode* node;
+		size_t expansion;
+		size_t child;
+	};
+	std::vector<Frame> frames;
+
+	// returns the next child of the node in [frame], or nullptr once all children have been visited
+	auto next = [](Frame& frame) -> GrammarNode* {
+		while (frame.expansion < frame.node->_expansions.size()) {
+			auto& expansion = frame.node->_expansions[frame.expansion];
+			if (frame.child < expansion->_nodes.size())
+				return expansion->_nodes[frame.child++].get();
+			if (frame.child == expansion->_nodes.size() && expansion->IsRegex()) {
+				frame.child++;
+				if (auto& node = ((GrammarExpansionRegex*)expansion.get())->_node)
+					return node.get();
 			}
+			frame.expansion++;
+			frame.child = 0;
 		}
-		return;
-	}
-	std::set<std::shared_ptr<GrammarExpansion>> skip;
-	// otherwise this is a
-	for (auto expansion : node->_expansions) {
-		if (finished_ids.contains(expansion->_id) == false) {
-			if (path.contains(expansion->_id)) {
-				// if the expansion is not finished, but it is already on our path
-				// we have encountered a cycle. This cycle can be resolved quite easily
-				// by knowing that an expansion is only producing if all of its nodes are
-				// producing. If its our only expansion than we cannot be producing ourselves
-				// so just skip this expansion when collecting information later
-				skip.insert(expansion);
-			} else
-				GatherFlags(expansion, path);
+		return nullptr;
+	};
+	auto derivesItself = [](GrammarNode* node) {
+		for (auto& expansion : node->_expansions) {
+			for (auto& child : expansion->_nodes)
+				if (child.get() == node)
+					return true;
+			if (expansion->IsRegex() && ((GrammarExpansionRegex*)expansion.get())->_node.get() == node)
+				return true;
+		}
+		return false;
+	};
+	uint32_t counter = 0;
+	auto visit = [&](GrammarNode* node) {
+		node->_reachable = true;
+		info[node] = { counter, counter, true };
+		counter++;
+		stack.push_back(node);
+		frames.push_back({ node, 0, 0 });
+	};
+
+	visit(_root.get());
+	while (!frames.empty()) {
+		auto& frame = frames.back();
+		if (GrammarNode* child = next(frame)) {
+			if (auto itr = info.find(child); itr == info.end())
+				visit(child);
+			else if (itr->second.onstack) {
+				auto& ninfo = info[frame.node];
+				ninfo.lowlink = std::min(ninfo.lowlink, itr->second.index);
+			}
+			continue;
+		}
+		// all children have been visited
+		GrammarNode* node = frame.node;
+		frames.pop_back();
+		auto& ninfo = info[node];
+		if (!frames.empty()) {
+			auto& pinfo = info[frames.back().node];
+			pinfo.lowlink = std::min(pinfo.lowlink, ninfo.lowlink);
+		}
+		if (ninfo.lowlink == ninfo.index) {
+			// the node is the first visited node of its component, which consists of the nodes above it on the stack
+			auto& component = components.emplace_back();
+			GrammarNode* member = nullptr;
+			do {
+				member = stack.back();
+				stack.pop_back();
+				info[member].onstack = false;
+				component.push_back(member);
+			} while (member != node);
+			if (component.size() > 1 || derivesItself(node))
+				_numcycles++;
 		}
 	}
-	// collect information from expansions;
-	// the node is producing if at least one of its expansions is producing
-	node->_producing = false;
-	node->_flags = [&node]() {
+	return components;
+}
+
+void GrammarTree::GatherFlags()
+{
+	// terminals of the form [:class:] produce single characters of the class
+	auto classFlags = [](std::string_view identifier) -> EnumType {
+		auto begin = identifier.find("[:");
+		if (begin == std::string_view::npos || identifier.find(":]", begin + 2) == std::string_view::npos)
+			return 0;
+		EnumType flags = GrammarNode::NodeFlags::TerminalCharClass;
+		if (identifier.find("[:ascii:]") != std::string_view::npos)
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAscii;
+		else if (identifier.find("[:alpha:]") != std::string_view::npos)
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAlpha;
+		else if (identifier.find("[:alnum:]") != std::string_view::npos)
+			flags |= GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric;
+		else if (identifier.find("[:digit:]") != std::string_view::npos)
+			flags |= GrammarNode::NodeFlags::TerminalCharClassDigit;
+		return flags;
+	};
+
+	StartProfiling;
+	loginfo("enter");
+	for (auto [id, nd] : _hashmap) {
+		nd->_reachable = false;
+		nd->_producing = false;
+		nd->_remove = false;
+		nd->_flags = 0;
+	}
+	for (auto [id, exp] : _hashmap_expansions) {
+		exp->_flags = 0;
+		exp->_producing = false;
+		exp->_remove = false;
+		exp->_nonterminals = 0;
+		exp->_seqnonterminals = 0;
+		exp->_terminals = 0;
+	}
+
+	// components are ordered so that all nodes a component derives into are in earlier components
+	auto components = FindCycles();
+
+	auto typeFlags = [](GrammarNode* node) {
 		switch (node->_type) {
 		case GrammarNode::NodeType::NonTerminal:
 			return GrammarNode::NodeFlags::ProduceNonTerminals;
-			break;
 		case GrammarNode::NodeType::Sequence:
 			return GrammarNode::NodeFlags::ProduceSequence;
-			break;
 		case GrammarNode::NodeType::Terminal:
 			return GrammarNode::NodeFlags::ProduceTerminals;
-			break;
 		}
 		return GrammarNode::NodeFlags::ProduceTerminals;
-	}();
-	for (int32_t i = 0; i < (int)(node->_expansions.size()); i++) {
-		if (skip.contains(node->_expansions[i]))  // skip cycling expansions
-			continue;
-		node->_producing |= node->_expansions[i]->_producing;
-		node->_flags |= node->_expansions[i]->_flags;
-	}
-	finished_ids.insert(node->_id);
+	};
+	// an expansion produces everything its nodes produce
+	auto expansionFlags = [&typeFlags](GrammarExpansion* expansion) {
+		EnumType flags = 0;
+		for (auto& node : expansion->_nodes)
+			flags |= node->_flags | typeFlags(node.get());
+		if (expansion->IsRegex()) {
+			auto regex = (GrammarExpansionRegex*)expansion;
+			if (regex->_node)
+				flags |= regex->_node->_flags | typeFlags(regex->_node.get());
+			if (regex->_min == 0)
+				flags |= GrammarNode::NodeFlags::ProduceEmptyWord;
+		} else if (expansion->_nodes.size() == 0)
+			flags |= GrammarNode::NodeFlags::ProduceEmptyWord;
+		return flags;
+	};
 
-	if (reset)
-	{
-		loginfo("exit");
-		profile(TimeProfiling, "function execution time");
+	// flags of nodes on a cycle depend on each other, so they are propagated through the component until they are
+	// stable. As flags are only ever added, this takes at most as many passes as there are flags
+	for (auto& component : components) {
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (auto node : component) {
+				if (node->IsLeaf()) {
+					node->_flags |= classFlags(node->_identifier);
+					continue;
+				}
+				EnumType flags = typeFlags(node);
+				for (auto& expansion : node->_expansions) {
+					expansion->_flags = expansionFlags(expansion.get());
+					flags |= expansion->_flags;
+				}
+				if (flags != node->_flags) {
+					node->_flags = flags;
+					changed = true;
+				}
+			}
+		}
 	}
-}
 
-void GrammarTree::GatherFlags(std::shared_ptr<GrammarExpansion> expansion, std::set<uint64_t> path)
-{
-	// add expansion to path
-	path.insert(expansion->_id);
-	// the expansion is only producing if and only if ALL its nodes are also producing
-	expansion->_producing = true;
-	for (int32_t i = 0; i < expansion->_nodes.size(); i++) {
-		if (finished_ids.contains(expansion->_nodes[i]->_id) == false) {
-			GatherFlags(expansion->_nodes[i], path);
+	// an expansion is producing once all of its nodes are producing, and a node once one of its expansions is.
+	// Starting from the terminals, nodes are handled once they become producing
+	std::unordered_map<GrammarExpansion*, size_t> missing;
+	std::vector<GrammarNode*> worklist;
+	auto setProducing = [&worklist](GrammarExpansion* expansion) {
+		expansion->_producing = true;
+		if (auto& parent = expansion->_parent; parent && parent->_producing == false) {
+			parent->_producing = true;
+			worklist.push_back(parent.get());
 		}
-		expansion->_producing &= expansion->_nodes[i]->_producing;
-		expansion->_flags |= expansion->_nodes[i]->_flags;
-		switch (expansion->_nodes[i]->_type)
-		{
-		case GrammarNode::NodeType::NonTerminal:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceNonTerminals;
-			expansion->_nonterminals++;
-			break;
-		case GrammarNode::NodeType::Sequence:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceSequence;
-			break;
-		case GrammarNode::NodeType::Terminal:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceTerminals;
-			expansion->_terminals++;
-			break;
+	};
+	for (auto& component : components) {
+		for (auto node : component) {
+			if (node->IsLeaf()) {
+				node->_producing = true;
+				worklist.push_back(node);
+			}
+			for (auto& expansion : node->_expansions) {
+				size_t count = expansion->_nodes.size();
+				if (expansion->IsRegex() && ((GrammarExpansionRegex*)expansion.get())->_node)
+					count++;
+				missing.insert({ expansion.get(), count });
+			}
 		}
-		if (expansion->_nodes[i]->_flags & GrammarNode::NodeFlags::ProduceSequence)
-			expansion->_seqnonterminals++;
 	}
-	if (expansion->IsRegex()) {
-		auto regex = dynamic_pointer_cast<GrammarExpansionRegex>(expansion);
-		if (finished_ids.contains(regex->_node->_id) == false)
-			GatherFlags(regex->_node, path);
-		expansion->_producing &= regex->_node->_producing;
-		expansion->_flags |= regex->_node->_flags;
-		switch (regex->_node->_type) {
-		case GrammarNode::NodeType::NonTerminal:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceNonTerminals;
-			expansion->_nonterminals++;
-			break;
-		case GrammarNode::NodeType::Sequence:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceSequence;
-			break;
-		case GrammarNode::NodeType::Terminal:
-			expansion->_flags |= GrammarNode::NodeFlags::ProduceTerminals;
-			expansion->_terminals++;
-			break;
+	for (auto& [expansion, count] : missing)
+		if (count == 0)
+			setProducing(expansion);
+	while (!worklist.empty()) {
+		auto node = worklist.back();
+		worklist.pop_back();
+		for (auto& parent : node->_parents) {
+			auto itr = missing.find(parent.get());
+			if (itr == missing.end() || itr->second == 0)
+				continue;
+			// the node may occur multiple times in the expansion
+			size_t occurrences = std::count_if(parent->_nodes.begin(), parent->_nodes.end(), [node](auto& child) { return child.get() == node; });
+			if (parent->IsRegex() && ((GrammarExpansionRegex*)parent.get())->_node.get() == node)
+				occurrences++;
+			itr->second -= std::min(occurrences, itr->second);
+			if (itr->second == 0)
+				setProducing(parent.get());
+		}
+	}
+
+	// count the kinds of nodes in each expansion, now that all flags are known
+	for (auto& component : components) {
+		for (auto node : component) {
+			for (auto& expansion : node->_expansions) {
+				auto count = [&expansion](GrammarNode* child) {
+					switch (child->_type) {
+					case GrammarNode::NodeType::NonTerminal:
+						expansion->_nonterminals++;
+						break;
+					case GrammarNode::NodeType::Sequence:
+						break;
+					case GrammarNode::NodeType::Terminal:
+						expansion->_terminals++;
+						break;
+					}
+					if (child->_flags & GrammarNode::NodeFlags::ProduceSequence)
+						expansion->_seqnonterminals++;
+				};
+				for (auto& child : expansion->_nodes)
+					count(child.get());
+				if (expansion->IsRegex() && ((GrammarExpansionRegex*)expansion.get())->_node)
+					count(((GrammarExpansionRegex*)expansion.get())->_node.get());
+			}
 		}
-		if (regex->_node->_flags & GrammarNode::NodeFlags::ProduceSequence)
-			expansion->_seqnonterminals++;
 	}
-	if (expansion->IsRegex() == false && expansion->_nodes.size() == 0)
-		expansion->_flags |= GrammarNode::NodeFlags::ProduceEmptyWord;
-	if (expansion->IsRegex() && dynamic_pointer_cast<GrammarExpansionRegex>(expansion)->_min == 0)
-		expansion->_flags |= GrammarNode::NodeFlags::ProduceEmptyWord;
-	finished_ids.insert(expansion->_id);
+
+	loginfo("exit");
+	profile(TimeProfiling, "function execution time");
 }
 
 void GrammarTree::Prune(bool pruneall)
@@ -1139,7 +1270,7 @@ void GrammarTree::InsertParseNodes()
 		_root = (*(_root->_parents.begin()))->_parent;
 
 	// as we have inserted a lot of stuff, call gather flags so the tree is consistent
-	GatherFlags(_root, {}, true);
+	GatherFlags();
 }
 
 void GrammarTree::FixRoot()
@@ -1173,7 +1304,7 @@ void GrammarTree::FixRoot()
 
 		_root = node;
 
-		GatherFlags(_root, {}, true);
+		GatherFlags();
 	}
 }
 
@@ -1436,7 +1567,7 @@ bool GrammarTree::CheckForSequenceSimplicityAndSimplify()
 		}
 
 		// gather all flags for all tree nodes
-		GatherFlags(_root, {}, true);
+		GatherFlags();
 
 		// prune tree to valid expansion and nodes
 		Prune();
@@ -1450,7 +1581,7 @@ bool GrammarTree::CheckForSequenceSimplicityAndSimplify()
 
 size_t GrammarTree::MemorySize()
 {
-	return sizeof(GrammarTree) + _nonterminals.size() * sizeof(std::shared_ptr<GrammarNode>) + _terminals.size() * sizeof(std::shared_ptr<GrammarNode>) + _hashmap.size() * sizeof(std::pair<uint64_t, std::shared_ptr<GrammarNode>>) + _hashmap_expansions.size() * sizeof(std::pair<uint64_t, std::shared_ptr<GrammarExpansion>>) + _ruleorder.size() * sizeof(uint64_t) + _hashmap_parsenodes.size() * sizeof(uint64_t);
+	return sizeof(GrammarTree) + _nonterminals.size() * sizeof(std::shared_ptr<GrammarNode>) + _terminals.size() * sizeof(std::shared_ptr<GrammarNode>) + _hashmap.size() * sizeof(std::pair<uint64_t, std::shared_ptr<GrammarNode>>) + _hashmap_expansions.size() * sizeof(std::pair<uint64_t, std::shared_ptr<GrammarExpansion>>) + _ruleorder.size() * sizeof(uint64_t) + _hashmap_parsenodes.size() * sizeof(uint64_t) + (_compiled ? _compiled->MemorySize() : 0);
 }
 
 void Grammar::ParseScala(std::filesystem::path path)
@@ -1567,12 +1698,15 @@ void Grammar::ParseScala(std::filesystem::path path)
 		if (_tree->IsValid()) {
 			loginfo("Successfully read the grammar from file: {}", path.string());
 
+			_tree->Compile();
+
 			// only if the grammar isn't simple
 			if (_tree->_simpleGrammar == false) {
 				// now construct tree for parsing
 				_treeParse = std::make_shared<GrammarTree>();
 				_tree->DeepCopy(_treeParse);
 				_treeParse->InsertParseNodes();
+				_treeParse->Compile();
 			}
 		} else
 			logcritical("The file {} does not contain a valid grammar", path.string());
@@ -1632,8 +1766,6 @@ void Grammar::Extract(std::shared_ptr<DerivationTree> stree, std::shared_ptr<Der
 	{
 		StartProfiling;
 
-		auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-
 		// simple grammar
 		// yay no earleyparser
 		// just copy tree and check that it fits our regexes
@@ -1644,28 +1776,13 @@ void Grammar::Extract(std::shared_ptr<DerivationTree> stree, std::shared_ptr<Der
 		dtree->SetGrammarID(stree->GetGrammarID());
 
 		// gather the sequence nodes of the source tree
-		std::vector<DerivationTree::SequenceNode*> seqnodes;
+		std::vector<DerivationTree::NodeIndex> seqnodes;
 		seqnodes.reserve(stree->_sequenceNodes);
-		std::stack<DerivationTree::NonTerminalNode*> stacks;
-		stacks.push((DerivationTree::NonTerminalNode*)(stree->_root));
-		DerivationTree::NonTerminalNode* tmp = nullptr;
-
-		while (stacks.size() > 0) {
-			tmp = stacks.top();
-			stacks.pop();
-			if (tmp == nullptr) {
-				logcritical("stree has become empty");
-				return;
-			}
-			if (tmp->Type() == DerivationTree::NodeType::Sequence)
-				seqnodes.push_back((DerivationTree::SequenceNode*)tmp);
-			// push children in reverse order to stack: We explore from left to right
-			// skip terminal children, they cannot produce sequences
-			for (int32_t i = (int32_t)tmp->_children.size() - 1; i >= 0; i--) {
-				if (tmp->_children[i]->Type() != DerivationTree::NodeType::Terminal)
-					stacks.push((DerivationTree::NonTerminalNode*)(tmp->_children[i]));
-			}
+		if (stree->_root == DerivationTree::NoNode) {
+			logcritical("stree has become empty");
+			return;
 		}
+		stree->GatherSequenceNodes(stree->_root, seqnodes);
 		if ((int64_t)seqnodes.size() != stree->_sequenceNodes) {
 			logwarn("Danger");
 			return;
@@ -1674,36 +1791,26 @@ void Grammar::Extract(std::shared_ptr<DerivationTree> stree, std::shared_ptr<Der
 		profile(TimeProfiling, "{}: gathered sequence nodes", Utility::PrintForm(dtree));
 		// sequence nodes are in order
 
-		
-		if (!stree) {
-			logcritical("stree has become empty");
-			return;
-		}
-
-		std::vector<DerivationTree::SequenceNode*> targetnodes;
+		// dtree shares the nodes of stree, the copies of the sequence nodes refer to the subtrees of stree and are
+		// attached to the root once they fit the grammar
+		std::vector<DerivationTree::NodeIndex> targetnodes;
 		targetnodes.reserve(stree->_sequenceNodes);
-		std::vector<std::vector<DerivationTree::Node*>> targetnodesvec;
-		targetnodesvec.reserve(stree->_nodes);
+		dtree->ShareNodes(*stree);
+		dtree->ReserveNodes(stree->_sequenceNodes + 1);
 		if (complement)
 		{
 			int64_t idx = 0;
 			size_t segidx = 0;
 			while (idx < stop && segidx < segments.size()) {
 				while (idx < stop && idx < segments[segidx].first) {
-					//auto [cnode, cnodes] = seqnodes[idx]->CopyRecursive();
-					auto [cnode, cnodes] = seqnodes[idx]->CopyRecursiveAlloc(allocators);
-					targetnodes.push_back((DerivationTree::SequenceNode*)cnode);
-					targetnodesvec.push_back(cnodes);
+					targetnodes.push_back(dtree->ShareSubtree(seqnodes[idx]));
 					idx++;
 				}
 				idx = segments[segidx].first + segments[segidx].second;
 				segidx++;
 			}
 			while (idx < stop) {
-				//auto [cnode, cnodes] = seqnodes[idx]->CopyRecursive();
-				auto [cnode, cnodes] = seqnodes[idx]->CopyRecursiveAlloc(allocators);
-				targetnodes.push_back((DerivationTree::SequenceNode*)cnode);
-				targetnodesvec.push_back(cnodes);
+				targetnodes.push_back(dtree->ShareSubtree(seqnodes[idx]));
 				idx++;
 			}
 
@@ -1716,43 +1823,33 @@ void Grammar::Extract(std::shared_ptr<DerivationTree> stree, std::shared_ptr<Der
 					return;
 				}
 				for (int64_t c = segments[i].first; c < segments[i].first + segments[i].second; c++)
-				{
-					//auto [cnode, cnodes] = seqnodes[c]->CopyRecursive();
-					auto [cnode, cnodes] = seqnodes[c]->CopyRecursiveAlloc(allocators);
-					targetnodes.push_back((DerivationTree::SequenceNode*)cnode);
-					targetnodesvec.push_back(cnodes);
-				}
+					targetnodes.push_back(dtree->ShareSubtree(seqnodes[c]));
 			}
 		}
 
-		profile(TimeProfiling, "{}: copied nodes", Utility::PrintForm(dtree));
+		profile(TimeProfiling, "{}: shared nodes", Utility::PrintForm(dtree));
 
 		// got all nodes
 		// we know that our grammar is simple, so our tree root is a regex that derives all the nodes
-		
-		if (targetnodes.size() > 0 && _tree->_root->_expansions.size() == 1 && _tree->_root->_expansions[0]->IsRegex() && dynamic_pointer_cast<GrammarExpansionRegex>(_tree->_root->_expansions[0])->_node->_id == targetnodes[0]->_grammarID)
+		auto compiled = _tree->_compiled;
+		if (!compiled) {
+			logcritical("Cannot extract with grammar {} as it hasn't been compiled", Utility::GetHex(_formid));
+			return;
+		}
+		auto& groot = compiled->GetNode(compiled->GetRoot());
+		if (targetnodes.size() > 0 && groot.expansionCount == 1 && compiled->GetExpansion(groot, 0).regex != CompiledGrammar::None && compiled->GetNode(compiled->GetExpansion(groot, 0).regex).id == dtree->GetNode(targetnodes[0])._grammarID)
 		{
 			bool same = true;
 			// check whether all nodes are the same
 			for (size_t i = 0; i < targetnodes.size(); i++)
-				same &= (targetnodes[0]->_grammarID == targetnodes[i]->_grammarID);
+				same &= (dtree->GetNode(targetnodes[0])._grammarID == dtree->GetNode(targetnodes[i])._grammarID);
 			if (same)
 			{
 				// build derivation tree
-				DerivationTree::NonTerminalNode* droot = allocators->DerivationTree_NonTerminalNode()->New();
-				//DerivationTree::NonTerminalNode* droot = DerivationTree::NonTerminalNode();
-				droot->_grammarID = _tree->_root->_id;
+				DerivationTree::NodeIndex droot = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, groot.id);
 				dtree->_root = droot;
-				dtree->_nodes++;
-				droot->_children.resize(targetnodes.size());
-				for (size_t c = 0; c < targetnodes.size(); c++) {
-					//auto [cnode, cnodes] = targetnodes[c]->CopyRecursive();
-					//droot->_children[c] = targetnodes[c];
-					droot->SetChild(c, targetnodes[c]);
-					dtree->_nodes += targetnodesvec[c].size();
-					//for (auto x : targetnodesvec[c])
-					//	dtree->_nodes++;
-				}
+				for (size_t c = 0; c < targetnodes.size(); c++)
+					dtree->AddChild(droot, targetnodes[c]);
 
 				dtree->_valid = true;
 				dtree->SetRegenerate(true);
@@ -1774,121 +1871,92 @@ void Grammar::ExtractEarley(std::shared_ptr<DerivationTree> stree, std::shared_p
 	dtree->SetGrammarID(stree->GetGrammarID());
 
 	// gather the sequence nodes of the source tree
-	std::vector<DerivationTree::SequenceNode*> seqnodes;
-	std::stack<DerivationTree::NonTerminalNode*> stacks;
-	stacks.push((DerivationTree::NonTerminalNode*)(stree->_root));
-	DerivationTree::NonTerminalNode* tmp = nullptr;
-
-	while (stacks.size() > 0) {
-		tmp = stacks.top();
-		stacks.pop();
-		if (tmp->Type() == DerivationTree::NodeType::Sequence)
-			seqnodes.push_back((DerivationTree::SequenceNode*)tmp);
-		// push children in reverse order to stack: We explore from left to right
-		// skip terminal children, they cannot produce sequences
-		for (int32_t i = (int32_t)tmp->_children.size() - 1; i >= 0; i--) {
-			if (tmp->_children[i]->Type() != DerivationTree::NodeType::Terminal)
-				stacks.push((DerivationTree::NonTerminalNode*)(tmp->_children[i]));
-		}
-	}
+	std::vector<DerivationTree::NodeIndex> seqnodes;
+	stree->GatherSequenceNodes(stree->_root, seqnodes);
 	// sequence nodes are in order
 
-	EarleyParser parser;
-	std::vector<DerivationTree::SequenceNode*> targetnodes;
-
-	for (int64_t i = 0; i < stop; i++) {
-		if (complement) {
-			if (i < begin || i >= begin + length) {
-				parser.inputVector.push_back(_treeParse->_hashmap.at(seqnodes[i]->_grammarID));
-				targetnodes.push_back(seqnodes[i]);
-			}
-		} else {
-			if (i >= begin && i < begin + length) {
-				parser.inputVector.push_back(_treeParse->_hashmap.at(seqnodes[i]->_grammarID));
-				targetnodes.push_back(seqnodes[i]);
-			}
+	// the input are the compiled nodes of the selected sequence nodes
+	auto compiled = _treeParse ? _treeParse->_compiled : nullptr;
+	std::vector<uint32_t> input;
+	std::vector<DerivationTree::NodeIndex> targetnodes;
+	bool known = compiled != nullptr;
+	for (int64_t i = 0; i < stop && known; i++) {
+		if ((i >= begin && i < begin + length) != complement) {
+			uint32_t node = compiled->Find(stree->GetNode(seqnodes[i])._grammarID);
+			known = node != CompiledGrammar::None;
+			input.push_back(node);
+			targetnodes.push_back(seqnodes[i]);
 		}
 	}
-	parser.initialize(false);
-	parser.createChart(_treeParse->_root);
 	// we have the correct sequence we want to create
 	// now find a parse tree that supports it
+	std::vector<EarleyParser::TreeNode> forest;
+	if (known) {
+		EarleyParser parser(*compiled);
+		if (parser.Parse(input))
+			parser.ExtractTree(forest);
+	}
 
-	parser.parse();
-	auto forest = parser.returnParsingTrees(_treeParse->_root);
-
-	// check wether there is at least one tree in the forest
-	if (forest->size() < 1) {
+	// check wether there is a valid derivation
+	if (forest.size() < 1) {
 		// there is no valid derivation, so set dest tree to invalid and return
 		dtree->_valid = false;
 		dtree->SetRegenerate(false);
 		return;
 	}
 
-	// there is at least one valid derivation, so just take the first there is and be done with it
-	// construct the derivation tree
-
+	// construct the derivation tree from the extracted parse tree
 	// traversing the parseTree from left to right will result in the corresponding derivation tree
-	// we want
+	// we want. The subtrees of the target nodes are shared with stree
+	dtree->ShareNodes(*stree);
 	int64_t targetnodesIndex = 0;
+	auto isParseNode = [this](const CompiledGrammar::Node& node) {
+		return _treeParse->_hashmap_parsenodes.find(node.id) != _treeParse->_hashmap_parsenodes.end();
+	};
 
-	auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-	auto allocNonT = allocators->DerivationTree_NonTerminalNode();
-	auto allocSeq = allocators->DerivationTree_SequenceNode();
-
-	Node* proot = forest->at(0);
-	//DerivationTree::NonTerminalNode* droot = new DerivationTree::NonTerminalNode();
-	DerivationTree::NonTerminalNode* droot = allocNonT->New();
-	droot->_grammarID = proot->getGrammarElement()->_id;
+	DerivationTree::NodeIndex droot = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, compiled->GetNode(forest[0].node).id);
 	dtree->_root = droot;
-	dtree->_nodes++;
-	std::stack<std::pair<Node*, DerivationTree::NonTerminalNode*>> stack;
-	DerivationTree::NonTerminalNode* ntmp = nullptr;
-	stack.push({ proot, droot });
+	std::stack<std::pair<uint32_t, DerivationTree::NodeIndex>> stack;
+	std::vector<std::pair<uint32_t, DerivationTree::NodeIndex>> created;
+	stack.push({ 0, droot });
 	while (stack.size() > 0)
 	{
 		auto [pnode, dnode] = stack.top();
 		stack.pop();
-		auto children = pnode->getChildren();
+		auto& gnode = compiled->GetNode(forest[pnode].node);
 		// check whether pnode is a parse node, if thats the case replace it by the original node
 		// and put it back onto the stack
-		if (_treeParse->_hashmap_parsenodes.find(pnode->getGrammarElement()->_id) != _treeParse->_hashmap_parsenodes.end())
-			stack.push({ children[0], dnode }); // there is only one child by definition
-		else if (pnode->getGrammarElement()->IsSequence()) {
-			// we have found the currently left most seqnode, so copy that one and all their children and childrens children, etc.
-			// to the dnode
-			dnode->_grammarID = targetnodes[targetnodesIndex]->_grammarID;
-			for (auto child : targetnodes[targetnodesIndex]->_children) {
-				//auto [cnode, cnodes] = child->CopyRecursive();
-				auto [cnode, cnodes] = child->CopyRecursiveAlloc(allocators);
-				dnode->AddChild(cnode);
-				// not available in linux (barf)
-				//dtree->_nodes.insert_range(cnodes);
-				for (auto x : cnodes)
-					dtree->_nodes++;
-			}
+		if (isParseNode(gnode))
+			stack.push({ forest[pnode].child, dnode });  // there is only one child by definition
+		else if (gnode.IsSequence()) {
+			// we have found the currently left most seqnode, so the dnode takes its place and refers to its children
+			auto& target = stree->GetNode(targetnodes[targetnodesIndex]);
+			auto& node = dtree->GetOwnNode(dnode);
+			node._grammarID = target._grammarID;
+			node._child = target._child;
+			node._last = target._last;
 			targetnodesIndex++;
 		}
 		else
 		{
-			dnode->_children.resize(children.size());
 			// its just a terminal node, so expand the dnode with children and add them to the stack
-			for (int64_t i = (int64_t)children.size() - 1; i >= 0; i--) {
+			created.clear();
+			for (uint32_t child = forest[pnode].child; child != EarleyParser::None; child = forest[child].sibling) {
+				auto& gchild = compiled->GetNode(forest[child].node);
 				// if the node is a sequence node, or the node is a special parse node insert a SequenceNode instead of a NonTerminal
-				if (children[i]->getGrammarElement()->IsSequence() || _treeParse->_hashmap_parsenodes.find(children[i]->getGrammarElement()->_id) != _treeParse->_hashmap_parsenodes.end()) {
-					//ntmp = new DerivationTree::SequenceNode();
-					ntmp = allocSeq->New();
+				DerivationTree::NodeIndex dchild;
+				if (gchild.IsSequence() || isParseNode(gchild)) {
+					dchild = dtree->CreateNode(DerivationTree::NodeType::Sequence, gchild.id);
 					dtree->_sequenceNodes++;
 				} else {
-					//ntmp = new DerivationTree::NonTerminalNode();
-					ntmp = allocNonT->New();
+					dchild = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, gchild.id);
 				}
-				ntmp->_grammarID = children[i]->getGrammarElement()->_id;
-				dtree->_nodes++;
-				dnode->SetChild(i, ntmp);
-				//dnode->_children[i] = (ntmp);
-				stack.push({ children.at(i), ntmp });
+				dtree->AddChild(dnode, dchild);
+				created.push_back({ child, dchild });
 			}
+			// push in reverse order, so that children are expanded from left to right
+			for (auto itr = created.rbegin(); itr != created.rend(); itr++)
+				stack.push(*itr);
 		}
 	}
 	if (targetnodesIndex == (int64_t)targetnodes.size()) {
@@ -1903,6 +1971,11 @@ void Grammar::ExtractEarley(std::shared_ptr<DerivationTree> stree, std::shared_p
 }
 
 void Grammar::Derive(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, int32_t /*maxsteps*/)
+{
+	DeriveRoot(dtree, targetlength, seed, nullptr);
+}
+
+bool Grammar::DeriveRoot(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, DerivationTree::SequenceBuffer* sequence)
 {
 	StartProfiling
 	// this function takes an empty derivation tree and a goal of nonterminals to produce
@@ -1913,182 +1986,151 @@ void Grammar::Derive(std::shared_ptr<DerivationTree> dtree, int32_t targetlength
 	dtree->SetGrammarID(_formid);
 	dtree->SetSeed(seed);
 	dtree->SetTargetLength(targetlength);
-	DerivationTree::NonTerminalNode* nnode = nullptr;
-	DerivationTree::TerminalNode* ttnode = nullptr;
-	DerivationTree::NonTerminalNode* tnnode = nullptr;
+
+	// keep the compiled grammar alive for the duration of the derivation
+	auto compiled = _tree->_compiled;
+	if (!compiled) {
+		logcritical("Cannot derive from grammar {} as it hasn't been compiled", Utility::GetHex(_formid));
+		return false;
+	}
+	auto& groot = compiled->GetNode(compiled->GetRoot());
 
 	// count of generated sequence nodes
 	int32_t seq = 0;
 	// holds all nonterminals that were generated
-	std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>> qnonterminals;
+	DerivationQueue qnonterminals;
 	// holds all sequence nodes and sequence producing nodes during generation
-	std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>> qseqnonterminals;
+	DerivationQueue qseqnonterminals;
 
 	// init random stuff
 	std::mt19937 randan((unsigned int)seed);
 
-	auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-
 	// begin: insert start node 
-	if (_tree->_root->IsSequence()) {
-		//nnode = new DerivationTree::NonTerminalNode;
-		nnode = allocators->DerivationTree_NonTerminalNode()->New();
-		if (_tree->_simpleGrammar) // if we have a simple grammar most nodes will be derived from this one
-			nnode->_children.reserve(targetlength);
-		dtree->_nodes++;
-		nnode->_grammarID = _tree->_root->_id;
-		dtree->_root = nnode;
+	if (groot.IsSequence()) {
+		dtree->_root = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, groot.id);
 		seq++;
-		qseqnonterminals.push_back({ nnode, _tree->_root });
-	} else if (_tree->_root->_type == GrammarNode::NodeType::NonTerminal) {
-		//nnode = new DerivationTree::NonTerminalNode;
-		nnode = allocators->DerivationTree_NonTerminalNode()->New();
-		if (_tree->_simpleGrammar)  // if we have a simple grammar most nodes will be derived from this one
-			nnode->_children.reserve(targetlength);
-		dtree->_nodes++;
-		nnode->_grammarID = _tree->_root->_id;
-		dtree->_root = nnode;
-		qseqnonterminals.push_back({ nnode, _tree->_root });
+		qseqnonterminals.Push(dtree->_root, compiled->GetRoot());
+	} else if (groot.type == GrammarNode::NodeType::NonTerminal) {
+		dtree->_root = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, groot.id);
+		qseqnonterminals.Push(dtree->_root, compiled->GetRoot());
 	} else {
-		//ttnode = new DerivationTree::TerminalNode;
-		ttnode = allocators->DerivationTree_TerminalNode()->New();
-		dtree->_nodes++;
-		ttnode->_grammarID = _tree->_root->_id;
-		dtree->_root = ttnode;
-		ttnode->_content = _tree->_root->_identifier;
+		dtree->_root = dtree->CreateTerminal(groot.id, groot.symbol);
 	}
 
-	DeriveFromNode(dtree, qnonterminals, qseqnonterminals, randan, seq);
+	// only streaming derivations write the entries of the tree while deriving it, and only if the root is no terminal
+	bool streamed = sequence && dtree->GetStrategy() == DerivationTree::Strategy::Streaming && qseqnonterminals.Size() > 0;
+	DeriveFromNode(dtree, *compiled, qnonterminals, qseqnonterminals, randan, seq, streamed ? sequence : nullptr);
 	
 	dtree->_valid = true;
 	dtree->SetRegenerate(true);
 	dtree->_sequenceNodes = seq;
 
 	profile(TimeProfiling, "{}: Time taken for derivation of length: {}", Utility::PrintForm(dtree), dtree->_sequenceNodes);
+	return streamed;
 }
 
-std::string GetSymbols(std::shared_ptr<GrammarNode> node, std::mt19937& randan)
+void Grammar::Generate(std::shared_ptr<DerivationTree> dtree, int32_t targetlength, uint32_t seed, DerivationTree::SequenceBuffer& sequence, bool keepTree)
 {
-	if ((node->_flags & GrammarNode::NodeFlags::TerminalCharClass) > 0) {
-		if ((node->_flags & GrammarNode::NodeFlags::TerminalCharClassAscii) > 0) {
-			std::uniform_int_distribution<signed> dist(0x1, 0x7E);
-			char c = (char)dist(randan);
-			return std::string(1, c);
-		} else if ((node->_flags & GrammarNode::NodeFlags::TerminalCharClassAlpha) > 0) {
-			std::uniform_int_distribution<signed> dist(0x0, 52);
-			char c = (char)dist(randan);
-			if (c < 26)
-				c += 0x41;
-			else
-				c += 0x61;
-			return std::string(1, c);
-		} else if ((node->_flags & GrammarNode::NodeFlags::TerminalCharClassAlphaNumeric) > 0) {
-			std::uniform_int_distribution<signed> dist(0x0, 62);
-			char c = (char)dist(randan);
-			if (c < 26)
-				c += 0x41;
-			else if (c < 52)
-				c += 0x61;
-			else
-				c += 0x30;
-			return std::string(1, c);
-		} else if ((node->_flags & GrammarNode::NodeFlags::TerminalCharClassDigit) > 0) {
-			std::uniform_int_distribution<signed> dist(0x30, 0x39);
-			char c = (char)dist(randan);
-			return std::string(1, c);
-		}
+	if (keepTree) {
+		if (!DeriveRoot(dtree, targetlength, seed, &sequence))
+			dtree->EmitSequence(sequence);
+		return;
 	}
-	return node->_identifier;
+	// the scratch tree keeps its arena between derivations, so deriving only allocates when a longer input than
+	// before is generated
+	thread_local std::shared_ptr<DerivationTree> scratch = std::make_shared<DerivationTree>();
+	scratch->ResetNodes();
+	scratch->SetStrategy(dtree->GetStrategy());
+	scratch->SetCharacterClasses(dtree->GetCharacterClasses());
+	if (!DeriveRoot(scratch, targetlength, seed, &sequence))
+		scratch->EmitSequence(sequence);
+	// the tree is in the same state as a tree whose memory has been freed
+	dtree->SetGrammarID(_formid);
+	dtree->SetSeed(seed);
+	dtree->SetTargetLength(targetlength);
+	dtree->SetRegenerate(true);
+	dtree->_sequenceNodes = scratch->_sequenceNodes;
+	dtree->_valid = false;
 }
 
-void Grammar::DeriveFromNode(std::shared_ptr<DerivationTree> dtree, std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>>& qnonterminals, std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>>& qseqnonterminals, std::mt19937& randan, int32_t& seq)
+void Grammar::DeriveFromNode(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, DerivationTree::SequenceBuffer* sequence)
 {
-	DerivationTree::NonTerminalNode* nnode = nullptr;
-	DerivationTree::TerminalNode* ttnode = nullptr;
-	DerivationTree::NonTerminalNode* tnnode = nullptr;
-	int32_t idx = 0;
-	int32_t cnodes = 0;
-	float cweight = 0.f;
-	std::shared_ptr<GrammarNode> gnode;
-	std::shared_ptr<GrammarExpansion> gexp;
+	if (dtree->GetStrategy() == DerivationTree::Strategy::LengthAware) {
+		DeriveLengthAware(dtree, grammar, qnonterminals, qseqnonterminals, randan, seq);
+		return;
+	}
+	if (dtree->GetStrategy() == DerivationTree::Strategy::Parallel) {
+		DeriveParallel(dtree, grammar, qnonterminals, qseqnonterminals, randan, seq);
+		return;
+	}
+	if (dtree->GetStrategy() == DerivationTree::Strategy::Streaming) {
+		DeriveStreaming(dtree, grammar, qnonterminals, qseqnonterminals, randan, seq, sequence);
+		return;
+	}
+
+	DerivationTree::NodeIndex nnode = DerivationTree::NoNode;
+	uint32_t idx = 0;
+	const auto classes = dtree->GetCharacterClasses();
 
 	bool flip = false;
 
-	auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-	auto allocNonT = allocators->DerivationTree_NonTerminalNode();
-	auto allocT = allocators->DerivationTree_TerminalNode();
-	auto allocSeq = allocators->DerivationTree_SequenceNode();
+	// creates the derivation node for the grammar node [child] below [nnode]. While growing sequences, nodes that can
+	// produce further sequences are expanded in the first loop, afterwards all nodes are left to the last loop
+	auto addChild = [&](DerivationTree::NodeIndex nnode, uint32_t child, bool growing) {
+		auto& node = grammar.GetNode(child);
+		DerivationTree::NodeIndex tnode = DerivationTree::NoNode;
+		switch (node.type) {
+		case GrammarNode::NodeType::Sequence:
+			seq++;
+			tnode = dtree->CreateNode(DerivationTree::NodeType::Sequence, node.id);
+			dtree->_sequenceNodes++;
+			if (growing && (node.flags & GrammarNode::NodeFlags::ProduceSequence))
+				qseqnonterminals.Push(tnode, child);
+			else
+				qnonterminals.Push(tnode, child);
+			break;
+		case GrammarNode::NodeType::NonTerminal:
+			tnode = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, node.id);
+			if (growing && (node.flags & GrammarNode::NodeFlags::ProduceSequence))
+				qseqnonterminals.Push(tnode, child);
+			else
+				qnonterminals.Push(tnode, child);
+			break;
+		case GrammarNode::NodeType::Terminal:
+			// create new terminal node
+			tnode = dtree->CreateTerminal(node.id, grammar.GetSymbol(node, classes, randan));
+			break;
+		}
+		dtree->AddChild(nnode, tnode);
+	};
+	auto addChildren = [&](DerivationTree::NodeIndex nnode, const CompiledGrammar::Expansion& gexp, bool growing) {
+		auto children = grammar.GetChildren(gexp);
+		for (uint32_t i = 0; i < gexp.childCount; i++)
+			addChild(nnode, children[i], growing);
+	};
 
 	// in the first loop, we will expand the non terminals and sequence non terminals such that we only expand
 	// nodes that can produce new sequence nodes and only apply expansions that produce new sequence nodes
-	while (seq < dtree->GetTargetLength() && qseqnonterminals.size() > 0) {
+	while (seq < dtree->GetTargetLength() && qseqnonterminals.Size() > 0) {
 		// expand the current valid sequence nonterminals by applying rules that may produce sequences
-		int32_t nonseq = (int32_t)qseqnonterminals.size();  // number of non terminals that will be handled this iteration
-		for (int c = 0; c < nonseq; c++) {
+		size_t nonseq = qseqnonterminals.Size();  // number of non terminals that will be handled this iteration
+		for (size_t c = 0; c < nonseq; c++) {
 			// get node to handle
-			auto pair = qseqnonterminals.front();
-			qseqnonterminals.pop_front();
-			nnode = std::get<0>(pair);
-			gnode = std::get<1>(pair);
-			cnodes = 0;
-			cweight = 0;
-			idx = -1;
+			auto [node, gindex] = qseqnonterminals.Pop();
+			nnode = node;
+			auto& gnode = grammar.GetNode(gindex);
 			// choose expansion
 			// we are sure there are always expansions to choose from, as we have pruned the tree and this cannot be a terminal node
-			if (!flip)
-				for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++) {
-					// as long as we don't use weighted rules, the one with the most sequence symbols is used
-					if (cnodes < gnode->_expansions[i]->_seqnonterminals && cweight == 0) {
-						cnodes = gnode->_expansions[i]->_seqnonterminals;
-						idx = i;
-					} else if (cweight < gnode->_expansions[i]->_weight) {
-						cnodes = gnode->_expansions[i]->_seqnonterminals;
-						cweight = gnode->_expansions[i]->_weight;
-						idx = i;
-					}
-				}
-			else
-				for (int32_t i = (int32_t)gnode->_expansions.size() - 1; i >= 0; i--) {
-					// as long as we don't use weighted rules, the one with the most sequence symbols is used
-					if (cnodes < gnode->_expansions[i]->_seqnonterminals && cweight == 0) {
-						cnodes = gnode->_expansions[i]->_seqnonterminals;
-						idx = i;
-					} else if (cweight < gnode->_expansions[i]->_weight) {
-						cnodes = gnode->_expansions[i]->_seqnonterminals;
-						cweight = gnode->_expansions[i]->_weight;
-						idx = i;
-					}
-				}
+			// as long as we don't use weighted rules, the one with the most sequence symbols is used
+			idx = gnode.preferred[flip ? 1 : 0];
 			// if there is no rule that directly produces sequence nodes, choose a random expansion that produces sequence nodes
-			if (idx == -1) {
-				std::vector<int32_t> exp;
-				float tweight = 0.f;
-				for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++) {
-					if (gnode->_expansions[i]->_flags & GrammarNode::NodeFlags::ProduceSequence) {
-						exp.push_back(i);
-						tweight += gnode->_expansions[i]->_weight;
-					}
-				}
-				if (exp.size() > 0) {
-					if (tweight == 0.f) {
-						std::uniform_int_distribution<signed> dist(0, (int32_t)exp.size() - 1);
-						idx = exp[dist(randan)];
-					} else {
-						std::uniform_int_distribution<signed> dist(0, 100000000);
-						// calc target weight and adjust for the total weight not being 1
-						float target = ((float)dist(randan) / 100000000.f) * tweight;
-						float current = 0.f;
-						for (int32_t i = 0; i < (int32_t)exp.size(); i++) {
-							if (current += gnode->_expansions[exp[i]]->_weight; current >= target) {
-								idx = exp[i];
-								break;
-							}
-						}
-					}
-				} else if (gnode->IsSequence()) {
+			if (idx == CompiledGrammar::None) {
+				if (gnode.sequence.count > 0) {
+					idx = grammar.Choose(gnode.sequence, gnode.sequence.weight, randan);
+				} else if (gnode.IsSequence()) {
 					// this node is a sequence non terminal but doesn't have any rules that expand into new sequences
 					// so we just add it to the regular nonterminals we will deal with later
-					qnonterminals.push_back({ nnode, gnode });
+					qnonterminals.Push(nnode, gindex);
 					continue;
 				} else {
 					logcritical("Error during Derivation: Produce Sequence Flag set on node, but no expansions produce sequences.");
@@ -2096,251 +2138,509 @@ void Grammar::DeriveFromNode(std::shared_ptr<DerivationTree> dtree, std::deque<s
 				}
 			}
 			// create derivation nodes and add them to the derivation tree
-			gexp = gnode->_expansions[idx];
-			if (gexp->IsRegex()) {
-				auto regex = dynamic_pointer_cast<GrammarExpansionRegex>(gexp);
+			auto& gexp = grammar.GetExpansion(gnode, idx);
+			if (gexp.regex != CompiledGrammar::None) {
 				int64_t num = dtree->GetTargetLength() - seq;  // generate as much as we can without going over our limit
-				if (num == 0 && regex->_min == 1)
+				if (num == 0 && gexp.min == 1)
 					num = 1;
+				if (num > 0)
+					dtree->ReserveNodes(dtree->_nodes + num);
 				for (int64_t i = 0; i < num; i++)
-				{
-					switch (regex->_node->_type) {
-					case GrammarNode::NodeType::Sequence:
-						seq++;
-						//tnnode = new DerivationTree::SequenceNode;
-						tnnode = allocSeq->New();
-						dtree->_nodes++;
-						dtree->_sequenceNodes++;
-						tnnode->_grammarID = regex->_node->_id;
-						nnode->AddChild(tnnode);
-						if (regex->_node->_flags & GrammarNode::NodeFlags::ProduceSequence)
-							qseqnonterminals.push_back({ tnnode, regex->_node });
-						else
-							qnonterminals.push_back({ tnnode, regex->_node });
-						break;
-					case GrammarNode::NodeType::NonTerminal:
-						//tnnode = new DerivationTree::NonTerminalNode;
-						tnnode = allocNonT->New();
-						dtree->_nodes++;
-						tnnode->_grammarID = regex->_node->_id;
-						nnode->AddChild(tnnode);
-						if (regex->_node->_flags & GrammarNode::NodeFlags::ProduceSequence)
-							qseqnonterminals.push_back({ tnnode, regex->_node });
-						else
-							qnonterminals.push_back({ tnnode, regex->_node });
-						break;
-					case GrammarNode::NodeType::Terminal:
-						// create new terminal node
-						//ttnode = new DerivationTree::TerminalNode();
-						ttnode = allocT->New();
-						dtree->_nodes++;
-						ttnode->_grammarID = regex->_node->_id;
-						ttnode->_content = GetSymbols(regex->_node, randan);
-						nnode->AddChild(ttnode);
-						break;
-					}
-				}
-			} else {
-				for (int32_t i = 0; i < (int32_t)gexp->_nodes.size(); i++) {
-					switch (gexp->_nodes[i]->_type) {
-					case GrammarNode::NodeType::Sequence:
-						seq++;
-						//tnnode = new DerivationTree::SequenceNode;
-						tnnode = allocSeq->New();
-						dtree->_nodes++;
-						dtree->_sequenceNodes++;
-						tnnode->_grammarID = gexp->_nodes[i]->_id;
-						nnode->AddChild(tnnode);
-						if (gexp->_nodes[i]->_flags & GrammarNode::NodeFlags::ProduceSequence)
-							qseqnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-						else
-							qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-						break;
-					case GrammarNode::NodeType::NonTerminal:
-						//tnnode = new DerivationTree::NonTerminalNode;
-						tnnode = allocNonT->New();
-						dtree->_nodes++;
-						tnnode->_grammarID = gexp->_nodes[i]->_id;
-						nnode->AddChild(tnnode);
-						if (gexp->_nodes[i]->_flags & GrammarNode::NodeFlags::ProduceSequence)
-							qseqnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-						else
-							qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-						break;
-					case GrammarNode::NodeType::Terminal:
-						// create new terminal node
-						//ttnode = new DerivationTree::TerminalNode();
-						ttnode = allocT->New();
-						dtree->_nodes++;
-						ttnode->_grammarID = gexp->_nodes[i]->_id;
-						ttnode->_content = GetSymbols(gexp->_nodes[i], randan);
-						//ttnode->_content = gexp->_nodes[i]->_identifier;
-						nnode->AddChild(ttnode);
-						break;
-					}
-				}
-			}
+					addChild(nnode, gexp.regex, true);
+			} else
+				addChildren(nnode, gexp, true);
 		}
 		flip = true;
 	}
 
 	// in the second loop we expand all seq-nonterminals until non remain, while favoring expansions that
 	// do not produce new sequences
-	while (qseqnonterminals.size() > 0) {
+	while (qseqnonterminals.Size() > 0) {
 		// get node to handle
-		auto pair = qseqnonterminals.front();
-		qseqnonterminals.pop_front();
-		nnode = std::get<0>(pair);
-		gnode = std::get<1>(pair);
-		cnodes = 0;
-		cweight = 0;
-		idx = -1;
-		float tweight = 0.f;
-		float ttweight = 0.f;
-		// sort out expansions that do not increase sequence number
-		std::vector<int32_t> exp;
-		for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++) {
-			if ((gnode->_expansions[i]->_flags & GrammarNode::NodeFlags::ProduceSequence) == 0) {
-				exp.push_back(i);
-				tweight += gnode->_expansions[i]->_weight;
+		auto [node, gindex] = qseqnonterminals.Pop();
+		nnode = node;
+		auto& gnode = grammar.GetNode(gindex);
+		// prefer expansions that do not increase sequence number
+		if (gnode.final.count > 0)
+			idx = grammar.Choose(gnode.final, gnode.final.weight, randan);
+		else {
+			// there weren't any expansions that do not increase the sequence size, so just choose any random expansion
+			// weighted choices are scaled by the weight of the non-increasing expansions, which always selects the first one
+			idx = grammar.Choose(gnode.all, gnode.final.weight, randan);
+		}
+
+		// create derivation nodes and add them to the derivation tree
+		addChildren(nnode, grammar.GetExpansion(gnode, idx), false);
+	}
+
+	// in the third loop we expand all non-terminals, favoring rules that do not increase the sequence nodes,
+	// until only terminal nodes remain
+	while (qnonterminals.Size() > 0) {
+		// get node to handle
+		auto [node, gindex] = qnonterminals.Pop();
+		nnode = node;
+		auto& gnode = grammar.GetNode(gindex);
+		// choose random expansion
+		idx = grammar.Choose(gnode.all, gnode.all.weight, randan);
+
+		// create derivation nodes and add them to the derivation tree
+		addChildren(nnode, grammar.GetExpansion(gnode, idx), false);
+	}
+}
+
+uint32_t Grammar::ChooseLengthAware(const CompiledGrammar& grammar, uint32_t gindex, int64_t slack, int64_t hiOther, size_t split, std::vector<uint32_t>& candidates, std::mt19937& randan)
+{
+	auto& gnode = grammar.GetNode(gindex);
+	uint32_t idx = gnode.cheapest;
+	if (slack > gnode.minYield) {
+		// expansions that keep the target reachable
+		candidates.clear();
+		float weight = 0.f;
+		for (uint32_t i = 0; i < gnode.expansionCount; i++) {
+			auto& gexp = grammar.GetExpansion(gnode, i);
+			if (gexp.minYield <= slack && std::min(gexp.maxYield + hiOther, CompiledGrammar::Unbounded) >= slack) {
+				candidates.push_back(i);
+				weight += gexp.weight;
 			}
-			ttweight += gnode->_expansions[i]->_weight;
 		}
-		if (exp.size() > 0) {
-			if (tweight == 0.f) {
-				std::uniform_int_distribution<signed> dist(0, (int32_t)exp.size() - 1);
-				idx = exp[dist(randan)];
-			} else {
-				std::uniform_int_distribution<signed> dist(0, 100000000);
-				float target = ((float)dist(randan) / 100000000.f) * tweight; 
-				float current = 0.f;
-				for (int32_t i = 0; i < (int32_t)exp.size(); i++) {
-					if (current += gnode->_expansions[exp[i]]->_weight; current >= target) {
-						idx = exp[i];
-						break;
-					}
+		// while the top of a parallel derivation is derived, the expansions opening the most subtrees that can grow
+		// are preferred, so that the tree can be split early
+		if (split != SIZE_MAX && candidates.size() > 1) {
+			auto branches = [&grammar, &gnode, split](uint32_t i) {
+				auto& gexp = grammar.GetExpansion(gnode, i);
+				if (gexp.regex != CompiledGrammar::None)
+					return gexp.maxYield > 0 ? split : (size_t)0;
+				size_t count = 0;
+				auto children = grammar.GetChildren(gexp);
+				for (uint32_t c = 0; c < gexp.childCount; c++)
+					if (grammar.GetNode(children[c]).maxYield > 0)
+						count++;
+				return count;
+			};
+			size_t most = 0;
+			for (auto candidate : candidates)
+				most = std::max(most, branches(candidate));
+			size_t kept = 0;
+			weight = 0.f;
+			for (auto candidate : candidates) {
+				if (branches(candidate) == most) {
+					candidates[kept++] = candidate;
+					weight += grammar.GetExpansion(gnode, candidate).weight;
+				}
+			}
+			candidates.resize(kept);
+		}
+		if (candidates.size() > 0 && weight == 0.f) {
+			std::uniform_int_distribution<signed> dist(0, (int32_t)candidates.size() - 1);
+			idx = candidates[dist(randan)];
+		} else if (candidates.size() > 0) {
+			std::uniform_int_distribution<signed> dist(0, 100000000);
+			float choice = ((float)dist(randan) / 100000000.f) * weight;
+			idx = candidates.back();
+			for (auto candidate : candidates) {
+				choice -= grammar.GetExpansion(gnode, candidate).weight;
+				if (choice <= 0.f) {
+					idx = candidate;
+					break;
 				}
 			}
 		} else {
-			// there weren't any expansions that do not increase the sequence size, so just choose any random expansion
-			if (ttweight == 0.f) {
-				std::uniform_int_distribution<signed> dist(0, (int32_t)gnode->_expansions.size() - 1);
-				idx = dist(randan);
-			} else {
-				std::uniform_int_distribution<signed> dist(0, 100000000);
-				float target = ((float)dist(randan) / 100000000.f) * tweight; 
-				float current = 0.f;
-				for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++) {
-					if (current += gnode->_expansions[i]->_weight; current >= target) {
-						idx = i;
-						break;
-					}
+			// the target cannot be met exactly, so the expansion that gets closest to it is used
+			int64_t best = CompiledGrammar::Unbounded;
+			for (uint32_t i = 0; i < gnode.expansionCount; i++) {
+				auto& gexp = grammar.GetExpansion(gnode, i);
+				int64_t miss = slack - std::min(gexp.maxYield + hiOther, CompiledGrammar::Unbounded);
+				if (gexp.minYield > slack)
+					miss = gexp.minYield - slack;
+				if (miss < best) {
+					best = miss;
+					idx = i;
 				}
 			}
 		}
-		exp.clear();
+	}
 
-		// create derivation nodes and add them to the derivation tree
-		gexp = gnode->_expansions[idx];
-		for (int32_t i = 0; i < (int32_t)gexp->_nodes.size(); i++) {
-			switch (gexp->_nodes[i]->_type) {
-			case GrammarNode::NodeType::Sequence:
-				seq++;
-				//tnnode = new DerivationTree::SequenceNode;
-				tnnode = allocSeq->New();
-				dtree->_nodes++;
-				dtree->_sequenceNodes++;
-				tnnode->_grammarID = gexp->_nodes[i]->_id;
-				nnode->AddChild(tnnode);
-				qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-				break;
-			case GrammarNode::NodeType::NonTerminal:
-				//tnnode = new DerivationTree::NonTerminalNode;
-				tnnode = allocNonT->New();
-				dtree->_nodes++;
-				tnnode->_grammarID = gexp->_nodes[i]->_id;
-				nnode->AddChild(tnnode);
-				qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-				break;
-			case GrammarNode::NodeType::Terminal:
-				// create new terminal node
-				//ttnode = new DerivationTree::TerminalNode();
-				ttnode = allocT->New();
-				dtree->_nodes++;
-				ttnode->_grammarID = gexp->_nodes[i]->_id;
-				ttnode->_content = GetSymbols(gexp->_nodes[i], randan);
-				nnode->AddChild(ttnode);
-				break;
+	return idx;
+}
+
+int64_t Grammar::RepeatLengthAware(const CompiledGrammar& grammar, uint32_t regex, int32_t min, int64_t slack)
+{
+	// repeat the child as often as its smallest derivation fits into the slack
+	auto& child = grammar.GetNode(regex);
+	int64_t yield = child.minYield + (child.IsSequence() ? 1 : 0);
+	int64_t num = min;
+	if (yield > 0)
+		num = std::max(num, slack / yield);
+	else if (child.maxYield > 0)
+		num = std::max(num, slack);
+	return num;
+}
+
+void Grammar::DeriveLengthAware(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, size_t split)
+{
+	const int64_t target = dtree->GetTargetLength();
+	const auto classes = dtree->GetCharacterClasses();
+	// all open nodes are handled in one queue, the yield bounds decide whether a node grows or is closed
+	DerivationQueue open;
+	// bounds of the sequence nodes the open nodes can still produce, open nodes with unbounded yields are counted
+	// separately so that they can be removed from the sum again
+	int64_t lo = 0;
+	int64_t hi = 0;
+	int64_t unbounded = 0;
+	// open nodes that can still produce sequence nodes
+	size_t growing = 0;
+	auto push = [&](DerivationTree::NodeIndex node, uint32_t gindex) {
+		auto& gnode = grammar.GetNode(gindex);
+		open.Push(node, gindex);
+		lo += gnode.minYield;
+		if (gnode.maxYield > 0)
+			growing++;
+		if (gnode.maxYield >= CompiledGrammar::Unbounded)
+			unbounded++;
+		else
+			hi += gnode.maxYield;
+	};
+	while (qseqnonterminals.Size() > 0) {
+		auto [node, gindex] = qseqnonterminals.Pop();
+		push(node, gindex);
+	}
+	while (qnonterminals.Size() > 0) {
+		auto [node, gindex] = qnonterminals.Pop();
+		push(node, gindex);
+	}
+
+	auto addChild = [&](DerivationTree::NodeIndex nnode, uint32_t child) {
+		auto& node = grammar.GetNode(child);
+		DerivationTree::NodeIndex tnode = DerivationTree::NoNode;
+		switch (node.type) {
+		case GrammarNode::NodeType::Sequence:
+			seq++;
+			tnode = dtree->CreateNode(DerivationTree::NodeType::Sequence, node.id);
+			dtree->_sequenceNodes++;
+			push(tnode, child);
+			break;
+		case GrammarNode::NodeType::NonTerminal:
+			tnode = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, node.id);
+			push(tnode, child);
+			break;
+		case GrammarNode::NodeType::Terminal:
+			tnode = dtree->CreateTerminal(node.id, grammar.GetSymbol(node, classes, randan));
+			break;
+		}
+		dtree->AddChild(nnode, tnode);
+	};
+
+	std::vector<uint32_t> candidates;
+	while (open.Size() > 0) {
+		if (growing >= split) {
+			while (open.Size() > 0) {
+				auto [node, gindex] = open.Pop();
+				qnonterminals.Push(node, gindex);
 			}
+			return;
+		}
+		auto [nnode, gindex] = open.Pop();
+		auto& gnode = grammar.GetNode(gindex);
+		if (gnode.maxYield > 0)
+			growing--;
+		// bounds of all other open nodes
+		lo -= gnode.minYield;
+		int64_t hiOther = 0;
+		if (gnode.maxYield >= CompiledGrammar::Unbounded) {
+			unbounded--;
+			hiOther = unbounded > 0 ? CompiledGrammar::Unbounded : hi;
+		} else {
+			hi -= gnode.maxYield;
+			hiOther = unbounded > 0 ? CompiledGrammar::Unbounded : hi;
+		}
+		// number of sequence nodes this node should produce so that the target can be met
+		int64_t slack = target - seq - lo;
+
+		uint32_t idx = ChooseLengthAware(grammar, gindex, slack, hiOther, split, candidates, randan);
+
+		auto& gexp = grammar.GetExpansion(gnode, idx);
+		if (gexp.regex != CompiledGrammar::None) {
+			int64_t num = RepeatLengthAware(grammar, gexp.regex, gexp.min, slack);
+			if (num > 0)
+				dtree->ReserveNodes(dtree->_nodes + num);
+			for (int64_t i = 0; i < num; i++)
+				addChild(nnode, gexp.regex);
+		} else {
+			auto children = grammar.GetChildren(gexp);
+			for (uint32_t i = 0; i < gexp.childCount; i++)
+				addChild(nnode, children[i]);
 		}
 	}
+}
 
-	// in the third loop we expand all non-terminals, favoring rules that do not increase the sequence nodes,
-	// until only terminal nodes remain
-	while (qnonterminals.size() > 0) {
-		// get node to handle
-		auto pair = qnonterminals.front();
-		qnonterminals.pop_front();
-		nnode = std::get<0>(pair);
-		gnode = std::get<1>(pair);
-		cnodes = 0;
-		cweight = 0;
-		idx = -1;
-		float tweight = 0.f;
-		// choose random expansion
-		for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++)
-			tweight += gnode->_expansions[i]->_weight;
+void Grammar::DeriveStreaming(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq, DerivationTree::SequenceBuffer* sequence)
+{
+	const int64_t target = dtree->GetTargetLength();
+	const auto classes = dtree->GetCharacterClasses();
+	// the stack holds the open nodes, the terminals whose contents have not been written yet and the sequence nodes
+	// whose entries are closed once their subtrees are complete. Its top is always the leftmost of them, so the entries
+	// of the input are complete in the order of the sequence
+	enum class Step
+	{
+		Expand,
+		Write,
+		Close,
+	};
+	struct Item
+	{
+		DerivationTree::NodeIndex node;
+		uint32_t gindex;
+		Step step;
+	};
+	std::vector<Item> stack;
+	// bounds of the sequence nodes the open nodes can still produce, open nodes with unbounded yields are counted
+	// separately so that they can be removed from the sum again
+	int64_t lo = 0;
+	int64_t hi = 0;
+	int64_t unbounded = 0;
+	auto open = [&](uint32_t gindex) {
+		auto& gnode = grammar.GetNode(gindex);
+		lo += gnode.minYield;
+		if (gnode.maxYield >= CompiledGrammar::Unbounded)
+			unbounded++;
+		else
+			hi += gnode.maxYield;
+	};
+	// the queued nodes are pushed in reverse, so that they are expanded in the order they have been queued in
+	std::vector<std::pair<DerivationTree::NodeIndex, uint32_t>> queued;
+	while (qseqnonterminals.Size() > 0)
+		queued.push_back(qseqnonterminals.Pop());
+	while (qnonterminals.Size() > 0)
+		queued.push_back(qnonterminals.Pop());
+	for (auto itr = queued.rbegin(); itr != queued.rend(); itr++) {
+		open(itr->second);
+		stack.push_back({ itr->first, itr->second, Step::Expand });
+	}
+
+	// creates the derivation node for the grammar node [child] below [nnode]
+	auto addChild = [&](DerivationTree::NodeIndex nnode, uint32_t child) {
+		auto& node = grammar.GetNode(child);
+		DerivationTree::NodeIndex tnode = DerivationTree::NoNode;
+		switch (node.type) {
+		case GrammarNode::NodeType::Sequence:
+			seq++;
+			tnode = dtree->CreateNode(DerivationTree::NodeType::Sequence, node.id);
+			dtree->_sequenceNodes++;
+			open(child);
+			break;
+		case GrammarNode::NodeType::NonTerminal:
+			tnode = dtree->CreateNode(DerivationTree::NodeType::NonTerminal, node.id);
+			open(child);
+			break;
+		case GrammarNode::NodeType::Terminal:
+			tnode = dtree->CreateTerminal(node.id, grammar.GetSymbol(node, classes, randan));
+			break;
+		}
+		dtree->AddChild(nnode, tnode);
+		return tnode;
+	};
+
+	// symbols are never removed from the table, so their views can be cached per thread
+	thread_local std::vector<std::string_view> cache;
+	auto& symbols = cache;
+	auto write = [&sequence, &symbols](uint32_t id) {
+		if (id >= symbols.size())
+			symbols.resize(id + 1);
+		if (symbols[id].data() == nullptr)
+			symbols[id] = DerivationTree::GetSymbol(id);
+		sequence->data.append(symbols[id]);
+	};
 
-		if (tweight == 0.f) {
-			std::uniform_int_distribution<signed> dist(0, (int32_t)gnode->_expansions.size() - 1);
-			idx = dist(randan);
+	std::vector<uint32_t> candidates;
+	while (stack.size() > 0) {
+		auto [nnode, gindex, step] = stack.back();
+		stack.pop_back();
+		if (step == Step::Write) {
+			write(dtree->GetNode(nnode)._symbol);
+			continue;
+		}
+		if (step == Step::Close) {
+			// [gindex] holds the entry of the sequence node
+			sequence->entries[gindex].second = (uint32_t)sequence->data.size();
+			continue;
+		}
+		auto& gnode = grammar.GetNode(gindex);
+		if (sequence && gnode.IsSequence() && dtree->GetNode(nnode)._type == DerivationTree::NodeType::Sequence) {
+			stack.push_back({ nnode, (uint32_t)sequence->entries.size(), Step::Close });
+			sequence->entries.push_back({ (uint32_t)sequence->data.size(), 0 });
+		}
+		// bounds of all other open nodes
+		lo -= gnode.minYield;
+		int64_t hiOther = 0;
+		if (gnode.maxYield >= CompiledGrammar::Unbounded) {
+			unbounded--;
+			hiOther = unbounded > 0 ? CompiledGrammar::Unbounded : hi;
 		} else {
-			std::uniform_int_distribution<signed> dist(0, 100000000);
-			float target = ((float)dist(randan) / 100000000.f) * tweight; 
-			float current = 0.f;
-			for (int32_t i = 0; i < (int32_t)gnode->_expansions.size(); i++) {
-				if (current += gnode->_expansions[i]->_weight; current >= target) {
-					idx = i;
-					break;
-				}
+			hi -= gnode.maxYield;
+			hiOther = unbounded > 0 ? CompiledGrammar::Unbounded : hi;
+		}
+		// number of sequence nodes this node should produce so that the target can be met
+		int64_t slack = target - seq - lo;
+
+		uint32_t idx = ChooseLengthAware(grammar, gindex, slack, hiOther, SIZE_MAX, candidates, randan);
+
+		auto& gexp = grammar.GetExpansion(gnode, idx);
+		// the children are pushed in order and reversed afterwards. Terminals in front of the first open child are the
+		// leftmost contents of the tree and are written at once
+		size_t first = stack.size();
+		auto addItem = [&](uint32_t child) {
+			auto tnode = addChild(nnode, child);
+			if (grammar.GetNode(child).type != GrammarNode::NodeType::Terminal)
+				stack.push_back({ tnode, child, Step::Expand });
+			else if (sequence && stack.size() == first)
+				write(dtree->GetNode(tnode)._symbol);
+			else if (sequence)
+				stack.push_back({ tnode, child, Step::Write });
+		};
+		if (gexp.regex != CompiledGrammar::None) {
+			int64_t num = RepeatLengthAware(grammar, gexp.regex, gexp.min, slack);
+			if (num > 0)
+				dtree->ReserveNodes(dtree->_nodes + num);
+			for (int64_t i = 0; i < num; i++)
+				addItem(gexp.regex);
+		} else {
+			auto gchildren = grammar.GetChildren(gexp);
+			for (uint32_t i = 0; i < gexp.childCount; i++)
+				addItem(gchildren[i]);
+		}
+		std::reverse(stack.begin() + first, stack.end());
+	}
+}
+
+struct Grammar::ParallelDerivation
+{
+	struct Piece
+	{
+		/// <summary>
+		/// open node of the tree the subtree is attached to
+		/// </summary>
+		DerivationTree::NodeIndex node = DerivationTree::NoNode;
+		uint32_t gindex = 0;
+		/// <summary>
+		/// sequence nodes the subtree should produce
+		/// </summary>
+		int64_t target = 0;
+		uint32_t seed = 0;
+		std::shared_ptr<DerivationTree> tree;
+	};
+
+	Grammar* grammar = nullptr;
+	const CompiledGrammar* compiled = nullptr;
+	DerivationTree::CharacterClasses classes = DerivationTree::CharacterClasses::Tables;
+	std::vector<Piece> pieces;
+	/// <summary>
+	/// next piece to derive
+	/// </summary>
+	std::atomic<size_t> next = 0;
+	/// <summary>
+	/// number of pieces that have been derived
+	/// </summary>
+	std::atomic<size_t> done = 0;
+	std::mutex lock;
+	std::condition_variable condition;
+
+	/// <summary>
+	/// derives pieces until all of them have been taken
+	/// </summary>
+	void Work()
+	{
+		for (size_t index = next++; index < pieces.size(); index = next++) {
+			grammar->DerivePiece(*this, index);
+			if (++done == pieces.size()) {
+				std::unique_lock<std::mutex> guard(lock);
+				condition.notify_all();
 			}
 		}
+	}
+};
 
-		// create derivation nodes and add them to the derivation tree
-		gexp = gnode->_expansions[idx];
-		for (int32_t i = 0; i < (int32_t)gexp->_nodes.size(); i++) {
-			switch (gexp->_nodes[i]->_type) {
-			case GrammarNode::NodeType::Sequence:
-				seq++;
-				//tnnode = new DerivationTree::SequenceNode;
-				tnnode = allocSeq->New();
-				dtree->_nodes++;
-				dtree->_sequenceNodes++;
-				tnnode->_grammarID = gexp->_nodes[i]->_id;
-				nnode->AddChild(tnnode);
-				qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-				break;
-			case GrammarNode::NodeType::NonTerminal:
-				//tnnode = new DerivationTree::NonTerminalNode;
-				tnnode = allocNonT->New();
-				dtree->_nodes++;
-				tnnode->_grammarID = gexp->_nodes[i]->_id;
-				nnode->AddChild(tnnode);
-				qnonterminals.push_back({ tnnode, gexp->_nodes[i] });
-				break;
-			case GrammarNode::NodeType::Terminal:
-				// create new terminal node
-				//ttnode = new DerivationTree::TerminalNode();
-				ttnode = allocT->New();
-				dtree->_nodes++;
-				ttnode->_grammarID = gexp->_nodes[i]->_id;
-				ttnode->_content = GetSymbols(gexp->_nodes[i], randan);
-				//ttnode->_content = gexp->_nodes[i]->_identifier;
-				nnode->AddChild(ttnode);
-				break;
+void Grammar::DeriveParallel(std::shared_ptr<DerivationTree> dtree, const CompiledGrammar& grammar, DerivationQueue& qnonterminals, DerivationQueue& qseqnonterminals, std::mt19937& randan, int32_t& seq)
+{
+	// the top of the tree is derived until enough subtrees can grow, those are left open
+	DeriveLengthAware(dtree, grammar, qnonterminals, qseqnonterminals, randan, seq, ParallelFrontier);
+	if (qnonterminals.Size() == 0)
+		return;
+
+	auto derivation = std::make_shared<ParallelDerivation>();
+	derivation->grammar = this;
+	derivation->compiled = &grammar;
+	derivation->classes = dtree->GetCharacterClasses();
+	auto& pieces = derivation->pieces;
+	int64_t remaining = dtree->GetTargetLength() - seq;
+	while (qnonterminals.Size() > 0) {
+		auto [node, gindex] = qnonterminals.Pop();
+		auto& piece = pieces.emplace_back();
+		piece.node = node;
+		piece.gindex = gindex;
+		piece.target = grammar.GetNode(gindex).minYield;
+		remaining -= piece.target;
+	}
+	// the remaining sequence nodes are spread evenly over the subtrees that can still take them
+	while (remaining > 0) {
+		int64_t open = 0;
+		for (auto& piece : pieces)
+			if (piece.target < grammar.GetNode(piece.gindex).maxYield)
+				open++;
+		if (open == 0)
+			break;
+		int64_t share = std::max(remaining / open, (int64_t)1);
+		for (auto& piece : pieces) {
+			int64_t add = std::min({ share, grammar.GetNode(piece.gindex).maxYield - piece.target, remaining });
+			if (add > 0) {
+				piece.target += add;
+				remaining -= add;
 			}
 		}
 	}
+	// the seeds only depend on the seed of the tree, so that the subtrees are the same regardless of which thread
+	// derives them
+	for (auto& piece : pieces)
+		piece.seed = (uint32_t)randan();
+
+	if (auto controller = _controller.lock(); controller && pieces.size() > 1) {
+		size_t helpers = std::min((size_t)std::max(controller->GetNumThreads(), 0), pieces.size() - 1);
+		for (size_t i = 0; i < helpers; i++) {
+			auto callback = std::make_shared<Functions::DerivePiecesCallback>();
+			callback->_derivation = derivation;
+			controller->AddTask(callback);
+		}
+	}
+	// the calling thread derives pieces as well, so that it only waits for pieces that are being derived, even if all
+	// workers are busy
+	derivation->Work();
+	{
+		std::unique_lock<std::mutex> guard(derivation->lock);
+		derivation->condition.wait(guard, [&derivation]() { return derivation->done.load() == derivation->pieces.size(); });
+	}
+
+	for (auto& piece : pieces) {
+		dtree->GraftChildren(piece.node, *piece.tree);
+		seq += (int32_t)piece.tree->_sequenceNodes;
+		piece.tree.reset();
+	}
+}
+
+void Grammar::DerivePiece(ParallelDerivation& derivation, size_t index)
+{
+	auto& piece = derivation.pieces[index];
+	auto& gnode = derivation.compiled->GetNode(piece.gindex);
+	piece.tree = std::make_shared<DerivationTree>();
+	piece.tree->SetStrategy(DerivationTree::Strategy::LengthAware);
+	piece.tree->SetCharacterClasses(derivation.classes);
+	piece.tree->SetTargetLength((int32_t)piece.target);
+	// the root stands in for the open node and is dropped when the subtree is attached, so it isn't counted
+	piece.tree->_root = piece.tree->CreateNode(gnode.IsSequence() ? DerivationTree::NodeType::Sequence : DerivationTree::NodeType::NonTerminal, gnode.id);
+	DerivationQueue qnonterminals;
+	DerivationQueue qseqnonterminals;
+	qseqnonterminals.Push(piece.tree->_root, piece.gindex);
+	std::mt19937 randan(piece.seed);
+	int32_t seq = 0;
+	DeriveLengthAware(piece.tree, *derivation.compiled, qnonterminals, qseqnonterminals, randan, seq);
 }
 
 void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTree> dtree, bool backtrack, int32_t targetlength, uint32_t seed, int32_t& backtrackingdone, int32_t /*maxsteps*/)
@@ -2360,13 +2660,14 @@ void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTr
 	dtree->_valid = false;
 
 	// tmp
-	DerivationTree::NonTerminalNode* nnode = nullptr;
-	DerivationTree::TerminalNode* ttnode = nullptr;
-	DerivationTree::NonTerminalNode* tnnode = nullptr;
-	std::shared_ptr<GrammarNode> gnode;
-	std::shared_ptr<GrammarExpansion> gexp;
-	// counter
-	int32_t additionalLength = 0;
+	uint32_t gnode = CompiledGrammar::None;
+
+	// keep the compiled grammar alive for the duration of the extension
+	auto compiled = _tree->_compiled;
+	if (!compiled) {
+		logcritical("Cannot extend with grammar {} as it hasn't been compiled", Utility::GetHex(_formid));
+		return;
+	}
 
 	// init random stuff
 	std::mt19937 randan((unsigned int)seed);
@@ -2379,19 +2680,6 @@ void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTr
 
 	int32_t trackback = dist(randan);
 
-	auto allocators = Allocators::GetThreadAllocators(std::this_thread::get_id());
-	auto allocNonT = allocators->DerivationTree_NonTerminalNode();
-	auto allocT = allocators->DerivationTree_TerminalNode();
-	auto allocSeq = allocators->DerivationTree_SequenceNode();
-
-	// copy source derivation tree to dest tree
-	// // uhhh stack overflow uhh I like complaingin uhhh
-	//auto [node, nodevec] = stree->_root->CopyRecursive();
-	//for (auto nd : nodevec)
-	//	dtree->_nodes.insert(nd);
-	//dtree->_sequenceNodes = stree->_sequenceNodes;
-
-
 	if (sinput->IsTrimmed())
 	{
 		// nothing to extract and then extend
@@ -2412,141 +2700,38 @@ void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTr
 	}
 	else if (trackback == 0)
 	{
-		// ----- COPY THE SOURCE TREE -----
-		dtree->_sequenceNodes = 0;
-		std::stack<std::pair<DerivationTree::NonTerminalNode*, DerivationTree::NonTerminalNode*>> nodestack;
-		if (stree->_root->Type() == DerivationTree::NodeType::Sequence) {
-			//nnode = new DerivationTree::SequenceNode;
-			nnode = allocSeq->New();
-			dtree->_nodes++;
-			nnode->_grammarID = ((DerivationTree::SequenceNode*)stree->_root)->_grammarID;
-			dtree->_root = nnode;
-			nodestack.push({ nnode, (DerivationTree::NonTerminalNode*)stree->_root });
-		} else if (stree->_root->Type() == DerivationTree::NodeType::NonTerminal) {
-			//nnode = new DerivationTree::NonTerminalNode;
-			nnode = allocNonT->New();
-			dtree->_nodes++;
-			nnode->_grammarID = ((DerivationTree::NonTerminalNode*)stree->_root)->_grammarID;
-			dtree->_root = nnode;
-			nodestack.push({ nnode, (DerivationTree::NonTerminalNode*)stree->_root });
-		} else {
-			//ttnode = new DerivationTree::TerminalNode;
-			ttnode = allocT->New();
-			dtree->_nodes++;
-			ttnode->_grammarID = ((DerivationTree::NonTerminalNode*)stree->_root)->_grammarID;
-			dtree->_root = ttnode;
-			ttnode->_content = _tree->_root->_identifier;
-		}
-		while (nodestack.size() > 0) {
-			auto [dnode, snode] = nodestack.top();
-			nodestack.pop();
-			for (int32_t i = 0; i < (int32_t)snode->_children.size(); i++) {
-				switch (snode->_children[i]->Type()) {
-				case DerivationTree::NodeType::NonTerminal:
-					//tnnode = new DerivationTree::NonTerminalNode;
-					tnnode = allocNonT->New();
-					tnnode->_grammarID = ((DerivationTree::NonTerminalNode*)snode->_children[i])->_grammarID;
-					dnode->AddChild(tnnode);
-					dtree->_nodes++;
-					nodestack.push({ tnnode, (DerivationTree::NonTerminalNode*)snode->_children[i] });
-					break;
-				case DerivationTree::NodeType::Sequence:
-					//tnnode = new DerivationTree::SequenceNode;
-					tnnode = allocSeq->New();
-					tnnode->_grammarID = ((DerivationTree::SequenceNode*)snode->_children[i])->_grammarID;
-					dnode->AddChild(tnnode);
-					dtree->_nodes++;
-					dtree->_sequenceNodes++;
-					nodestack.push({ tnnode, (DerivationTree::SequenceNode*)snode->_children[i] });
-					break;
-				case DerivationTree::NodeType::Terminal:
-					//ttnode = new DerivationTree::TerminalNode;
-					ttnode = allocT->New();
-					ttnode->_grammarID = ((DerivationTree::TerminalNode*)snode->_children[i])->_grammarID;
-					ttnode->_content = ((DerivationTree::TerminalNode*)snode->_children[i])->_content;
-					dnode->AddChild(ttnode);
-					dtree->_nodes++;
-					break;
-				}
-			}
-		}
+		// ----- SHARE THE SOURCE TREE -----
+		// only the nodes on the path that is extended are copied
+		dtree->ShareNodes(*stree);
+		dtree->ReserveNodes(targetlength);
+		dtree->_root = dtree->ShareSubtree(stree->_root);
+		dtree->_sequenceNodes = stree->_sequenceNodes;
 	}
 
 	// set backtracking done
 	backtrackingdone = (int32_t)(sinput->derive->_sequenceNodes - dtree->_sequenceNodes);
 
-	DerivationTree::NonTerminalNode* root;
+	DerivationTree::NodeIndex root;
 
 	if (_tree->_simpleGrammar == false) {
-		std::stack<DerivationTree::NonTerminalNode*> path;
+		std::stack<DerivationTree::NodeIndex> path;
 
 		// find right-most path in the tree, that the one where we will be deleting stuff
-		auto findRightPath = [&path](DerivationTree::NonTerminalNode* root) {
-			DerivationTree::NonTerminalNode* tmp = root;
-			while (tmp != nullptr) {
-				if (tmp->_children.size() > 0) {
-					for (int32_t i = (int32_t)tmp->_children.size() - 1; i >= 0; i--) {
-						if (tmp->_children[i]->Type() == DerivationTree::NodeType::Sequence) {
-							path.push((DerivationTree::SequenceNode*)tmp->_children[i]);
-							tmp = nullptr;
-							break;
-						} else if (tmp->_children[i]->Type() == DerivationTree::NodeType::NonTerminal) {
-							tmp = (DerivationTree::NonTerminalNode*)tmp->_children[i];
-							path.push(tmp);
-							break;
-						} else {  // terminal
-							continue;
-						}
-					}
-				} else
-					tmp = nullptr;
-			}
-		};
-
-		// get the number of node children that are sequence nodes
-		auto getSeqChildren = [](DerivationTree::NonTerminalNode* root) {
-			int32_t i = 0;
-			std::stack<DerivationTree::NonTerminalNode*> stack;
-			DerivationTree::NonTerminalNode* tmp;
-			stack.push(root);
-			while (stack.size() > 0) {
-				tmp = stack.top();
-				stack.pop();
-				if (tmp->Type() == DerivationTree::NodeType::Sequence)
-					i++;
-				else {
-					for (auto node : tmp->_children) {
-						if (node->Type() == DerivationTree::NodeType::Sequence)
-							i++;
-						else if (node->Type() == DerivationTree::NodeType::NonTerminal)
-							stack.push((DerivationTree::NonTerminalNode*)node);
-					}
-				}
-			}
-			return i;
-		};
-		// delete this node and all its children
-		auto deleteNode = [](DerivationTree::NonTerminalNode* root, std::shared_ptr<DerivationTree> tree) {
-			std::stack<DerivationTree::NonTerminalNode*> stack;
-			DerivationTree::NonTerminalNode* tmp;
-			stack.push(root);
-			while (stack.size() > 0) {
-				tmp = stack.top();
-				stack.pop();
-				for (DerivationTree::Node* node : tmp->_children) {
-					if (node->Type() == DerivationTree::NodeType::NonTerminal || node->Type() == DerivationTree::NodeType::Sequence)
-						stack.push((DerivationTree::NonTerminalNode*)node);
-					else {
-						tree->_nodes--;
-						delete (DerivationTree::TerminalNode*)node;
-					}
-				}
-				if (tmp->Type() == DerivationTree::NodeType::Sequence) {
-					tree->_nodes--;
-					delete (DerivationTree::SequenceNode*)tmp;
-				} else {
-					tree->_nodes--;
-					delete (DerivationTree::NonTerminalNode*)tmp;
+		// the children of the nodes on the path are copied, so that the path can be extended
+		auto findRightPath = [&path, &dtree](DerivationTree::NodeIndex root) {
+			DerivationTree::NodeIndex tmp = root;
+			while (tmp != DerivationTree::NoNode) {
+				dtree->UnshareChildren(tmp);
+				// the right-most child that isn't a terminal
+				DerivationTree::NodeIndex right = DerivationTree::NoNode;
+				for (auto child = dtree->GetNode(tmp)._child; child != DerivationTree::NoNode; child = dtree->GetNode(child)._sibling)
+					if (!dtree->GetNode(child).IsTerminal())
+						right = child;
+				tmp = DerivationTree::NoNode;
+				if (right != DerivationTree::NoNode) {
+					path.push(right);
+					if (dtree->GetNode(right)._type == DerivationTree::NodeType::NonTerminal)
+						tmp = right;
 				}
 			}
 		};
@@ -2555,34 +2740,16 @@ void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTr
 		// if that isn't the case we have to get the right-most path, cut the lowest sequence node, and backtrack until we find
 		// a node that expands into multiple sequence nodes, and can get started from there
 
-		// we cannot start on a sequence node
-		while (path.size() > 0 && (path.top()->Type() == DerivationTree::NodeType::Sequence || path.top()->Type() == DerivationTree::NodeType::Terminal))
-			path.pop();
-
-		while (path.size() > 0)
-			path.pop();
 		bool found = false;
 		while (found == false) {
-			findRightPath((DerivationTree::NonTerminalNode*)dtree->_root);
+			findRightPath(dtree->_root);
 			while (path.size() > 0 && found == false) {
-				if (path.top()->Type() == DerivationTree::NodeType::NonTerminal) {
-					auto itr = _tree->_hashmap.find(path.top()->_grammarID);
-					if (itr != _tree->_hashmap.end()) {
-						gnode = itr->second;
-						// we are in business
-						if (gnode->_expansions.size() > 0) {
-							for (auto exp : gnode->_expansions) {
-								// find one that has multiple nodes with ProduceSequence flag
-								int32_t c = 60;
-								for (auto nd : exp->_nodes)
-									if (nd->_flags & GrammarNode::NodeFlags::ProduceSequence)
-										c++;
-								if (c > 1) {
-									found = true;
-									break;
-								}
-							}
-						}
+				if (dtree->GetNode(path.top())._type == DerivationTree::NodeType::NonTerminal) {
+					if (uint32_t index = compiled->Find(dtree->GetNode(path.top())._grammarID); index != CompiledGrammar::None) {
+						gnode = index;
+						// we are in business, any expansion will do
+						if (compiled->GetNode(gnode).expansionCount > 0)
+							found = true;
 					}
 				}
 				if (found == false)
@@ -2591,38 +2758,35 @@ void Grammar::Extend(std::shared_ptr<Input> sinput, std::shared_ptr<DerivationTr
 		}
 
 		root = path.top();
-		// delete path it takes up ram
-		while (path.size() > 0)
-			path.pop();
-		//}
 	}
 	else
 	{
 		// well its a simple regex, so this stuff is simple
-		root = (DerivationTree::NonTerminalNode*)dtree->_root;
-		gnode = _tree->_root;
+		root = dtree->_root;
+		gnode = compiled->GetRoot();
 	}
 
 	// count of generated sequence nodes
 	int32_t seq = 0;
 	// holds all nonterminals that were generated
-	std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>> qnonterminals;
+	DerivationQueue qnonterminals;
 	// holds all sequence nodes and sequence producing nodes during generation
-	std::deque<std::pair<DerivationTree::NonTerminalNode*, std::shared_ptr<GrammarNode>>> qseqnonterminals;
+	DerivationQueue qseqnonterminals;
 
 	// begin: insert start node
 	if (_tree->_simpleGrammar)
-		root->_children.reserve(root->_children.size() + targetlength);
-	if (gnode->_flags & GrammarNode::NodeFlags::ProduceSequence) {
-		qseqnonterminals.push_back({ root, gnode });
-	} else if (gnode->_flags & GrammarNode::NodeFlags::ProduceNonTerminals) {
-		qnonterminals.push_back({ root, gnode });
+		dtree->ReserveNodes(dtree->_nodes + targetlength);
+	dtree->UnshareChildren(root);
+	if (compiled->GetNode(gnode).flags & GrammarNode::NodeFlags::ProduceSequence) {
+		qseqnonterminals.Push(root, gnode);
+	} else if (compiled->GetNode(gnode).flags & GrammarNode::NodeFlags::ProduceNonTerminals) {
+		qnonterminals.Push(root, gnode);
 	}
 
 	// generated sequence nodes
 	seq = 0;
 
-	DeriveFromNode(dtree, qnonterminals, qseqnonterminals, randan, seq);
+	DeriveFromNode(dtree, *compiled, qnonterminals, qseqnonterminals, randan, seq);
 
 	dtree->_valid = true;
 	dtree->SetRegenerate(true);
@@ -2659,6 +2823,7 @@ void Grammar::RegisterFactories()
 {
 	if (!_registeredFactories) {
 		_registeredFactories = !_registeredFactories;
+		Functions::RegisterFactory(Functions::DerivePiecesCallback::GetTypeStatic(), Functions::DerivePiecesCallback::Create);
 	}
 }
 
@@ -2912,10 +3077,12 @@ bool Grammar::ReadData(std::istream* buffer, size_t& offset, size_t length, Load
 
 void Grammar::InitializeEarly(LoadResolver* /*resolver*/)
 {
+	_tree->Compile();
 	// now construct tree for parsing
 	_treeParse = std::make_shared<GrammarTree>();
 	_tree->DeepCopy(_treeParse);
 	_treeParse->InsertParseNodes();
+	_treeParse->Compile();
 }
 
 void Grammar::InitializeLate(LoadResolver* /*resolver*/)
@@ -2999,3 +3166,46 @@ void LoadResolverGrammar::Resolve()
 		del->Dispose();
 	}
 }
+
+namespace Functions
+{
+	void DerivePiecesCallback::Run()
+	{
+		// callbacks restored from a savefile do not have a derivation attached
+		if (_derivation)
+			_derivation->Work();
+	}
+
+	std::shared_ptr<BaseFunction> DerivePiecesCallback::DeepCopy()
+	{
+		auto ptr = std::make_shared<DerivePiecesCallback>();
+		ptr->_derivation = _derivation;
+		return dynamic_pointer_cast<BaseFunction>(ptr);
+	}
+
+	bool DerivePiecesCallback::ReadData(std::istream*, size_t&, size_t, LoadResolver*)
+	{
+		return true;
+	}
+
+	bool DerivePiecesCallback::ReadData(unsigned char*, size_t&, size_t, LoadResolver*)
+	{
+		return true;
+	}
+
+	bool DerivePiecesCallback::WriteData(std::ostream* buffer, size_t& offset)
+	{
+		BaseFunction::WriteData(buffer, offset);
+		return true;
+	}
+
+	size_t DerivePiecesCallback::GetLength()
+	{
+		return BaseFunction::GetLength();
+	}
+
+	void DerivePiecesCallback::Dispose()
+	{
+		_derivation.reset();
+	}
+}
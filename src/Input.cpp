@@ -452,6 +452,19 @@ void Input::AddEntry(std::string entry)
 	SetChanged();
 }
 
+void Input::AddEntries(const DerivationTree::SequenceBuffer& buffer, size_t count)
+{
+	count = std::min(count, buffer.Size());
+	// the entries are built outside of the sequence, so that it is only locked twice. Existing entries are kept in front
+	std::vector<std::string> entries;
+	_sequence.swap(entries);
+	entries.reserve(entries.size() + count);
+	for (size_t i = 0; i < count; i++)
+		entries.emplace_back(buffer.Get(i));
+	_sequence.swap(entries);
+	SetChanged();
+}
+
 std::string Input::ToString()
 {
 	std::string str = "[ ";
@@ -895,6 +908,18 @@ uint64_t Input::GetDerivedFails()
 	return _derivedFails;
 }
 
+void Input::IncRegenerationUses()
+{
+	Utility::SpinLock guard(_derivedFlag);
+	_regenerationUses++;
+}
+
+uint64_t Input::GetRegenerationUses()
+{
+	Utility::SpinLock guard(_derivedFlag);
+	return _regenerationUses;
+}
+
 void Input::SetGenerationTime(std::chrono::nanoseconds genTime)
 {
 	std::unique_lock<std::shared_mutex> guard(_lock);
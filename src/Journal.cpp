@@ -0,0 +1,324 @@
+#include "Journal.h"
+#include "BufferOperations.h"
+#include "Codecs.h"
+#include "Data.h"
+#include "LZMAStreamBuf.h"
+#include "Logging.h"
+#include "MappedFile.h"
+#include "SaveFile.h"
+
+#include <fstream>
+#include <unordered_map>
+
+namespace Journal
+{
+	static constexpr uint64_t Magic = 0x4C4E52554F4A4654;         // TFJOURNL
+	static constexpr uint64_t CommitMarker = 0x54494D4D4F434654;  // TFCOMMIT
+	static constexpr int32_t Version = 0x1;
+
+	std::filesystem::path GetPath(std::filesystem::path base)
+	{
+		return base.replace_extension(Extension);
+	}
+
+	void WriteFileHeader(std::ostream* out, FileHeader& header)
+	{
+		unsigned char buffer[FileHeader::Size];
+		size_t offset = 0;
+		Buffer::Write(Magic, buffer, offset);
+		Buffer::Write(Version, buffer, offset);
+		Buffer::Write(header.guid1, buffer, offset);
+		Buffer::Write(header.guid2, buffer, offset);
+		Buffer::Write(header.base, buffer, offset);
+		out->write((char*)buffer, FileHeader::Size);
+	}
+
+	bool ReadFileHeader(std::istream* in, FileHeader& header)
+	{
+		unsigned char buffer[FileHeader::Size];
+		in->read((char*)buffer, FileHeader::Size);
+		if (in->gcount() != (std::streamsize)FileHeader::Size)
+			return false;
+		size_t offset = 0;
+		if (Buffer::ReadUInt64(buffer, offset) != Magic || Buffer::ReadInt32(buffer, offset) != Version)
+			return false;
+		header.guid1 = Buffer::ReadUInt64(buffer, offset);
+		header.guid2 = Buffer::ReadUInt64(buffer, offset);
+		header.base = Buffer::ReadInt32(buffer, offset);
+		return true;
+	}
+
+	void WriteSegment(std::ostream* out, SegmentHeader& header, const std::string& data)
+	{
+		unsigned char buffer[SegmentHeader::Size + 8];
+		size_t offset = 0;
+		Buffer::Write(header.epoch, buffer, offset);
+		Buffer::Write(header.nextformid, buffer, offset);
+		Buffer::Write(header.globalTasks, buffer, offset);
+		Buffer::Write(header.globalExec, buffer, offset);
+		Buffer::Write(header.runtime, buffer, offset);
+		Buffer::Write(header.codec, buffer, offset);
+		Buffer::Write(header.records, buffer, offset);
+		Buffer::Write(header.rawsize, buffer, offset);
+		Buffer::Write(header.storedsize, buffer, offset);
+		out->write((char*)buffer, SegmentHeader::Size);
+		out->write(data.data(), data.size());
+		// the marker is written last, a segment without it has been torn
+		offset = 0;
+		Buffer::Write(CommitMarker ^ header.epoch, buffer, offset);
+		out->write((char*)buffer, 8);
+	}
+
+	bool ReadSegment(std::istream* in, SegmentHeader& header, std::string& data)
+	{
+		unsigned char buffer[SegmentHeader::Size];
+		in->read((char*)buffer, SegmentHeader::Size);
+		if (in->gcount() != (std::streamsize)SegmentHeader::Size)
+			return false;
+		size_t offset = 0;
+		header.epoch = Buffer::ReadUInt64(buffer, offset);
+		header.nextformid = Buffer::ReadUInt64(buffer, offset);
+		header.globalTasks = Buffer::ReadBool(buffer, offset);
+		header.globalExec = Buffer::ReadBool(buffer, offset);
+		header.runtime = Buffer::ReadNanoSeconds(buffer, offset);
+		header.codec = Buffer::ReadInt32(buffer, offset);
+		header.records = Buffer::ReadUInt64(buffer, offset);
+		header.rawsize = Buffer::ReadUInt64(buffer, offset);
+		header.storedsize = Buffer::ReadUInt64(buffer, offset);
+		// don't trust the sizes of a torn header
+		auto pos = in->tellg();
+		in->seekg(0, std::ios_base::end);
+		auto end = in->tellg();
+		in->seekg(pos);
+		if (pos < 0 || (uint64_t)(end - pos) < header.storedsize + 8)
+			return false;
+		data.resize(header.storedsize);
+		in->read(data.data(), header.storedsize);
+		if (in->gcount() != (std::streamsize)header.storedsize)
+			return false;
+		offset = 0;
+		in->read((char*)buffer, 8);
+		return in->gcount() == 8 && Buffer::ReadUInt64(buffer, offset) == (CommitMarker ^ header.epoch);
+	}
+
+	namespace
+	{
+		bool IsBulk(int32_t type)
+		{
+			return type == FormType::Input || type == FormType::DevTree;
+		}
+
+		struct JournalRecord
+		{
+			int32_t type = 0;
+			EnumType flags = 0;
+			std::string data;
+		};
+	}
+
+	bool ReadFormIDs(const std::string& data, uint64_t records, std::vector<FormID>& formids)
+	{
+		return SaveFile::ForEachRecord(data.data(), data.size(), records, [&formids](int32_t type, const char* record, size_t length) {
+			FormID formid = 0;
+			EnumType flags = 0;
+			if (type != 'STRH' && SaveFile::ReadFormHeader(record, length, formid, flags))
+				formids.push_back(formid);
+		});
+	}
+
+	bool Compact(CompactArgs& args)
+	{
+		// collect the latest version of every form in the journal, and all strings interned after the base
+		std::unordered_map<FormID, JournalRecord> latest;
+		std::vector<FormID> order;
+		std::string strings;
+		uint64_t stringcount = 0;
+		SegmentHeader last;
+		uint64_t segments = 0;
+		{
+			std::ifstream journal(args.journal, std::ios_base::in | std::ios_base::binary);
+			FileHeader fheader;
+			if (!ReadFileHeader(&journal, fheader)) {
+				logcritical("Cannot read journal \"{}\"", args.journal.string());
+				return false;
+			}
+			std::unordered_map<int32_t, std::unique_ptr<Codecs::Codec>> codecs;
+			SegmentHeader header;
+			std::string data;
+			std::string raw;
+			while ((uint64_t)journal.tellg() < args.end && ReadSegment(&journal, header, data)) {
+				const std::string* block = &data;
+				if (header.codec != (int32_t)Codecs::CodecType::None) {
+					auto& codec = codecs[header.codec];
+					if (!codec)
+						codec = Codecs::CreateCodec((Codecs::CodecType)header.codec);
+					raw.resize(header.rawsize);
+					if (!codec || !codec->Decompress(data.data(), data.size(), raw.data(), raw.size())) {
+						logcritical("Cannot decompress segment {} of journal", header.epoch);
+						return false;
+					}
+					block = &raw;
+				}
+				bool valid = SaveFile::ForEachRecord(block->data(), block->size(), header.records, [&](int32_t type, const char* record, size_t length) {
+					if (type == 'STRH') {
+						// version, number of strings, strings
+						if (length < 24)
+							return;
+						size_t offset = 16;
+						stringcount += Buffer::ReadSize((unsigned char*)record, offset);
+						strings.append(record + 24, length - 24);
+						return;
+					}
+					FormID formid = 0;
+					EnumType flags = 0;
+					if (!SaveFile::ReadFormHeader(record, length, formid, flags))
+						return;
+					auto [itr, inserted] = latest.try_emplace(formid);
+					if (inserted)
+						order.push_back(formid);
+					itr->second.type = type;
+					itr->second.flags = flags;
+					itr->second.data.assign(record, length);
+				});
+				if (!valid) {
+					logcritical("Segment {} of journal is corrupted", header.epoch);
+					return false;
+				}
+				last = header;
+				segments++;
+			}
+		}
+
+		MappedFile base;
+		if (!base.Open(args.base)) {
+			logcritical("Cannot open base savefile \"{}\"", args.base.string());
+			return false;
+		}
+		SaveFile::Header header;
+		if (!SaveFile::ReadHeader(base.GetData(), base.GetSize(), header)) {
+			logcritical("Journals require a full base savefile of version 0x6 or newer");
+			return false;
+		}
+		// the compacted savefile is written in the current version
+		int32_t version = header.version;
+		std::unique_ptr<Codecs::Codec> codec;
+		if (header.codec != Codecs::CodecType::None)
+			codec = Codecs::CreateCodec(header.codec, args.compressionLevel, header.compressionExtreme, header.dictionary);
+
+		std::vector<Data::SaveBlockIndexEntry> blocks;
+		std::vector<Data::SaveFormIndexEntry> forms;
+		{
+			MappedStreambuf buf(base.GetData(), base.GetSize());
+			std::istream stream(&buf);
+			if (!Data::ReadSaveIndex(stream, version, blocks, forms)) {
+				logcritical("Cannot read the index of the base savefile");
+				return false;
+			}
+		}
+		// which kinds of records each block holds, so that every pass only decompresses the blocks it needs
+		std::vector<uint64_t> bulkrecords(blocks.size(), 0);
+		for (auto& entry : forms)
+			if (entry.block < blocks.size() && IsBulk(entry.type))
+				bulkrecords[entry.block]++;
+
+		std::ofstream out(args.output, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!out.is_open()) {
+			logcritical("Cannot create savefile \"{}\"", args.output.string());
+			return false;
+		}
+		header.nextformid = last.nextformid;
+		header.globalTasks = last.globalTasks;
+		header.globalExec = last.globalExec;
+		header.runtime = last.runtime;
+		header.compressionLevel = codec ? args.compressionLevel : -1;
+		header.records = 0;
+		SaveFile::WriteHeader(&out, header);
+
+		SaveFile::BlockWriter writer;
+		writer.out = &out;
+		writer.codec = codec.get();
+		writer.blockRecords = args.blockRecords;
+		std::string raw;
+		bool failed = false;
+		// copies the records of the base that haven't been changed in the journal
+		auto copyBase = [&](bool bulk) {
+			for (size_t i = 0; i < blocks.size() && !failed; i++) {
+				auto& entry = blocks[i];
+				if ((bulk && bulkrecords[i] == 0) || (!bulk && bulkrecords[i] == entry.records))
+					continue;
+				const char* data = SaveFile::GetBlockData(base.GetData(), base.GetSize(), version, entry);
+				if (data == nullptr) {
+					logcritical("Block {} of the base savefile is damaged", i);
+					failed = true;
+					break;
+				}
+				if (codec) {
+					raw.resize(entry.rawsize);
+					if (!codec->Decompress(data, entry.storedsize, raw.data(), raw.size())) {
+						failed = true;
+						break;
+					}
+					data = raw.data();
+				}
+				failed |= !SaveFile::ForEachRecord(data, entry.rawsize, entry.records, [&](int32_t type, const char* record, size_t length) {
+					if (IsBulk(type) != bulk)
+						return;
+					if (type == 'STRH') {
+						// the string hashmap is written into a block of its own, extended by the strings from the journal
+						if (length < 24)
+							return;
+						writer.Flush();
+						size_t offset = 16;
+						uint64_t count = Buffer::ReadSize((unsigned char*)record, offset);
+						std::string merged(24, '\0');
+						offset = 0;
+						Buffer::WriteSize(length - 12 + strings.size(), (unsigned char*)merged.data(), offset);
+						Buffer::Write((int32_t)'STRH', (unsigned char*)merged.data(), offset);
+						memcpy(merged.data() + offset, record + 12, 4);
+						offset += 4;
+						Buffer::WriteSize(count + stringcount, (unsigned char*)merged.data(), offset);
+						merged.append(record + 24, length - 24);
+						merged.append(strings);
+						writer.Add(type, merged.data(), merged.size());
+						writer.Flush();
+						return;
+					}
+					FormID formid = 0;
+					EnumType flags = 0;
+					if (SaveFile::ReadFormHeader(record, length, formid, flags) && latest.contains(formid))
+						return;
+					writer.Add(type, record, length);
+				});
+			}
+		};
+		// adds the latest versions of forms from the journal, forms deleted since the base are dropped
+		auto copyJournal = [&](bool bulk) {
+			for (FormID formid : order) {
+				auto& record = latest[formid];
+				if (IsBulk(record.type) != bulk || (record.flags & Form::FormFlags::Deleted))
+					continue;
+				writer.Add(record.type, record.data.data(), record.data.size());
+			}
+		};
+		// Inputs and DerivationTrees are written last, in blocks of their own, just as in a regular save
+		copyBase(false);
+		copyJournal(false);
+		writer.Flush();
+		copyBase(true);
+		copyJournal(true);
+		writer.Finish();
+		failed |= writer.failed;
+
+		SaveFile::WriteRecordCount(&out, writer.written);
+		out.flush();
+		failed |= out.fail();
+		out.close();
+		if (failed) {
+			logcritical("Failed to compact journal \"{}\"", args.journal.string());
+			std::filesystem::remove(args.output);
+			return false;
+		}
+		loginfo("Compacted {} segments with {} forms into \"{}\"", segments, latest.size(), args.output.filename().string());
+		return true;
+	}
+}
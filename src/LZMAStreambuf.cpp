@@ -10,6 +10,8 @@
 
 #include "LZMAStreamBuf.h"
 #include "Logging.h"
+#include "BufferOperations.h"
+#include "Checksum.h"
 #include <cassert>
 
 
@@ -340,3 +342,130 @@ int LZMAStreambuf::overflow(int c)
 		}
 	}
 }
+
+
+
+void BlockStreambuf::WriteHeader(unsigned char* header, uint64_t rawsize, uint64_t storedsize, uint64_t records, uint32_t checksum)
+{
+	size_t offset = 0;
+	Buffer::Write(rawsize, header, offset);
+	Buffer::Write(storedsize, header, offset);
+	Buffer::Write(records, header, offset);
+	Buffer::Write(checksum, header, offset);
+	Buffer::Write(Checksum::CRC32C(header, offset), header, offset);
+}
+
+bool BlockStreambuf::ReadHeader(const unsigned char* header, bool checksums, uint64_t& rawsize, uint64_t& storedsize, uint64_t& records, uint32_t& checksum)
+{
+	size_t offset = 0;
+	rawsize = Buffer::ReadUInt64((unsigned char*)header, offset);
+	storedsize = Buffer::ReadUInt64((unsigned char*)header, offset);
+	records = Buffer::ReadUInt64((unsigned char*)header, offset);
+	checksum = 0;
+	if (!checksums)
+		return true;
+	checksum = Buffer::ReadUInt32((unsigned char*)header, offset);
+	return Buffer::ReadUInt32((unsigned char*)header, offset) == Checksum::CRC32C(header, LegacyHeaderSize + 4);
+}
+
+BlockStreambuf::BlockStreambuf(std::istream* pIn, Codecs::Codec* codec, bool checksums) :
+	_in(pIn),
+	_codec(codec),
+	_checksums(checksums)
+{
+	setg(nullptr, nullptr, nullptr);
+}
+
+int BlockStreambuf::underflow()
+{
+	// Do nothing if data is still available (sanity check)
+	if (this->gptr() < this->egptr())
+		return traits_type::to_int_type(*this->gptr());
+
+	size_t headersize = GetHeaderSize(_checksums);
+	while (!_end) {
+		if (_useoffsets) {
+			if (_block >= _offsets.size()) {
+				_end = true;
+				break;
+			}
+			_in->clear();
+			_in->seekg(_offsets[_block]);
+		}
+		unsigned char header[HeaderSize];
+		_in->read((char*)header, headersize);
+		if (_in->gcount() != (std::streamsize)headersize) {
+			_end = true;
+			break;
+		}
+		uint64_t rawsize = 0, storedsize = 0, records = 0;
+		uint32_t checksum = 0;
+		if (!ReadHeader(header, _checksums, rawsize, storedsize, records, checksum)) {
+			logcritical("Header of block {} is damaged", _block);
+			_damaged = true;
+			_end = true;
+			break;
+		}
+		if (rawsize == 0) {
+			_end = true;
+			break;
+		}
+		size_t block = _block++;
+		if (block < _skip.size() && _skip[block]) {
+			_in->seekg(storedsize, std::ios_base::cur);
+			continue;
+		}
+		// if the source is held in memory, blocks are decompressed from or read in place
+		char* stored = Buffer::View(_in, storedsize);
+		if (!stored && (_codec || _checksums)) {
+			if (storedsize > _compressedSize) {
+				_compressedBuffer.reset(new char[storedsize]);
+				_compressedSize = storedsize;
+			}
+			_in->read(_compressedBuffer.get(), storedsize);
+			if (_in->gcount() != (std::streamsize)storedsize) {
+				logcritical("Failed to read block of {} bytes", rawsize);
+				_end = true;
+				break;
+			}
+			stored = _compressedBuffer.get();
+		}
+		if (_checksums && Checksum::CRC32C(stored, storedsize) != checksum) {
+			logcritical("Block {} is damaged", block);
+			_damaged = true;
+			_end = true;
+			break;
+		}
+		if (!_codec && stored) {
+			if (storedsize != rawsize) {
+				logcritical("Failed to read block of {} bytes", rawsize);
+				_end = true;
+				break;
+			}
+			setg(stored, stored, stored + rawsize);
+			return traits_type::to_int_type(*this->gptr());
+		}
+		if (rawsize > _decompressedSize) {
+			_decompressedBuffer.reset(new char[rawsize]);
+			_decompressedSize = rawsize;
+		}
+		if (_codec) {
+			if (!_codec->Decompress(stored, storedsize, _decompressedBuffer.get(), rawsize)) {
+				logcritical("Failed to read block of {} bytes", rawsize);
+				_end = true;
+				break;
+			}
+		} else {
+			_in->read(_decompressedBuffer.get(), rawsize);
+			if (_in->gcount() != (std::streamsize)rawsize) {
+				logcritical("Failed to read block of {} bytes", rawsize);
+				_end = true;
+				break;
+			}
+		}
+		setg(_decompressedBuffer.get(), _decompressedBuffer.get(), _decompressedBuffer.get() + rawsize);
+		return traits_type::to_int_type(*this->gptr());
+	}
+	setg(nullptr, nullptr, nullptr);
+	return traits_type::eof();
+}
@@ -0,0 +1,121 @@
+#include "MappedFile.h"
+#include "Logging.h"
+
+#if defined(unix) || defined(__unix__) || defined(__unix)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#elif defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include <Windows.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+#if defined(unix) || defined(__unix__) || defined(__unix)
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	// private writable mapping, so streambufs may hand out non-const pointers into it
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+	if (data == MAP_FAILED) {
+		logwarn("Failed to map file \"{}\"", path.string());
+		return false;
+	}
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+	_data = (char*)data;
+	_size = (size_t)st.st_size;
+	return true;
+#elif defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		logwarn("Failed to map file \"{}\"", path.string());
+		return false;
+	}
+	void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		logwarn("Failed to map file \"{}\"", path.string());
+		return false;
+	}
+	_file = file;
+	_mapping = mapping;
+	_data = (char*)data;
+	_size = (size_t)size.QuadPart;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void MappedFile::Close()
+{
+	if (_data == nullptr)
+		return;
+#if defined(unix) || defined(__unix__) || defined(__unix)
+	munmap(_data, _size);
+#elif defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#endif
+	_data = nullptr;
+	_size = 0;
+}
+
+MappedStreambuf::MappedStreambuf(char* data, size_t size)
+{
+	setg(data, data, data + size);
+}
+
+MappedStreambuf::pos_type MappedStreambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	off_type pos = 0;
+	switch (dir) {
+	case std::ios_base::beg:
+		pos = off;
+		break;
+	case std::ios_base::cur:
+		pos = (gptr() - eback()) + off;
+		break;
+	case std::ios_base::end:
+		pos = (egptr() - eback()) + off;
+		break;
+	default:
+		return pos_type(off_type(-1));
+	}
+	return seekpos(pos_type(pos), which);
+}
+
+MappedStreambuf::pos_type MappedStreambuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	if (!(which & std::ios_base::in) || off_type(pos) < 0 || off_type(pos) > egptr() - eback())
+		return pos_type(off_type(-1));
+	setg(eback(), eback() + off_type(pos), egptr());
+	return pos;
+}
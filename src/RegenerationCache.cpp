@@ -0,0 +1,84 @@
+#include "RegenerationCache.h"
+#include "Data.h"
+#include "DerivationTree.h"
+#include "Input.h"
+
+#include <algorithm>
+
+bool RegenerationCache::NeedsRegeneration(std::shared_ptr<Input> input)
+{
+	return input->GetGenerated() == false || input->GetSequenceLength() == 0 || !input->derive || input->derive->_valid == false;
+}
+
+RegenerationCache::Cost RegenerationCache::Estimate(Data* data, std::shared_ptr<Input> input, bool simpleGrammar)
+{
+	Cost cost;
+	while (input && cost.depth < MaxDepth) {
+		cost.depth++;
+		// the derivation tree is regenerated and the sequence is gathered from it
+		int64_t length = input->derive ? input->derive->_sequenceNodes : (int64_t)input->GetSequenceLength();
+		cost.cost += (uint64_t)std::max(length, (int64_t)0) * DeriveWeight;
+		if (!input->HasFlag(Input::Flags::GeneratedGrammarParent) && !input->HasFlag(Input::Flags::GeneratedDeltaDebugging))
+			break;
+		auto parent = data->LookupFormID<Input>(input->GetParentID());
+		if (!parent)
+			break;
+		// delta debugging extracts the input from the whole tree of the parent, extensions share the tree of the
+		// parent and only derive the new part
+		if (input->HasFlag(Input::Flags::GeneratedDeltaDebugging) && parent->derive)
+			cost.cost += (uint64_t)std::max(parent->derive->_sequenceNodes, (int64_t)0) * (simpleGrammar ? DeriveWeight : ParseWeight);
+		if (!NeedsRegeneration(parent))
+			break;
+		input = parent;
+	}
+	return cost;
+}
+
+uint64_t RegenerationCache::GetMemorySize(std::shared_ptr<Input> input)
+{
+	return input->MemorySize() + (input->derive ? input->derive->MemorySize() : 0);
+}
+
+size_t RegenerationCache::Order(Data* data, std::vector<std::shared_ptr<Input>>& inputs, bool simpleGrammar, uint64_t cacheSize)
+{
+	struct Entry
+	{
+		std::shared_ptr<Input> input;
+		/// <summary>
+		/// cost of regenerating the input per byte it holds
+		/// </summary>
+		double cost;
+		/// <summary>
+		/// regeneration work saved per byte by keeping the input
+		/// </summary>
+		double saved;
+		uint64_t bytes;
+		bool cached = false;
+	};
+	std::vector<Entry> entries;
+	entries.reserve(inputs.size());
+	for (auto& input : inputs) {
+		uint64_t bytes = std::max(GetMemorySize(input), (uint64_t)1);
+		double cost = (double)Estimate(data, input, simpleGrammar).cost / (double)bytes;
+		// inputs that are the parent of others are needed each time one of those is regenerated
+		uint64_t uses = input->GetDerivedInputs() + input->GetRegenerationUses();
+		entries.push_back({ input, cost, cost * (double)uses, bytes });
+	}
+
+	// fill the cache with the inputs saving the most work per byte
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) { return lhs.saved > rhs.saved; });
+	uint64_t used = 0;
+	for (auto& entry : entries) {
+		if (entry.saved > 0 && used + entry.bytes <= cacheSize) {
+			used += entry.bytes;
+			entry.cached = true;
+		}
+	}
+	// the others are freed cheapest to regenerate first
+	auto cached = std::stable_partition(entries.begin(), entries.end(), [](const Entry& entry) { return !entry.cached; });
+	std::stable_sort(entries.begin(), cached, [](const Entry& lhs, const Entry& rhs) { return lhs.cost < rhs.cost; });
+
+	for (size_t i = 0; i < entries.size(); i++)
+		inputs[i] = std::move(entries[i].input);
+	return (size_t)(cached - entries.begin());
+}
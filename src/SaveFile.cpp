@@ -0,0 +1,351 @@
+#include "SaveFile.h"
+#include "Checksum.h"
+#include "LZMAStreamBuf.h"
+#include "MappedFile.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#if defined(unix) || defined(__unix__) || defined(__unix)
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+namespace SaveFile
+{
+	bool ReadHeader(const char* data, size_t size, Header& header)
+	{
+		if (size < RecordCountOffset + 8 + 12)
+			return false;
+		unsigned char* buffer = (unsigned char*)data;
+		size_t offset = 0;
+		header.version = Buffer::ReadInt32(buffer, offset);
+		if (header.version < 0x6)
+			return false;
+		memcpy(header.guid, data + offset, 16);
+		offset += 16;
+		header.nextformid = Buffer::ReadUInt64(buffer, offset);
+		header.globalTasks = Buffer::ReadBool(buffer, offset);
+		header.globalExec = Buffer::ReadBool(buffer, offset);
+		header.runtime = Buffer::ReadNanoSeconds(buffer, offset);
+		header.compressionLevel = Buffer::ReadInt32(buffer, offset);
+		header.compressionExtreme = Buffer::ReadBool(buffer, offset);
+		// incremental savefiles list their prior saves, which moves all following fields
+		if (Buffer::ReadSize(buffer, offset) != 0)
+			return false;
+		offset = RecordCountOffset;
+		header.records = Buffer::ReadUInt64(buffer, offset);
+		header.codec = (Codecs::CodecType)Buffer::ReadInt32(buffer, offset);
+		size_t dictsize = Buffer::ReadSize(buffer, offset);
+		if (offset + dictsize > size)
+			return false;
+		header.dictionary.assign(data + offset, dictsize);
+		return true;
+	}
+
+	void WriteHeader(std::ostream* out, Header& header)
+	{
+		unsigned char buffer[RecordCountOffset + 8];
+		size_t offset = 0;
+		header.version = Data::saveversion;
+		Buffer::Write(header.version, buffer, offset);
+		memcpy(buffer + offset, header.guid, 16);
+		offset += 16;
+		Buffer::Write(header.nextformid, buffer, offset);
+		Buffer::Write(header.globalTasks, buffer, offset);
+		Buffer::Write(header.globalExec, buffer, offset);
+		Buffer::Write(header.runtime, buffer, offset);
+		Buffer::Write(header.compressionLevel, buffer, offset);
+		Buffer::Write(header.compressionExtreme, buffer, offset);
+		Buffer::WriteSize(0, buffer, offset);
+		// no callback
+		memset(buffer + offset, 0, 256);
+		offset += 256;
+		Buffer::Write(header.records, buffer, offset);
+		out->write((char*)buffer, RecordCountOffset + 8);
+		offset = 0;
+		Buffer::Write((int32_t)header.codec, out, offset);
+		Buffer::WriteSize(header.dictionary.size(), out, offset);
+		out->write(header.dictionary.data(), header.dictionary.size());
+	}
+
+	void WriteRecordCount(std::ostream* out, uint64_t records)
+	{
+		auto pos = out->tellp();
+		out->seekp(RecordCountOffset);
+		size_t offset = 0;
+		Buffer::Write(records, out, offset);
+		out->seekp(pos);
+	}
+
+	bool ReadFormHeader(const char* record, size_t length, FormID& formid, EnumType& flags)
+	{
+		if (length < 12 + 24)
+			return false;
+		size_t offset = 12 + 8;
+		formid = Buffer::ReadUInt64((unsigned char*)record, offset);
+		flags = Buffer::ReadUInt64((unsigned char*)record, offset);
+		return true;
+	}
+
+	void WriteFormFlags(char* record, size_t length, EnumType flags)
+	{
+		if (length < 12 + 24)
+			return;
+		size_t offset = 12 + 16;
+		Buffer::Write(flags, (unsigned char*)record, offset);
+	}
+
+	void BlockWriter::Add(int32_t type, const char* record, size_t length)
+	{
+		FormID formid = 0;
+		EnumType flags = 0;
+		if (type != 'STRH' && ReadFormHeader(record, length, formid, flags))
+			pending.push_back({ formid, type, flags, 0, block.size() });
+		block.append(record, length);
+		records++;
+		written++;
+		if (records >= blockRecords)
+			Flush();
+	}
+
+	void BlockWriter::Flush()
+	{
+		if (records == 0)
+			return;
+		std::string compressed;
+		const std::string* stored = &block;
+		if (codec) {
+			if (codec->Compress(block.data(), block.size(), compressed))
+				stored = &compressed;
+			else
+				failed = true;
+		}
+		WriteBlock(block.size(), *stored, records);
+		for (auto& form : pending) {
+			form.block = index.size() - 1;
+			forms.push_back(form);
+		}
+		pending.clear();
+		block.clear();
+		records = 0;
+	}
+
+	void BlockWriter::WriteBlock(uint64_t rawsize, const std::string& stored, uint64_t count)
+	{
+		Data::SaveBlockIndexEntry entry;
+		entry.rawsize = rawsize;
+		entry.storedsize = stored.size();
+		entry.records = count;
+		SaveFile::WriteBlock(out, entry, stored.data());
+		index.push_back(entry);
+	}
+
+	void BlockWriter::Finish()
+	{
+		Flush();
+		WriteBlock(0, {}, 0);
+		index.pop_back();
+		WriteIndex(out, index, forms);
+	}
+
+	uint64_t GetHeaderSize(Header& header)
+	{
+		return RecordCountOffset + 8 + 12 + header.dictionary.size();
+	}
+
+	const char* GetBlockData(const char* file, size_t size, int32_t version, const Data::SaveBlockIndexEntry& entry)
+	{
+		bool checksums = version >= 0x7;
+		size_t headersize = BlockStreambuf::GetHeaderSize(checksums);
+		if (entry.offset > size || size - entry.offset < headersize || size - entry.offset - headersize < entry.storedsize)
+			return nullptr;
+		const char* data = file + entry.offset + headersize;
+		if (!checksums)
+			return data;
+		uint64_t rawsize = 0, storedsize = 0, records = 0;
+		uint32_t checksum = 0;
+		if (!BlockStreambuf::ReadHeader((const unsigned char*)file + entry.offset, true, rawsize, storedsize, records, checksum))
+			return nullptr;
+		if (rawsize != entry.rawsize || storedsize != entry.storedsize || records != entry.records || checksum != entry.checksum)
+			return nullptr;
+		if (Checksum::CRC32C(data, storedsize) != checksum)
+			return nullptr;
+		return data;
+	}
+
+	void WriteBlock(std::ostream* out, Data::SaveBlockIndexEntry& entry, const char* data)
+	{
+		entry.offset = (uint64_t)out->tellp();
+		entry.checksum = Checksum::CRC32C(data, entry.storedsize);
+		unsigned char header[BlockStreambuf::HeaderSize];
+		BlockStreambuf::WriteHeader(header, entry.rawsize, entry.storedsize, entry.records, entry.checksum);
+		out->write((char*)header, BlockStreambuf::HeaderSize);
+		out->write(data, entry.storedsize);
+	}
+
+	void WriteIndex(std::ostream* out, std::vector<Data::SaveBlockIndexEntry>& index, std::vector<Data::SaveFormIndexEntry>& forms)
+	{
+		uint64_t indexpos = (uint64_t)out->tellp();
+		uint64_t formindexpos = indexpos + 8 + index.size() * 36;
+		size_t len = 8 + index.size() * 36 + 8 + forms.size() * 36;
+		std::unique_ptr<unsigned char[]> buffer(new unsigned char[len + 20]);
+		size_t offset = 0;
+		Buffer::WriteSize(index.size(), buffer.get(), offset);
+		for (auto& entry : index) {
+			Buffer::Write(entry.offset, buffer.get(), offset);
+			Buffer::Write(entry.rawsize, buffer.get(), offset);
+			Buffer::Write(entry.storedsize, buffer.get(), offset);
+			Buffer::Write(entry.records, buffer.get(), offset);
+			Buffer::Write(entry.checksum, buffer.get(), offset);
+		}
+		Buffer::WriteSize(forms.size(), buffer.get(), offset);
+		for (auto& entry : forms) {
+			Buffer::Write(entry.formid, buffer.get(), offset);
+			Buffer::Write(entry.type, buffer.get(), offset);
+			Buffer::Write(entry.flags, buffer.get(), offset);
+			Buffer::Write(entry.block, buffer.get(), offset);
+			Buffer::Write(entry.offset, buffer.get(), offset);
+		}
+		Buffer::Write(Checksum::CRC32C(buffer.get(), len), buffer.get(), offset);
+		Buffer::Write(formindexpos, buffer.get(), offset);
+		Buffer::Write(indexpos, buffer.get(), offset);
+		out->write((char*)buffer.get(), offset);
+	}
+
+	void ScanBlocks(const char* file, size_t size, uint64_t start, std::vector<Data::SaveBlockIndexEntry>& blocks, uint64_t& damaged)
+	{
+		damaged = 0;
+		uint64_t pos = start;
+		bool resync = false;
+		while (pos <= size && size - pos >= BlockStreambuf::HeaderSize) {
+			Data::SaveBlockIndexEntry entry;
+			entry.offset = pos;
+			bool valid = BlockStreambuf::ReadHeader((const unsigned char*)file + pos, true, entry.rawsize, entry.storedsize, entry.records, entry.checksum);
+			if (valid && entry.rawsize == 0)
+				return;
+			if (valid && size - pos - BlockStreambuf::HeaderSize >= entry.storedsize) {
+				resync = false;
+				if (Checksum::CRC32C(file + pos + BlockStreambuf::HeaderSize, entry.storedsize) == entry.checksum)
+					blocks.push_back(entry);
+				else
+					damaged++;
+				pos += BlockStreambuf::HeaderSize + entry.storedsize;
+				continue;
+			}
+			// the header is damaged, the next block starts somewhere after it
+			if (!resync)
+				damaged++;
+			resync = true;
+			pos++;
+		}
+		// the end of blocks is missing, the file has been truncated
+		if (!resync)
+			damaged++;
+	}
+
+	bool CommitFile(const std::filesystem::path& temp, const std::filesystem::path& path)
+	{
+#if defined(unix) || defined(__unix__) || defined(__unix)
+		int fd = open(temp.c_str(), O_RDONLY);
+		if (fd == -1 || fsync(fd) != 0) {
+			if (fd != -1)
+				close(fd);
+			logcritical("Cannot flush \"{}\" to disk", temp.string());
+			return false;
+		}
+		close(fd);
+#endif
+		std::error_code err;
+		std::filesystem::rename(temp, path, err);
+		if (err) {
+			logcritical("Cannot rename \"{}\": {}", temp.filename().string(), err.message());
+			return false;
+		}
+#if defined(unix) || defined(__unix__) || defined(__unix)
+		// the rename itself is only durable once the directory has been flushed
+		int dir = open(path.parent_path().empty() ? "." : path.parent_path().c_str(), O_RDONLY);
+		if (dir != -1) {
+			fsync(dir);
+			close(dir);
+		}
+#endif
+		return true;
+	}
+
+	bool Verify(const std::filesystem::path& path, size_t threads, VerifyResult& result)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		result = VerifyResult();
+		MappedFile file;
+		if (!file.Open(path)) {
+			logcritical("Cannot open savefile \"{}\"", path.string());
+			return false;
+		}
+		result.bytes = file.GetSize();
+		Header header;
+		if (!ReadHeader(file.GetData(), file.GetSize(), header)) {
+			logcritical("Verification requires a full savefile of version 0x6 or newer");
+			return false;
+		}
+		result.version = header.version;
+		if (header.version < 0x7) {
+			logcritical("Savefile of version {} doesn't have checksums", header.version);
+			return false;
+		}
+		std::vector<Data::SaveBlockIndexEntry> blocks;
+		std::vector<Data::SaveFormIndexEntry> forms;
+		{
+			MappedStreambuf buf(file.GetData(), file.GetSize());
+			std::istream stream(&buf);
+			result.index = Data::ReadSaveIndex(stream, header.version, blocks, forms);
+		}
+		if (result.index) {
+			// blocks follow each other without gaps, the index must describe all of them
+			uint64_t pos = GetHeaderSize(header);
+			for (auto& entry : blocks) {
+				if (entry.offset != pos)
+					result.index = false;
+				pos = entry.offset + BlockStreambuf::HeaderSize + entry.storedsize;
+			}
+		}
+		if (result.index) {
+			if (threads == 0)
+				threads = std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+			threads = std::max(std::min(threads, blocks.size()), (size_t)1);
+			std::atomic<size_t> next = 0;
+			std::atomic<uint64_t> damaged = 0;
+			auto check = [&]() {
+				for (size_t i = next++; i < blocks.size(); i = next++) {
+					if (GetBlockData(file.GetData(), file.GetSize(), header.version, blocks[i]) == nullptr) {
+						logcritical("Block {} at offset {} is damaged", i, blocks[i].offset);
+						damaged++;
+					}
+				}
+			};
+			std::vector<std::thread> workers;
+			for (size_t t = 1; t < threads; t++)
+				workers.emplace_back(check);
+			check();
+			for (auto& worker : workers)
+				worker.join();
+			result.blocks = blocks.size();
+			result.damaged = damaged;
+			for (auto& entry : blocks)
+				result.records += entry.records;
+			if (result.records != header.records) {
+				logcritical("Savefile holds {} records, but its header lists {}", result.records, header.records);
+				result.damaged++;
+			}
+		} else {
+			logcritical("The index of the savefile is damaged, searching for intact blocks");
+			ScanBlocks(file.GetData(), file.GetSize(), GetHeaderSize(header), blocks, result.damaged);
+			result.blocks = blocks.size() + result.damaged;
+			for (auto& entry : blocks)
+				result.records += entry.records;
+		}
+		result.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+		return result.index && result.damaged == 0;
+	}
+}
@@ -0,0 +1,404 @@
+#include "SaveQuery.h"
+#include "BufferOperations.h"
+#include "Codecs.h"
+#include "Data.h"
+#include "DerivationTree.h"
+#include "Input.h"
+#include "LZMAStreamBuf.h"
+#include "Logging.h"
+#include "MappedFile.h"
+#include "Oracle.h"
+#include "Record.h"
+#include "SaveFile.h"
+#include "Utility.h"
+
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace SaveQuery
+{
+	bool Filter::Matches(Input* input)
+	{
+		if (result != 0 && (input->GetOracleResult() & result) == 0)
+			return false;
+		int64_t length = (int64_t)input->Length();
+		if ((minLength >= 0 && length < minLength) || (maxLength >= 0 && length > maxLength))
+			return false;
+		double primary = input->GetPrimaryScore();
+		if (primary < minPrimary || primary > maxPrimary)
+			return false;
+		double secondary = input->GetSecondaryScore();
+		if (secondary < minSecondary || secondary > maxSecondary)
+			return false;
+		if (generation != 0 && input->GetGenerationID() != generation)
+			return false;
+		EnumType formflags = input->GetFlags();
+		return (formflags & flags) == flags && (formflags & noflags) == 0;
+	}
+
+	bool ParseFilter(const std::string& text, Filter& filter)
+	{
+		for (auto& term : Utility::SplitString(text, ',', false)) {
+			if (term.empty())
+				continue;
+			auto pos = term.find('=');
+			if (pos == std::string::npos) {
+				logcritical("Filter term \"{}\" has no value", term);
+				return false;
+			}
+			std::string key = Utility::ToLower(term.substr(0, pos));
+			std::string value = term.substr(pos + 1);
+			try {
+				if (key == "result") {
+					filter.result = 0;
+					for (auto& name : Utility::SplitString(Utility::ToLower(value), '|', false)) {
+						if (name == "passing")
+							filter.result |= OracleResult::Passing;
+						else if (name == "failing")
+							filter.result |= OracleResult::Failing;
+						else if (name == "undefined")
+							filter.result |= OracleResult::Undefined;
+						else if (name == "prefix")
+							filter.result |= OracleResult::Prefix;
+						else if (name == "repeat")
+							filter.result |= OracleResult::Repeat;
+						else {
+							logcritical("Unknown oracle result \"{}\"", name);
+							return false;
+						}
+					}
+				} else if (key == "minlength")
+					filter.minLength = std::stoll(value);
+				else if (key == "maxlength")
+					filter.maxLength = std::stoll(value);
+				else if (key == "minprimary")
+					filter.minPrimary = std::stod(value);
+				else if (key == "maxprimary")
+					filter.maxPrimary = std::stod(value);
+				else if (key == "minsecondary")
+					filter.minSecondary = std::stod(value);
+				else if (key == "maxsecondary")
+					filter.maxSecondary = std::stod(value);
+				else if (key == "generation")
+					filter.generation = std::stoull(value, nullptr, 16);
+				else if (key == "flags")
+					filter.flags = std::stoull(value, nullptr, 16);
+				else if (key == "noflags")
+					filter.noflags = std::stoull(value, nullptr, 16);
+				else {
+					logcritical("Unknown filter key \"{}\"", key);
+					return false;
+				}
+			} catch (std::exception&) {
+				logcritical("Invalid value for filter key \"{}\": {}", key, value);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	Format GetFormat(std::filesystem::path path)
+	{
+		auto extension = Utility::ToLower(path.extension().string());
+		if (extension == ".tfsave")
+			return Format::Save;
+		if (extension == ".csv")
+			return Format::CSV;
+		return Format::IDs;
+	}
+
+	namespace
+	{
+		struct Source
+		{
+			MappedFile file;
+			SaveFile::Header header;
+			std::unique_ptr<Codecs::Codec> codec;
+			std::vector<Data::SaveBlockIndexEntry> blocks;
+			std::vector<Data::SaveFormIndexEntry> forms;
+		};
+
+		/// <summary>
+		/// decodes the blocks [which] in waves of [threads] blocks. [work] is called with the slot, the block number and the
+		/// uncompressed data of each block on a worker thread, [consume] is called with the slot on the calling thread in the
+		/// order of the blocks
+		/// </summary>
+		template <class W, class C>
+		bool ProcessBlocks(Source& source, const std::vector<size_t>& which, size_t threads, W work, C consume)
+		{
+			std::vector<char> failed(threads, false);
+			for (size_t wave = 0; wave < which.size(); wave += threads) {
+				size_t count = std::min(threads, which.size() - wave);
+				auto decode = [&source, &which, &failed, &work, wave](size_t slot) {
+					auto& entry = source.blocks[which[wave + slot]];
+					const char* data = SaveFile::GetBlockData(source.file.GetData(), source.file.GetSize(), source.header.version, entry);
+					if (data == nullptr) {
+						failed[slot] = true;
+						return;
+					}
+					std::string raw;
+					if (source.codec) {
+						raw.resize(entry.rawsize);
+						if (!source.codec->Decompress(data, entry.storedsize, raw.data(), raw.size())) {
+							failed[slot] = true;
+							return;
+						}
+						data = raw.data();
+					}
+					failed[slot] = !work(slot, which[wave + slot], data, (size_t)entry.rawsize);
+				};
+				std::vector<std::thread> workers;
+				for (size_t slot = 1; slot < count; slot++)
+					workers.emplace_back(decode, slot);
+				decode(0);
+				for (auto& worker : workers)
+					worker.join();
+				for (size_t slot = 0; slot < count; slot++) {
+					if (failed[slot]) {
+						logcritical("Failed to read block {} of savefile", which[wave + slot]);
+						return false;
+					}
+					consume(slot);
+				}
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// decodes a form record, the record header has already been read
+		/// </summary>
+		template <class T>
+		std::shared_ptr<T> DecodeRecord(const char* record, size_t length, LoadResolver* resolver)
+		{
+			MappedStreambuf buf((char*)record + 12, length - 12);
+			std::istream stream(&buf);
+			size_t offset = 0;
+			return Records::ReadRecord<T>(&stream, 0, offset, length - 12, resolver);
+		}
+
+		/// <summary>
+		/// records that are copied into savefiles besides the Inputs, they are needed to regenerate Inputs after loading
+		/// </summary>
+		bool IsStatic(int32_t type)
+		{
+			return type == 'STRH' || type == FormType::Settings || type == FormType::Oracle || type == FormType::Grammar;
+		}
+
+		struct Slot
+		{
+			std::vector<FormID> matches;
+			std::vector<std::pair<FormID, FormID>> parents;
+			std::string text;
+			std::string records;
+			uint64_t inputs = 0;
+			uint64_t count = 0;
+		};
+	}
+
+	bool Run(Args& args, Stats& stats)
+	{
+		Source source;
+		if (!source.file.Open(args.save)) {
+			logcritical("Cannot open savefile \"{}\"", args.save.string());
+			return false;
+		}
+		if (!SaveFile::ReadHeader(source.file.GetData(), source.file.GetSize(), source.header)) {
+			logcritical("Queries require a full savefile of version 0x6 or newer");
+			return false;
+		}
+		if (source.header.codec != Codecs::CodecType::None) {
+			source.codec = Codecs::CreateCodec(source.header.codec, args.compressionLevel, source.header.compressionExtreme, source.header.dictionary);
+			if (!source.codec) {
+				logcritical("Savefile uses unsupported compression codec {}", (int32_t)source.header.codec);
+				return false;
+			}
+		}
+		{
+			MappedStreambuf buf(source.file.GetData(), source.file.GetSize());
+			std::istream stream(&buf);
+			if (!Data::ReadSaveIndex(stream, source.header.version, source.blocks, source.forms)) {
+				logcritical("Cannot read the index of the savefile");
+				return false;
+			}
+		}
+		// only blocks that hold the records of interest are decompressed
+		std::vector<bool> hasinputs(source.blocks.size(), false);
+		std::vector<bool> hastrees(source.blocks.size(), false);
+		std::vector<bool> hasstatic(source.blocks.size(), false);
+		for (auto& entry : source.forms) {
+			if (entry.block >= source.blocks.size())
+				continue;
+			hasinputs[entry.block] = hasinputs[entry.block] || entry.type == FormType::Input;
+			hastrees[entry.block] = hastrees[entry.block] || entry.type == FormType::DevTree;
+			hasstatic[entry.block] = hasstatic[entry.block] || IsStatic(entry.type);
+		}
+		// the string hashmap isn't part of the form index and is always stored in the first block
+		if (!hasstatic.empty())
+			hasstatic[0] = true;
+		std::vector<size_t> inputblocks;
+		for (size_t i = 0; i < source.blocks.size(); i++)
+			if (hasinputs[i])
+				inputblocks.push_back(i);
+
+		size_t threads = args.threads > 0 ? args.threads : std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+		std::vector<Slot> slots(threads);
+		LoadResolver resolver;
+		Input::RegisterFactories();
+		DerivationTree::RegisterFactories();
+
+		// savefiles are written next to the output and only replace it once they are complete
+		std::filesystem::path temp = args.output;
+		temp += ".tmp";
+		bool save = args.format == Format::Save;
+		std::ofstream out(save ? temp : args.output, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!out.is_open()) {
+			logcritical("Cannot create output file \"{}\"", args.output.string());
+			return false;
+		}
+
+		// first pass: filter the Inputs and write them out directly, unless a savefile is created
+		std::unordered_set<FormID> keep;
+		std::unordered_map<FormID, FormID> parents;
+		if (args.format == Format::CSV)
+			out << "formid;parent;generation;result;length;primary;secondary;executiontime;flags\n";
+		auto filter = [&](size_t s, size_t block, const char* data, size_t size) {
+			auto& slot = slots[s];
+			slot = Slot();
+			return SaveFile::ForEachRecord(data, size, source.blocks[block].records, [&](int32_t type, const char* record, size_t length) {
+				if (type != FormType::Input)
+					return;
+				slot.inputs++;
+				auto input = DecodeRecord<Input>(record, length, &resolver);
+				if (!input || input->HasFlag(Form::FormFlags::Deleted))
+					return;
+				if (save && args.ancestors && input->GetParentID() != 0)
+					slot.parents.push_back({ input->GetFormID(), input->GetParentID() });
+				if (!args.filter.Matches(input.get()))
+					return;
+				slot.matches.push_back(input->GetFormID());
+				if (args.format == Format::CSV)
+					slot.text += Utility::GetHex(input->GetFormID()) + ";" + Utility::GetHex(input->GetParentID()) + ";" + Utility::GetHex(input->GetGenerationID()) + ";" +
+					             std::to_string(input->GetOracleResult()) + ";" + std::to_string(input->Length()) + ";" + std::to_string(input->GetPrimaryScore()) + ";" +
+					             std::to_string(input->GetSecondaryScore()) + ";" + std::to_string(input->GetExecutionTime().count()) + ";" + Utility::GetHex(input->GetFlags()) + "\n";
+				else if (args.format == Format::IDs)
+					slot.text += Utility::GetHex(input->GetFormID()) + "\n";
+			});
+		};
+		auto collect = [&](size_t s) {
+			auto& slot = slots[s];
+			stats.blocks++;
+			stats.inputs += slot.inputs;
+			stats.matches += slot.matches.size();
+			if (save) {
+				keep.insert(slot.matches.begin(), slot.matches.end());
+				parents.insert(slot.parents.begin(), slot.parents.end());
+			} else {
+				out.write(slot.text.data(), slot.text.size());
+				stats.written += slot.matches.size();
+			}
+			slot = Slot();
+		};
+		if (!ProcessBlocks(source, inputblocks, threads, filter, collect)) {
+			out.close();
+			std::filesystem::remove(save ? temp : args.output);
+			return false;
+		}
+		if (!save) {
+			out.close();
+			loginfo("Query matched {} of {} inputs", stats.matches, stats.inputs);
+			return !out.fail();
+		}
+
+		if (args.ancestors) {
+			std::vector<FormID> matches(keep.begin(), keep.end());
+			for (FormID formid : matches) {
+				auto itr = parents.find(formid);
+				while (itr != parents.end() && keep.insert(itr->second).second)
+					itr = parents.find(itr->second);
+			}
+		}
+		parents.clear();
+
+		// second pass: copy the static records, the kept Inputs and their DerivationTrees into a new savefile
+		SaveFile::Header header = source.header;
+		std::unique_ptr<Codecs::Codec> codec;
+		if (args.compressionLevel >= 0 && header.codec != Codecs::CodecType::None) {
+			codec = Codecs::CreateCodec(header.codec, args.compressionLevel, header.compressionExtreme, header.dictionary);
+			header.compressionLevel = args.compressionLevel;
+		} else {
+			header.codec = Codecs::CodecType::None;
+			header.compressionLevel = -1;
+			header.dictionary.clear();
+		}
+		header.records = 0;
+		SaveFile::WriteHeader(&out, header);
+		SaveFile::BlockWriter writer;
+		writer.out = &out;
+		writer.codec = codec.get();
+		writer.blockRecords = args.blockRecords;
+
+		auto copy = [&](size_t s, size_t block, const char* data, size_t size) {
+			auto& slot = slots[s];
+			slot = Slot();
+			return SaveFile::ForEachRecord(data, size, source.blocks[block].records, [&](int32_t type, const char* record, size_t length) {
+				bool copy = IsStatic(type);
+				if (type == FormType::Input) {
+					FormID formid = 0;
+					EnumType flags = 0;
+					if (SaveFile::ReadFormHeader(record, length, formid, flags) && keep.contains(formid)) {
+						// there is no session to regenerate the inputs on load
+						size_t begin = slot.records.size();
+						slot.records.append(record, length);
+						SaveFile::WriteFormFlags(slot.records.data() + begin, length, flags & ~(EnumType)Input::Flags::RegenerateOnLoad);
+						slot.count++;
+					}
+				} else if (type == FormType::DevTree) {
+					auto tree = DecodeRecord<DerivationTree>(record, length, &resolver);
+					copy = tree && keep.contains(tree->GetInputID());
+				}
+				if (copy) {
+					slot.records.append(record, length);
+					slot.count++;
+				}
+			});
+		};
+		auto write = [&](size_t s) {
+			auto& slot = slots[s];
+			SaveFile::ForEachRecord(slot.records.data(), slot.records.size(), slot.count, [&](int32_t type, const char* record, size_t length) {
+				if (type == 'STRH') {
+					// the string hashmap is written into a block of its own, as in regular saves
+					writer.Flush();
+					writer.Add(type, record, length);
+					writer.Flush();
+				} else
+					writer.Add(type, record, length);
+			});
+			slot = Slot();
+		};
+		std::vector<size_t> copyblocks;
+		for (size_t i = 0; i < source.blocks.size(); i++)
+			if (hasstatic[i] || hasinputs[i] || hastrees[i])
+				copyblocks.push_back(i);
+		if (!ProcessBlocks(source, copyblocks, threads, copy, write)) {
+			out.close();
+			std::filesystem::remove(temp);
+			return false;
+		}
+		writer.Finish();
+		SaveFile::WriteRecordCount(&out, writer.written);
+		stats.written = writer.written;
+		out.flush();
+		bool failed = writer.failed || out.fail();
+		out.close();
+		if (failed || !SaveFile::CommitFile(temp, args.output)) {
+			logcritical("Failed to write savefile \"{}\"", args.output.string());
+			std::filesystem::remove(temp);
+			return false;
+		}
+		loginfo("Query matched {} of {} inputs, wrote {} records", stats.matches, stats.inputs, stats.written);
+		return true;
+	}
+}
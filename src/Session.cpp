@@ -37,6 +37,8 @@ void Session::LoadSession_Async(Data* dat, std::string name, int32_t number, boo
 	Data::LoadSaveArgs loadArgs;
 	if (args) {
 		loadArgs.skipExlusionTree = args->skipExclusionTree;
+		loadArgs.lazyLoad = args->lazyLoad;
+		loadArgs.recover = args->recover;
 	}
 	if (number == -1)
 		dat->Load(name, loadArgs);
@@ -628,6 +630,9 @@ void Session::SessionControl()
 		_sessiondata->_controller->Start(_sessiondata, _sessiondata->_settings->controller.numLightThreads, _sessiondata->_settings->controller.numMediumThreads, _sessiondata->_settings->controller.numHeavyThreads, _sessiondata->_settings->controller.numAllThreads);
 	else
 		_sessiondata->_controller->Start(_sessiondata, taskthreads);
+	_sessiondata->_controller->StartStatistics(std::chrono::milliseconds(_sessiondata->_settings->controller.statisticsInterval), (size_t)_sessiondata->_settings->controller.statisticsHistory, _sessiondata->_settings->controller.statisticsDumpPath);
+	if (_sessiondata->_grammar)
+		_sessiondata->_grammar->SetTaskController(_sessiondata->_controller);
 	_sessiondata->_exechandler->Init(_self, _sessiondata, _sessiondata->_settings, _sessiondata->_controller, _sessiondata->_settings->general.concurrenttests, _sessiondata->_oracle);
 	_sessiondata->_exechandler->SetEnableFragments(_sessiondata->_settings->tests.executeFragments);
 	_sessiondata->_exechandler->SetPeriod(_sessiondata->_settings->general.testEnginePeriod());
@@ -848,6 +853,9 @@ void Session::GetStatus(SessionStatus& status)
 		status.task_waiting = _sessiondata->_controller->GetWaitingJobs();
 		status.task_waiting_light = _sessiondata->_controller->GetWaitingLightJobs();
 		status.task_waiting_medium = _sessiondata->_controller->GetWaitingMediumJobs();
+		status.task_deadlines_light = _sessiondata->_controller->GetDeadlineTasks(Functions::FunctionType::Light);
+		status.task_deadlines_missed_light = _sessiondata->_controller->GetMissedDeadlines(Functions::FunctionType::Light);
+		status.task_deadlines_lateness_light = _sessiondata->_controller->GetMaxDeadlineLateness(Functions::FunctionType::Light);
 		
 		// ExecutionHandler
 		status.exec_running = _sessiondata->_exechandler->GetRunningTests();
@@ -1174,6 +1182,13 @@ void Session::UI_GetThreadStatus(std::vector<TaskController::ThreadStatus>& stat
 	_sessiondata->_controller->GetThreadStatus(status, names, time);
 }
 
+void Session::UI_GetThreadStatistics(TaskController::Sample& sample)
+{
+	if (!_loaded)
+		return;
+	sample = _sessiondata->_controller->GetSample();
+}
+
 void Session::UI_GetGenerations(std::vector<std::pair<FormID, int32_t>>& generations, size_t& size)
 {
 	if (!_loaded)
@@ -1512,6 +1527,9 @@ void Session::ExtractInputs(int number, int length, double score)
 		sessdata->_controller->Start(sessdata, sessdata->_settings->controller.numLightThreads, sessdata->_settings->controller.numMediumThreads, sessdata->_settings->controller.numHeavyThreads, sessdata->_settings->controller.numAllThreads);
 	else
 		sessdata->_controller->Start(sessdata, taskthreads);
+	sessdata->_controller->StartStatistics(std::chrono::milliseconds(sessdata->_settings->controller.statisticsInterval), (size_t)sessdata->_settings->controller.statisticsHistory, sessdata->_settings->controller.statisticsDumpPath);
+	if (sessdata->_grammar)
+		sessdata->_grammar->SetTaskController(sessdata->_controller);
 	sessdata->_exechandler->Init(_self, sessdata, sessdata->_settings, sessdata->_controller, sessdata->_settings->general.concurrenttests, sessdata->_oracle);
 	sessdata->_exechandler->SetEnableFragments(sessdata->_settings->tests.executeFragments);
 	sessdata->_exechandler->SetPeriod(sessdata->_settings->general.testEnginePeriod());
@@ -9,6 +9,7 @@
 #include "DeltaDebugging.h"
 #include "Form.h"
 #include "Evaluation.h"
+#include "RegenerationCache.h"
 
 #include <mutex>
 #include <boost/circular_buffer.hpp>
@@ -356,10 +357,21 @@ void SessionFunctions::ReclaimMemory(std::shared_ptr<SessionData> sessiondata)
 	StartProfiling;
 	sessiondata->_lastMemorySweep = std::chrono::steady_clock::now();
 	std::vector<std::shared_ptr<IForm>> free;
+	std::vector<std::shared_ptr<Input>> inputs;
 	int32_t size = 0;
-	sessiondata->data->Visit([&free,&size](std::shared_ptr<IForm> form) {
+	// forms of a lazily loaded save that aren't used anymore are dropped and read again when needed, the forms that
+	// haven't been read yet don't take up memory and are skipped
+	if (sessiondata->data->IsLazyLoaded()) {
+		size_t evicted = sessiondata->data->EvictLazyForms();
+		profile(TimeProfiling, "Evicted {} forms", evicted);
+		ResetProfiling;
+	}
+	sessiondata->data->VisitLoaded([&free, &inputs, &size](std::shared_ptr<IForm> form) {
 		if (HandleForms(form)) {
-			free.push_back(form);
+			if (form->GetType() == FormType::Input)
+				inputs.push_back(std::dynamic_pointer_cast<Input>(form));
+			else
+				free.push_back(form);
 			size++;
 		}
 		return Data::VisitAction::None;
@@ -370,16 +382,47 @@ void SessionFunctions::ReclaimMemory(std::shared_ptr<SessionData> sessiondata)
 
 	for (auto& form : free) {
 		form->FreeMemory();
-		if (form->GetType() == FormType::Input) {
-			auto _input = form->As<Input>();
-			if (_input->GetGenerated() == false && _input->test && _input->test->IsValid() == false) {
-				if (_input->derive)
-					_input->derive->FreeMemory();
-			}
-		}
 	}
 	free.clear();
 
+	// inputs have to be regenerated once they are needed again, so below the memory limit only as many are freed as
+	// needed to get below the soft limit, cheapest to regenerate first, and the regeneration cache is kept
+	size_t count = inputs.size();
+	uint64_t target = UINT64_MAX;
+	if ((int64_t)sessiondata->_memory_mem <= sessiondata->_settings->general.memory_limit) {
+		bool simple = sessiondata->_grammar && sessiondata->_grammar->IsSimple();
+		uint64_t cache = (uint64_t)std::max(sessiondata->_settings->general.memory_regeneration_cache, (int64_t)0) * 1048576;
+		count = RegenerationCache::Order(sessiondata->data, inputs, simple, cache);
+		target = (uint64_t)std::max((int64_t)sessiondata->_memory_mem - sessiondata->_settings->general.memory_softlimit, (int64_t)0) * 1048576;
+	}
+	profile(TimeProfiling, "Ordered {} inputs", inputs.size());
+	ResetProfiling;
+
+	uint64_t freed = 0;
+	size_t freedinputs = 0;
+	for (; freedinputs < count && freed < target; freedinputs++) {
+		auto& _input = inputs[freedinputs];
+		uint64_t bytes = RegenerationCache::GetMemorySize(_input);
+		_input->FreeMemory();
+		if (_input->GetGenerated() == false && _input->test && _input->test->IsValid() == false) {
+			if (_input->derive)
+				_input->derive->FreeMemory();
+		}
+		uint64_t remaining = RegenerationCache::GetMemorySize(_input);
+		if (remaining < bytes)
+			freed += bytes - remaining;
+	}
+	profile(TimeProfiling, "Freed {} of {} inputs", freedinputs, inputs.size());
+	ResetProfiling;
+	// inputs that are kept still hold the nodes of freed source trees they share, which are only released once they
+	// are compacted
+	size_t compacted = 0;
+	for (size_t i = freedinputs; i < inputs.size(); i++)
+		if (inputs[i]->derive && inputs[i]->derive->CompactNodes())
+			compacted++;
+	profile(TimeProfiling, "Compacted {} derivation trees", compacted);
+	inputs.clear();
+
 #if defined(unix) || defined(__unix__) || defined(__unix)
 	uint64_t mem = Processes::GetProcessMemory(getpid());
 #elif defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
@@ -83,6 +83,8 @@ void Settings::Load(std::wstring path, bool reload)
 	loginfo("{}{} {}", "General:          ", general.memory_softlimit_NAME, general.memory_softlimit);
 	general.memory_sweep_period = std::chrono::milliseconds((int64_t)ini.GetLongValue("General", general.memory_sweep_period_NAME, (long)general.memory_sweep_period.count()));
 	loginfo("{}{} {}", "General:          ", general.memory_sweep_period_NAME, general.memory_sweep_period.count());
+	general.memory_regeneration_cache = (int64_t)ini.GetLongValue("General", general.memory_regeneration_cache_NAME, (long)general.memory_regeneration_cache);
+	loginfo("{}{} {}", "General:          ", general.memory_regeneration_cache_NAME, general.memory_regeneration_cache);
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
 	general.testEnginePeriodWindows = std::chrono::nanoseconds((int64_t)ini.GetLongValue("General", general.testEnginePeriodWindows_NAME, (long)general.testEnginePeriodWindows.count()));
 	loginfo("{}{} {}", "General:          ", general.testEnginePeriodWindows_NAME, general.testEnginePeriodWindows.count());
@@ -102,6 +104,14 @@ void Settings::Load(std::wstring path, bool reload)
 	loginfo("{}{} {}", "TaskController:          ", controller.numHeavyThreads_NAME, controller.numHeavyThreads);
 	controller.numAllThreads = (int32_t)ini.GetLongValue("TaskController", controller.numAllThreads_NAME, controller.numAllThreads);
 	loginfo("{}{} {}", "TaskController:          ", controller.numAllThreads_NAME, controller.numAllThreads);
+	controller.testCallbackDeadline = (int64_t)ini.GetLongValue("TaskController", controller.testCallbackDeadline_NAME, (long)controller.testCallbackDeadline);
+	loginfo("{}{} {}", "TaskController:          ", controller.testCallbackDeadline_NAME, controller.testCallbackDeadline);
+	controller.statisticsInterval = (int64_t)ini.GetLongValue("TaskController", controller.statisticsInterval_NAME, (long)controller.statisticsInterval);
+	loginfo("{}{} {}", "TaskController:          ", controller.statisticsInterval_NAME, controller.statisticsInterval);
+	controller.statisticsHistory = (int32_t)ini.GetLongValue("TaskController", controller.statisticsHistory_NAME, controller.statisticsHistory);
+	loginfo("{}{} {}", "TaskController:          ", controller.statisticsHistory_NAME, controller.statisticsHistory);
+	controller.statisticsDumpPath = std::string(ini.GetValue("TaskController", controller.statisticsDumpPath_NAME, controller.statisticsDumpPath.c_str()));
+	loginfo("{}{} {}", "TaskController:          ", controller.statisticsDumpPath_NAME, controller.statisticsDumpPath);
 
 	// saves
 	saves.enablesaves = ini.GetBoolValue("SaveFiles", saves.enablesaves_NAME, saves.enablesaves);
@@ -124,6 +134,14 @@ void Settings::Load(std::wstring path, bool reload)
 	loginfo("{}{} {}", "SaveFiles:          ", saves.incrementalSaveFiles_NAME, saves.incrementalSaveFiles);
 	saves.createFullSaveEvery = (int32_t)ini.GetLongValue("SaveFiles", saves.createFullSaveEvery_NAME, saves.createFullSaveEvery);
 	loginfo("{}{} {}", "SaveFiles:          ", saves.createFullSaveEvery_NAME, saves.createFullSaveEvery);
+	saves.compressAfterThaw = ini.GetBoolValue("SaveFiles", saves.compressAfterThaw_NAME, saves.compressAfterThaw);
+	loginfo("{}{} {}", "SaveFiles:          ", saves.compressAfterThaw_NAME, saves.compressAfterThaw);
+	saves.compressionCodec = (int32_t)ini.GetLongValue("SaveFiles", saves.compressionCodec_NAME, saves.compressionCodec);
+	loginfo("{}{} {}", "SaveFiles:          ", saves.compressionCodec_NAME, saves.compressionCodec);
+	saves.journal = ini.GetBoolValue("SaveFiles", saves.journal_NAME, saves.journal);
+	loginfo("{}{} {}", "SaveFiles:          ", saves.journal_NAME, saves.journal);
+	saves.journalCompactSegments = (int32_t)ini.GetLongValue("SaveFiles", saves.journalCompactSegments_NAME, saves.journalCompactSegments);
+	loginfo("{}{} {}", "SaveFiles:          ", saves.journalCompactSegments_NAME, saves.journalCompactSegments);
 
 	// optimization
 	optimization.constructinputsiteratively = ini.GetBoolValue("Optimization", optimization.constructinputsiteratively_NAME, optimization.constructinputsiteratively);
@@ -171,6 +189,8 @@ void Settings::Load(std::wstring path, bool reload)
 	loginfo("{}{} {}", "DeltaDebugging:          ", dd.batchprocessing_NAME, (long)dd.batchprocessing);
 	dd.budgetGenEnd = ini.GetLongValue("DeltaDebugging", dd.budgetGenEnd_NAME, dd.budgetGenEnd);
 	loginfo("{}{} {}", "DeltaDebugging:          ", dd.budgetGenEnd_NAME, (long)dd.budgetGenEnd);
+	dd.coroutines = ini.GetBoolValue("DeltaDebugging", dd.coroutines_NAME, dd.coroutines);
+	loginfo("{}{} {}", "DeltaDebugging:          ", dd.coroutines_NAME, dd.coroutines);
 
 	// generation
 	generation.generationsize = (int32_t)ini.GetLongValue("Generation", generation.generationsize_NAME, generation.generationsize);
@@ -211,6 +231,17 @@ void Settings::Load(std::wstring path, bool reload)
 	loginfo("{}{} {}", "Generation:       ", generation.maxNumberOfFailsPerSource_NAME, generation.maxNumberOfFailsPerSource);
 	generation.maxNumberOfGenerationsPerSource = (uint64_t)ini.GetLongValue("Generation", generation.maxNumberOfGenerationsPerSource_NAME, (long)generation.maxNumberOfGenerationsPerSource);
 	loginfo("{}{} {}", "Generation:       ", generation.maxNumberOfGenerationsPerSource_NAME, generation.maxNumberOfGenerationsPerSource);
+	generation.keepDerivationTrees = ini.GetBoolValue("Generation", generation.keepDerivationTrees_NAME, generation.keepDerivationTrees);
+	loginfo("{}{} {}", "Generation:       ", generation.keepDerivationTrees_NAME, generation.keepDerivationTrees);
+	generation.derivationStrategy = (int32_t)ini.GetLongValue("Generation", generation.derivationStrategy_NAME, generation.derivationStrategy);
+	// [2] is only chosen automatically for long inputs derived with [1]
+	if (generation.derivationStrategy != 0 && generation.derivationStrategy != 1 && generation.derivationStrategy != 3) {
+		logwarn("Unknown derivation strategy {}, using 1", generation.derivationStrategy);
+		generation.derivationStrategy = 1;
+	}
+	loginfo("{}{} {}", "Generation:       ", generation.derivationStrategy_NAME, generation.derivationStrategy);
+	generation.parallelDerivationThreshold = (int32_t)ini.GetLongValue("Generation", generation.parallelDerivationThreshold_NAME, generation.parallelDerivationThreshold);
+	loginfo("{}{} {}", "Generation:       ", generation.parallelDerivationThreshold_NAME, generation.parallelDerivationThreshold);
 
 	// endconditions
 	conditions.use_foundnegatives = ini.GetBoolValue("EndConditions", conditions.use_foundnegatives_NAME, conditions.use_foundnegatives);
@@ -322,6 +353,9 @@ void Settings::Save(std::wstring _path)
 		"\\\\ When memory consumption exceeds the soft limit, the application will periodically free used memory. [in MB]");
 	ini.SetLongValue("General", general.memory_sweep_period_NAME, (long)general.memory_sweep_period.count(),
 		"\\\\ The period of memory sweeps trying to the free up space. [in milliseconds]");
+	ini.SetLongValue("General", general.memory_regeneration_cache_NAME, (long)general.memory_regeneration_cache,
+		"\\\\ Memory kept for the inputs that are the most expensive to regenerate and are most often needed to regenerate\n"
+		"\\\\ other inputs. Below the memory limit, memory sweeps free the other inputs cheapest to regenerate first. [in MB]");
 
 	ini.SetLongValue("General", general.testEnginePeriodWindows_NAME, (long)general.testEnginePeriodWindows.count(),
 		"\\\\ The period in which the test engine handles tests. [in nanoseconds]");
@@ -342,6 +376,17 @@ void Settings::Save(std::wstring _path)
 	ini.SetLongValue("TaskController", controller.numAllThreads_NAME, (long)controller.numAllThreads,
 		"\\\\ Number of threads executing light, medium and heavy weight tasks.\n"
 		"\\\\ If this is set the options above are ignored and only threads handling all tasks are used.");
+	ini.SetLongValue("TaskController", controller.testCallbackDeadline_NAME, (long)controller.testCallbackDeadline,
+		"\\\\ Maximum time the processing of a finished test may be delayed, before it is prioritized over other tasks. [in microseconds]\n"
+		"\\\\ Set to 0 to disable.");
+	ini.SetLongValue("TaskController", controller.statisticsInterval_NAME, (long)controller.statisticsInterval,
+		"\\\\ Interval in which the busy, idle and lock wait times of the worker threads and the queue depths are sampled. [in milliseconds]\n"
+		"\\\\ Set to 0 to disable.");
+	ini.SetLongValue("TaskController", controller.statisticsHistory_NAME, (long)controller.statisticsHistory,
+		"\\\\ Number of samples that are kept in memory.");
+	ini.SetValue("TaskController", controller.statisticsDumpPath_NAME, controller.statisticsDumpPath.c_str(),
+		"\\\\ File the samples are written to. Files ending in .json receive one json object per sample, all other files csv.\n"
+		"\\\\ Leave empty to disable.");
 
 
 
@@ -361,7 +406,7 @@ void Settings::Save(std::wstring _path)
 	ini.SetValue("SaveFiles", saves.savename_NAME, saves.savename.c_str(),
 		"\\\\ The name of savefiles. [Do not use UNDERSCORE, may include other sign including Whitespaces]");
 	ini.SetLongValue("SaveFiles", saves.compressionLevel_NAME, saves.compressionLevel,
-		"\\\\ CompressionLevel used for LZMA savefile compression\n"
+		"\\\\ CompressionLevel used for savefile compression. [LZMA: 0-9, zstd: 1-22]\n"
 		"\\\\ Set to -1 to disable compression.");
 	ini.SetBoolValue("SaveFiles", saves.compressionExtreme_NAME, saves.compressionExtreme,
 		"\\\\ Whether to use the extreme compression preset for LZMA save file compression.\n"
@@ -370,6 +415,17 @@ void Settings::Save(std::wstring _path)
 		"\\\\ Save files do not store all objects in the session. They only store new objects created since the last save of changed objects.");
 	ini.SetLongValue("SaveFiles", saves.createFullSaveEvery_NAME, saves.createFullSaveEvery,
 		"\\\\ When incremental saves are enabled, the tool will create a full save every x saves.");
+	ini.SetBoolValue("SaveFiles", saves.compressAfterThaw_NAME, saves.compressAfterThaw,
+		"\\\\ Saves only stop all workers until the records have been serialized into memory, instead of for the whole save.\n"
+		"\\\\ The records are compressed and written while the session continues, which needs memory for the whole save.");
+	ini.SetLongValue("SaveFiles", saves.compressionCodec_NAME, saves.compressionCodec,
+		"\\\\ Codec used to compress save files. [1 = LZMA, 2 = zstd, 3 = zstd with a dictionary trained on the saved records]\n"
+		"\\\\ zstd is considerably faster than LZMA, the dictionary improves the ratio for small records.");
+	ini.SetBoolValue("SaveFiles", saves.journal_NAME, saves.journal,
+		"\\\\ After an initial full save, saves only append the objects changed since the last save to a journal.\n"
+		"\\\\ The journal is merged into a new full save in the background. [Replaces IncrementalSaveFiles]");
+	ini.SetLongValue("SaveFiles", saves.journalCompactSegments_NAME, saves.journalCompactSegments,
+		"\\\\ Number of saves appended to the journal, before it is merged into a new full save.");
 
 	// optimization
 	ini.SetBoolValue("Optimization", optimization.constructinputsiteratively_NAME, optimization.constructinputsiteratively,
@@ -425,6 +481,8 @@ void Settings::Save(std::wstring _path)
 		"\\\\ skipping all others in the same iteration.");
 	ini.SetLongValue("DeltaDebugging", dd.budgetGenEnd_NAME, (long)dd.budgetGenEnd,
 		"\\\\ Max number of tests that may be run by any instance of DD that is executed at the end of a generation.\n");
+	ini.SetBoolValue("DeltaDebugging", dd.coroutines_NAME, dd.coroutines,
+		"\\\\ [Standard mode] Runs the tests of each level as coroutines instead of callback chains.");
 
 
 	// generation
@@ -460,6 +518,18 @@ void Settings::Save(std::wstring _path)
 	ini.SetLongValue("Generation", generation.generationLengthMax_NAME, generation.generationLengthMax, "\\\\ Maximum input length generated in each generation.");
 	ini.SetLongValue("Generation", generation.maxNumberOfFailsPerSource_NAME, (long)generation.maxNumberOfFailsPerSource, "\\\\ The maximum number of derived inputs that can fail for an input to be elligible to be a source.");
 	ini.SetLongValue("Generation", generation.maxNumberOfGenerationsPerSource_NAME, (long)generation.maxNumberOfGenerationsPerSource, "\\\\ The maximum number of total derived inputs for an input to be elligible to be a source.");
+	ini.SetBoolValue("Generation", generation.keepDerivationTrees_NAME, generation.keepDerivationTrees,
+		"\\\\ Keeps the derivation trees of newly generated inputs in memory. If disabled, only the inputs themselves are\n"
+		"\\\\ generated and their trees are regenerated once they are extended or delta debugged.");
+	ini.SetLongValue("Generation", generation.derivationStrategy_NAME, generation.derivationStrategy,
+		"\\\\ The algorithm used to derive new inputs.\n"
+		"\\\\ 0 - Grows sequences until the target length is reached and closes the remaining nodes at random.\n"
+		"\\\\ 1 - Chooses expansions by the number of sequence nodes they can produce, so that inputs meet their target length.\n"
+		"\\\\ 3 - Chooses expansions like 1, but derives inputs from left to right and writes their entries while deriving.\n"
+		"\\\\ Strategy 2 [parallel derivation] cannot be set, it is chosen automatically for long inputs derived with 1. See ParallelDerivationThreshold.");
+	ini.SetLongValue("Generation", generation.parallelDerivationThreshold_NAME, generation.parallelDerivationThreshold,
+		"\\\\ Inputs with at least this target length are derived in parallel when using derivation strategy 1.\n"
+		"\\\\ The subtrees below the top of their derivation trees are derived on the worker threads. [0 = disabled]");
 
 	// endconditions
 	ini.SetBoolValue("EndConditions", conditions.use_foundnegatives_NAME, conditions.use_foundnegatives, "\\\\ Stop execution after foundnegatives failing inputs have been found.");
@@ -594,6 +664,30 @@ size_t Settings::GetStaticSize(int32_t version)
 	size_t size0x5 = size0x4  // prior stuff
 	                 + 1      // SaveFiles::incrementalSaveFiles
 	                 + 4;     // SaveFiles::createFullSaveEvery
+	size_t size0x6 = size0x5  // prior stuff
+	                 + 8;     // Controller::testCallbackDeadline
+	size_t size0x7 = size0x6  // prior stuff
+	                 + 8      // Controller::statisticsInterval
+	                 + 4;     // Controller::statisticsHistory
+	size_t size0x8 = size0x7  // prior stuff
+	                 + 1;     // SaveFiles::compressAfterThaw
+	size_t size0x9 = size0x8  // prior stuff
+	                 + 1;     // unused [formerly SaveFiles::backgroundSave]
+	size_t size0xA = size0x9  // prior stuff
+	                 + 4;     // SaveFiles::compressionCodec
+	size_t size0xB = size0xA  // prior stuff
+	                 + 1      // SaveFiles::journal
+	                 + 4;     // SaveFiles::journalCompactSegments
+	size_t size0xC = size0xB  // prior stuff
+	                 + 1;     // Generation::keepDerivationTrees
+	size_t size0xD = size0xC  // prior stuff
+	                 + 8;     // General::memory_regeneration_cache
+	size_t size0xE = size0xD  // prior stuff
+	                 + 4;     // Generation::derivationStrategy
+	size_t size0xF = size0xE  // prior stuff
+	                 + 4;     // Generation::parallelDerivationThreshold
+	size_t size0x10 = size0xF  // prior stuff
+	                 + 1;      // DeltaDebugging::coroutines
 
 	switch (version) {
 	case 0x1:
@@ -606,6 +700,28 @@ size_t Settings::GetStaticSize(int32_t version)
 		return size0x4;
 	case 0x5:
 		return size0x5;
+	case 0x6:
+		return size0x6;
+	case 0x7:
+		return size0x7;
+	case 0x8:
+		return size0x8;
+	case 0x9:
+		return size0x9;
+	case 0xA:
+		return size0xA;
+	case 0xB:
+		return size0xB;
+	case 0xC:
+		return size0xC;
+	case 0xD:
+		return size0xD;
+	case 0xE:
+		return size0xE;
+	case 0xF:
+		return size0xF;
+	case 0x10:
+		return size0x10;
 	default:
 		return 0;
 	}
@@ -622,7 +738,8 @@ size_t Settings::GetDynamicSize()
 	       + Buffer::CalcStringLength(oracle.lua_path_cmd_replay)        // Oracle::lua_path_cmd_replay
 	       + Buffer::CalcStringLength(oracle.lua_path_oracle)            // Oracle::lua_path_oracle
 	       + Buffer::CalcStringLength(oracle.grammar_path)               // Oracle::grammar_path
-	       + Buffer::CalcStringLength(oracle.oraclepath_Unix.string());  // Oracle::oraclepath_unix
+	       + Buffer::CalcStringLength(oracle.oraclepath_Unix.string())   // Oracle::oraclepath_unix
+	       + Buffer::CalcStringLength(controller.statisticsDumpPath);    // Controller::statisticsDumpPath
 }
 
 bool Settings::WriteData(std::ostream* buffer, size_t& offset, size_t length)
@@ -744,6 +861,32 @@ bool Settings::WriteData(std::ostream* buffer, size_t& offset, size_t length)
 	// VERSION 0x5
 	Buffer::Write(saves.incrementalSaveFiles, buffer, offset);
 	Buffer::Write(saves.createFullSaveEvery, buffer, offset);
+	// VERSION 0x6
+	Buffer::Write(controller.testCallbackDeadline, buffer, offset);
+	// VERSION 0x7
+	Buffer::Write(controller.statisticsInterval, buffer, offset);
+	Buffer::Write(controller.statisticsHistory, buffer, offset);
+	Buffer::Write(controller.statisticsDumpPath, buffer, offset);
+	// VERSION 0x8
+	Buffer::Write(saves.compressAfterThaw, buffer, offset);
+	// VERSION 0x9
+	// background saves have been removed, the byte is kept so that the layout of later versions doesn't change
+	Buffer::Write(false, buffer, offset);
+	// VERSION 0xA
+	Buffer::Write(saves.compressionCodec, buffer, offset);
+	// VERSION 0xB
+	Buffer::Write(saves.journal, buffer, offset);
+	Buffer::Write(saves.journalCompactSegments, buffer, offset);
+	// VERSION 0xC
+	Buffer::Write(generation.keepDerivationTrees, buffer, offset);
+	// VERSION 0xD
+	Buffer::Write(general.memory_regeneration_cache, buffer, offset);
+	// VERSION 0xE
+	Buffer::Write(generation.derivationStrategy, buffer, offset);
+	// VERSION 0xF
+	Buffer::Write(generation.parallelDerivationThreshold, buffer, offset);
+	// VERSION 0x10
+	Buffer::Write(dd.coroutines, buffer, offset);
 	return true;
 }
 
@@ -757,6 +900,17 @@ bool Settings::ReadData(std::istream* buffer, size_t& offset, size_t length, Loa
 	case 0x3:
 	case 0x4:
 	case 0x5:
+	case 0x6:
+	case 0x7:
+	case 0x8:
+	case 0x9:
+	case 0xA:
+	case 0xB:
+	case 0xC:
+	case 0xD:
+	case 0xE:
+	case 0xF:
+	case 0x10:
 		{
 			Form::ReadData(buffer, offset, length, resolver);
 			// oracle
@@ -883,6 +1037,53 @@ bool Settings::ReadData(std::istream* buffer, size_t& offset, size_t length, Loa
 			saves.incrementalSaveFiles = Buffer::ReadBool(buffer, offset);
 			saves.createFullSaveEvery = Buffer::ReadInt32(buffer, offset);
 		}
+		if (version >= 0x6) {
+			// controller
+			controller.testCallbackDeadline = Buffer::ReadInt64(buffer, offset);
+		}
+		if (version >= 0x7) {
+			// controller
+			controller.statisticsInterval = Buffer::ReadInt64(buffer, offset);
+			controller.statisticsHistory = Buffer::ReadInt32(buffer, offset);
+			controller.statisticsDumpPath = Buffer::ReadString(buffer, offset);
+		}
+		if (version >= 0x8) {
+			// saves
+			saves.compressAfterThaw = Buffer::ReadBool(buffer, offset);
+		}
+		if (version >= 0x9) {
+			// unused [formerly saves.backgroundSave]
+			Buffer::ReadBool(buffer, offset);
+		}
+		if (version >= 0xA) {
+			// saves
+			saves.compressionCodec = Buffer::ReadInt32(buffer, offset);
+		}
+		if (version >= 0xB) {
+			// saves
+			saves.journal = Buffer::ReadBool(buffer, offset);
+			saves.journalCompactSegments = Buffer::ReadInt32(buffer, offset);
+		}
+		if (version >= 0xC) {
+			// generation
+			generation.keepDerivationTrees = Buffer::ReadBool(buffer, offset);
+		}
+		if (version >= 0xD) {
+			// general
+			general.memory_regeneration_cache = Buffer::ReadInt64(buffer, offset);
+		}
+		if (version >= 0xE) {
+			// generation
+			generation.derivationStrategy = Buffer::ReadInt32(buffer, offset);
+		}
+		if (version >= 0xF) {
+			// generation
+			generation.parallelDerivationThreshold = Buffer::ReadInt32(buffer, offset);
+		}
+		if (version >= 0x10) {
+			// dd
+			dd.coroutines = Buffer::ReadBool(buffer, offset);
+		}
 		return true;
 	default:
 		return false;
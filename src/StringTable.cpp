@@ -0,0 +1,312 @@
+#include "StringTable.h"
+#include "BufferOperations.h"
+#include "Logging.h"
+#include "Utility.h"
+
+#include <bit>
+#include <cstring>
+
+StringTable::StringTable(FormID firstid) :
+	_firstid(firstid)
+{
+	for (auto& segment : _segments)
+		segment.store(nullptr, std::memory_order_relaxed);
+}
+
+StringTable::~StringTable()
+{
+	Clear();
+}
+
+uint64_t StringTable::Hash(std::string_view str)
+{
+	// FNV-1a followed by a finalizer, the upper bits select the shard and the tag, the lower bits the slot
+	uint64_t hash = 0xcbf29ce484222325;
+	for (char c : str) {
+		hash ^= (unsigned char)c;
+		hash *= 0x100000001b3;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccd;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+std::string_view StringTable::GetString(const char* entry)
+{
+	uint64_t length = 0;
+	memcpy(&length, entry + 8, 8);
+	return std::string_view(entry + EntryHeader, length);
+}
+
+FormID StringTable::GetID(const char* entry)
+{
+	FormID id = 0;
+	memcpy(&id, entry, 8);
+	return id;
+}
+
+char* StringTable::Arena::Allocate(size_t size)
+{
+	if (pos == nullptr || (size_t)(end - pos) < size) {
+		// long strings get a chunk of their own, so that the current chunk isn't abandoned
+		if (size > ChunkSize / 4) {
+			chunks.push_back(std::make_unique<char[]>(size));
+			allocated += size;
+			return chunks.back().get();
+		}
+		chunks.push_back(std::make_unique<char[]>(ChunkSize));
+		allocated += ChunkSize;
+		pos = chunks.back().get();
+		end = pos + ChunkSize;
+	}
+	char* result = pos;
+	pos += size;
+	return result;
+}
+
+std::atomic<const char*>* StringTable::GetSlot(uint64_t index, bool create)
+{
+	uint64_t position = index + (1ull << FirstSegmentBits);
+	size_t bit = 63 - std::countl_zero(position);
+	size_t segment = bit - FirstSegmentBits;
+	auto entries = _segments[segment].load(std::memory_order_acquire);
+	if (entries == nullptr) {
+		if (!create)
+			return nullptr;
+		std::unique_lock<std::mutex> guard(_segmentlock);
+		entries = _segments[segment].load(std::memory_order_acquire);
+		if (entries == nullptr) {
+			size_t size = 1ull << bit;
+			entries = new std::atomic<const char*>[size];
+			for (size_t i = 0; i < size; i++)
+				entries[i].store(nullptr, std::memory_order_relaxed);
+			_segments[segment].store(entries, std::memory_order_release);
+		}
+	}
+	return entries + (position - (1ull << bit));
+}
+
+const char* StringTable::GetEntry(uint64_t index)
+{
+	auto slot = GetSlot(index, false);
+	return slot ? slot->load(std::memory_order_acquire) : nullptr;
+}
+
+uint64_t StringTable::Lookup(Index* index, uint64_t hash, std::string_view str)
+{
+	if (index == nullptr)
+		return 0;
+	uint64_t tag = hash >> 32;
+	for (uint64_t pos = hash & index->mask;; pos = (pos + 1) & index->mask) {
+		uint64_t value = index->slots[pos].load(std::memory_order_acquire);
+		if (value == 0)
+			return 0;
+		if ((value >> 32) != tag)
+			continue;
+		const char* entry = GetEntry((value & 0xFFFFFFFF) - 1);
+		if (entry && GetString(entry) == str)
+			return value & 0xFFFFFFFF;
+	}
+}
+
+void StringTable::Insert(Shard& shard, uint64_t hash, uint64_t index)
+{
+	Index* current = shard.index.load(std::memory_order_relaxed);
+	// grow at a load factor of 0.5, readers keep using the old index until the new one is published
+	if (current == nullptr || (shard.count + 1) * 2 > current->mask + 1) {
+		auto grown = std::make_unique<Index>();
+		uint64_t capacity = current ? (current->mask + 1) * 2 : 64;
+		grown->mask = capacity - 1;
+		grown->slots = std::make_unique<std::atomic<uint64_t>[]>(capacity);
+		for (uint64_t i = 0; i < capacity; i++)
+			grown->slots[i].store(0, std::memory_order_relaxed);
+		if (current) {
+			for (uint64_t i = 0; i <= current->mask; i++) {
+				uint64_t value = current->slots[i].load(std::memory_order_relaxed);
+				if (value == 0)
+					continue;
+				const char* entry = GetEntry((value & 0xFFFFFFFF) - 1);
+				uint64_t pos = Hash(GetString(entry)) & grown->mask;
+				while (grown->slots[pos].load(std::memory_order_relaxed) != 0)
+					pos = (pos + 1) & grown->mask;
+				grown->slots[pos].store(value, std::memory_order_relaxed);
+			}
+		}
+		shard.index.store(grown.get(), std::memory_order_release);
+		if (current)
+			shard.retired.emplace_back(current);
+		grown.release();
+		current = shard.index.load(std::memory_order_relaxed);
+	}
+	uint64_t pos = hash & current->mask;
+	while (current->slots[pos].load(std::memory_order_relaxed) != 0)
+		pos = (pos + 1) & current->mask;
+	current->slots[pos].store(((hash >> 32) << 32) | (index + 1), std::memory_order_release);
+	shard.count++;
+}
+
+bool StringTable::Add(Shard& shard, uint64_t hash, uint64_t index, const char* entry)
+{
+	// the slot encoding limits the table to 2^32 - 1 strings
+	if (index >= 0xFFFFFFFF)
+		return false;
+	auto slot = GetSlot(index, true);
+	if (slot->load(std::memory_order_relaxed) != nullptr)
+		return false;
+	// the entry is published before the index points to it
+	slot->store(entry, std::memory_order_release);
+	Insert(shard, hash, index);
+	_count.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+bool StringTable::Find(std::string_view str, FormID& id)
+{
+	uint64_t hash = Hash(str);
+	auto& shard = _shards[hash >> 60];
+	uint64_t found = Lookup(shard.index.load(std::memory_order_acquire), hash, str);
+	if (found == 0)
+		return false;
+	id = _firstid + found - 1;
+	return true;
+}
+
+FormID StringTable::Intern(std::string_view str)
+{
+	uint64_t hash = Hash(str);
+	auto& shard = _shards[hash >> 60];
+	uint64_t found = Lookup(shard.index.load(std::memory_order_acquire), hash, str);
+	if (found != 0)
+		return _firstid + found - 1;
+	std::unique_lock<std::mutex> guard(shard.lock);
+	// another thread may have added the string in the meantime
+	found = Lookup(shard.index.load(std::memory_order_relaxed), hash, str);
+	if (found != 0)
+		return _firstid + found - 1;
+	uint64_t index = _next.fetch_add(1, std::memory_order_acq_rel);
+	FormID id = _firstid + index;
+	uint64_t length = str.size();
+	char* entry = shard.arena.Allocate(EntryHeader + length);
+	memcpy(entry, &id, 8);
+	memcpy(entry + 8, &length, 8);
+	memcpy(entry + EntryHeader, str.data(), length);
+	if (!Add(shard, hash, index, entry)) {
+		logcritical("Cannot add string with id {}", Utility::GetHex(id));
+		return 0;
+	}
+	return id;
+}
+
+bool StringTable::Get(FormID id, std::string_view& str)
+{
+	if (id < _firstid)
+		return false;
+	const char* entry = GetEntry(id - _firstid);
+	if (entry == nullptr)
+		return false;
+	str = GetString(entry);
+	return true;
+}
+
+size_t StringTable::GetMemoryUsage()
+{
+	size_t size = sizeof(StringTable) + _bulk.allocated;
+	for (size_t i = 0; i < _segments.size(); i++)
+		if (_segments[i].load(std::memory_order_acquire) != nullptr)
+			size += (1ull << (i + FirstSegmentBits)) * sizeof(std::atomic<const char*>);
+	for (auto& shard : _shards) {
+		std::unique_lock<std::mutex> guard(shard.lock);
+		size += shard.arena.allocated;
+		Index* index = shard.index.load(std::memory_order_relaxed);
+		if (index)
+			size += sizeof(Index) + (index->mask + 1) * sizeof(uint64_t);
+		for (auto& retired : shard.retired)
+			size += sizeof(Index) + (retired->mask + 1) * sizeof(uint64_t);
+	}
+	return size;
+}
+
+FormID StringTable::Write(std::string& out, FormID minid)
+{
+	// all shards are locked, so that every id below the snapshot has been published
+	std::array<std::unique_lock<std::mutex>, Shards> guards;
+	for (size_t i = 0; i < Shards; i++)
+		guards[i] = std::unique_lock<std::mutex>(_shards[i].lock);
+	uint64_t next = _next.load(std::memory_order_acquire);
+	uint64_t first = minid > _firstid ? minid - _firstid : 0;
+	size_t start = out.size();
+	out.resize(start + 12);
+	size_t offset = start;
+	Buffer::Write(version, (unsigned char*)out.data(), offset);
+	uint64_t count = 0;
+	for (uint64_t index = first; index < next; index++) {
+		const char* entry = GetEntry(index);
+		if (entry == nullptr)
+			continue;
+		out.append(entry, EntryHeader + GetString(entry).size());
+		count++;
+	}
+	Buffer::WriteSize(count, (unsigned char*)out.data(), offset);
+	return _firstid + next;
+}
+
+bool StringTable::Read(const char* data, size_t size)
+{
+	if (size < 12)
+		return false;
+	size_t offset = 0;
+	int32_t ver = Buffer::ReadInt32((unsigned char*)data, offset);
+	if (ver != version)
+		return false;
+	uint64_t count = Buffer::ReadSize((unsigned char*)data, offset);
+	// the entries are copied at once and indexed in place
+	char* entries = nullptr;
+	{
+		std::unique_lock<std::mutex> guard(_segmentlock);
+		entries = _bulk.Allocate(size - offset);
+	}
+	memcpy(entries, data + offset, size - offset);
+	size_t pos = 0;
+	size_t length = size - offset;
+	for (uint64_t i = 0; i < count; i++) {
+		if (pos + EntryHeader > length)
+			return false;
+		const char* entry = entries + pos;
+		std::string_view str = GetString(entry);
+		if (str.size() > length - pos - EntryHeader)
+			return false;
+		pos += EntryHeader + str.size();
+		FormID id = GetID(entry);
+		if (id < _firstid)
+			continue;
+		uint64_t index = id - _firstid;
+		uint64_t hash = Hash(str);
+		auto& shard = _shards[hash >> 60];
+		std::unique_lock<std::mutex> guard(shard.lock);
+		if (Lookup(shard.index.load(std::memory_order_relaxed), hash, str) != 0 || !Add(shard, hash, index, entry))
+			continue;
+		// new strings must not reuse the ids of loaded ones
+		uint64_t next = _next.load(std::memory_order_relaxed);
+		while (next <= index && !_next.compare_exchange_weak(next, index + 1, std::memory_order_acq_rel))
+			;
+	}
+	return true;
+}
+
+void StringTable::Clear()
+{
+	for (auto& segment : _segments) {
+		delete[] segment.load(std::memory_order_relaxed);
+		segment.store(nullptr, std::memory_order_relaxed);
+	}
+	for (auto& shard : _shards) {
+		delete shard.index.load(std::memory_order_relaxed);
+		shard.index.store(nullptr, std::memory_order_relaxed);
+		shard.retired.clear();
+		shard.count = 0;
+		shard.arena = Arena();
+	}
+	_bulk = Arena();
+	_count.store(0, std::memory_order_relaxed);
+}
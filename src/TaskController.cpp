@@ -1,7 +1,9 @@
 #include <atomic>
 #include <queue>
 #include <exception>
+#include <filesystem>
 
+#include "Coroutines.h"
 #include "Data.h"
 #include "TaskController.h"
 #include "Threading.h"
@@ -47,6 +49,7 @@ void TaskController::Start(std::shared_ptr<SessionData> session, int32_t numthre
 	_numthreads = numthreads;
 	if (_numthreads < 1)
 		_numthreads = 1;
+	InitWorkerStatistics(_numthreads);
 	if (_numthreads == 1) {
 		_numLightThreads = 0;
 		_numMediumThreads = 0;
@@ -102,6 +105,7 @@ void TaskController::Start(std::shared_ptr<SessionData> session, int32_t numLigh
 		_numMediumThreads = 0;
 		_numHeavyThreads = 0;
 	}
+	InitWorkerStatistics(_numthreads);
 	int32_t i = 0;
 	if (_numthreads == 1 || _numAllThreads > 0) {
 		_numLightThreads = 0;
@@ -162,6 +166,7 @@ int32_t TaskController::GetLightThreadCount()
 
 void TaskController::Stop(bool completeall)
 {
+	StopStatistics();
 	{
 		std::unique_lock<std::mutex> guard(_lock);
 		_terminate = true;
@@ -189,6 +194,7 @@ void TaskController::Stop(bool completeall)
 
 TaskController::~TaskController()
 {
+	StopStatistics();
 	if (_terminate == false)
 	{
 		// we are exiting unexpectedly
@@ -232,22 +238,16 @@ void TaskController::InternalLoop_LightExclusive(int32_t number)
 	while (true) {
 		std::shared_ptr<Functions::BaseFunction> del;
 		{
-			std::unique_lock<std::mutex> guard(_lockLight);
+			std::unique_lock<std::mutex> guard(_lockLight, std::defer_lock);
+			LockQueue(guard, number);
 			// while freeze is [true], this will never return, if freeze is [false] it only returns when [tasks is non-empty], when [terinated and not waiting], or when [terminating and tasks is empty]
 			_condition_light.wait(guard, [this] { return _freeze == false && (!_tasks_light.empty() || _terminate && _wait == false || _terminate && _tasks_light.empty()); });
 			if (_terminate && _wait == false || _terminate && _tasks_light.empty())
 				return;
-			del = _tasks_light.front();
-			_tasks_light.pop_front();
-		}
-		if (del) {
-			_status[number] = ThreadStatus::Running;
-			_statusTime[number] = std::chrono::steady_clock::now();
-			_statusTask[number] = del->GetName();
-			del->Run();
-			del->Dispose();
-			_completedjobs++;
+			del = TakeTask(_tasks_light);
 		}
+		if (del)
+			ExecuteTask(del, number);
 		_status[number] = ThreadStatus::Waiting;
 	}
 
@@ -271,24 +271,17 @@ void TaskController::InternalLoop_Medium(int32_t number)
 	while (true) {
 		std::shared_ptr<Functions::BaseFunction> del;
 		{
-			std::unique_lock<std::mutex> guard(_lockMedium);
+			std::unique_lock<std::mutex> guard(_lockMedium, std::defer_lock);
+			LockQueue(guard, number);
 			// while freeze is [true], this will never return, if freeze is [false] it only returns when [tasks is non-empty], when [terinated and not waiting], or when [terminating and tasks is empty]
 			_condition_medium.wait(guard, [this] { return _freeze == false && (!_tasks_medium.empty() || _terminate && _wait == false || _terminate && _tasks_medium.empty()); });
 			if (_terminate && _wait == false || _terminate && _tasks_medium.empty())
 				return;
-			if (!_tasks_medium.empty()) {
-				del = _tasks_medium.front();
-				_tasks_medium.pop_front();
-			}
-		}
-		if (del) {
-			_status[number] = ThreadStatus::Running;
-			_statusTime[number] = std::chrono::steady_clock::now();
-			_statusTask[number] = del->GetName();
-			del->Run();
-			del->Dispose();
-			_completedjobs++;
+			if (!_tasks_medium.empty())
+				del = TakeTask(_tasks_medium);
 		}
+		if (del)
+			ExecuteTask(del, number);
 		_status[number] = ThreadStatus::Waiting;
 	}
 
@@ -311,25 +304,25 @@ void TaskController::InternalLoop_Heavy(int32_t number)
 	_status[number] = ThreadStatus::Waiting;
 	while (true) {
 		std::shared_ptr<Functions::BaseFunction> del;
-		{
-			std::unique_lock<std::mutex> guard(_lock);
+		// help out with light tasks that have exceeded their deadline, so that the processing
+		// of finished tests does not fall behind during bursts of heavy tasks
+		if (_controlEnableLight && _freeze == false && _lockLight.try_lock()) {
+			if (_tasks_light.FrontOverdue(std::chrono::steady_clock::now()))
+				del = TakeTask(_tasks_light);
+			_lockLight.unlock();
+		}
+		if (!del) {
+			std::unique_lock<std::mutex> guard(_lock, std::defer_lock);
+			LockQueue(guard, number);
 			// while freeze is [true], this will never return, if freeze is [false] it only returns when [tasks is non-empty], when [terinated and not waiting], or when [terminating and tasks is empty]
 			_condition.wait(guard, [this] { return _freeze == false && (!_tasks.empty() || _terminate && _wait == false || _terminate && _tasks.empty()); });
 			if (_terminate && _wait == false || _terminate && _tasks.empty())
 				return;
-			if (!_tasks.empty()) {
-				del = _tasks.front();
-				_tasks.pop_front();
-			}
-		}
-		if (del) {
-			_status[number] = ThreadStatus::Running;
-			_statusTime[number] = std::chrono::steady_clock::now();
-			_statusTask[number] = del->GetName();
-			del->Run();
-			del->Dispose();
-			_completedjobs++;
+			if (!_tasks.empty())
+				del = TakeTask(_tasks);
 		}
+		if (del)
+			ExecuteTask(del, number);
 		_status[number] = ThreadStatus::Waiting;
 	}
 
@@ -353,28 +346,22 @@ void TaskController::InternalLoop_SingleThread(int32_t number)
 	while (true) {
 		std::shared_ptr<Functions::BaseFunction> del;
 		{
-			std::unique_lock<std::mutex> guard(_lock);
+			std::unique_lock<std::mutex> guard(_lock, std::defer_lock);
+			LockQueue(guard, number);
 			// while freeze is [true], this will never return, if freeze is [false] it only returns when [tasks is non-empty], when [terinated and not waiting], or when [terminating and tasks is empty]
 			_condition.wait_for(guard, std::chrono::milliseconds(100), [this] { return _freeze == false && (!_tasks_light.empty() || !_tasks_medium.empty() || !_tasks.empty() || _terminate && _wait == false || _terminate && _tasks_light.empty() && _tasks_medium.empty() && _tasks.empty()); });
 			if (_terminate && _wait == false || _terminate && _tasks_light.empty() && _tasks_medium.empty() && _tasks.empty())
 				return;
 			if (_freeze)
 				continue;
-			if (!_tasks_light.empty()) {
-				del = _tasks_light.front();
-				_tasks_light.pop_front();
-			} else if (!_tasks_medium.empty()) {
-				del = _tasks_medium.front();
-				_tasks_medium.pop_front();
-			} else if (!_tasks.empty()) {
-				del = _tasks.front();
-				_tasks.pop_front();
-			}
+			if (!_tasks_light.empty())
+				del = TakeTask(_tasks_light);
+			else if (!_tasks_medium.empty())
+				del = TakeTask(_tasks_medium);
+			else if (!_tasks.empty())
+				del = TakeTask(_tasks);
 		}
 		if (del) {
-			_status[number] = ThreadStatus::Running;
-			_statusTime[number] = std::chrono::steady_clock::now();
-			_statusTask[number] = del->GetName();
 #ifndef NDEBUG
 			{
 				std::unique_lock<std::mutex> finLock(_finishedTasksLock);
@@ -387,9 +374,7 @@ void TaskController::InternalLoop_SingleThread(int32_t number)
 					_finishedTasks.insert_or_assign(name, 1);
 			}
 #endif
-			del->Run();
-			del->Dispose();
-			_completedjobs++;
+			ExecuteTask(del, number);
 		}
 		_status[number] = ThreadStatus::Waiting;
 	}
@@ -401,6 +386,207 @@ void TaskController::InternalLoop_SingleThread(int32_t number)
 		Lua::UnregisterThread();
 }
 
+std::shared_ptr<Functions::BaseFunction> TaskController::TakeTask(TaskQueue& queue)
+{
+	const TaskQueue::Entry& entry = queue.front_entry();
+	if (entry.HasDeadline()) {
+		int32_t type = (int32_t)entry.task->GetFunctionType();
+		_deadlineTasks[type]++;
+		int64_t lateness = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - entry.deadline).count();
+		if (lateness > 0) {
+			_missedDeadlines[type]++;
+			int64_t max = _maxLateness[type].load();
+			while (max < lateness && !_maxLateness[type].compare_exchange_weak(max, lateness))
+				;
+		}
+	}
+	std::shared_ptr<Functions::BaseFunction> task = entry.task;
+	queue.pop_front();
+	return task;
+}
+
+uint64_t TaskController::GetDeadlineTasks(Functions::FunctionType type)
+{
+	return _deadlineTasks[(int32_t)type].load();
+}
+
+uint64_t TaskController::GetMissedDeadlines(Functions::FunctionType type)
+{
+	return _missedDeadlines[(int32_t)type].load();
+}
+
+std::chrono::nanoseconds TaskController::GetMaxDeadlineLateness(Functions::FunctionType type)
+{
+	return std::chrono::nanoseconds(_maxLateness[(int32_t)type].load());
+}
+
+void TaskController::InitWorkerStatistics(int32_t numthreads)
+{
+	_startTime = std::chrono::steady_clock::now();
+	_workerStats.reset(new WorkerStatistics[numthreads]);
+	_workerStatsCount = numthreads;
+}
+
+void TaskController::LockQueue(std::unique_lock<std::mutex>& guard, int32_t number)
+{
+	// uncontended locks are not timed
+	if (guard.try_lock())
+		return;
+	if (_disableStatistics) {
+		guard.lock();
+		return;
+	}
+	auto begin = std::chrono::steady_clock::now();
+	guard.lock();
+	int64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	WorkerStatistics& stats = _workerStats[number];
+	// every worker is the only writer of its statistics, so no read-modify-write is needed
+	stats.lockwait.store(stats.lockwait.load(std::memory_order_relaxed) + wait, std::memory_order_relaxed);
+	stats.currentlockwait.store(stats.currentlockwait.load(std::memory_order_relaxed) + wait, std::memory_order_relaxed);
+}
+
+void TaskController::ExecuteTask(std::shared_ptr<Functions::BaseFunction>& task, int32_t number)
+{
+	auto begin = std::chrono::steady_clock::now();
+	_status[number] = ThreadStatus::Running;
+	_statusTime[number] = begin;
+	_statusTask[number] = task->GetName();
+	if (!_disableStatistics) {
+		// the idle time is accounted when the worker wakes up, until then samples add the open interval themselves
+		WorkerStatistics& stats = _workerStats[number];
+		int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - _startTime).count();
+		int64_t idle = now - stats.waitingSince.load(std::memory_order_relaxed) - stats.currentlockwait.load(std::memory_order_relaxed);
+		if (idle > 0)
+			stats.idle.store(stats.idle.load(std::memory_order_relaxed) + idle, std::memory_order_relaxed);
+		stats.currentlockwait.store(0, std::memory_order_relaxed);
+		stats.waitingSince.store(WorkerStatistics::NotWaiting, std::memory_order_release);
+	}
+	task->Run();
+	task->Dispose();
+	_completedjobs++;
+	if (!_disableStatistics) {
+		auto end = std::chrono::steady_clock::now();
+		WorkerStatistics& stats = _workerStats[number];
+		int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+		stats.busy.store(stats.busy.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+		if (duration > stats.maxtask.load(std::memory_order_relaxed))
+			stats.maxtask.store(duration, std::memory_order_relaxed);
+		stats.tasks.store(stats.tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		stats.waitingSince.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - _startTime).count(), std::memory_order_release);
+	}
+}
+
+TaskController::Sample TaskController::GetSample()
+{
+	Sample sample;
+	sample.time = std::chrono::steady_clock::now();
+	sample.completedjobs = _completedjobs.load();
+	sample.waitingLight = GetWaitingLightJobs();
+	sample.waitingMedium = GetWaitingMediumJobs();
+	sample.waitingHeavy = GetWaitingHeavyJobs();
+	sample.workers.resize(_workerStatsCount);
+	int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(sample.time - _startTime).count();
+	for (int32_t i = 0; i < _workerStatsCount; i++) {
+		sample.workers[i].busy = _workerStats[i].busy.load(std::memory_order_relaxed);
+		sample.workers[i].idle = _workerStats[i].idle.load(std::memory_order_relaxed);
+		// workers waiting for tasks have not accounted their current idle time yet. The accumulated idle time is read
+		// first, so that an interval accounted in between is missed for this sample instead of counted twice
+		int64_t since = _workerStats[i].waitingSince.load(std::memory_order_acquire);
+		if (since != WorkerStatistics::NotWaiting) {
+			int64_t open = now - since - _workerStats[i].currentlockwait.load(std::memory_order_relaxed);
+			if (open > 0)
+				sample.workers[i].idle += open;
+		}
+		sample.workers[i].lockwait = _workerStats[i].lockwait.load(std::memory_order_relaxed);
+		sample.workers[i].maxtask = _workerStats[i].maxtask.load(std::memory_order_relaxed);
+		sample.workers[i].tasks = _workerStats[i].tasks.load(std::memory_order_relaxed);
+	}
+	return sample;
+}
+
+void TaskController::GetSamples(std::vector<Sample>& samples)
+{
+	std::unique_lock<std::mutex> guard(_samplesLock);
+	samples.assign(_samples.begin(), _samples.end());
+}
+
+void TaskController::StartStatistics(std::chrono::milliseconds interval, size_t history, std::string dumppath)
+{
+	StopStatistics();
+	if (interval.count() <= 0)
+		return;
+	_samplesInterval = interval;
+	_samplesMax = history;
+	_samplesDumpPath = dumppath;
+	if (!dumppath.empty()) {
+		_samplesDumpJson = std::filesystem::path(dumppath).extension() == ".json";
+		_samplesDump.open(dumppath, std::ios_base::out | std::ios_base::trunc);
+		if (!_samplesDump.is_open()) {
+			logwarn("Cannot open statistics file: {}", dumppath);
+		} else if (!_samplesDumpJson)
+			_samplesDump << "time_ms,completed,waiting_light,waiting_medium,waiting_heavy,worker,busy_ns,idle_ns,lockwait_ns,tasks,maxtask_ns\n";
+	}
+	_terminateStatistics = false;
+	_statisticsThread = std::thread(&TaskController::InternalLoop_Statistics, this);
+}
+
+void TaskController::StopStatistics()
+{
+	{
+		std::unique_lock<std::mutex> guard(_samplesLock);
+		_terminateStatistics = true;
+	}
+	_conditionStatistics.notify_all();
+	if (_statisticsThread.joinable())
+		_statisticsThread.join();
+	if (_samplesDump.is_open())
+		_samplesDump.close();
+}
+
+void TaskController::InternalLoop_Statistics()
+{
+	std::unique_lock<std::mutex> guard(_samplesLock);
+	while (!_terminateStatistics) {
+		_conditionStatistics.wait_for(guard, _samplesInterval, [this] { return _terminateStatistics; });
+		if (_terminateStatistics)
+			break;
+		guard.unlock();
+		Sample sample = GetSample();
+		DumpSample(sample);
+		guard.lock();
+		_samples.push_back(std::move(sample));
+		while (_samples.size() > _samplesMax)
+			_samples.pop_front();
+	}
+}
+
+void TaskController::DumpSample(Sample& sample)
+{
+	if (!_samplesDump.is_open())
+		return;
+	int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(sample.time - _startTime).count();
+	if (_samplesDumpJson) {
+		_samplesDump << "{\"time_ms\":" << time << ",\"completed\":" << sample.completedjobs
+					 << ",\"waiting_light\":" << sample.waitingLight << ",\"waiting_medium\":" << sample.waitingMedium << ",\"waiting_heavy\":" << sample.waitingHeavy
+					 << ",\"workers\":[";
+		for (size_t i = 0; i < sample.workers.size(); i++) {
+			auto& worker = sample.workers[i];
+			if (i > 0)
+				_samplesDump << ",";
+			_samplesDump << "{\"busy_ns\":" << worker.busy << ",\"idle_ns\":" << worker.idle << ",\"lockwait_ns\":" << worker.lockwait
+						 << ",\"tasks\":" << worker.tasks << ",\"maxtask_ns\":" << worker.maxtask << "}";
+		}
+		_samplesDump << "]}\n";
+	} else {
+		for (size_t i = 0; i < sample.workers.size(); i++) {
+			auto& worker = sample.workers[i];
+			_samplesDump << time << "," << sample.completedjobs << "," << sample.waitingLight << "," << sample.waitingMedium << "," << sample.waitingHeavy << ","
+						 << i << "," << worker.busy << "," << worker.idle << "," << worker.lockwait << "," << worker.tasks << "," << worker.maxtask << "\n";
+		}
+	}
+	_samplesDump.flush();
+}
+
 uint64_t TaskController::GetCompletedJobs()
 {
 	return _completedjobs;
@@ -459,21 +645,19 @@ size_t TaskController::GetStaticSize(int32_t version)
 size_t TaskController::GetDynamicSize()
 {
 	size_t sz = 0;
-	for (auto task : _tasks)
-	{
-		if (task != nullptr)
-		{
-			sz += task->GetLength();
+	for (auto& entry : _tasks) {
+		if (entry.task != nullptr) {
+			sz += entry.task->GetLength();
 		}
 	}
-	for (auto task : _tasks_medium) {
-		if (task != nullptr) {
-			sz += task->GetLength();
+	for (auto& entry : _tasks_medium) {
+		if (entry.task != nullptr) {
+			sz += entry.task->GetLength();
 		}
 	}
-	for (auto task : _tasks_light) {
-		if (task != nullptr) {
-			sz += task->GetLength();
+	for (auto& entry : _tasks_light) {
+		if (entry.task != nullptr) {
+			sz += entry.task->GetLength();
 		}
 	}
 	sz += 8;
@@ -502,17 +686,16 @@ bool TaskController::WriteData(std::ostream* buffer, size_t& offset, size_t leng
 	Buffer::Write(_controlEnableMedium, buffer, offset);
 	Buffer::Write(_controlEnableHeavy, buffer, offset);
 	Buffer::WriteSize(_tasks.size(), buffer, offset);
-	for (auto task : _tasks)
-	{
-		task->WriteData(buffer, offset);
+	for (auto& entry : _tasks) {
+		entry.task->WriteData(buffer, offset);
 	}
 	Buffer::WriteSize(_tasks_medium.size(), buffer, offset);
-	for (auto task : _tasks_medium) {
-		task->WriteData(buffer, offset);
+	for (auto& entry : _tasks_medium) {
+		entry.task->WriteData(buffer, offset);
 	}
 	Buffer::WriteSize(_tasks_light.size(), buffer, offset);
-	for (auto task : _tasks_light) {
-		task->WriteData(buffer, offset);
+	for (auto& entry : _tasks_light) {
+		entry.task->WriteData(buffer, offset);
 	}
 	Buffer::Write((uint64_t)_completedjobs.load(), buffer, offset);
 
@@ -655,6 +838,7 @@ void TaskController::RegisterFactories()
 {
 	if (!_registeredFactories) {
 		_registeredFactories = !_registeredFactories;
+		Coroutines::RegisterFactories();
 	}
 }
 
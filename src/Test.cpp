@@ -945,6 +945,7 @@ void Test::InitializeEarly(LoadResolver* resolver)
 			this->_itr = input->begin();
 			this->_itrend = input->end();
 			this->_input = input;
+			std::unique_lock<std::mutex> guard(resolver->GetLinkLock(input->GetFormID()));
 			if (!input->test) {
 				input->test = resolver->ResolveFormID<Test>(_formid);
 			}
@@ -1156,6 +1157,13 @@ namespace Functions
 		SessionFunctions::MasterControl(_sessiondata);
 	}
 
+	std::chrono::nanoseconds TestCallback::GetDeadline()
+	{
+		if (_sessiondata)
+			return std::chrono::microseconds(_sessiondata->_settings->controller.testCallbackDeadline);
+		return std::chrono::nanoseconds(0);
+	}
+
 	std::shared_ptr<BaseFunction> TestCallback::DeepCopy()
 	{
 		auto ptr = std::make_shared<TestCallback>();
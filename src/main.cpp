@@ -7,6 +7,8 @@
 #include <filesystem>
 #include <iostream>
 #include "DeltaDebugging.h"
+#include "SaveFile.h"
+#include "SaveQuery.h"
 //#include "Processes.h"
 
 
@@ -83,6 +85,12 @@ int extractlength = -1;
 double extractscore = -1;
 bool extract = false;
 
+bool query = false;
+SaveQuery::Args queryargs;
+
+bool verify = false;
+std::filesystem::path verifypath;
+
 bool failedLoad = false;
 
 SessionStatus status;
@@ -172,6 +180,8 @@ std::string Snapshot(bool full)
 		snap << fmt::format("Waiting [Medium]:        {}", status.task_waiting_medium) << "\n";
 		snap << fmt::format("Waiting [Light]:         {}", status.task_waiting_light) << "\n";
 		snap << fmt::format("Completed:               {}", status.task_completed) << "\n";
+		snap << fmt::format("Late Tasks [Light]:      {} / {}", status.task_deadlines_missed_light, status.task_deadlines_light) << "\n";
+		snap << fmt::format("Max Lateness [Light]:    {}", Logging::FormatTimeNS(status.task_deadlines_lateness_light.count())) << "\n";
 
 		snap << ("Execution Handler") << "\n";
 		snap << fmt::format("Waiting:                 {}", status.exec_waiting) << "\n";
@@ -333,6 +343,14 @@ std::string Snapshot(bool full)
 				break;
 			}
 		}
+		static TaskController::Sample sample;
+		session->UI_GetThreadStatistics(sample);
+		snap << fmt::format("Queue Depth: Light {} | Medium {} | Heavy {}", sample.waitingLight, sample.waitingMedium, sample.waitingHeavy) << "\n";
+		for (size_t i = 0; i < sample.workers.size(); i++) {
+			auto& worker = sample.workers[i];
+			double total = (double)std::max(worker.busy + worker.idle + worker.lockwait, (int64_t)1);
+			snap << fmt::format("Worker {}: Busy {:.1f}% | Idle {:.1f}% | Lock {:.1f}% | Tasks {} | Avg {} | Max {}", i, worker.busy * 100 / total, worker.idle * 100 / total, worker.lockwait * 100 / total, worker.tasks, Logging::FormatTimeNS(worker.tasks > 0 ? worker.busy / (int64_t)worker.tasks : 0), Logging::FormatTimeNS(worker.maxtask)) << "\n";
+		}
 		snap << ("ExecutionHandler") << "\n";
 		execstatus = session->UI_GetExecHandlerStatus();
 		snap << fmt::format("Status: {}", toStringExec(execstatus)) << "\n";
@@ -680,6 +698,7 @@ void StartSession()
 	args.settingsPath = CmdArgs::_settingspath;
 	args.loadNewGrammar = CmdArgs::_updateGrammar;
 	args.skipExclusionTree = CmdArgs::_doNotLoadExclusionTree;
+	args.recover = CmdArgs::_recover;
 	args.customsavepath = CmdArgs::_customsavepath;
 	args.savepath = CmdArgs::_savepath;
 
@@ -697,6 +716,8 @@ void StartSession()
 		}
 	} else if (CmdArgs::_printresults) {
 		args.startSession = false;
+		// the session is only inspected, so inputs are read from the savefile when they are needed
+		args.lazyLoad = true;
 		// load session
 		if (CmdArgs::_num)
 			session = Session::LoadSession(CmdArgs::_loadname, CmdArgs::_number, args, &failedLoad, &status);
@@ -708,6 +729,8 @@ void StartSession()
 		}
 	} else if (CmdArgs::_print) {
 		args.startSession = false;
+		// the session is only inspected, so inputs are read from the savefile when they are needed
+		args.lazyLoad = true;
 		// load session
 		if (CmdArgs::_num)
 			session = Session::LoadSession(CmdArgs::_loadname, CmdArgs::_number, args, &failedLoad, &status);
@@ -810,6 +833,13 @@ int32_t main(int32_t argc, char** argv)
 		"	 --extract-inputs <NUMBER>  		  - Extracts a random number of generated inputs to a new savefile [must be used with a \'print\' option]\n"
 		"	 --extract-length <NUMBER>  		  - Extracts generated inputs with length of at least NUMBER\n"
 		"	 --extract-score <NUMBER>  		      - Extracts generated inputs with score of at least NUMBER\n"
+		"    --query <SAVEFILE> <OUTPUT> <FILTER> - Streams the inputs of a savefile without loading it and writes the ones matching\n"
+		"                                           FILTER to OUTPUT [.tfsave: savefile, .csv: statistics, otherwise form ids]\n"
+		"                                           FILTER: key=value,... with keys result, minlength, maxlength, minprimary, maxprimary,\n"
+		"                                           minsecondary, maxsecondary, generation, flags, noflags\n"
+		"    --query-ancestors                    - Adds the ancestors of matching inputs to savefiles written by --query\n"
+		"    --verify <SAVEFILE>                  - Checks the checksums and structure of a savefile without loading it\n"
+		"    --recover                            - Loads the intact blocks of a damaged savefile and skips the damaged ones\n"
 		"	 --test-dd <FORMID>  				  - Tests delta debugging on the given input\n";
 
 	std::string logpath = "";
@@ -930,6 +960,19 @@ int32_t main(int32_t argc, char** argv)
 		} else if (option.find("--no-exclusiontree") != std::string::npos) {
 			std::cout << "Parameter: --no-exclusiontree\n";
 			CmdArgs::_doNotLoadExclusionTree = true;
+		} else if (option.find("--recover") != std::string::npos) {
+			std::cout << "Parameter: --recover\n";
+			CmdArgs::_recover = true;
+		} else if (option.find("--verify") != std::string::npos) {
+			if (i + 1 < argc) {
+				verifypath = std::filesystem::absolute(std::filesystem::path(argv[i + 1]));
+				std::cout << "Parameter: --verify\t" + verifypath.string() + "\n";
+				verify = true;
+				i++;
+			} else {
+				std::cerr << "missing savefile";
+				exit(ExitCodes::ArgumentError);
+			}
 		} else if (option.find("--reloadconfig") != std::string::npos) {
 			std::cout << "Parameter: --reloadconfig\n";
 			CmdArgs::_reloadConfig = true;
@@ -1112,6 +1155,25 @@ int32_t main(int32_t argc, char** argv)
 		} else if (option.find("--fork") != std::string::npos) {
 			std::cout << "Parameter: --fork\n";
 			CmdArgs::_fork = true;
+		} else if (option.find("--query-ancestors") != std::string::npos) {
+			std::cout << "Parameter: --query-ancestors\n";
+			queryargs.ancestors = true;
+		} else if (option.find("--query") != std::string::npos) {
+			if (i + 3 < argc) {
+				queryargs.save = std::filesystem::absolute(std::filesystem::path(argv[i + 1]));
+				queryargs.output = std::filesystem::absolute(std::filesystem::path(argv[i + 2]));
+				queryargs.format = SaveQuery::GetFormat(queryargs.output);
+				if (!SaveQuery::ParseFilter(std::string(argv[i + 3]), queryargs.filter)) {
+					std::cerr << "invalid query filter";
+					exit(ExitCodes::ArgumentError);
+				}
+				std::cout << "Parameter: --query\t" + queryargs.save.string() + "\t" + queryargs.output.string() + "\n";
+				query = true;
+				i += 3;
+			} else {
+				std::cerr << "missing savefile, output or filter";
+				exit(ExitCodes::ArgumentError);
+			}
 		} else if (option.find("--test") != std::string::npos) {
 			std::vector<std::pair<size_t, size_t>> vec;
 			vec.push_back({ 1, 3 });
@@ -1174,6 +1236,22 @@ int32_t main(int32_t argc, char** argv)
 	logmessage("Working Directory:\t{}", CmdArgs::workdir.string());
 	logmessage("Configuration file path:\t{}", std::filesystem::absolute(std::filesystem::path(CmdArgs::_settingspath)).string());
 
+	// queries only read the savefile, no session is created
+	if (query) {
+		SaveQuery::Stats stats;
+		bool res = SaveQuery::Run(queryargs, stats);
+		logmessage("Query matched {} of {} inputs, wrote {} records", stats.matches, stats.inputs, stats.written);
+		exit(res ? ExitCodes::Success : ExitCodes::Error);
+	}
+	if (verify) {
+		SaveFile::VerifyResult result;
+		bool res = SaveFile::Verify(verifypath, 0, result);
+		double seconds = (double)result.time.count() / 1000000000;
+		logmessage("Verified savefile version {}: {} blocks, {} damaged, {} records, {} bytes in {} [{:.1f} MB/s]{}", Utility::GetHex(result.version), result.blocks, result.damaged, result.records, result.bytes,
+			Logging::FormatTimeNS(result.time.count()), seconds > 0 ? (double)result.bytes / 1000000 / seconds : 0.0, result.index ? "" : ", index is damaged");
+		exit(res ? ExitCodes::Success : ExitCodes::Error);
+	}
+
 	// check out the load path and print
 	if (CmdArgs::_load && CmdArgs::_print) {
 		logcritical("Load and Print option cannot be active at the same time.");
@@ -1601,6 +1679,8 @@ int32_t main(int32_t argc, char** argv)
 						ImGui::Text("Waiting [Medium]:        %d", status.task_waiting_medium);
 						ImGui::Text("Waiting [Light]:         %d", status.task_waiting_light);
 						ImGui::Text("Completed:               %llu", status.task_completed);
+						ImGui::Text("Late Tasks [Light]:      %llu / %llu", status.task_deadlines_missed_light, status.task_deadlines_light);
+						ImGui::Text("Max Lateness [Light]:    %s", Logging::FormatTimeNS(status.task_deadlines_lateness_light.count()).c_str());
 
 						ImGui::SeparatorText("Execution Handler");
 						ImGui::Text("Waiting:                 %d", status.exec_waiting);
@@ -1786,6 +1866,14 @@ int32_t main(int32_t argc, char** argv)
 							break;
 						}
 					}
+					static TaskController::Sample sample;
+					session->UI_GetThreadStatistics(sample);
+					ImGui::Text("Queue Depth: Light %d | Medium %d | Heavy %d", sample.waitingLight, sample.waitingMedium, sample.waitingHeavy);
+					for (size_t i = 0; i < sample.workers.size(); i++) {
+						auto& worker = sample.workers[i];
+						double total = (double)std::max(worker.busy + worker.idle + worker.lockwait, (int64_t)1);
+						ImGui::Text("Worker %zu: Busy %.1f%% | Idle %.1f%% | Lock %.1f%% | Tasks %llu | Avg %s | Max %s", i, worker.busy * 100 / total, worker.idle * 100 / total, worker.lockwait * 100 / total, worker.tasks, Logging::FormatTimeNS(worker.tasks > 0 ? worker.busy / (int64_t)worker.tasks : 0).c_str(), Logging::FormatTimeNS(worker.maxtask).c_str());
+					}
 					ImGui::SeparatorText("ExecutionHandler");
 					execstatus = session->UI_GetExecHandlerStatus();
 					ImGui::Text("Status: %s", toStringExec(execstatus));
@@ -0,0 +1,602 @@
+#include "Logging.h"
+#include "TaskController.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#include "ChrashHandlerINCL.h"
+#endif
+
+#include "Coroutines.h"
+#include "Function.h"
+#include "Session.h"
+#include "Data.h"
+
+#include <memory>
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace Functions
+{
+	class CoroutinesTestCallback : public BaseFunction
+	{
+	public:
+		std::atomic<int>* value = nullptr;
+		int add = 0;
+		FunctionType type = FunctionType::Heavy;
+
+		void Run() override
+		{
+			if (value)
+				value->fetch_add(add);
+		}
+
+		static uint64_t GetTypeStatic() { return 'CTTE'; }
+		uint64_t GetType() override { return 'CTTE'; }
+		FunctionType GetFunctionType() override { return type; };
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override
+		{
+			auto ptr = std::make_shared<CoroutinesTestCallback>();
+			ptr->value = value;
+			ptr->add = add;
+			ptr->type = type;
+			return dynamic_pointer_cast<BaseFunction>(ptr);
+		}
+
+		bool ReadData(std::istream*, size_t&, size_t, LoadResolver*) override
+		{
+			return true;
+		}
+		bool ReadData(unsigned char*, size_t&, size_t, LoadResolver*) override
+		{
+			return true;
+		}
+
+		static std::shared_ptr<BaseFunction> Create()
+		{
+			return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutinesTestCallback>());
+		}
+
+		void Dispose() override
+		{
+			value = nullptr;
+		}
+
+		virtual const char* GetName() override
+		{
+			return "CoroutinesTestCallback";
+		}
+	};
+
+	/// <summary>
+	/// one step of a callback chain, does some work and schedules the next step
+	/// </summary>
+	class CoroutinesChainCallback : public BaseFunction
+	{
+	public:
+		TaskController* controller = nullptr;
+		std::atomic<int>* remaining = nullptr;
+		std::atomic<int64_t>* work = nullptr;
+		int steps = 0;
+
+		void Run() override;
+
+		static uint64_t GetTypeStatic() { return 'CTCH'; }
+		uint64_t GetType() override { return 'CTCH'; }
+		FunctionType GetFunctionType() override { return FunctionType::Medium; };
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override
+		{
+			auto ptr = std::make_shared<CoroutinesChainCallback>();
+			ptr->controller = controller;
+			ptr->remaining = remaining;
+			ptr->work = work;
+			ptr->steps = steps;
+			return dynamic_pointer_cast<BaseFunction>(ptr);
+		}
+
+		bool ReadData(std::istream*, size_t&, size_t, LoadResolver*) override
+		{
+			return true;
+		}
+		bool ReadData(unsigned char*, size_t&, size_t, LoadResolver*) override
+		{
+			return true;
+		}
+
+		static std::shared_ptr<BaseFunction> Create()
+		{
+			return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutinesChainCallback>());
+		}
+
+		void Dispose() override
+		{
+			controller = nullptr;
+		}
+
+		virtual const char* GetName() override
+		{
+			return "CoroutinesChainCallback";
+		}
+	};
+}
+
+/// <summary>
+/// simulates the work done by a single step of a multi-stage algorithm
+/// </summary>
+int64_t DoWork()
+{
+	auto begin = std::chrono::steady_clock::now();
+	volatile uint64_t x = 0;
+	for (int i = 0; i < 2000; i++)
+		x = x + i * 31;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void Functions::CoroutinesChainCallback::Run()
+{
+	work->fetch_add(DoWork());
+	if (steps > 1) {
+		auto next = std::make_shared<CoroutinesChainCallback>();
+		next->controller = controller;
+		next->remaining = remaining;
+		next->work = work;
+		next->steps = steps - 1;
+		controller->AddTask(next);
+	} else
+		remaining->fetch_sub(1);
+}
+
+/// <summary>
+/// events completed by the checkpoint hook of TestCoroutine
+/// </summary>
+struct CheckpointEvents
+{
+	/// <summary>
+	/// completed while the checkpoint runs
+	/// </summary>
+	Coroutines::Completion* during = nullptr;
+	/// <summary>
+	/// completed by another thread once the coroutine is suspended
+	/// </summary>
+	Coroutines::Completion* after = nullptr;
+	std::thread completer;
+};
+
+Coroutines::Task TestCoroutine(std::atomic<int>* value, std::vector<int>* stages, CheckpointEvents* events)
+{
+	stages->push_back(0);
+	co_await Coroutines::Schedule(Functions::FunctionType::Light);
+	stages->push_back(1);
+	co_await Coroutines::Schedule(Functions::FunctionType::Heavy);
+	stages->push_back(2);
+	auto task = std::make_shared<Functions::CoroutinesTestCallback>();
+	task->value = value;
+	task->add = 5;
+	co_await Coroutines::AwaitTask(task);
+	if (value->load() != 5)
+		co_return;
+	stages->push_back(3);
+	auto begin = std::chrono::steady_clock::now();
+	co_await Coroutines::Sleep(std::chrono::milliseconds(20));
+	if (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(20))
+		co_return;
+	stages->push_back(4);
+	// an event completed before it is awaited does not suspend
+	Coroutines::Completion completed;
+	completed.GetCallback()->Run();
+	co_await completed;
+	// an event completed during the checkpoint does not suspend either
+	Coroutines::Completion checkpoint;
+	events->during = &checkpoint;
+	co_await checkpoint;
+	stages->push_back(5);
+	// the completion callback is run by a different task once we are suspended, the same way
+	// a finished test runs its callback
+	Coroutines::Completion completion;
+	events->after = &completion;
+	co_await completion;
+	stages->push_back(6);
+}
+
+Coroutines::Task ChainCoroutine(std::atomic<int>* remaining, std::atomic<int64_t>* work, int steps)
+{
+	for (int i = 0; i < steps; i++) {
+		work->fetch_add(DoWork());
+		if (i < steps - 1)
+			co_await Coroutines::Schedule();
+	}
+	remaining->fetch_sub(1);
+}
+
+void Benchmark(std::shared_ptr<SessionData> sessiondata, int32_t threads, int chains, int steps, bool coroutines)
+{
+	TaskController controller;
+	controller.SetDisableLua();
+	controller.Start(sessiondata, threads);
+	std::atomic<int> remaining = chains;
+	std::atomic<int64_t> work = 0;
+	std::vector<Coroutines::Task> tasks;
+	auto begin = std::chrono::steady_clock::now();
+	for (int i = 0; i < chains; i++) {
+		if (coroutines) {
+			tasks.push_back(ChainCoroutine(&remaining, &work, steps));
+			tasks.back().Start(&controller, Functions::FunctionType::Medium);
+		} else {
+			auto first = std::make_shared<Functions::CoroutinesChainCallback>();
+			first->controller = &controller;
+			first->remaining = &remaining;
+			first->work = &work;
+			first->steps = steps;
+			controller.AddTask(first);
+		}
+	}
+	for (auto& task : tasks)
+		task.Wait();
+	while (remaining.load() > 0)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	controller.Stop();
+	double utilization = (double)work.load() / ((double)wall * controller.GetNumThreads());
+	std::cout << (coroutines ? "Coroutines" : "Callbacks ") << " | threads: " << controller.GetNumThreads() << " | chains: " << chains << " | steps: " << steps
+			  << " | time: " << Logging::FormatTimeNS(wall) << " | tasks/s: " << (uint64_t)((double)chains * steps / ((double)wall / 1000000000))
+			  << " | worker utilization: " << (int)(utilization * 100) << "%\n";
+}
+
+/// <summary>
+/// simulates the test executor: runs up to [concurrent] tests at a time, each taking [latency],
+/// and hands the callback of a finished test to the task controller
+/// </summary>
+class SimulatedExecutor
+{
+public:
+	SimulatedExecutor(TaskController* controller, int concurrent, std::chrono::microseconds latency) :
+		_controller(controller), _concurrent(concurrent), _latency(latency)
+	{
+		_thread = std::thread(&SimulatedExecutor::Loop, this);
+	}
+	~SimulatedExecutor()
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_stop = true;
+		}
+		_cond.notify_all();
+		_thread.join();
+	}
+
+	void Add(std::shared_ptr<Functions::BaseFunction> callback)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_waiting.push_back(callback);
+		}
+		_cond.notify_all();
+	}
+
+private:
+	void Loop()
+	{
+		std::deque<std::pair<std::chrono::steady_clock::time_point, std::shared_ptr<Functions::BaseFunction>>> running;
+		std::unique_lock<std::mutex> guard(_lock);
+		while (!_stop) {
+			while (!_waiting.empty() && (int)running.size() < _concurrent) {
+				running.push_back({ std::chrono::steady_clock::now() + _latency, _waiting.front() });
+				_waiting.pop_front();
+			}
+			auto now = std::chrono::steady_clock::now();
+			while (!running.empty() && running.front().first <= now) {
+				_controller->AddTask(running.front().second);
+				running.pop_front();
+			}
+			if (running.empty())
+				_cond.wait(guard, [this]() { return _stop || !_waiting.empty(); });
+			else
+				_cond.wait_until(guard, running.front().first);
+		}
+	}
+
+	TaskController* _controller;
+	int _concurrent;
+	std::chrono::microseconds _latency;
+	std::mutex _lock;
+	std::condition_variable _cond;
+	std::deque<std::shared_ptr<Functions::BaseFunction>> _waiting;
+	bool _stop = false;
+	std::thread _thread;
+};
+
+/// <summary>
+/// one level of a simulated standard delta debugging run
+/// </summary>
+struct SimulatedLevel
+{
+	TaskController* controller = nullptr;
+	SimulatedExecutor* executor = nullptr;
+	std::mutex lock;
+	int next = 0;
+	int candidates = 0;
+	std::atomic<int> tasks = 0;
+	std::atomic<int64_t> work = 0;
+	std::atomic<bool> finished = false;
+
+	/// <summary>
+	/// returns the next candidate to test, -1 if there is none
+	/// </summary>
+	int Next()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		return next < candidates ? next++ : -1;
+	}
+};
+
+namespace Functions
+{
+	/// <summary>
+	/// [callback pipeline] generates a candidate and hands it to the executor
+	/// </summary>
+	class CoroutinesGenerateCallback : public BaseFunction
+	{
+	public:
+		SimulatedLevel* level = nullptr;
+
+		void Run() override;
+
+		static uint64_t GetTypeStatic() { return 'CTGE'; }
+		uint64_t GetType() override { return 'CTGE'; }
+		FunctionType GetFunctionType() override { return FunctionType::Medium; };
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override
+		{
+			auto ptr = std::make_shared<CoroutinesGenerateCallback>();
+			ptr->level = level;
+			return dynamic_pointer_cast<BaseFunction>(ptr);
+		}
+
+		bool ReadData(std::istream*, size_t&, size_t, LoadResolver*) override { return true; }
+		bool ReadData(unsigned char*, size_t&, size_t, LoadResolver*) override { return true; }
+
+		static std::shared_ptr<BaseFunction> Create()
+		{
+			return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutinesGenerateCallback>());
+		}
+
+		void Dispose() override { level = nullptr; }
+
+		virtual const char* GetName() override { return "CoroutinesGenerateCallback"; }
+	};
+
+	/// <summary>
+	/// [callback pipeline] evaluates a finished test and pulls the next candidate
+	/// </summary>
+	class CoroutinesTestEndCallback : public BaseFunction
+	{
+	public:
+		SimulatedLevel* level = nullptr;
+
+		void Run() override;
+
+		static uint64_t GetTypeStatic() { return 'CTEN'; }
+		uint64_t GetType() override { return 'CTEN'; }
+		FunctionType GetFunctionType() override { return FunctionType::Light; };
+
+		virtual std::shared_ptr<BaseFunction> DeepCopy() override
+		{
+			auto ptr = std::make_shared<CoroutinesTestEndCallback>();
+			ptr->level = level;
+			return dynamic_pointer_cast<BaseFunction>(ptr);
+		}
+
+		bool ReadData(std::istream*, size_t&, size_t, LoadResolver*) override { return true; }
+		bool ReadData(unsigned char*, size_t&, size_t, LoadResolver*) override { return true; }
+
+		static std::shared_ptr<BaseFunction> Create()
+		{
+			return dynamic_pointer_cast<BaseFunction>(std::make_shared<CoroutinesTestEndCallback>());
+		}
+
+		void Dispose() override { level = nullptr; }
+
+		virtual const char* GetName() override { return "CoroutinesTestEndCallback"; }
+	};
+}
+
+void Functions::CoroutinesGenerateCallback::Run()
+{
+	level->work.fetch_add(DoWork());
+	auto callback = std::make_shared<CoroutinesTestEndCallback>();
+	callback->level = level;
+	level->executor->Add(callback);
+}
+
+void Functions::CoroutinesTestEndCallback::Run()
+{
+	level->work.fetch_add(DoWork());
+	if (level->Next() != -1) {
+		auto callback = std::make_shared<CoroutinesGenerateCallback>();
+		callback->level = level;
+		level->controller->AddTask(callback);
+	} else if (level->tasks.fetch_sub(1) == 1)
+		level->finished = true;
+}
+
+/// <summary>
+/// [coroutine pipeline] generates, tests and evaluates candidates until the level is exhausted
+/// </summary>
+Coroutines::Task LevelWorker(SimulatedLevel* level)
+{
+	while (level->Next() != -1) {
+		level->work.fetch_add(DoWork());
+		Coroutines::Completion completion;
+		level->executor->Add(completion.GetCallback());
+		co_await completion;
+		level->work.fetch_add(DoWork());
+		co_await Coroutines::Schedule(Functions::FunctionType::Medium);
+	}
+	if (level->tasks.fetch_sub(1) == 1)
+		level->finished = true;
+}
+
+/// <summary>
+/// runs [levels] simulated delta debugging levels with [candidates] tests each, at most [batch] at a time
+/// </summary>
+void DeltaBenchmark(std::shared_ptr<SessionData> sessiondata, int32_t threads, int levels, int candidates, int batch, bool coroutines)
+{
+	TaskController controller;
+	controller.SetDisableLua();
+	controller.Start(sessiondata, threads);
+	SimulatedExecutor executor(&controller, batch, std::chrono::microseconds(1000));
+	int64_t work = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (int l = 0; l < levels; l++) {
+		SimulatedLevel level;
+		level.controller = &controller;
+		level.executor = &executor;
+		level.candidates = candidates;
+		int workers = std::min(batch, candidates);
+		level.tasks = workers;
+		std::vector<Coroutines::Task> tasks;
+		for (int i = 0; i < workers; i++) {
+			if (coroutines) {
+				tasks.push_back(LevelWorker(&level));
+				tasks.back().Start(&controller, Functions::FunctionType::Medium);
+			} else {
+				level.Next();
+				auto callback = std::make_shared<Functions::CoroutinesGenerateCallback>();
+				callback->level = &level;
+				controller.AddTask(callback);
+			}
+		}
+		for (auto& task : tasks)
+			task.Wait();
+		while (!level.finished.load())
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		work += level.work.load();
+	}
+	auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	controller.Stop();
+	double utilization = (double)work / ((double)wall * controller.GetNumThreads());
+	std::cout << (coroutines ? "DD Coroutines" : "DD Callbacks ") << " | threads: " << controller.GetNumThreads() << " | levels: " << levels << " | tests per level: " << candidates
+			  << " | batch: " << batch << " | time: " << Logging::FormatTimeNS(wall) << " | tests/s: " << (uint64_t)((double)levels * candidates / ((double)wall / 1000000000))
+			  << " | worker utilization: " << (int)(utilization * 100) << "%\n";
+}
+
+int main(/*int argc, char** argv*/)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	std::shared_ptr<Session> session = Session::CreateSession();
+	std::shared_ptr<SessionData> sessiondata = session->data->CreateForm<SessionData>();
+	Functions::RegisterFactory(Functions::CoroutinesTestCallback::GetTypeStatic(), Functions::CoroutinesTestCallback::Create);
+	Functions::RegisterFactory(Functions::CoroutinesChainCallback::GetTypeStatic(), Functions::CoroutinesChainCallback::Create);
+
+	// awaiting workers, tasks, timers and completion events
+	{
+		TaskController controller;
+		controller.SetDisableLua();
+		controller.Start(sessiondata, 2);
+		std::atomic<int> value = 0;
+		std::vector<int> stages;
+		std::vector<uint64_t> checkpoints;
+		CheckpointEvents events;
+		auto task = TestCoroutine(&value, &stages, &events);
+		task.SetCheckpoint([&checkpoints, &events, &controller](uint64_t count) {
+			checkpoints.push_back(count);
+			if (auto during = std::exchange(events.during, nullptr); during)
+				during->GetCallback()->Run();
+			if (auto after = std::exchange(events.after, nullptr); after)
+				events.completer = std::thread([after, &controller]() {
+					while (!after->Awaited())
+						std::this_thread::yield();
+					controller.AddTask(after->GetCallback());
+				});
+		});
+		if (task.Finished() || stages.size() != 0)
+			return 1;
+		task.Start(&controller, Functions::FunctionType::Medium);
+		task.Wait();
+		if (events.completer.joinable())
+			events.completer.join();
+		controller.Stop();
+		if (!task.Finished())
+			return 1;
+		if (stages.size() != 7)
+			return 1;
+		for (int i = 0; i < 7; i++)
+			if (stages[i] != i)
+				return 1;
+		// Schedule, Schedule, AwaitTask, Sleep and the last Completion. The checkpoint of the completion
+		// that was completed during its checkpoint is repeated by the next suspension
+		if (task.GetSuspensions() != 5 || task.Suspended())
+			return 1;
+		if (checkpoints != std::vector<uint64_t>{ 1, 2, 3, 4, 5, 5 })
+			return 1;
+	}
+
+	// callbacks of coroutines restored from a savefile keep the owner that restarts their flow
+	{
+		Coroutines::RegisterFactories();
+		auto roundtrip = [](std::shared_ptr<Functions::BaseFunction> function) -> std::shared_ptr<Functions::BaseFunction> {
+			std::ostringstream out(std::ios_base::out | std::ios_base::binary);
+			size_t offset = 0;
+			function->WriteData(&out, offset);
+			if (offset != function->GetLength())
+				return {};
+			std::string data = out.str();
+			std::istringstream in(data, std::ios_base::in | std::ios_base::binary);
+			size_t read = 0;
+			auto restored = Functions::BaseFunction::Create(&in, read, data.size(), nullptr);
+			if (read != offset)
+				return {};
+			return restored;
+		};
+		auto resume = std::make_shared<Functions::CoroutineResumeCallback>();
+		resume->_owner = 0x42;
+		auto restoredresume = dynamic_pointer_cast<Functions::CoroutineResumeCallback>(roundtrip(resume));
+		if (!restoredresume || restoredresume->_owner != 0x42 || restoredresume->_handle)
+			return 1;
+		// there is no coroutine to resume, the owner restarts the flow
+		restoredresume->Run();
+
+		auto completion = std::make_shared<Functions::CoroutineCompletionCallback>();
+		completion->_owner = 0x43;
+		auto restoredcompletion = dynamic_pointer_cast<Functions::CoroutineCompletionCallback>(roundtrip(completion));
+		if (!restoredcompletion || restoredcompletion->_owner != 0x43)
+			return 1;
+		restoredcompletion->Run();
+
+		// functions awaited by a coroutine without owner are still executed, the coroutine is reported as lost
+		auto task = std::make_shared<Functions::CoroutineTaskCallback>();
+		task->_function = std::make_shared<Functions::CoroutinesTestCallback>();
+		auto restoredtask = dynamic_pointer_cast<Functions::CoroutineTaskCallback>(roundtrip(task));
+		if (!restoredtask || restoredtask->_owner != 0 || !restoredtask->_function || restoredtask->_function->GetType() != Functions::CoroutinesTestCallback::GetTypeStatic())
+			return 1;
+		restoredtask->Run();
+	}
+
+	// a coroutine that is never started is destroyed with its task object
+	{
+		std::atomic<int> value = 0;
+		std::vector<int> stages;
+		{
+			auto task = TestCoroutine(&value, &stages, nullptr);
+		}
+		if (stages.size() != 0)
+			return 1;
+	}
+
+	// worker utilization of callback chains versus coroutines
+	int32_t threads = std::max((int32_t)std::thread::hardware_concurrency(), 2);
+	for (int chains : { threads, threads * 8 }) {
+		Benchmark(sessiondata, threads, chains, 2000, false);
+		Benchmark(sessiondata, threads, chains, 2000, true);
+		// a standard delta debugging level: generate, test and evaluate every candidate
+		DeltaBenchmark(sessiondata, threads, 20, 200, threads * 2, false);
+		DeltaBenchmark(sessiondata, threads, 20, 200, threads * 2, true);
+	}
+	return 0;
+}
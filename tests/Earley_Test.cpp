@@ -0,0 +1,237 @@
+#include "Logging.h"
+#include "Grammar.h"
+#include "Input.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// unambiguous, right recursive grammar. Its language is (a | b a)* a, where a are the first two and b the last entry
+/// </summary>
+const char* rightGrammar = R"grammar(Grammar(
+	'start := 'list,
+	'list := 'SEQ_a | 'SEQ_a ~ 'list | 'SEQ_b ~ 'tail,
+	'tail := 'SEQ_a ~ 'list,
+	'SEQ_a := "[ 'A' ]" | "[ 'B' ]",
+	'SEQ_b := "[]",
+))grammar";
+
+/// <summary>
+/// ambiguous grammar with left and right recursion, derives every non-empty sequence of commands
+/// </summary>
+const char* ambiguousGrammar = R"grammar(Grammar(
+	'start := 'list,
+	'list := 'SEQ_cmd | 'SEQ_cmd ~ 'list | 'list ~ 'SEQ_cmd,
+	'SEQ_cmd := "[" ~ 'key ~ "]" | "[]",
+	'key := "'A'" | "'B'" | "'LEFT'" | "'RIGHT'",
+))grammar";
+
+/// <summary>
+/// returns whether [entries] are a word of the right recursive grammar
+/// </summary>
+bool RightAccepts(const std::vector<std::string>& entries)
+{
+	size_t i = 0;
+	while (i < entries.size()) {
+		if (entries[i] != "[]") {
+			if (++i == entries.size())
+				return true;
+		} else if (i + 2 < entries.size() && entries[i + 1] != "[]")
+			i += 2;
+		else
+			return false;
+	}
+	return false;
+}
+
+/// <summary>
+/// hashes the structure and content of [tree]
+/// </summary>
+uint64_t Fingerprint(std::shared_ptr<DerivationTree> tree)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	auto add = [&hash](uint64_t value) {
+		hash = (hash ^ value) * 0x100000001b3;
+	};
+	std::vector<std::pair<DerivationTree::NodeIndex, int32_t>> stack = { { tree->_root, 0 } };
+	while (!stack.empty()) {
+		auto [node, depth] = stack.back();
+		stack.pop_back();
+		auto& record = tree->GetNode(node);
+		add(depth);
+		add((uint64_t)record._type);
+		if (record.IsTerminal())
+			add(std::hash<std::string_view>()(DerivationTree::GetSymbol(record._symbol)));
+		else {
+			add(record._grammarID);
+			std::vector<DerivationTree::NodeIndex> children;
+			for (auto child = record._child; child != DerivationTree::NoNode; child = tree->GetNode(child)._sibling)
+				children.push_back(child);
+			for (auto itr = children.rbegin(); itr != children.rend(); itr++)
+				stack.push_back({ *itr, depth + 1 });
+		}
+	}
+	return hash;
+}
+
+/// <summary>
+/// returns the entries of [tree]
+/// </summary>
+std::vector<std::string> Entries(std::shared_ptr<DerivationTree> tree)
+{
+	DerivationTree::SequenceBuffer sequence;
+	tree->EmitSequence(sequence);
+	std::vector<std::string> entries;
+	for (size_t i = 0; i < sequence.Size(); i++)
+		entries.emplace_back(sequence.Get(i));
+	return entries;
+}
+
+std::shared_ptr<Grammar> LoadGrammar(std::string name, const char* text)
+{
+	{
+		std::ofstream file(name);
+		file << text;
+	}
+	auto grammar = std::make_shared<Grammar>();
+	grammar->ParseScala(name);
+	return grammar;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+
+	std::vector<std::shared_ptr<Grammar>> grammars = { LoadGrammar("grammar_right.scala", rightGrammar), LoadGrammar("grammar_ambiguous.scala", ambiguousGrammar) };
+	for (auto& grammar : grammars)
+		if (!grammar->IsValid() || grammar->IsSimple())
+			return 1;
+
+	// extracted trees contain exactly the selected entries, or are invalid if the grammar cannot derive them. Trees of
+	// the unambiguous grammar are unique, so they must match those of previous versions
+	{
+		std::vector<uint64_t> references = {
+			0x83a330b15ebbcc11,
+			0xc670cd5c5e181232,
+			0xd863892d90ffe884,
+			0x88b0f85a376b3ca5,
+			0x44c7854a5f51eab3,
+			0xaefc8d9cc4b7077b,
+			0xa0822763e05eb700,
+			0xa0822763e05eb700,
+			0xcbe404fa66ceeef3,
+			0x7509e0a606c1ab3,
+			0xab44da46a2b4bbf8,
+			0x7509e0a606c1ab3,
+			0xab44da46a2b4bbf8,
+			0x4b03259cdcaad0c2,
+			0xc01d29cb4b59228d,
+			0x86ed921286e063b,
+			0xea33e3643f3853a6,
+			0x697287f6148e1c19,
+			0x8ed155d5e956a213,
+			0x1189fca7f395c006,
+			0x8896c292f5058558,
+			0x7394d50b20bce2ef,
+			0xd47e2eb2f6fc7bac,
+			0xface8266b06004e0,
+			0xb6891abeba9ce621,
+			0xe8ef5a23a0682812,
+			0xeed257c352e2850d,
+			0x946a900807be41ee,
+			0xd8f4d2cef2ba124a,
+			0xe391ef7ae53a9465,
+			0xb4098799d5fe6b61,
+			0x1d0c9931e5ec2932,
+			0x2b181d8b63bf4360,
+			0xcac6075e45fda7f9,
+			0x944dcd41951d1a37,
+			0x139c66b25e94a1c,
+			0xd494a4d2ec0edffc,
+			0xbfdb279382f6e2b6,
+			0x94093398cc284ec6,
+			0xd176005371fe5372,
+			0x820e22f1d5bafba6,
+			0x98f1e06410009164,
+			0x9e9d20d9eb212e10,
+			0xe4290ad5c796166e,
+			0xff07dfb72742c6eb
+		};
+		bool print = argc > 1 && std::string(argv[1]) == "--print";
+		size_t index = 0;
+		for (size_t g = 0; g < grammars.size(); g++) {
+			for (int32_t length : { 1, 5, 20, 100 }) {
+				for (uint32_t seed : { 1u, 42u, 0xdeadbeefu }) {
+					auto source = std::make_shared<DerivationTree>();
+					grammars[g]->Derive(source, length, seed);
+					auto entries = Entries(source);
+					int64_t count = (int64_t)entries.size();
+					std::vector<std::tuple<int64_t, int64_t, bool>> segments = { { 0, count, false }, { 0, 1, true }, { count / 2, 1, true }, { count / 3, count / 2 + 1, false }, { 1, count / 3, true } };
+					for (auto [begin, size, complement] : segments) {
+						std::vector<std::string> expected;
+						for (int64_t i = 0; i < count; i++)
+							if ((i >= begin && i < begin + size) != complement)
+								expected.push_back(entries[i]);
+						bool accepts = g == 0 ? RightAccepts(expected) : expected.size() > 0;
+						std::vector<std::pair<int64_t, int64_t>> split = { { begin, size } };
+						auto extracted = std::make_shared<DerivationTree>();
+						grammars[g]->Extract(source, extracted, split, count, complement);
+						if (extracted->_valid != accepts) {
+							logcritical("Extraction of {} entries from {} is {}, expected {}", expected.size(), count, extracted->_valid, accepts);
+							return 1;
+						}
+						if (!accepts)
+							continue;
+						if (Entries(extracted) != expected || extracted->_sequenceNodes != (int64_t)expected.size())
+							return 1;
+						if (g == 0) {
+							uint64_t fingerprint = Fingerprint(extracted);
+							// the only derivation of all entries is the source tree
+							if (begin == 0 && size == count && !complement && fingerprint != Fingerprint(source))
+								return 1;
+							if (print)
+								std::cout << "\t\t\t0x" << Utility::GetHex(fingerprint) << ",\n";
+							else if (index >= references.size() || references[index] != fingerprint) {
+								logcritical("Extracted tree {} differs from previous versions", index);
+								return 1;
+							}
+							index++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// parse time of inputs of growing length. The chart of the ambiguous grammar grows quadratically with the input, so
+	// it is only measured for shorter inputs
+	{
+		int64_t max = argc > 1 && std::string(argv[1]) != "--print" ? std::stoll(argv[1]) : 100000;
+		const char* names[] = { "right recursive", "ambiguous" };
+		for (size_t g = 0; g < grammars.size(); g++) {
+			for (int64_t length = 100; length <= (g == 0 ? max : max / 100); length *= 10) {
+				auto source = std::make_shared<DerivationTree>();
+				grammars[g]->Derive(source, (int32_t)length, 7);
+				std::vector<std::pair<int64_t, int64_t>> split = { { 0, source->_sequenceNodes } };
+				auto extracted = std::make_shared<DerivationTree>();
+				auto begin = std::chrono::steady_clock::now();
+				grammars[g]->Extract(source, extracted, split, source->_sequenceNodes, false);
+				auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+				if (!extracted->_valid)
+					return 1;
+				std::cout << "Extract | " << names[g] << " | entries: " << source->_sequenceNodes << " | time: " << Logging::FormatTimeNS(ns)
+						  << " | entries/s: " << (double)source->_sequenceNodes * 1000000000 / std::max(ns, (int64_t)1) << "\n";
+			}
+		}
+	}
+	return 0;
+}
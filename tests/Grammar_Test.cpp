@@ -1,10 +1,129 @@
 #include "Logging.h"
 #include "Grammar.h"
+#include "Input.h"
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
 #include "ChrashHandlerINCL.h"
 #endif
 
-int main(/*int argc, char** argv*/)
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stack>
+
+/// <summary>
+/// grammar with sequence nodes that cannot be simplified into a regular expression
+/// </summary>
+const char* sequenceGrammar = R"grammar(Grammar(
+	'start := 'list,
+	'list := 'SEQ_cmd | 'SEQ_cmd ~ 'list | "<" ~ 'list ~ ">" ~ 'list | 'WGT_0.25 ~ 'list ~ 'SEQ_cmd,
+	'SEQ_cmd := "[" ~ 'key ~ 'keys ~ "]" | "[]",
+	'keys := "" | "," ~ 'key ~ 'keys | 'WGT_2.5 ~ "," ~ 'key,
+	'key := "'A'" | "'B'" | 'WGT_3 ~ "'LEFT'" | "'RIGHT'" | "[0-9]",
+))grammar";
+
+/// <summary>
+/// grammar that only produces long sequences by branching, which growing sequences doesn't follow
+/// </summary>
+const char* branchingGrammar = R"grammar(Grammar(
+	'start := 'tree,
+	'tree := 'WGT_2 ~ 'SEQ_leaf | 'WGT_1 ~ 'tree ~ 'tree | 'WGT_1 ~ "<" ~ 'tree ~ ">",
+	'SEQ_leaf := "a" | "b",
+))grammar";
+
+/// <summary>
+/// grammar with character class terminals and terminals that were mistaken for character classes by older versions
+/// </summary>
+const char* legacyClassGrammar = R"grammar(Grammar(
+	'start := 'entries,
+	'entries := 'SEQ_entry | 'entries ~ 'SEQ_entry,
+	'SEQ_entry := "[:ascii:]" | "[:alpha:]" ~ "[:alnum:]" | "[:digit:]" ~ "[:digit:]" | "key:value" | "x.y" | "plain",
+))grammar";
+
+/// <summary>
+/// returns the number of nonterminal and sequence nodes of [tree], each of which is one derivation step
+/// </summary>
+int64_t CountSteps(std::shared_ptr<DerivationTree> tree)
+{
+	int64_t steps = 0;
+	std::stack<DerivationTree::NodeIndex> stack;
+	stack.push(tree->_root);
+	while (!stack.empty()) {
+		auto& node = tree->GetNode(stack.top());
+		stack.pop();
+		if (node.IsTerminal())
+			continue;
+		steps++;
+		for (auto child = node._child; child != DerivationTree::NoNode; child = tree->GetNode(child)._sibling)
+			stack.push(child);
+	}
+	return steps;
+}
+
+/// <summary>
+/// hashes the structure and content of [tree]. Grammar ids of terminals depend on the order of construction, so
+/// they aren't part of the hash
+/// </summary>
+uint64_t Fingerprint(std::shared_ptr<DerivationTree> tree)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	auto add = [&hash](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash ^= ((const unsigned char*)data)[i];
+			hash *= 0x100000001b3;
+		}
+	};
+	std::stack<DerivationTree::NodeIndex> stack;
+	stack.push(tree->_root);
+	std::vector<DerivationTree::NodeIndex> children;
+	// nodes of the tree, which may be shared with other trees
+	int64_t nodes = 0;
+	while (!stack.empty()) {
+		auto& node = tree->GetNode(stack.top());
+		stack.pop();
+		nodes++;
+		int32_t type = (int32_t)node._type;
+		add(&type, sizeof(type));
+		if (node.IsTerminal()) {
+			auto content = DerivationTree::GetSymbol(node._symbol);
+			char end = 0;
+			add(content.data(), content.size());
+			add(&end, 1);
+		} else {
+			children.clear();
+			for (auto child = node._child; child != DerivationTree::NoNode; child = tree->GetNode(child)._sibling)
+				children.push_back(child);
+			size_t count = children.size();
+			add(&count, sizeof(size_t));
+			for (auto itr = children.rbegin(); itr != children.rend(); itr++)
+				stack.push(*itr);
+		}
+	}
+	add(&nodes, sizeof(int64_t));
+	add(&tree->_sequenceNodes, sizeof(int64_t));
+	return hash;
+}
+
+/// <summary>
+/// creates an input from the sequence nodes of [tree]
+/// </summary>
+std::shared_ptr<Input> CreateInput(std::shared_ptr<DerivationTree> tree)
+{
+	auto input = std::make_shared<Input>();
+	input->derive = tree;
+	std::vector<DerivationTree::NodeIndex> seqnodes;
+	tree->GatherSequenceNodes(tree->_root, seqnodes);
+	for (auto node : seqnodes) {
+		std::string entry;
+		tree->AppendContent(node, entry);
+		input->AddEntry(entry);
+	}
+	return input;
+}
+
+int main(int argc, char** argv)
 {
 	Logging::InitializeLog(".");
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
@@ -28,7 +147,7 @@ int main(/*int argc, char** argv*/)
 	result &= Utility::RemoveSymbols(Utility::RemoveSymbols(scala, '\n', true, '\"'), '\r', true, '\"').compare(Utility::RemoveSymbols(Utility::RemoveSymbols(compare, '\n', true, '\"'), '\r', true, '\"')) == 0;
 	grammar.reset();
 
-	
+
 	grammar = std::make_shared<Grammar>();
 	grammar->ParseScala("../../FormatExamples/grammar3.scala");
 	scala = grammar->Scala(false);
@@ -38,14 +157,635 @@ int main(/*int argc, char** argv*/)
 	grammar2->ParseScala("../../FormatExamples/grammar3_compare.scala");
 	std::string scala2 = grammar2->Scala(false);
 	logmessage("Full Grammar:\n{}", scala2);
-	
+
 	result &= Utility::RemoveSymbols(Utility::RemoveSymbols(scala, '\n', true, '\"'), '\r', true, '\"').compare(Utility::RemoveSymbols(Utility::RemoveSymbols(scala2, '\n', true, '\"'), '\r', true, '\"')) == 0;
 
 	grammar.reset();
 	grammar2.reset();
 
-	if (result)
-		return 0;
-	else
+	if (!result)
+		return 1;
+
+	{
+		std::ofstream file("grammar_sequence.scala");
+		file << sequenceGrammar;
+	}
+	std::vector<std::pair<std::string, std::shared_ptr<Grammar>>> grammars;
+	for (std::string name : { "../../FormatExamples/grammar3.scala", "grammar_sequence.scala" }) {
+		grammar = std::make_shared<Grammar>();
+		grammar->ParseScala(name);
+		if (!grammar->IsValid())
+			return 1;
+		grammars.push_back({ name, grammar });
+	}
+	if (grammars[0].second->IsSimple() == false || grammars[1].second->IsSimple())
 		return 1;
+
+	// inputs are regenerated from their seed, so derivations must be identical to those of previous versions
+	{
+		struct Reference
+		{
+			size_t grammar;
+			int32_t length;
+			uint32_t seed;
+			uint64_t derive;
+			uint64_t extend;
+			uint64_t backtrack;
+		};
+		std::vector<Reference> references = {
+			{ 0, 1, 1, 0x90a090bea924a9c, 0xb4d234afd9207e25, 0x0 },
+			{ 0, 1, 42, 0x90a090bea924a9c, 0xb3cc89b77c26a371, 0x0 },
+			{ 0, 1, 3735928559, 0x1f873f8ce018e738, 0x77622c91a9ee2663, 0x0 },
+			{ 0, 10, 1, 0x58f6ee1731643f61, 0x6ab4ea8d17aacb73, 0xe333b33f2a570d51 },
+			{ 0, 10, 42, 0xac4deaea0a6b1edd, 0x7db4d4d451f14a0d, 0x193aa7b13428a4be },
+			{ 0, 10, 3735928559, 0xbc4f02097593cf51, 0xb318ad826901fba1, 0x8eedc40ca7aa966e },
+			{ 0, 100, 1, 0x9b3c2e5b77cd1b0b, 0xebe0ea4f281bf71c, 0xc117f8037ac71e8e },
+			{ 0, 100, 42, 0xec8c63392cbbb61b, 0xe291a0d48de6184c, 0x76e04376bc614f1d },
+			{ 0, 100, 3735928559, 0x76b4bb33f4d5e18d, 0xbc08d3d9284055be, 0x4f035557ca986093 },
+			{ 1, 1, 1, 0x4a9c18b17210e3ad, 0xf057a523da6701b, 0x0 },
+			{ 1, 1, 42, 0x4a9c18b17210e3ad, 0x4413d49e6dc219a5, 0x0 },
+			{ 1, 1, 3735928559, 0x4a9c18b17210e3ad, 0x4413d49e6dc219a5, 0x0 },
+			{ 1, 10, 1, 0xb5fd90c283b006f0, 0xb363a9381645751d, 0x0 },
+			{ 1, 10, 42, 0x66aad6dd197c7bb6, 0xb56dd524fb5978ba, 0x0 },
+			{ 1, 10, 3735928559, 0xb973d7174ec57e4a, 0x45d48770994e4437, 0x0 },
+			{ 1, 100, 1, 0x6ac292bf4c464615, 0xd1ed59244891a143, 0x0 },
+			{ 1, 100, 42, 0xb6218f753c6037a8, 0x56a8c41663f509e, 0x0 },
+			{ 1, 100, 3735928559, 0x4fded55cfba8a08b, 0x401e782988f68400, 0x0 },
+		};
+		bool print = argc > 1 && std::string(argv[1]) == "--print";
+		size_t index = 0;
+		for (size_t g = 0; g < grammars.size(); g++) {
+			for (int32_t length : { 1, 10, 100 }) {
+				for (uint32_t seed : { 1u, 42u, 0xdeadbeefu }) {
+					auto& grammar = grammars[g].second;
+					grammar->SetGenerationParameters(0, 0, 0, 0);
+					auto tree = std::make_shared<DerivationTree>();
+					grammar->Derive(tree, length, seed);
+					uint64_t derive = Fingerprint(tree);
+					// the same seed yields the same tree
+					auto again = std::make_shared<DerivationTree>();
+					grammar->Derive(again, length, seed);
+					if (Fingerprint(again) != derive || tree->_valid == false)
+						return 1;
+
+					int32_t backtracked = 0;
+					auto input = CreateInput(tree);
+					auto extended = std::make_shared<DerivationTree>();
+					grammar->Extend(input, extended, false, length, seed + 1, backtracked);
+					uint64_t extend = Fingerprint(extended);
+					// backtracking in complex grammars goes through the earley parser, which doesn't use the compiled grammar
+					uint64_t back = 0;
+					if (grammar->IsSimple()) {
+						grammar->SetGenerationParameters(0, 0, 1, 3);
+						auto backtrack = std::make_shared<DerivationTree>();
+						grammar->Extend(input, backtrack, true, length, seed + 2, backtracked);
+						back = backtrack->_valid ? Fingerprint(backtrack) : 0;
+					}
+					if (print)
+						std::cout << "\t\t\t{ " << g << ", " << length << ", " << seed << ", 0x" << Utility::GetHex(derive) << ", 0x" << Utility::GetHex(extend) << ", 0x" << Utility::GetHex(back) << " },\n";
+					else if (index >= references.size() || references[index].derive != derive || references[index].extend != extend || references[index].backtrack != back) {
+						logcritical("Derivation {} of {} differs from previous versions", index, grammars[g].first);
+						return 1;
+					}
+					index++;
+				}
+			}
+		}
+	}
+
+	// length-aware derivations and extensions meet their target length, and are reproducible from their seed
+	{
+		struct Reference
+		{
+			size_t grammar;
+			int32_t length;
+			uint32_t seed;
+			uint64_t derive;
+			uint64_t extend;
+		};
+		std::vector<Reference> references = {
+			{ 0, 1, 1, 0x1f873f8ce018e738, 0x666c3aa75ebced9f },
+			{ 0, 1, 42, 0x1f873f8ce018e738, 0x666c3aa75ebced9f },
+			{ 0, 1, 3735928559, 0x1f873f8ce018e738, 0x666c3aa75ebced9f },
+			{ 0, 10, 1, 0x764e420119322ac7, 0x45af4f546e54d8d9 },
+			{ 0, 10, 42, 0x764e420119322ac7, 0x45af4f546e54d8d9 },
+			{ 0, 10, 3735928559, 0x764e420119322ac7, 0x45af4f546e54d8d9 },
+			{ 0, 1000, 1, 0x66ca4aa22cdfe800, 0x4a8033639524e320 },
+			{ 0, 1000, 42, 0x66ca4aa22cdfe800, 0x4a8033639524e320 },
+			{ 0, 1000, 3735928559, 0x66ca4aa22cdfe800, 0x4a8033639524e320 },
+			{ 1, 1, 1, 0xa4ec5d4cb869a8df, 0xf8ff3bf5908995bc },
+			{ 1, 1, 42, 0xa4ec5d4cb869a8df, 0xf8ff3bf5908995bc },
+			{ 1, 1, 3735928559, 0xa4ec5d4cb869a8df, 0xf8ff3bf5908995bc },
+			{ 1, 10, 1, 0x1e59f619ed6b062a, 0xeda849d4cd1c54cc },
+			{ 1, 10, 42, 0x140cd4cfb331bd62, 0xcf07938da5faaa77 },
+			{ 1, 10, 3735928559, 0x523c5c8bd2030195, 0x265a5572f53b69c6 },
+			{ 1, 1000, 1, 0xbb22d3cfeaec79e4, 0xb31ba7a48bc91f75 },
+			{ 1, 1000, 42, 0x7d15683b68cc3bae, 0x34fde38edc16cd2d },
+			{ 1, 1000, 3735928559, 0x905e47b5ab27ca1a, 0xa14d05294fe57987 },
+		};
+		bool print = argc > 1 && std::string(argv[1]) == "--print";
+		size_t index = 0;
+		for (size_t g = 0; g < grammars.size(); g++) {
+			for (int32_t length : { 1, 10, 1000 }) {
+				for (uint32_t seed : { 1u, 42u, 0xdeadbeefu }) {
+					auto& grammar = grammars[g].second;
+					grammar->SetGenerationParameters(0, 0, 0, 0);
+					auto tree = std::make_shared<DerivationTree>();
+					tree->SetStrategy(DerivationTree::Strategy::LengthAware);
+					grammar->Derive(tree, length, seed);
+					uint64_t derive = Fingerprint(tree);
+					auto again = std::make_shared<DerivationTree>();
+					again->SetStrategy(DerivationTree::Strategy::LengthAware);
+					grammar->Derive(again, length, seed);
+					if (Fingerprint(again) != derive || tree->_valid == false || tree->_sequenceNodes != length)
+						return 1;
+
+					int32_t backtracked = 0;
+					auto input = CreateInput(tree);
+					auto extended = std::make_shared<DerivationTree>();
+					extended->SetStrategy(DerivationTree::Strategy::LengthAware);
+					grammar->Extend(input, extended, false, length, seed + 1, backtracked);
+					uint64_t extend = Fingerprint(extended);
+					if (extended->_valid == false || extended->_sequenceNodes != tree->_sequenceNodes + length)
+						return 1;
+					if (print)
+						std::cout << "\t\t\t{ " << g << ", " << length << ", " << seed << ", 0x" << Utility::GetHex(derive) << ", 0x" << Utility::GetHex(extend) << " },\n";
+					else if (index >= references.size() || references[index].derive != derive || references[index].extend != extend) {
+						logcritical("Length-aware derivation {} of {} differs from previous versions", index, grammars[g].first);
+						return 1;
+					}
+					index++;
+				}
+			}
+		}
+	}
+
+	// copies share the nodes of their source and stay intact once it is freed, subtree copies are independent
+	{
+		auto tree = std::make_shared<DerivationTree>();
+		grammars[1].second->Derive(tree, 100, 5);
+		auto copy = std::make_shared<DerivationTree>();
+		tree->DeepCopy(copy);
+		uint64_t fingerprint = Fingerprint(tree);
+		int64_t sequences = 0;
+		auto subtree = std::make_shared<DerivationTree>();
+		subtree->_root = subtree->CopySubtree(*tree, tree->_root, sequences);
+		subtree->_sequenceNodes = sequences;
+		if (Fingerprint(copy) != fingerprint || Fingerprint(subtree) != fingerprint || sequences != tree->_sequenceNodes || CreateInput(tree)->ConvertToString() != CreateInput(subtree)->ConvertToString())
+			return 1;
+		if (copy->_nodes != 1 || subtree->_nodes != tree->_nodes)
+			return 1;
+		// the nodes are only released with the last tree holding them, which accounts for them
+		size_t treeSize = tree->MemorySize();
+		size_t copySize = copy->MemorySize();
+		if (treeSize >= subtree->MemorySize() || copySize >= subtree->MemorySize())
+			return 1;
+		tree->FreeMemory();
+		if (!tree->Freed() || tree->MemorySize() != sizeof(DerivationTree) + sizeof(DerivationTree::NodeBlock) || Fingerprint(copy) != fingerprint || copy->Freed())
+			return 1;
+		if (copy->MemorySize() <= copySize || copy->CompactNodes())
+			return 1;
+	}
+
+	// extracted and extended trees only create the nodes above the subtrees they share with their source, and keep
+	// their entries once it is freed
+	for (auto& [name, grammar] : grammars) {
+		grammar->SetGenerationParameters(0, 0, 0, 0);
+		auto tree = std::make_shared<DerivationTree>();
+		grammar->Derive(tree, 1000, 11);
+		auto input = CreateInput(tree);
+		int64_t count = tree->_sequenceNodes;
+		std::vector<std::pair<int64_t, int64_t>> split = { { count / 4, count / 4 } };
+		auto extracted = std::make_shared<DerivationTree>();
+		grammar->Extract(tree, extracted, split, count, true);
+		std::vector<std::pair<int64_t, int64_t>> piece = { { count / 2, count / 8 } };
+		auto part = std::make_shared<DerivationTree>();
+		grammar->Extract(tree, part, piece, count, false);
+		int32_t backtracked = 0;
+		auto extended = std::make_shared<DerivationTree>();
+		grammar->Extend(input, extended, false, 1100, 12, backtracked);
+		if (!extracted->_valid || !extended->_valid || extracted->_sequenceNodes != count - count / 4 || extended->_sequenceNodes < count)
+			return 1;
+		// full copies hold all nodes reachable from the root
+		int64_t reachable = 0;
+		auto full = std::make_shared<DerivationTree>();
+		full->CopySubtree(*extracted, extracted->_root, reachable);
+		if (extracted->_nodes >= full->_nodes || (grammar->IsSimple() && extracted->_nodes != extracted->_sequenceNodes + 1))
+			return 1;
+		full = std::make_shared<DerivationTree>();
+		full->CopySubtree(*extended, extended->_root, reachable);
+		if (extended->_nodes >= full->_nodes)
+			return 1;
+		std::string extractedString = CreateInput(extracted)->ConvertToString();
+		auto extendedInput = CreateInput(extended);
+		std::string extendedString = extendedInput->ConvertToString();
+		for (int64_t i = 0; i < count; i++)
+			if ((*extendedInput)[i] != (*input)[i])
+				return 1;
+		std::string partString = CreateInput(part)->ConvertToString();
+		auto partFull = std::make_shared<DerivationTree>();
+		partFull->CopySubtree(*part, part->_root, reachable);
+		if (!part->_valid || part->_sequenceNodes != count / 8 || part->CompactNodes())
+			return 1;
+		tree->FreeMemory();
+		if (CreateInput(extracted)->ConvertToString() != extractedString || CreateInput(extended)->ConvertToString() != extendedString)
+			return 1;
+		// once the source is freed, trees reaching only a small part of its nodes copy them into a block of their own,
+		// while the others keep sharing them
+		if (extracted->CompactNodes() || extended->CompactNodes() || !part->CompactNodes() || part->CompactNodes())
+			return 1;
+		if (part->_nodes != partFull->_nodes || CreateInput(part)->ConvertToString() != partString)
+			return 1;
+		// the compacted nodes are only held by the tree itself, which accounts for them
+		extracted->FreeMemory();
+		extended->FreeMemory();
+		if (part->MemorySize() < sizeof(DerivationTree::NodeRecord) * partFull->_nodes || CreateInput(part)->ConvertToString() != partString)
+			return 1;
+	}
+
+	// entries emitted in one walk after deriving, or while deriving from left to right, match those gathered from the
+	// sequence nodes, with and without keeping the tree
+	for (auto& [name, grammar] : grammars) {
+		for (int32_t length : { 1, 10, 100, 1000 }) {
+			for (auto [strategy, seed] : std::vector<std::pair<DerivationTree::Strategy, uint32_t>>{ { DerivationTree::Strategy::Growing, 3u }, { DerivationTree::Strategy::Growing, 42u },
+					 { DerivationTree::Strategy::Streaming, 3u }, { DerivationTree::Strategy::Streaming, 42u } }) {
+				auto tree = std::make_shared<DerivationTree>();
+				tree->SetStrategy(strategy);
+				DerivationTree::SequenceBuffer sequence;
+				grammar->Generate(tree, length, seed, sequence, true);
+				auto reference = CreateInput(tree);
+				if (tree->_valid == false || sequence.Size() != reference->GetSequenceLength() || (int64_t)sequence.Size() != tree->_sequenceNodes)
+					return 1;
+				for (size_t i = 0; i < sequence.Size(); i++)
+					if (sequence.Get(i) != (*reference)[i])
+						return 1;
+				auto input = std::make_shared<Input>();
+				input->AddEntries(sequence);
+				if (input->ConvertToString() != reference->ConvertToString())
+					return 1;
+				if (strategy == DerivationTree::Strategy::Streaming) {
+					DerivationTree::SequenceBuffer walked;
+					tree->EmitSequence(walked);
+					if (walked.data != sequence.data || walked.entries != sequence.entries || tree->_sequenceNodes != length)
+						return 1;
+				}
+
+				// without the tree only the parameters to regenerate it are kept
+				auto lean = std::make_shared<DerivationTree>();
+				lean->SetStrategy(strategy);
+				DerivationTree::SequenceBuffer leansequence;
+				grammar->Generate(lean, length, seed, leansequence, false);
+				if (lean->_valid || lean->_nodes != 0 || lean->GetRegenerate() == false || lean->GetSeed() != seed || lean->GetTargetLength() != length ||
+					lean->_sequenceNodes != tree->_sequenceNodes || leansequence.data != sequence.data || leansequence.entries != sequence.entries)
+					return 1;
+				grammar->Derive(lean, lean->GetTargetLength(), lean->GetSeed());
+				if (Fingerprint(lean) != Fingerprint(tree))
+					return 1;
+
+				// entries are appended behind existing ones and limited to the given count
+				auto partial = std::make_shared<Input>();
+				partial->AddEntry("first");
+				partial->AddEntries(sequence, 1);
+				if (partial->GetSequenceLength() != std::min(sequence.Size(), (size_t)1) + 1 || (*partial)[0] != "first" || (sequence.Size() > 0 && (*partial)[1] != sequence.Get(0)))
+					return 1;
+			}
+		}
+	}
+
+	// memory per node
+	for (auto& [name, grammar] : grammars) {
+		for (int32_t length : { 100, 10000 }) {
+			auto tree = std::make_shared<DerivationTree>();
+			grammar->Derive(tree, length, 7);
+			size_t bytes = tree->MemorySize() - sizeof(DerivationTree);
+			std::cout << "Memory | " << std::filesystem::path(name).filename().string() << " | length: " << length << " | nodes: " << tree->_nodes
+					  << " | bytes/node: " << (double)bytes / tree->_nodes << "\n";
+		}
+	}
+
+	// delta debugging children of a long input, each missing a part of it
+	for (auto& [name, grammar] : grammars) {
+		auto tree = std::make_shared<DerivationTree>();
+		grammar->Derive(tree, 1000, 7);
+		int64_t count = tree->_sequenceNodes;
+		int64_t children = 20;
+		size_t bytes = 0;
+		size_t parent = tree->MemorySize();
+		auto begin = std::chrono::steady_clock::now();
+		for (int64_t i = 0; i < children; i++) {
+			std::vector<std::pair<int64_t, int64_t>> split = { { count * i / children, count / children } };
+			auto child = std::make_shared<DerivationTree>();
+			grammar->Extract(tree, child, split, count, true);
+			if (!child->_valid)
+				return 1;
+			bytes += child->MemorySize();
+		}
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << "Children | " << std::filesystem::path(name).filename().string() << " | entries: " << count << " | children: " << children
+				  << " | time/child: " << Logging::FormatTimeNS(ns / children) << " | bytes/child: " << bytes / children << " | parent bytes: " << parent << "\n";
+	}
+
+	// derivation steps and distance to the target length of both strategies
+	{
+		{
+			std::ofstream file("grammar_branching.scala");
+			file << branchingGrammar;
+		}
+		auto branching = std::make_shared<Grammar>();
+		branching->ParseScala("grammar_branching.scala");
+		if (!branching->IsValid())
+			return 1;
+		std::vector<std::pair<std::string, std::shared_ptr<Grammar>>> benchmark = grammars;
+		benchmark.push_back({ "grammar_branching.scala", branching });
+		for (auto& [name, grammar] : benchmark) {
+			for (int32_t length : { 10, 100, 1000, 10000 }) {
+				for (auto strategy : { DerivationTree::Strategy::Growing, DerivationTree::Strategy::LengthAware, DerivationTree::Strategy::Streaming }) {
+					int64_t steps = 0;
+					int64_t error = 0;
+					int64_t seeds = 20;
+					auto begin = std::chrono::steady_clock::now();
+					for (int64_t seed = 0; seed < seeds; seed++) {
+						auto tree = std::make_shared<DerivationTree>();
+						tree->SetStrategy(strategy);
+						grammar->Derive(tree, length, (uint32_t)seed);
+						steps += CountSteps(tree);
+						error += std::abs(tree->_sequenceNodes - length);
+						if (strategy != DerivationTree::Strategy::Growing && tree->_sequenceNodes != length)
+							return 1;
+					}
+					auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+					const char* strategies[] = { "growing", "length-aware", "parallel", "streaming" };
+					std::cout << "Steps | " << std::filesystem::path(name).filename().string() << " | " << strategies[(uint32_t)strategy]
+							  << " | length: " << length << " | steps/entry: " << (double)steps / (double)(seeds * length) << " | mean error: " << (double)error / (double)seeds
+							  << " | time: " << Logging::FormatTimeNS(ns / seeds) << "\n";
+				}
+			}
+		}
+	}
+
+	// time taken to load a generated grammar with many rules that form one large cycle
+	{
+		int32_t rules = argc > 3 ? std::stoi(argv[3]) : 10000;
+		{
+			std::ofstream file("grammar_large.scala");
+			file << "Grammar(\n\t'start := 'r0,\n";
+			for (int32_t i = 0; i < rules - 1; i++)
+				file << "\t'r" << i << " := 'SEQ_" << i % 100 << " ~ 'r" << i + 1 << " | 'r" << (i * 7 + 3) % rules << " ~ \"x\" | 'SEQ_" << i % 100 << ",\n";
+			file << "\t'r" << rules - 1 << " := 'SEQ_0,\n";
+			for (int32_t i = 0; i < 100; i++)
+				file << "\t'SEQ_" << i << " := \"a\" | \"b\" ~ 'SEQ_" << i << ",\n";
+			file << ")\n";
+		}
+		auto begin = std::chrono::steady_clock::now();
+		auto large = std::make_shared<Grammar>();
+		large->ParseScala("grammar_large.scala");
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		if (!large->IsValid() || large->IsSimple())
+			return 1;
+		auto tree = std::make_shared<DerivationTree>();
+		tree->SetStrategy(DerivationTree::Strategy::LengthAware);
+		large->Derive(tree, 1000, 3);
+		if (tree->_sequenceNodes != 1000)
+			return 1;
+		std::cout << "Load | grammar_large.scala | rules: " << rules + 101 << " | time: " << Logging::FormatTimeNS(ns) << "\n";
+	}
+
+	// character class terminals produce the characters of their class, other terminals are produced as they are
+	{
+		std::vector<std::pair<std::string, std::string>> classes = {
+			{ "ascii", "" },
+			{ "alpha", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" },
+			{ "alnum", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789" },
+			{ "digit", "0123456789" },
+		};
+		for (char c = 0x1; c <= 0x7E; c++)
+			classes[0].second.push_back(c);
+		for (auto& [name, characters] : classes) {
+			{
+				std::ofstream file("grammar_class.scala");
+				file << "Grammar(\n\t'start := 'entries,\n\t'entries := 'SEQ_entry | 'entries ~ 'SEQ_entry,\n\t'SEQ_entry := \"[:"
+					 << name << ":]\" | \"[:" << name << ":]\" ~ \"[:" << name << ":]\" | \"a:b.c*\",\n)\n";
+			}
+			auto classGrammar = std::make_shared<Grammar>();
+			classGrammar->ParseScala("grammar_class.scala");
+			if (!classGrammar->IsValid())
+				return 1;
+			int32_t length = 10000;
+			auto tree = std::make_shared<DerivationTree>();
+			tree->SetStrategy(DerivationTree::Strategy::LengthAware);
+			auto begin = std::chrono::steady_clock::now();
+			classGrammar->Derive(tree, length, 7);
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			if (tree->_sequenceNodes != length)
+				return 1;
+			std::set<char> seen;
+			auto input = CreateInput(tree);
+			for (auto& entry : *input) {
+				if (entry == "a:b.c*")
+					continue;
+				if (entry.empty() || entry.size() > 2)
+					return 1;
+				for (char c : entry) {
+					if (characters.find(c) == std::string::npos)
+						return 1;
+					seen.insert(c);
+				}
+			}
+			if (seen.size() != characters.size())
+				return 1;
+			std::cout << "CharClass | " << name << " | length: " << length << " | time: " << Logging::FormatTimeNS(ns) << "\n";
+		}
+	}
+
+	// trees saved before the character classes were recorded regenerate the inputs they were derived with back then
+	{
+		{
+			std::ofstream file("grammar_legacy.scala");
+			file << legacyClassGrammar;
+		}
+		auto legacy = std::make_shared<Grammar>();
+		legacy->ParseScala("grammar_legacy.scala");
+		if (!legacy->IsValid())
+			return 1;
+		struct Reference
+		{
+			DerivationTree::Strategy strategy;
+			int32_t length;
+			uint32_t seed;
+			uint64_t derive;
+		};
+		std::vector<Reference> references = {
+			{ DerivationTree::Strategy::Growing, 1, 1, 0x517261f478c31d3d },
+			{ DerivationTree::Strategy::Growing, 1, 42, 0xad9ea328c555a25d },
+			{ DerivationTree::Strategy::Growing, 1, 3735928559, 0x5ba8c60782ebaa23 },
+			{ DerivationTree::Strategy::Growing, 10, 1, 0x5a302ad83c34080b },
+			{ DerivationTree::Strategy::Growing, 10, 42, 0xec917571c18e52fd },
+			{ DerivationTree::Strategy::Growing, 10, 3735928559, 0x4164f2761d794353 },
+			{ DerivationTree::Strategy::Growing, 100, 1, 0x103048feeca987a5 },
+			{ DerivationTree::Strategy::Growing, 100, 42, 0xc9220d1d31b40ea5 },
+			{ DerivationTree::Strategy::Growing, 100, 3735928559, 0xe37a0d22565a326f },
+			{ DerivationTree::Strategy::LengthAware, 1, 1, 0x6834ecdcc41f7db9 },
+			{ DerivationTree::Strategy::LengthAware, 1, 42, 0x383860bdae98aa34 },
+			{ DerivationTree::Strategy::LengthAware, 1, 3735928559, 0xe84e39c5f2b2fbe1 },
+			{ DerivationTree::Strategy::LengthAware, 10, 1, 0x4d7fa070bedcbf92 },
+			{ DerivationTree::Strategy::LengthAware, 10, 42, 0x38576d0a3baee463 },
+			{ DerivationTree::Strategy::LengthAware, 10, 3735928559, 0x5af005e08c8c033f },
+			{ DerivationTree::Strategy::LengthAware, 100, 1, 0x5191be5fc49681f },
+			{ DerivationTree::Strategy::LengthAware, 100, 42, 0x74c8cad80999cff6 },
+			{ DerivationTree::Strategy::LengthAware, 100, 3735928559, 0xe352119b5cd66018 },
+		};
+		bool print = argc > 1 && std::string(argv[1]) == "--print";
+		size_t index = 0;
+		for (auto strategy : { DerivationTree::Strategy::Growing, DerivationTree::Strategy::LengthAware }) {
+			for (int32_t length : { 1, 10, 100 }) {
+				for (uint32_t seed : { 1u, 42u, 0xdeadbeefu }) {
+					auto tree = std::make_shared<DerivationTree>();
+					tree->SetStrategy(strategy);
+					tree->SetSeed(seed);
+					tree->SetTargetLength(length);
+					// write the tree as version 0x3, which ended with the strategy
+					std::ostringstream out(std::ios_base::out | std::ios_base::binary);
+					size_t offset = 0;
+					tree->WriteData(&out, offset, tree->GetDynamicSize());
+					std::string saved = std::move(out).str();
+					std::string data = saved;
+					int32_t version = 0x3;
+					std::memcpy(data.data(), &version, sizeof(int32_t));
+					data.resize(data.size() - sizeof(uint32_t));
+					std::istringstream in(data, std::ios_base::in | std::ios_base::binary);
+					offset = 0;
+					auto loaded = std::make_shared<DerivationTree>();
+					if (!loaded->ReadData(&in, offset, data.size(), nullptr) || loaded->GetCharacterClasses() != DerivationTree::CharacterClasses::Legacy || loaded->GetStrategy() != strategy)
+						return 1;
+					// trees of the current version keep producing character classes from their tables
+					std::istringstream current(saved, std::ios_base::in | std::ios_base::binary);
+					offset = 0;
+					auto reloaded = std::make_shared<DerivationTree>();
+					if (!reloaded->ReadData(&current, offset, saved.size(), nullptr) || reloaded->GetCharacterClasses() != DerivationTree::CharacterClasses::Tables)
+						return 1;
+					legacy->Derive(loaded, loaded->GetTargetLength(), loaded->GetSeed());
+					uint64_t derive = Fingerprint(loaded);
+					if (print)
+						std::cout << "\t\t\t{ DerivationTree::Strategy::" << (strategy == DerivationTree::Strategy::Growing ? "Growing" : "LengthAware") << ", " << length << ", " << seed << ", 0x" << Utility::GetHex(derive) << " },\n";
+					else if (index >= references.size() || references[index].strategy != strategy || references[index].derive != derive) {
+						logcritical("Derivation {} of an old tree differs from previous versions", index);
+						return 1;
+					}
+					index++;
+				}
+			}
+		}
+	}
+
+	// parallel derivations produce the same trees with and without workers, and meet their target length like
+	// length-aware derivations
+	{
+		auto branching = std::make_shared<Grammar>();
+		branching->ParseScala("grammar_branching.scala");
+		if (!branching->IsValid())
+			return 1;
+		std::vector<std::pair<std::string, std::shared_ptr<Grammar>>> parallel = grammars;
+		parallel.push_back({ "grammar_branching.scala", branching });
+		int32_t workers = 4;
+		auto controller = std::make_shared<TaskController>();
+		controller->SetDisableLua();
+		controller->Start(nullptr, workers);
+		for (auto& [name, grammar] : parallel) {
+			for (int32_t length : { 10, 100000, argc > 4 ? std::stoi(argv[4]) : 1000000 }) {
+				int64_t ns[2] = { 0, 0 };
+				for (uint32_t seed : { 1u, 42u }) {
+					std::shared_ptr<DerivationTree> trees[2];
+					for (int32_t mode = 0; mode < 2; mode++) {
+						grammar->SetTaskController(mode == 0 ? nullptr : controller);
+						trees[mode] = std::make_shared<DerivationTree>();
+						trees[mode]->SetStrategy(DerivationTree::Strategy::Parallel);
+						auto begin = std::chrono::steady_clock::now();
+						grammar->Derive(trees[mode], length, seed);
+						ns[mode] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+					}
+					if (Fingerprint(trees[0]) != Fingerprint(trees[1]) || trees[1]->_valid == false || trees[1]->_sequenceNodes != length)
+						return 1;
+					// the input is regenerated the same way without keeping the tree
+					DerivationTree::SequenceBuffer sequence;
+					auto regenerated = std::make_shared<DerivationTree>();
+					regenerated->SetStrategy(DerivationTree::Strategy::Parallel);
+					grammar->Generate(regenerated, length, seed, sequence, false);
+					auto input = std::make_shared<Input>();
+					input->AddEntries(sequence);
+					if (input->ConvertToString() != CreateInput(trees[1])->ConvertToString())
+						return 1;
+				}
+				if (length > 10)
+					std::cout << "Parallel | " << std::filesystem::path(name).filename().string() << " | length: " << length << " | one thread: " << Logging::FormatTimeNS(ns[0] / 2)
+							  << " | " << workers << " workers: " << Logging::FormatTimeNS(ns[1] / 2) << "\n";
+			}
+			grammar->SetTaskController(nullptr);
+		}
+		controller->Stop();
+	}
+
+	// derivations per second
+	{
+		int32_t length = argc > 2 ? std::stoi(argv[2]) : 100;
+		for (auto& [name, grammar] : grammars) {
+			size_t count = 0;
+			int64_t nodes = 0;
+			auto begin = std::chrono::steady_clock::now();
+			auto ns = (int64_t)0;
+			while (ns < 1000000000) {
+				auto tree = std::make_shared<DerivationTree>();
+				grammar->Derive(tree, length, (uint32_t)count);
+				nodes += tree->_nodes;
+				count++;
+				ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			}
+			std::cout << "Derive | " << std::filesystem::path(name).filename().string() << " | length: " << length << " | derivations/s: " << (double)count * 1000000000 / ns
+					  << " | nodes/s: " << (double)nodes * 1000000000 / ns << "\n";
+		}
+	}
+
+	// inputs per second, deriving the tree and walking it for each sequence node compared to emitting all entries in
+	// a single walk, with and without keeping the tree, and to writing them while deriving from left to right
+	{
+		int32_t length = argc > 2 ? std::stoi(argv[2]) : 1000;
+		for (auto& [name, grammar] : grammars) {
+			for (int32_t mode = 0; mode < 7; mode++) {
+				size_t count = 0;
+				size_t entries = 0;
+				DerivationTree::SequenceBuffer sequence;
+				auto begin = std::chrono::steady_clock::now();
+				auto ns = (int64_t)0;
+				while (ns < 1000000000) {
+					auto input = std::make_shared<Input>();
+					input->derive = std::make_shared<DerivationTree>();
+					input->derive->SetStrategy(mode < 3 ? DerivationTree::Strategy::Growing : mode < 5 ? DerivationTree::Strategy::LengthAware : DerivationTree::Strategy::Streaming);
+					if (mode == 0) {
+						grammar->Derive(input->derive, length, (uint32_t)count);
+						std::vector<DerivationTree::NodeIndex> seqnodes;
+						seqnodes.reserve(input->derive->_sequenceNodes);
+						input->ReserveSequence(input->derive->_sequenceNodes);
+						input->derive->GatherSequenceNodes(input->derive->_root, seqnodes);
+						std::string entry;
+						for (auto node : seqnodes) {
+							entry.clear();
+							input->derive->AppendContent(node, entry);
+							input->AddEntry(entry);
+						}
+					} else {
+						sequence.Clear();
+						grammar->Generate(input->derive, length, (uint32_t)count, sequence, mode % 2 == 1);
+						input->AddEntries(sequence);
+					}
+					entries += input->GetSequenceLength();
+					count++;
+					ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+				}
+				const char* modes[] = { "tree walk", "emit, tree", "emit, no tree", "length-aware, emit, tree", "length-aware, emit, no tree", "streaming, tree",
+					"streaming, no tree" };
+				std::cout << "Generate | " << std::filesystem::path(name).filename().string() << " | " << modes[mode] << " | length: " << length
+						  << " | inputs/s: " << (double)count * 1000000000 / ns << " | entries/s: " << (double)entries * 1000000000 / ns << "\n";
+			}
+		}
+	}
+	return 0;
 }
@@ -0,0 +1,220 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "Data.h"
+#include "Input.h"
+#include "Journal.h"
+#include "Session.h"
+#include "Settings.h"
+#include "SyntheticSession.h"
+
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+
+void SetupJournal(std::shared_ptr<Session> session, std::filesystem::path path, std::string name, int32_t compactSegments)
+{
+	auto settings = session->data->CreateForm<Settings>();
+	settings->saves.compressionLevel = 1;
+	settings->saves.journal = true;
+	settings->saves.journalCompactSegments = compactSegments;
+	session->data->_saveBlockRecords = 1000;
+	session->data->SetSaveName(name);
+	session->data->SetSavePath(path);
+}
+
+/// <summary>
+/// changes the parent of every [step]-th input, deletes every [step]-th input starting at [step / 2] and adds [add] new ones
+/// </summary>
+void Churn(std::shared_ptr<Session> session, std::vector<FormID>& ids, std::unordered_map<FormID, FormID>& parents, std::unordered_set<FormID>& deleted, size_t step, size_t add, size_t round)
+{
+	for (size_t i = 0; i < ids.size(); i += step) {
+		auto input = session->data->LookupFormID<Input>(ids[i]);
+		if (!input)
+			continue;
+		input->SetParentSplitInformation(1000000 * round + i, { { 0, 1 } }, false);
+		parents[ids[i]] = 1000000 * round + i;
+	}
+	for (size_t i = step / 2; i < ids.size(); i += step) {
+		if (deleted.contains(ids[i]))
+			continue;
+		session->data->DeleteForm(session->data->LookupFormID<Input>(ids[i]));
+		deleted.insert(ids[i]);
+	}
+	for (size_t i = 0; i < add; i++) {
+		auto input = session->data->CreateForm<Input>();
+		input->SetParentSplitInformation(2000000 * round + i, { { 0, 1 } }, true);
+		ids.push_back(input->GetFormID());
+		parents[input->GetFormID()] = 2000000 * round + i;
+	}
+}
+
+bool Verify(Data* data, std::vector<FormID>& ids, std::unordered_map<FormID, FormID>& parents, std::unordered_set<FormID>& deleted)
+{
+	if (data->_loaded == false)
+		return false;
+	for (size_t i = 0; i < ids.size(); i++) {
+		auto input = data->LookupFormID<Input>(ids[i]);
+		if (deleted.contains(ids[i])) {
+			if (input)
+				return false;
+			continue;
+		}
+		if (!input)
+			return false;
+		auto itr = parents.find(ids[i]);
+		if (itr != parents.end() ? input->GetParentID() != itr->second : input->GetParentID() != i)
+			return false;
+	}
+	return data->GetFormArray<Input>().size() == ids.size() - deleted.size();
+}
+
+size_t CountSaves(std::filesystem::path path)
+{
+	size_t count = 0;
+	for (auto& entry : std::filesystem::directory_iterator(path))
+		if (entry.path().extension() == ".tfsave")
+			count++;
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "Journal_Test";
+	std::filesystem::remove_all(path);
+
+	// saves after the first full save only append the changes to the journal, which is replayed on load
+	{
+		std::vector<FormID> ids;
+		std::unordered_map<FormID, FormID> parents;
+		std::unordered_set<FormID> deleted;
+		auto session = CreateSyntheticSession(5000, ids);
+		SetupJournal(session, path, "journal", 0);
+		session->data->Save({});
+		FormID string1 = session->data->GetIDFromString("journal string 1");
+		Churn(session, ids, parents, deleted, 50, 20, 1);
+		session->data->Save({});
+		FormID string2 = session->data->GetIDFromString("journal string 2");
+		Churn(session, ids, parents, deleted, 70, 20, 2);
+		session->data->Save({});
+		if (CountSaves(path) != 1)
+			return 1;
+		auto journal = Journal::GetPath(path / "journal_1.tfsave");
+		if (!std::filesystem::exists(journal) || std::filesystem::file_size(journal) * 10 > std::filesystem::file_size(path / "journal_1.tfsave"))
+			return 1;
+
+		// a segment torn by a crash is discarded
+		uintmax_t size = std::filesystem::file_size(journal);
+		{
+			std::ofstream file(journal, std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+			file.write("torn segment", 12);
+		}
+
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		data->Load("journal", args);
+		if (!Verify(data, ids, parents, deleted))
+			return 1;
+		if (data->GetStringFromID(string1).first != "journal string 1" || data->GetStringFromID(string2).first != "journal string 2")
+			return 1;
+		// strings interned after loading don't reuse the ids of loaded ones
+		if (data->GetIDFromString("journal string 3") <= std::max(string1, string2))
+			return 1;
+		if (std::filesystem::file_size(journal) != size)
+			return 1;
+		std::filesystem::remove_all(path);
+	}
+
+	// changes that could not be appended to the journal are written with the next segment
+	{
+		std::vector<FormID> ids;
+		std::unordered_map<FormID, FormID> parents;
+		std::unordered_set<FormID> deleted;
+		auto session = CreateSyntheticSession(2000, ids);
+		SetupJournal(session, path, "failed", 0);
+		session->data->Save({});
+		FormID string1 = session->data->GetIDFromString("failed string 1");
+		Churn(session, ids, parents, deleted, 30, 20, 1);
+		// the journal cannot be opened while a directory takes its place
+		auto journal = Journal::GetPath(path / "failed_1.tfsave");
+		std::filesystem::create_directories(journal);
+		session->data->Save({});
+		if (session->data->LookupFormID<Input>(ids[0])->HasChanged() == false)
+			return 1;
+		std::filesystem::remove_all(journal);
+		session->data->Save({});
+		if (session->data->LookupFormID<Input>(ids[0])->HasChanged())
+			return 1;
+
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		data->Load("failed", args);
+		if (!Verify(data, ids, parents, deleted))
+			return 1;
+		if (data->GetStringFromID(string1).first != "failed string 1")
+			return 1;
+		std::filesystem::remove_all(path);
+	}
+
+	// the journal is merged into a new full save in the background, once it holds enough segments
+	{
+		std::vector<FormID> ids;
+		std::unordered_map<FormID, FormID> parents;
+		std::unordered_set<FormID> deleted;
+		auto session = CreateSyntheticSession(5000, ids);
+		SetupJournal(session, path, "compact", 2);
+		session->data->Save({});
+		for (size_t round = 1; round <= 2; round++) {
+			Churn(session, ids, parents, deleted, 40 + round, 30, round);
+			session->data->Save({});
+		}
+		session->data->WaitForCompaction();
+		if (!std::filesystem::exists(path / "compact_2.tfsave") || std::filesystem::exists(Journal::GetPath(path / "compact_1.tfsave")))
+			return 1;
+		// changes after the compaction go to the journal of the new savefile
+		Churn(session, ids, parents, deleted, 33, 30, 3);
+		session->data->Save({});
+		session->data->WaitForCompaction();
+		if (!std::filesystem::exists(Journal::GetPath(path / "compact_2.tfsave")))
+			return 1;
+
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		data->Load("compact", args);
+		if (!Verify(data, ids, parents, deleted))
+			return 1;
+		std::filesystem::remove_all(path);
+	}
+
+	// time and size of a full save compared to a journal save, with 1% of the inputs changed
+	{
+		size_t count = argc > 1 ? std::stoull(argv[1]) : 50000;
+		std::vector<FormID> ids;
+		std::unordered_map<FormID, FormID> parents;
+		std::unordered_set<FormID> deleted;
+		auto session = CreateSyntheticSession(count, ids);
+		SetupJournal(session, path, "bench", 0);
+		auto begin = std::chrono::steady_clock::now();
+		session->data->Save({});
+		auto full = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		Churn(session, ids, parents, deleted, 100, 0, 1);
+		begin = std::chrono::steady_clock::now();
+		session->data->Save({});
+		auto journal = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << "Inputs: " << count << "\n";
+		std::cout << "Full save    | time: " << Logging::FormatTimeNS(full) << " | size: " << std::filesystem::file_size(path / "bench_1.tfsave") << "\n";
+		std::cout << "Journal save | time: " << Logging::FormatTimeNS(journal) << " | size: " << std::filesystem::file_size(Journal::GetPath(path / "bench_1.tfsave")) << "\n";
+		std::filesystem::remove_all(path);
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "Data.h"
+#include "Input.h"
+#include "RegenerationCache.h"
+#include "Session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/// <summary>
+/// creates an input of [length] entries, which is freed if [freed] is set
+/// </summary>
+std::shared_ptr<Input> CreateInput(std::shared_ptr<Session> session, int64_t length, bool freed)
+{
+	auto input = session->data->CreateForm<Input>();
+	input->derive = session->data->CreateForm<DerivationTree>();
+	input->derive->_sequenceNodes = length;
+	input->derive->SetRegenerate(true);
+	if (!freed) {
+		for (int64_t i = 0; i < length; i++)
+			input->AddEntry("entry" + std::to_string(i % 17));
+		input->derive->_valid = true;
+		input->SetGenerated();
+	}
+	return input;
+}
+
+std::shared_ptr<Input> Extend(std::shared_ptr<Session> session, std::shared_ptr<Input> parent, int64_t length, bool freed)
+{
+	auto input = CreateInput(session, length, freed);
+	input->SetFlag(Input::Flags::GeneratedGrammarParent);
+	input->SetParentGenerationInformation(parent->GetFormID());
+	return input;
+}
+
+std::shared_ptr<Input> DeltaDebug(std::shared_ptr<Session> session, std::shared_ptr<Input> parent, int64_t length, bool freed)
+{
+	auto input = CreateInput(session, length, freed);
+	input->SetFlag(Input::Flags::GeneratedDeltaDebugging);
+	input->SetParentSplitInformation(parent->GetFormID(), { { 0, length } }, false);
+	return input;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+
+	std::shared_ptr<Session> session = Session::CreateSession();
+	session->data->CreateForm<SessionData>();
+	Data* data = session->data;
+
+	// regeneration follows the parents until one that hasn't been freed
+	auto root = CreateInput(session, 1000, false);
+	auto freedExtension = Extend(session, root, 1100, true);
+	auto extension = Extend(session, freedExtension, 1200, false);
+	auto child = DeltaDebug(session, extension, 600, false);
+	auto leaf = CreateInput(session, 10, false);
+	{
+		auto cost = RegenerationCache::Estimate(data, root, true);
+		if (cost.cost != 1000 || cost.depth != 1)
+			return 1;
+		cost = RegenerationCache::Estimate(data, extension, true);
+		if (cost.cost != 2300 || cost.depth != 2)
+			return 1;
+		// extraction goes over the whole parent, which is more expensive with the earley parser
+		cost = RegenerationCache::Estimate(data, child, true);
+		if (cost.cost != 1800 || cost.depth != 1)
+			return 1;
+		cost = RegenerationCache::Estimate(data, child, false);
+		if (cost.cost != 600 + 1200 * RegenerationCache::ParseWeight || cost.depth != 1)
+			return 1;
+		// once the parent is freed as well, it has to be regenerated first
+		auto freedChild = DeltaDebug(session, freedExtension, 500, true);
+		auto grandchild = Extend(session, freedChild, 700, false);
+		cost = RegenerationCache::Estimate(data, grandchild, true);
+		if (cost.cost != 700 + 500 + 1100 + 1100 || cost.depth != 3)
+			return 1;
+		// chains that cannot be resolved end at the last input found
+		auto orphan = Extend(session, root, 100, false);
+		orphan->SetParentGenerationInformation(0xFFFFFFF);
+		cost = RegenerationCache::Estimate(data, orphan, true);
+		if (cost.cost != 100 || cost.depth != 1)
+			return 1;
+	}
+
+	// inputs used as parents are cached as long as they fit, the others are freed cheapest per byte first
+	root->IncDerivedInputs();
+	extension->IncRegenerationUses();
+	extension->IncRegenerationUses();
+	{
+		auto costPerByte = [data](std::shared_ptr<Input> input) {
+			return (double)RegenerationCache::Estimate(data, input, true).cost / (double)RegenerationCache::GetMemorySize(input);
+		};
+		auto ordered = [&costPerByte](std::vector<std::shared_ptr<Input>>& inputs, size_t count) {
+			for (size_t i = 1; i < count; i++)
+				if (costPerByte(inputs[i - 1]) > costPerByte(inputs[i]))
+					return false;
+			return true;
+		};
+		auto contains = [](std::vector<std::shared_ptr<Input>>& inputs, size_t begin, std::shared_ptr<Input> input) {
+			return std::find(inputs.begin() + begin, inputs.end(), input) != inputs.end();
+		};
+		uint64_t cacheSize = RegenerationCache::GetMemorySize(root) + RegenerationCache::GetMemorySize(extension);
+
+		std::vector<std::shared_ptr<Input>> inputs = { root, extension, child, leaf };
+		size_t count = RegenerationCache::Order(data, inputs, true, cacheSize);
+		if (count != 2 || !contains(inputs, count, root) || !contains(inputs, count, extension) || !ordered(inputs, count))
+			return 1;
+
+		inputs = { root, extension, child, leaf };
+		count = RegenerationCache::Order(data, inputs, true, RegenerationCache::GetMemorySize(root));
+		if (count != 3 || inputs[3] != root || !ordered(inputs, count))
+			return 1;
+
+		inputs = { root, extension, child, leaf };
+		count = RegenerationCache::Order(data, inputs, true, 0);
+		if (count != 4 || !ordered(inputs, count))
+			return 1;
+	}
+
+	// time taken to order many inputs in long chains, half of which are freed
+	{
+		int64_t total = argc > 1 ? std::stoll(argv[1]) : 10000;
+		std::vector<std::shared_ptr<Input>> inputs;
+		std::shared_ptr<Input> parent = CreateInput(session, 100, false);
+		inputs.push_back(parent);
+		for (int64_t i = 1; i < total; i++) {
+			bool freed = i % 2 == 1;
+			// start a new chain every 100 inputs
+			if (i % 100 == 0)
+				parent = inputs[(size_t)(i / 100)];
+			auto input = i % 3 == 0 ? DeltaDebug(session, parent, 50, freed) : Extend(session, parent, 100 + i % 100, freed);
+			parent->IncDerivedInputs();
+			if (!freed)
+				inputs.push_back(input);
+			parent = input;
+		}
+		auto begin = std::chrono::steady_clock::now();
+		size_t count = RegenerationCache::Order(data, inputs, true, 1048576);
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		if (count > inputs.size())
+			return 1;
+		std::cout << "Order | inputs: " << inputs.size() << " | freed ancestors: " << total - (int64_t)inputs.size() << " | to free: " << count << " | cached: " << inputs.size() - count << " | time: " << Logging::FormatTimeNS(ns) << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,333 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "Data.h"
+#include "Input.h"
+#include "Session.h"
+#include "Settings.h"
+#include "SyntheticSession.h"
+#include "Test.h"
+#include "BufferOperations.h"
+#include "Codecs.h"
+#include "MappedFile.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/// <summary>
+/// returns the number of blocks in the index at the end of the savefile at [path]
+/// </summary>
+size_t ReadBlockCount(std::filesystem::path path)
+{
+	std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	size_t offset = 0;
+	file.seekg(-8, std::ios_base::end);
+	uint64_t indexpos = Buffer::ReadUInt64(&file, offset);
+	file.seekg(indexpos);
+	return Buffer::ReadSize(&file, offset);
+}
+
+int64_t Benchmark(std::shared_ptr<Session> session, std::filesystem::path path, Codecs::CodecType codec, int32_t compression, size_t threads, bool load)
+{
+	auto settings = session->data->CreateForm<Settings>();
+	settings->saves.compressionLevel = compression;
+	settings->saves.compressionCodec = (int32_t)codec;
+	settings->saves.incrementalSaveFiles = false;
+	session->data->_saveThreads = threads;
+	auto begin = std::chrono::steady_clock::now();
+	session->data->Save({});
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	uintmax_t size = 0;
+	for (auto& entry : std::filesystem::directory_iterator(path))
+		size = std::max(size, entry.file_size());
+	std::cout << "Save | codec: " << (compression == -1 ? "None" : Codecs::ToString(codec)) << " | level: " << compression << " | threads: " << threads
+			  << " | time: " << Logging::FormatTimeNS(ns) << " | size: " << size << "\n";
+	if (load) {
+		// loaded sessions cannot be freed, so loading is only measured once per codec
+		for (bool map : { true, false }) {
+			Data* data = new Data();
+			data->SetSavePath(path);
+			Data::LoadSaveArgs args;
+			args.mapFile = map;
+			begin = std::chrono::steady_clock::now();
+			data->Load("bench", args);
+			std::cout << "Load | codec: " << (compression == -1 ? "None" : Codecs::ToString(codec)) << " | level: " << compression << " | " << (map ? "mapped" : "stream")
+					  << " | time: " << Logging::FormatTimeNS(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()) << "\n";
+			for (auto& [name, time] : data->_loadTimes)
+				std::cout << "     | " << name << ": " << Logging::FormatTimeNS(time.count()) << "\n";
+		}
+	}
+	std::filesystem::remove_all(path);
+	return ns;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "SaveBlocks_Test";
+	std::filesystem::remove_all(path);
+
+	// records split across many blocks are restored in full, with every codec
+	for (auto codec : { Codecs::CodecType::LZMA, Codecs::CodecType::Zstd, Codecs::CodecType::ZstdDictionary }) {
+		std::vector<FormID> ids;
+		auto session = CreateSyntheticSession(20000, ids, SyntheticSaveSettings());
+		auto settings = session->data->CreateForm<Settings>();
+		settings->saves.compressionCodec = (int32_t)codec;
+		session->data->_saveThreads = 4;
+		session->data->SetSaveName("blocks");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+		// string hashmap, 20 blocks of inputs, plus the static forms
+		if (ReadBlockCount(path / "blocks_1.tfsave") < 21)
+			return 1;
+
+		// through the memory mapping with blocks decoded in parallel, and through regular file reads
+		for (bool map : { true, false }) {
+			Data* data = new Data();
+			data->SetSavePath(path);
+			data->_loadThreads = 4;
+			Data::LoadSaveArgs args;
+			args.mapFile = map;
+			data->Load("blocks", args);
+			if (data->_loaded == false)
+				return 1;
+			for (size_t i = 0; i < ids.size(); i++) {
+				auto input = data->LookupFormID<Input>(ids[i]);
+				if (!input || input->GetParentID() != i || input->GetParentSplits().size() != 1 || input->GetParentSplits()[0].second != (int64_t)i + 8)
+					return 1;
+			}
+		}
+		std::filesystem::remove_all(path);
+	}
+
+	// saves that compress after thawing serialize all records before the session continues, and write them afterwards
+	{
+		std::vector<FormID> ids;
+		auto session = CreateSyntheticSession(5000, ids, SyntheticSaveSettings());
+		auto settings = session->data->CreateForm<Settings>();
+		settings->saves.compressionCodec = (int32_t)Codecs::CodecType::Zstd;
+		settings->saves.compressAfterThaw = true;
+		session->data->_saveThreads = 2;
+		session->data->SetSaveName("snapshot");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+		if (ReadBlockCount(path / "snapshot_1.tfsave") < 6 || session->data->LookupFormID<Input>(ids[0])->HasChanged())
+			return 1;
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		data->Load("snapshot", args);
+		if (data->_loaded == false)
+			return 1;
+		for (size_t i = 0; i < ids.size(); i++) {
+			auto input = data->LookupFormID<Input>(ids[i]);
+			if (!input || input->GetParentID() != i)
+				return 1;
+		}
+		std::filesystem::remove_all(path);
+	}
+
+	// streams over memory hand out views instead of copies
+	{
+		char data[64];
+		for (int i = 0; i < 64; i++)
+			data[i] = (char)i;
+		MappedStreambuf buf(data, 64);
+		std::istream stream(&buf);
+		stream.seekg(8);
+		Buffer::ArrayBuffer view(&stream, 16);
+		if (view.GetBuffer().first != (unsigned char*)data + 8 || stream.tellg() != 24)
+			return 1;
+		// requests beyond the end of the buffer are copied as far as possible
+		Buffer::ArrayBuffer copy(&stream, 64);
+		if (copy.GetBuffer().first == (unsigned char*)data + 24 || copy.Size() != 40 || copy.GetBuffer().first[0] != 24)
+			return 1;
+	}
+
+	// inputs of a lazily loaded save are read on first access and can be evicted again
+	{
+		std::vector<FormID> ids;
+		auto session = CreateSyntheticSession(20000, ids, SyntheticSaveSettings());
+		session->data->SetSaveName("lazy");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		args.lazyLoad = true;
+		data->Load("lazy", args);
+		if (data->_loaded == false || data->IsLazyLoaded() == false)
+			return 1;
+		// nothing has been read yet
+		if (data->EvictLazyForms() != 0)
+			return 1;
+		for (size_t i = 0; i < ids.size(); i += 7) {
+			auto input = data->LookupFormID<Input>(ids[i]);
+			if (!input || input->GetParentID() != i || input->GetParentSplits().size() != 1 || input->GetParentSplits()[0].second != (int64_t)i + 8)
+				return 1;
+		}
+		// forms that are still referenced stay in memory
+		auto held = data->LookupFormID<Input>(ids[0]);
+		if (data->EvictLazyForms() != (ids.size() + 6) / 7 - 1)
+			return 1;
+		if (data->LookupFormID<Input>(ids[0]) != held)
+			return 1;
+		auto input = data->LookupFormID<Input>(ids[7]);
+		if (!input || input->GetParentID() != 7)
+			return 1;
+		// counting and visiting don't read the forms that aren't in memory
+		size_t loaded = data->GetHashmapSize();
+		if (data->CountOlderObjects<Input>(input) != 7)
+			return 1;
+		size_t visited = 0;
+		data->VisitLoaded([&visited](std::shared_ptr<IForm>) {
+			visited++;
+			return Data::VisitAction::None;
+		});
+		if (visited != loaded || data->GetHashmapSize() != loaded)
+			return 1;
+		if (data->GetFormArray<Input>().size() != ids.size())
+			return 1;
+		std::filesystem::remove_all(path);
+	}
+
+	// tests of a lazily loaded save are read on demand, together with their inputs
+	{
+		std::vector<FormID> ids;
+		std::vector<FormID> tests;
+		auto session = CreateSyntheticSession(5000, ids, SyntheticSaveSettings());
+		for (size_t i = 0; i < ids.size(); i++) {
+			auto input = session->data->LookupFormID<Input>(ids[i]);
+			auto test = session->data->CreateForm<Test>();
+			test->_input = input;
+			input->test = test;
+			tests.push_back(test->GetFormID());
+		}
+		session->data->SetSaveName("lazytests");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		args.lazyLoad = true;
+		data->Load("lazytests", args);
+		if (data->_loaded == false || data->IsLazyLoaded() == false)
+			return 1;
+		// neither the tests nor their inputs have been read yet
+		if (data->EvictLazyForms() != 0)
+			return 1;
+		auto input = data->LookupFormID<Input>(ids[3]);
+		if (!input || !input->test || input->test->GetFormID() != tests[3] || input->test->_input.lock() != input)
+			return 1;
+		auto test = data->LookupFormID<Test>(tests[5]);
+		if (!test || !test->_input.lock() || test->_input.lock()->GetFormID() != ids[5] || test->_input.lock()->test != test)
+			return 1;
+		input.reset();
+		test.reset();
+		// inputs are evicted together with their tests
+		if (data->EvictLazyForms() != 4)
+			return 1;
+		if (data->GetFormArray<Test>().size() != ids.size())
+			return 1;
+		std::filesystem::remove_all(path);
+	}
+
+	// blocks compressed with a trained dictionary cannot be read without it
+	{
+		std::string samples;
+		std::vector<size_t> sizes;
+		for (size_t i = 0; i < 2000; i++) {
+			std::string record = "record" + std::to_string(i) + "|entry" + std::to_string(i % 97) + "|entry" + std::to_string((i * 31) % 97);
+			samples += record;
+			sizes.push_back(record.size());
+		}
+		std::string dictionary;
+		if (!Codecs::TrainDictionary(samples, sizes, 4096, dictionary) || dictionary.empty())
+			return 1;
+		auto codec = Codecs::CreateCodec(Codecs::CodecType::ZstdDictionary, 3, false, dictionary);
+		std::string compressed;
+		if (!codec || !codec->Compress(samples.data(), 200, compressed))
+			return 1;
+		std::string decompressed(200, '\0');
+		if (!codec->Decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size()) || decompressed != samples.substr(0, 200))
+			return 1;
+		auto plain = Codecs::CreateCodec(Codecs::CodecType::Zstd, 3);
+		if (plain->Decompress(compressed.data(), compressed.size(), decompressed.data(), decompressed.size()))
+			return 1;
+		if (Codecs::CreateCodec(Codecs::CodecType::ZstdDictionary, 3) != nullptr || Codecs::CreateCodec(Codecs::CodecType::None) != nullptr)
+			return 1;
+	}
+
+	// forms initialized and resolved on multiple threads are linked the same way as on a single thread
+	{
+		std::vector<FormID> ids;
+		auto session = CreateSyntheticSession(20000, ids, SyntheticSaveSettings());
+		for (size_t i = 0; i < ids.size(); i++) {
+			auto input = session->data->LookupFormID<Input>(ids[i]);
+			auto test = session->data->CreateForm<Test>();
+			test->_input = input;
+			// every third input only gets linked from its test
+			if (i % 3 != 0)
+				input->test = test;
+		}
+		session->data->SetSaveName("parallel");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+
+		for (size_t threads : { 1, 4 }) {
+			Data* data = new Data();
+			data->SetSavePath(path);
+			data->_loadThreads = threads;
+			Data::LoadSaveArgs args;
+			data->Load("parallel", args);
+			if (data->_loaded == false || data->GetFormArray<Test>().size() != ids.size())
+				return 1;
+			for (size_t i = 0; i < ids.size(); i++) {
+				auto input = data->LookupFormID<Input>(ids[i]);
+				if (!input || !input->test || input->test->_input.lock() != input || input->GetParentID() != i)
+					return 1;
+			}
+			for (auto name : { "Read records", "Decode blocks", "Initialize early", "Resolve", "Initialize late", "Resolve late", "Regenerate" })
+				if (std::find_if(data->_loadTimes.begin(), data->_loadTimes.end(), [name](auto& entry) { return entry.first == name; }) == data->_loadTimes.end())
+					return 1;
+		}
+		std::filesystem::remove_all(path);
+	}
+
+	// save and load time of a synthetic session for every codec, scaling with the number of threads
+	{
+		size_t count = argc > 1 ? std::stoull(argv[1]) : 50000;
+		std::cout << "Inputs: " << count << "\n";
+		size_t hardware = std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+		std::vector<std::pair<Codecs::CodecType, int32_t>> codecs = {
+			{ Codecs::CodecType::None, -1 },
+			{ Codecs::CodecType::LZMA, 1 },
+			{ Codecs::CodecType::LZMA, 6 },
+			{ Codecs::CodecType::Zstd, 1 },
+			{ Codecs::CodecType::Zstd, 3 },
+			{ Codecs::CodecType::Zstd, 9 },
+			{ Codecs::CodecType::ZstdDictionary, 3 },
+		};
+		for (auto [codec, compression] : codecs) {
+			// every codec gets a fresh session, so that all of them compress the same records
+			std::vector<FormID> ids;
+			auto session = CreateSyntheticSession(count, ids);
+			session->data->SetSaveName("bench");
+			session->data->SetSavePath(path);
+			std::vector<size_t> threadcounts = { 1, 2, 4, hardware };
+			for (size_t i = 0; i < threadcounts.size(); i++)
+				Benchmark(session, path, codec, compression, threadcounts[i], i == 0);
+		}
+	}
+	return 0;
+}
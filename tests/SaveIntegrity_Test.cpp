@@ -0,0 +1,216 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "Checksum.h"
+#include "Data.h"
+#include "Input.h"
+#include "MappedFile.h"
+#include "SaveFile.h"
+#include "Session.h"
+#include "SessionData.h"
+#include "Settings.h"
+#include "SyntheticSession.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// reads the block index of the savefile at [path]
+/// </summary>
+std::vector<Data::SaveBlockIndexEntry> ReadBlocks(std::filesystem::path path)
+{
+	std::vector<Data::SaveBlockIndexEntry> blocks;
+	std::vector<Data::SaveFormIndexEntry> forms;
+	MappedFile file;
+	SaveFile::Header header;
+	if (!file.Open(path) || !SaveFile::ReadHeader(file.GetData(), file.GetSize(), header))
+		return blocks;
+	MappedStreambuf buf(file.GetData(), file.GetSize());
+	std::istream stream(&buf);
+	Data::ReadSaveIndex(stream, header.version, blocks, forms);
+	return blocks;
+}
+
+/// <summary>
+/// flips the bits of the byte at [offset]
+/// </summary>
+void Corrupt(std::filesystem::path path, uint64_t offset)
+{
+	std::fstream file(path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+	file.seekg(offset);
+	char c = 0;
+	file.read(&c, 1);
+	c = ~c;
+	file.seekp(offset);
+	file.write(&c, 1);
+}
+
+/// <summary>
+/// returns the number of inputs of [ids] present in [data]
+/// </summary>
+size_t CountInputs(Data* data, std::vector<FormID>& ids)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < ids.size(); i++) {
+		auto input = data->LookupFormID<Input>(ids[i]);
+		if (input && input->GetParentID() == i)
+			count++;
+	}
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "SaveIntegrity_Test";
+	std::filesystem::remove_all(path);
+
+	// known CRC32C values, and checksums can be continued across calls at any alignment
+	{
+		const char* digits = "123456789";
+		unsigned char zeros[32] = {};
+		if (Checksum::CRC32C(digits, 9) != 0xE3069283 || Checksum::CRC32C(zeros, 32) != 0x8A9136AA || Checksum::CRC32C(nullptr, 0) != 0)
+			return 1;
+		std::string data;
+		for (size_t i = 0; i < 1000; i++)
+			data.push_back((char)(i * 7 + i / 13));
+		uint32_t full = Checksum::CRC32C(data.data(), data.size());
+		for (size_t split : { 1, 3, 8, 9, 500, 999 })
+			if (Checksum::CRC32C(data.data() + split, data.size() - split, Checksum::CRC32C(data.data(), split)) != full)
+				return 1;
+	}
+
+	std::vector<FormID> ids;
+	auto session = CreateSyntheticSession(20000, ids, SyntheticSaveSettings());
+	session->data->SetSaveName("integrity");
+	session->data->SetSavePath(path);
+	session->data->Save({});
+	std::filesystem::path save = path / "integrity_1.tfsave";
+	std::filesystem::path intact = path / "intact.tfsave";
+
+	// saves are written to a temporary file that is renamed once complete, and verify as intact
+	{
+		if (!std::filesystem::exists(save) || std::filesystem::exists(path / "integrity_1.tfsave.tmp"))
+			return 1;
+		SaveFile::VerifyResult result;
+		if (!SaveFile::Verify(save, 4, result) || result.version != Data::saveversion || !result.index || result.damaged != 0 || result.blocks < 21)
+			return 1;
+		std::filesystem::copy_file(save, intact);
+	}
+
+	auto blocks = ReadBlocks(save);
+	if (blocks.size() < 21)
+		return 1;
+
+	// a flipped byte inside a block is detected, regular loading refuses the file, recovery skips the damaged block
+	{
+		auto& entry = blocks[10];
+		Corrupt(save, entry.offset + 32 + entry.storedsize / 2);
+		SaveFile::VerifyResult result;
+		if (SaveFile::Verify(save, 4, result) || !result.index || result.damaged != 1)
+			return 1;
+		for (bool map : { true, false }) {
+			Data* data = new Data();
+			data->SetSavePath(path);
+			Data::LoadSaveArgs args;
+			args.mapFile = map;
+			data->Load("integrity", args);
+			if (data->_loaded)
+				return 1;
+		}
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		args.recover = true;
+		data->Load("integrity", args);
+		size_t count = CountInputs(data, ids);
+		if (data->_loaded == false || count == 0 || count + entry.records < ids.size() || count >= ids.size())
+			return 1;
+		std::filesystem::copy_file(intact, save, std::filesystem::copy_options::overwrite_existing);
+	}
+
+	// a damaged block header is skipped during recovery as well
+	{
+		Corrupt(save, blocks[5].offset + 4);
+		SaveFile::VerifyResult result;
+		if (SaveFile::Verify(save, 1, result) || result.damaged != 1)
+			return 1;
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		args.recover = true;
+		data->Load("integrity", args);
+		size_t count = CountInputs(data, ids);
+		if (data->_loaded == false || count == 0 || count >= ids.size())
+			return 1;
+		std::filesystem::copy_file(intact, save, std::filesystem::copy_options::overwrite_existing);
+	}
+
+	// a save interrupted in the middle of a block loses the index, recovery keeps all complete blocks before it
+	{
+		auto& entry = blocks[15];
+		std::filesystem::resize_file(save, entry.offset + 32 + entry.storedsize / 2);
+		SaveFile::VerifyResult result;
+		if (SaveFile::Verify(save, 4, result) || result.index || result.damaged != 1)
+			return 1;
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		args.recover = true;
+		data->Load("integrity", args);
+		size_t count = CountInputs(data, ids);
+		if (data->_loaded == false || count == 0 || count >= ids.size())
+			return 1;
+		std::filesystem::copy_file(intact, save, std::filesystem::copy_options::overwrite_existing);
+	}
+
+	// the restored copy loads completely
+	{
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs args;
+		data->Load("integrity", args);
+		if (data->_loaded == false || CountInputs(data, ids) != ids.size())
+			return 1;
+	}
+	std::filesystem::remove_all(path);
+
+	// checksum and verification throughput
+	{
+		size_t size = 256 * 1024 * 1024;
+		std::string buffer(size, 'x');
+		for (size_t i = 0; i < size; i += 4096)
+			buffer[i] = (char)i;
+		auto begin = std::chrono::steady_clock::now();
+		uint32_t crc = Checksum::CRC32C(buffer.data(), buffer.size());
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << "CRC32C | " << (Checksum::IsHardwareAccelerated() ? "hardware" : "software") << " | " << (double)size / std::max(ns, (int64_t)1) << " GB/s | " << crc << "\n";
+
+		size_t count = argc > 1 ? std::stoull(argv[1]) : 200000;
+		std::vector<FormID> benchids;
+		auto bench = CreateSyntheticSession(count, benchids, SyntheticSaveSettings());
+		bench->data->SetSaveName("bench");
+		bench->data->SetSavePath(path);
+		bench->data->Save({});
+		for (size_t threads : { (size_t)1, (size_t)0 }) {
+			SaveFile::VerifyResult result;
+			if (!SaveFile::Verify(path / "bench_1.tfsave", threads, result))
+				return 1;
+			std::cout << "Verify | threads: " << (threads == 0 ? std::max((size_t)std::thread::hardware_concurrency(), (size_t)1) : threads) << " | blocks: " << result.blocks
+					  << " | size: " << result.bytes << " | time: " << Logging::FormatTimeNS(result.time.count())
+					  << " | " << (double)result.bytes / std::max(result.time.count(), (int64_t)1) << " GB/s\n";
+		}
+		std::filesystem::remove_all(path);
+	}
+	return 0;
+}
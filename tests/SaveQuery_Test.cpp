@@ -0,0 +1,186 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "Data.h"
+#include "DerivationTree.h"
+#include "Input.h"
+#include "SaveQuery.h"
+#include "Session.h"
+#include "SessionData.h"
+#include "Settings.h"
+#include "SyntheticSession.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+size_t CountLines(std::filesystem::path path)
+{
+	std::ifstream file(path);
+	std::string line;
+	size_t count = 0;
+	while (std::getline(file, line))
+		count++;
+	return count;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "SaveQuery_Test";
+	std::filesystem::remove_all(path);
+
+	// filters are parsed from their textual form
+	{
+		SaveQuery::Filter filter;
+		if (!SaveQuery::ParseFilter("result=failing|prefix,minlength=3,maxlength=5,generation=2,noflags=200", filter))
+			return 1;
+		if (filter.result != (EnumType)(OracleResult::Failing | OracleResult::Prefix) || filter.minLength != 3 || filter.maxLength != 5 || filter.generation != 2 || filter.noflags != 0x200)
+			return 1;
+		SaveQuery::Filter invalid;
+		if (SaveQuery::ParseFilter("size=3", invalid) || SaveQuery::ParseFilter("minlength=three", invalid) || SaveQuery::ParseFilter("result=broken", invalid))
+			return 1;
+		if (SaveQuery::GetFormat("out.tfsave") != SaveQuery::Format::Save || SaveQuery::GetFormat("out.csv") != SaveQuery::Format::CSV || SaveQuery::GetFormat("out.txt") != SaveQuery::Format::IDs)
+			return 1;
+	}
+
+	std::vector<FormID> ids;
+	{
+		auto session = CreateSyntheticSession(20000, ids, SyntheticSaveSettings(), true);
+		session->data->SetSaveName("query");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+	}
+	auto matches = [](size_t i, int64_t minlength, FormID generation) {
+		return (int64_t)(i % 8) >= minlength && (generation == 0 || i % 4 + 1 == generation);
+	};
+
+	// statistics of matching inputs, in the order of the savefile
+	{
+		SaveQuery::Args args;
+		args.save = path / "query_1.tfsave";
+		args.output = path / "query.csv";
+		args.format = SaveQuery::Format::CSV;
+		args.threads = 4;
+		if (!SaveQuery::ParseFilter("minlength=5,generation=2", args.filter))
+			return 1;
+		SaveQuery::Stats stats;
+		if (!SaveQuery::Run(args, stats))
+			return 1;
+		size_t expected = 0;
+		for (size_t i = 0; i < ids.size(); i++)
+			if (matches(i, 5, 2))
+				expected++;
+		if (stats.inputs != ids.size() || stats.matches != expected || CountLines(args.output) != expected + 1)
+			return 1;
+	}
+
+	// form ids of matching inputs, independent of the number of threads
+	for (size_t threads : { 1, 3 }) {
+		SaveQuery::Args args;
+		args.save = path / "query_1.tfsave";
+		args.output = path / "query.txt";
+		args.format = SaveQuery::Format::IDs;
+		args.threads = threads;
+		args.filter.maxLength = 2;
+		SaveQuery::Stats stats;
+		if (!SaveQuery::Run(args, stats))
+			return 1;
+		std::vector<FormID> expected;
+		for (size_t i = 0; i < ids.size(); i++)
+			if (i % 8 <= 2)
+				expected.push_back(ids[i]);
+		std::vector<FormID> found;
+		std::ifstream file(args.output);
+		std::string line;
+		while (std::getline(file, line))
+			found.push_back((FormID)std::stoull(line, nullptr, 16));
+		// blocks are written in savefile order, which need not be the order of creation
+		std::sort(found.begin(), found.end());
+		if (found != expected)
+			return 1;
+	}
+
+	// matching inputs and their ancestors are written to a savefile that can be loaded again
+	{
+		SaveQuery::Args args;
+		args.save = path / "query_1.tfsave";
+		args.output = path / "subset" / "subset_1.tfsave";
+		args.format = SaveQuery::Format::Save;
+		args.threads = 4;
+		args.ancestors = true;
+		args.blockRecords = 500;
+		if (!SaveQuery::ParseFilter("minlength=7,generation=4", args.filter))
+			return 1;
+		std::filesystem::create_directories(path / "subset");
+		SaveQuery::Stats stats;
+		if (!SaveQuery::Run(args, stats))
+			return 1;
+		std::set<size_t> expected;
+		for (size_t i = 0; i < ids.size(); i++)
+			if (matches(i, 7, 4))
+				for (size_t x = i; expected.insert(x).second && x > 0; x = (x - 1) / 2)
+					;
+		if (stats.matches == 0 || stats.matches >= expected.size())
+			return 1;
+
+		Data* data = new Data();
+		data->SetSavePath(path / "subset");
+		Data::LoadSaveArgs loadargs;
+		data->Load("subset", loadargs);
+		if (data->_loaded == false || data->GetFormArray<Input>().size() != expected.size() || data->GetFormArray<DerivationTree>().size() != expected.size())
+			return 1;
+		for (size_t i = 0; i < ids.size(); i++) {
+			auto input = data->LookupFormID<Input>(ids[i]);
+			if ((input != nullptr) != (expected.count(i) > 0))
+				return 1;
+			if (input && (!input->derive || input->derive->GetInputID() != ids[i] || input->GetGenerationID() != i % 4 + 1 || (i > 0 && input->GetParentID() != ids[(i - 1) / 2])))
+				return 1;
+		}
+	}
+	std::filesystem::remove_all(path);
+
+	// query time compared to loading the whole session
+	{
+		size_t count = argc > 1 ? std::stoull(argv[1]) : 50000;
+		std::vector<FormID> benchids;
+		auto session = CreateSyntheticSession(count, benchids, SyntheticSaveSettings(), true);
+		session->data->SetSaveName("bench");
+		session->data->SetSavePath(path);
+		session->data->Save({});
+		std::cout << "Inputs: " << count << "\n";
+		size_t hardware = std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+		for (size_t threads : { (size_t)1, hardware }) {
+			SaveQuery::Args args;
+			args.save = path / "bench_1.tfsave";
+			args.output = path / "bench.csv";
+			args.format = SaveQuery::Format::CSV;
+			args.threads = threads;
+			args.filter.minLength = 4;
+			SaveQuery::Stats stats;
+			auto begin = std::chrono::steady_clock::now();
+			if (!SaveQuery::Run(args, stats))
+				return 1;
+			std::cout << "Query | threads: " << threads << " | matches: " << stats.matches
+					  << " | time: " << Logging::FormatTimeNS(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()) << "\n";
+		}
+		Data* data = new Data();
+		data->SetSavePath(path);
+		Data::LoadSaveArgs loadargs;
+		auto begin = std::chrono::steady_clock::now();
+		data->Load("bench", loadargs);
+		std::cout << "Load  | time: " << Logging::FormatTimeNS(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()) << "\n";
+		std::filesystem::remove_all(path);
+	}
+	return 0;
+}
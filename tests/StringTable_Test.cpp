@@ -0,0 +1,192 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include "StringTable.h"
+
+#include <boost/bimap.hpp>
+#include <boost/bimap/unordered_set_of.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+static size_t allocated = 0;
+
+/// <summary>
+/// counts the bytes allocated by the containers it is used in
+/// </summary>
+template <class T>
+struct CountingAllocator
+{
+	typedef T value_type;
+
+	CountingAllocator() = default;
+	template <class U>
+	CountingAllocator(const CountingAllocator<U>&)
+	{}
+
+	T* allocate(size_t n)
+	{
+		allocated += n * sizeof(T);
+		return std::allocator<T>().allocate(n);
+	}
+	void deallocate(T* p, size_t n)
+	{
+		allocated -= n * sizeof(T);
+		std::allocator<T>().deallocate(p, n);
+	}
+	template <class U>
+	bool operator==(const CountingAllocator<U>&) const { return true; }
+	template <class U>
+	bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+/// <summary>
+/// returns input entries of varying length
+/// </summary>
+std::string MakeString(size_t i)
+{
+	std::string str = "entry" + std::to_string(i);
+	str.append(i % 37, (char)('a' + i % 26));
+	return str;
+}
+
+int main(int argc, char** argv)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+
+	// ids are dense and stable, strings can be found in both directions
+	{
+		StringTable table;
+		for (size_t i = 0; i < 10000; i++)
+			if (table.Intern(MakeString(i)) != 100 + i)
+				return 1;
+		for (size_t i = 0; i < 10000; i++) {
+			std::string_view str;
+			FormID id = 0;
+			if (table.Intern(MakeString(i)) != 100 + i || !table.Get(100 + i, str) || str != MakeString(i) || !table.Find(MakeString(i), id) || id != 100 + i)
+				return 1;
+		}
+		std::string_view str;
+		FormID id = 0;
+		if (table.Size() != 10000 || table.GetNextID() != 10100 || table.Get(99, str) || table.Get(10100, str) || table.Find("missing", id))
+			return 1;
+		// empty and long strings
+		FormID empty = table.Intern("");
+		std::string large(100000, 'x');
+		FormID long1 = table.Intern(large);
+		if (!table.Get(empty, str) || !str.empty() || !table.Get(long1, str) || str != large || table.Intern(large) != long1)
+			return 1;
+	}
+
+	// concurrent insertion of overlapping strings hands out exactly one id per string
+	{
+		StringTable table;
+		std::vector<std::vector<FormID>> results(4);
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < 4; t++)
+			threads.emplace_back([&table, &results, t]() {
+				for (size_t i = 0; i < 50000; i++)
+					results[t].push_back(table.Intern(MakeString((i * (t + 1)) % 50000)));
+			});
+		for (auto& thread : threads)
+			thread.join();
+		if (table.Size() != 50000 || table.GetNextID() != 50100)
+			return 1;
+		for (size_t t = 0; t < 4; t++)
+			for (size_t i = 0; i < 50000; i++) {
+				std::string_view str;
+				if (!table.Get(results[t][i], str) || str != MakeString((i * (t + 1)) % 50000))
+					return 1;
+			}
+	}
+
+	// records round trip, and only strings added after a given id are written incrementally
+	{
+		StringTable table;
+		for (size_t i = 0; i < 1000; i++)
+			table.Intern(MakeString(i));
+		std::string full;
+		FormID next = table.Write(full);
+		for (size_t i = 1000; i < 1500; i++)
+			table.Intern(MakeString(i));
+		std::string incremental;
+		if (table.Write(incremental, next) != 1600)
+			return 1;
+
+		StringTable loaded;
+		if (!loaded.Read(full.data(), full.size()) || loaded.Size() != 1000 || loaded.GetNextID() != next)
+			return 1;
+		if (!loaded.Read(incremental.data(), incremental.size()) || loaded.Size() != 1500)
+			return 1;
+		// reading the same strings again changes nothing
+		if (!loaded.Read(incremental.data(), incremental.size()) || loaded.Size() != 1500)
+			return 1;
+		for (size_t i = 0; i < 1500; i++) {
+			std::string_view str;
+			if (!loaded.Get(100 + i, str) || str != MakeString(i) || loaded.Intern(MakeString(i)) != 100 + i)
+				return 1;
+		}
+		if (loaded.Intern("new") != 1600)
+			return 1;
+		// truncated records are rejected
+		StringTable truncated;
+		if (truncated.Read(full.data(), full.size() - 3))
+			return 1;
+	}
+
+	// memory per interned string, compared to a bimap of ids and strings
+	{
+		size_t count = argc > 1 ? std::stoull(argv[1]) : 1000000;
+		size_t bytes = 0;
+		for (size_t i = 0; i < count; i++)
+			bytes += MakeString(i).size();
+		std::cout << "Strings: " << count << " | average length: " << (double)bytes / count << "\n";
+
+		{
+			typedef boost::bimap<boost::bimaps::unordered_set_of<FormID>, boost::bimaps::unordered_set_of<std::string>, CountingAllocator<char>> Bimap;
+			auto map = std::make_unique<Bimap>();
+			size_t heap = 0;
+			auto begin = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < count; i++) {
+				std::string str = MakeString(i);
+				// strings beyond the small string buffer allocate their characters separately
+				if (str.size() >= sizeof(std::string))
+					heap += str.capacity() + 1;
+				map->insert(Bimap::value_type(100 + i, str));
+			}
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			std::cout << "bimap       | memory per string: " << (double)(allocated + heap) / count << " bytes | insert: " << Logging::FormatTimeNS(ns) << "\n";
+		}
+
+		{
+			StringTable table;
+			auto begin = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < count; i++)
+				table.Intern(MakeString(i));
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			std::cout << "StringTable | memory per string: " << (double)table.GetMemoryUsage() / count << " bytes | insert: " << Logging::FormatTimeNS(ns) << "\n";
+			std::string record;
+			begin = std::chrono::steady_clock::now();
+			table.Write(record);
+			ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			std::cout << "StringTable | write: " << Logging::FormatTimeNS(ns);
+			StringTable loaded;
+			begin = std::chrono::steady_clock::now();
+			if (!loaded.Read(record.data(), record.size()) || loaded.Size() != count)
+				return 1;
+			ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+			std::cout << " | read: " << Logging::FormatTimeNS(ns) << "\n";
+		}
+	}
+	return 0;
+}
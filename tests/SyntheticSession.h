@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Data.h"
+#include "DerivationTree.h"
+#include "Input.h"
+#include "Session.h"
+#include "SessionData.h"
+#include "Settings.h"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// save settings applied to a synthetic session
+/// </summary>
+struct SyntheticSaveSettings
+{
+	int32_t compressionLevel = 1;
+	bool incrementalSaveFiles = false;
+	/// <summary>
+	/// number of records per block of the savefile
+	/// </summary>
+	size_t saveBlockRecords = 1000;
+};
+
+/// <summary>
+/// creates a session with [count] inputs of 8 entries each, and applies [saves] to its settings if given.
+/// If [derived] is set, every input is derived from the input at [(i - 1) / 2], trimmed, assigned to one of
+/// four generations and gets a derivation tree. Otherwise every input has the parent [i]
+/// </summary>
+inline std::shared_ptr<Session> CreateSyntheticSession(size_t count, std::vector<FormID>& ids, std::optional<SyntheticSaveSettings> saves = {}, bool derived = false)
+{
+	std::shared_ptr<Session> session = Session::CreateSession();
+	session->data->CreateForm<SessionData>();
+	for (size_t i = 0; i < count; i++) {
+		auto input = session->data->CreateForm<Input>();
+		for (size_t x = 0; x < 8; x++)
+			input->AddEntry("entry" + std::to_string((i * 31 + x) % 97));
+		if (derived) {
+			if (i % 8 != 0)
+				input->TrimInput((int32_t)(i % 8));
+			input->SetGenerationID((FormID)(i % 4 + 1));
+			if (i > 0)
+				input->SetParentSplitInformation(ids[(i - 1) / 2], { { 0, 4 } }, false);
+			auto tree = session->data->CreateForm<DerivationTree>();
+			tree->SetInputID(input->GetFormID());
+			input->derive = tree;
+		} else
+			input->SetParentSplitInformation(i, { { (int64_t)i, (int64_t)i + 8 } }, i % 2 == 0);
+		ids.push_back(input->GetFormID());
+	}
+	if (saves) {
+		auto settings = session->data->CreateForm<Settings>();
+		settings->saves.compressionLevel = saves->compressionLevel;
+		settings->saves.incrementalSaveFiles = saves->incrementalSaveFiles;
+		session->data->_saveBlockRecords = saves->saveBlockRecords;
+	}
+	return session;
+}
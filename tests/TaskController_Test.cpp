@@ -9,6 +9,10 @@
 #include "Data.h"
 
 #include <memory>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
 
 namespace Functions
 {
@@ -39,6 +43,10 @@ namespace Functions
 		{
 			return true;
 		}
+		bool ReadData(unsigned char*, size_t&, size_t, LoadResolver*)
+		{
+			return true;
+		}
 		bool WriteData(std::ostream* buffer, size_t& offset)
 		{
 			BaseFunction::WriteData(buffer, offset);
@@ -65,6 +73,22 @@ namespace Functions
 			return "TaskControllerTestCallback";
 		}
 	};
+
+	class TaskControllerPriorityTestCallback : public TaskControllerTestCallback
+	{
+	public:
+		std::vector<int>* order = nullptr;
+		FunctionPriority priority = FunctionPriority::Normal;
+		std::chrono::nanoseconds deadline = std::chrono::nanoseconds(0);
+
+		void Run() override
+		{
+			order->push_back(i);
+		}
+
+		FunctionPriority GetPriority() override { return priority; }
+		std::chrono::nanoseconds GetDeadline() override { return deadline; }
+	};
 }
 
 int main(/*int argc, char** argv*/)
@@ -91,5 +115,114 @@ int main(/*int argc, char** argv*/)
 		if (arr[i] != i)
 			return 1;
 	}
+
+	// tasks are ordered by priority, then deadline, then insertion order
+	TaskController prioController;
+	prioController.SetDisableLua();
+	prioController.Start(sessiondata, 1);
+	prioController.Freeze();
+	std::vector<int> order;
+	auto addPrio = [&prioController, &order](int i, Functions::FunctionPriority priority, std::chrono::nanoseconds deadline, bool bypass) {
+		auto task = std::make_shared<Functions::TaskControllerPriorityTestCallback>();
+		task->order = &order;
+		task->i = i;
+		task->priority = priority;
+		task->deadline = deadline;
+		prioController.AddTask(dynamic_pointer_cast<Functions::BaseFunction>(task), bypass);
+	};
+	addPrio(5, Functions::FunctionPriority::Normal, std::chrono::nanoseconds(0), false);
+	addPrio(6, Functions::FunctionPriority::Normal, std::chrono::nanoseconds(0), false);
+	addPrio(7, Functions::FunctionPriority::Low, std::chrono::nanoseconds(0), false);
+	addPrio(4, Functions::FunctionPriority::Normal, std::chrono::seconds(10), false);
+	addPrio(3, Functions::FunctionPriority::Normal, std::chrono::seconds(1), false);
+	addPrio(2, Functions::FunctionPriority::Normal, std::chrono::nanoseconds(0), true);
+	addPrio(1, Functions::FunctionPriority::High, std::chrono::nanoseconds(0), false);
+	addPrio(0, Functions::FunctionPriority::High, std::chrono::nanoseconds(0), true);
+	prioController.Thaw();
+	prioController.Stop();
+	if (order.size() != 8)
+		return 1;
+	for (int i = 0; i < 8; i++) {
+		if (order[i] != i)
+			return 1;
+	}
+	if (prioController.GetDeadlineTasks(Functions::FunctionType::Heavy) != 2)
+		return 1;
+
+	// worker statistics and sampling
+	{
+		TaskController statController;
+		statController.SetDisableLua();
+		statController.Start(sessiondata, 3);
+		std::filesystem::path dump = std::filesystem::temp_directory_path() / "TaskController_Test_statistics.csv";
+		statController.StartStatistics(std::chrono::milliseconds(5), 4, dump.string());
+		std::vector<int> values(10000);
+		for (int i = 0; i < 10000; i++) {
+			auto task = Functions::BaseFunction::Create<Functions::TaskControllerTestCallback>();
+			task->arr = values.data();
+			task->i = i;
+			statController.AddTask(dynamic_pointer_cast<Functions::BaseFunction>(task));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		statController.Stop();
+		auto sample = statController.GetSample();
+		uint64_t tasks = 0;
+		int64_t busy = 0;
+		for (auto& worker : sample.workers) {
+			tasks += worker.tasks;
+			busy += worker.busy;
+		}
+		if (sample.workers.size() != 3 || tasks != 10000 || tasks != sample.completedjobs || busy <= 0)
+			return 1;
+		std::vector<TaskController::Sample> samples;
+		statController.GetSamples(samples);
+		if (samples.size() == 0 || samples.size() > 4)
+			return 1;
+		std::ifstream file(dump);
+		std::string header;
+		std::getline(file, header);
+		if (header.starts_with("time_ms,completed") == false)
+			return 1;
+		file.close();
+		std::filesystem::remove(dump);
+	}
+
+	// workers waiting for tasks are idle in samples taken while they wait
+	{
+		TaskController idleController;
+		idleController.SetDisableLua();
+		idleController.Start(sessiondata, 2);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		auto first = idleController.GetSample();
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		auto second = idleController.GetSample();
+		idleController.Stop();
+		for (size_t i = 0; i < second.workers.size(); i++) {
+			if (second.workers[i].busy != 0 || second.workers[i].idle - first.workers[i].idle < 40000000)
+				return 1;
+		}
+	}
+
+	// overhead of the worker statistics
+	for (bool disable : { true, false, true, false }) {
+		TaskController benchController;
+		benchController.SetDisableLua();
+		if (disable)
+			benchController.SetDisableStatistics();
+		benchController.Start(sessiondata, 4);
+		benchController.Freeze();
+		std::vector<int> values(500000);
+		for (int i = 0; i < 500000; i++) {
+			auto task = Functions::BaseFunction::Create<Functions::TaskControllerTestCallback>();
+			task->arr = values.data();
+			task->i = i;
+			benchController.AddTask(dynamic_pointer_cast<Functions::BaseFunction>(task));
+		}
+		auto begin = std::chrono::steady_clock::now();
+		benchController.Thaw();
+		benchController.Stop();
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << (disable ? "Without statistics: " : "With statistics:    ") << Logging::FormatTimeNS(ns) << " | tasks/s: " << (uint64_t)(500000.0 / ((double)ns / 1000000000)) << "\n";
+	}
 	return 0;
 }
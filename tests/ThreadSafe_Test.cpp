@@ -0,0 +1,281 @@
+#include "Logging.h"
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#	include "ChrashHandlerINCL.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <functional>
+
+#include "ThreadSafe.h"
+
+struct BenchForm
+{
+	uint64_t id = 0;
+	uint64_t GetFormID() { return id; }
+};
+
+struct BenchFormLess
+{
+	bool operator()(const std::shared_ptr<BenchForm>& lhs, const std::shared_ptr<BenchForm>& rhs) const
+	{
+		return lhs->id < rhs->id;
+	}
+};
+
+/// <summary>
+/// runs [func] on [threads] threads simultaneously and returns the wall time
+/// </summary>
+int64_t RunThreads(int threads, std::function<void(int)> func)
+{
+	std::atomic<bool> start = false;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+		workers.emplace_back([&start, &func, i]() {
+			while (!start.load())
+				std::this_thread::yield();
+			func(i);
+		});
+	auto begin = std::chrono::steady_clock::now();
+	start = true;
+	for (auto& worker : workers)
+		worker.join();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void Print(const char* name, int threads, int64_t ops, int64_t ns)
+{
+	std::cout << name << " | threads: " << threads << " | time: " << Logging::FormatTimeNS(ns) << " | ops/s: " << (uint64_t)((double)ops / ((double)ns / 1000000000)) << "\n";
+}
+
+bool TestRingQueue()
+{
+	TSRingQueue<int> queue(5);
+	if (queue.Capacity() != 8)
+		return false;
+	for (int i = 0; i < 8; i++)
+		if (!queue.Push(i))
+			return false;
+	if (queue.Push(8) || queue.Size() != 8)
+		return false;
+	for (int i = 0; i < 8; i++) {
+		auto val = queue.Pop();
+		if (!val || *val != i)
+			return false;
+	}
+	if (queue.Pop() || !queue.Empty())
+		return false;
+
+	// concurrent producers and consumers, every element is received exactly once
+	TSRingQueue<int> mpmc(1024);
+	std::atomic<int64_t> sum = 0;
+	std::atomic<int> received = 0;
+	RunThreads(8, [&](int i) {
+		if (i < 4) {
+			for (int x = 1; x <= 10000; x++)
+				while (!mpmc.Push(x))
+					std::this_thread::yield();
+		} else {
+			while (received.load() < 40000) {
+				auto val = mpmc.Pop();
+				if (val) {
+					sum += *val;
+					received++;
+				} else
+					std::this_thread::yield();
+			}
+		}
+	});
+	return sum.load() == 4 * (int64_t)10000 * 10001 / 2 && mpmc.Empty();
+}
+
+bool TestSegmentedQueue()
+{
+	TSSegmentedQueue<int, 16> queue;
+	for (int i = 0; i < 100; i++)
+		queue.Push(i);
+	if (queue.Size() != 100)
+		return false;
+	for (int i = 0; i < 100; i++) {
+		auto val = queue.Pop();
+		if (!val || *val != i)
+			return false;
+	}
+	if (queue.Pop() || !queue.Empty())
+		return false;
+
+	// elements of every producer are received in order
+	TSSegmentedQueue<std::pair<int, int>, 64> mpsc;
+	bool ordered = true;
+	RunThreads(5, [&](int i) {
+		if (i < 4) {
+			for (int x = 0; x < 20000; x++)
+				mpsc.Push({ i, x });
+		} else {
+			int next[4] = { 0, 0, 0, 0 };
+			int received = 0;
+			while (received < 80000) {
+				auto val = mpsc.Pop();
+				if (val) {
+					if (next[val->first] != val->second)
+						ordered = false;
+					next[val->first]++;
+					received++;
+				} else
+					std::this_thread::yield();
+			}
+		}
+	});
+	return ordered && mpsc.Empty();
+}
+
+bool TestFormIDSet()
+{
+	ts_formid_set<BenchForm, 8> set;
+	std::vector<std::shared_ptr<BenchForm>> forms;
+	for (uint64_t i = 0; i < 1000; i++)
+		forms.push_back(std::make_shared<BenchForm>(BenchForm{ i }));
+	// overlapping inserts from multiple threads
+	RunThreads(4, [&](int i) {
+		for (int x = i * 100; x < 600 + i * 100; x++)
+			set.insert(forms[x]);
+	});
+	if (set.size() != 900)
+		return false;
+	size_t count = 0;
+	for (auto ptr : set) {
+		if (!ptr || ptr->id >= 900)
+			return false;
+		count++;
+	}
+	if (count != 900)
+		return false;
+	if (!set.contains(forms[899]) || set.contains(forms[900]) || set.find(5) != forms[5])
+		return false;
+	if (set.erase(forms[5]) != 1 || set.erase(5) != 0 || set.size() != 899)
+		return false;
+	set.clear();
+	return set.empty() && set.begin() == set.end();
+}
+
+bool TestQueue()
+{
+	TSQueue<int> queue;
+	queue.Push(1);
+	auto val = queue.Pop();
+	return val && *val == 1 && !queue.Pop() && queue.Empty();
+}
+
+void BenchmarkQueues(int threads, int64_t ops)
+{
+	int64_t perThread = ops / threads;
+	// every thread adds and removes elements
+	{
+		TSQueue<int64_t> queue;
+		auto ns = RunThreads(threads, [&](int) {
+			for (int64_t i = 0; i < perThread; i++) {
+				queue.Push(i);
+				queue.Pop();
+			}
+		});
+		Print("TSQueue            push/pop", threads, perThread * threads * 2, ns);
+	}
+	{
+		TSRingQueue<int64_t> queue(4096);
+		auto ns = RunThreads(threads, [&](int) {
+			for (int64_t i = 0; i < perThread; i++) {
+				while (!queue.Push(i))
+					std::this_thread::yield();
+				queue.Pop();
+			}
+		});
+		Print("TSRingQueue        push/pop", threads, perThread * threads * 2, ns);
+	}
+	// multiple producers, single consumer
+	int producers = std::max(threads - 1, 1);
+	int64_t perProducer = ops / producers;
+	{
+		TSQueue<int64_t> queue;
+		auto ns = RunThreads(producers + 1, [&](int i) {
+			if (i < producers) {
+				for (int64_t x = 0; x < perProducer; x++)
+					queue.Push(x);
+			} else {
+				int64_t received = 0;
+				while (received < perProducer * producers) {
+					if (queue.Pop())
+						received++;
+					else
+						std::this_thread::yield();
+				}
+			}
+		});
+		Print("TSQueue            mpsc    ", threads, perProducer * producers * 2, ns);
+	}
+	{
+		TSSegmentedQueue<int64_t> queue;
+		auto ns = RunThreads(producers + 1, [&](int i) {
+			if (i < producers) {
+				for (int64_t x = 0; x < perProducer; x++)
+					queue.Push(x);
+			} else {
+				int64_t received = 0;
+				while (received < perProducer * producers) {
+					if (queue.Pop())
+						received++;
+					else
+						std::this_thread::yield();
+				}
+			}
+		});
+		Print("TSSegmentedQueue   mpsc    ", threads, perProducer * producers * 2, ns);
+	}
+}
+
+void BenchmarkSets(int threads, int64_t ops)
+{
+	int64_t perThread = ops / threads;
+	std::vector<std::shared_ptr<BenchForm>> forms;
+	for (int64_t i = 0; i < perThread * threads; i++)
+		forms.push_back(std::make_shared<BenchForm>(BenchForm{ (uint64_t)i + 1 }));
+	{
+		ts_set<std::shared_ptr<BenchForm>, BenchFormLess> set;
+		auto ns = RunThreads(threads, [&](int i) {
+			for (int64_t x = i * perThread; x < (i + 1) * perThread; x++)
+				set.insert(forms[x]);
+		});
+		Print("ts_set             insert  ", threads, perThread * threads, ns);
+	}
+	{
+		ts_formid_set<BenchForm> set;
+		auto ns = RunThreads(threads, [&](int i) {
+			for (int64_t x = i * perThread; x < (i + 1) * perThread; x++)
+				set.insert(forms[x]);
+		});
+		Print("ts_formid_set      insert  ", threads, perThread * threads, ns);
+	}
+}
+
+int main(/*int argc, char** argv*/)
+{
+	Logging::InitializeLog(".");
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+	Crash::Install(".");
+#endif
+	if (!TestQueue())
+		return 1;
+	if (!TestRingQueue())
+		return 1;
+	if (!TestSegmentedQueue())
+		return 1;
+	if (!TestFormIDSet())
+		return 1;
+
+	for (int threads : { 1, 2, 4, 8, 16, 32, 64 }) {
+		BenchmarkQueues(threads, 200000);
+		BenchmarkSets(threads, 200000);
+	}
+	return 0;
+}